@@ -3,6 +3,28 @@
 #include <smmintrin.h>
 
 namespace chromap {
+namespace {
+
+// The number of set bits in each 16-bit lane.
+inline __m128i PopCountEpi16(__m128i value) {
+  const __m128i nibble_pop_counts =
+      _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m128i low_nibble_mask = _mm_set1_epi8(0x0f);
+  const __m128i low_nibbles = _mm_and_si128(value, low_nibble_mask);
+  const __m128i high_nibbles =
+      _mm_and_si128(_mm_srli_epi16(value, 4), low_nibble_mask);
+  const __m128i byte_pop_counts =
+      _mm_add_epi8(_mm_shuffle_epi8(nibble_pop_counts, low_nibbles),
+                   _mm_shuffle_epi8(nibble_pop_counts, high_nibbles));
+  return _mm_maddubs_epi16(byte_pop_counts, _mm_set1_epi8(1));
+}
+
+// The number of set bits in each 32-bit lane.
+inline __m128i PopCountEpi32(__m128i value) {
+  return _mm_madd_epi16(PopCountEpi16(value), _mm_set1_epi16(1));
+}
+
+}  // namespace
 
 int GetLongestMatchLength(const char *pattern, const char *text,
                           const int read_length) {
@@ -140,7 +162,8 @@ void GenerateNMAndMDTag(const char *pattern, const char *text,
 
 int BandedAlignPatternToText(int error_threshold, const char *pattern,
                              const char *text, const int read_length,
-                             int *mapping_end_position) {
+                             int *mapping_end_position,
+                             bool find_end_past_error_threshold) {
   uint32_t Peq[5] = {0, 0, 0, 0, 0};
   for (int i = 0; i < 2 * error_threshold; i++) {
     uint8_t base = CharToUint8(pattern[i]);
@@ -166,7 +189,16 @@ int BandedAlignPatternToText(int error_threshold, const char *pattern,
     VN = X & HP;
     VP = HN | ~(X | HP);
     num_errors_at_band_start_position += 1 - (D0 & lowest_bit_in_band_mask);
-    if (num_errors_at_band_start_position > 3 * error_threshold) {
+    if (find_end_past_error_threshold) {
+      if (num_errors_at_band_start_position > 3 * error_threshold) {
+        return error_threshold + 1;
+      }
+    } else if (num_errors_at_band_start_position -
+                   __builtin_popcount(VN & (highest_bit_in_band_mask - 1)) >
+               error_threshold) {
+      // The errors along the band only drop where VN is set, and the fewest
+      // errors in the band never drop in the following rows. So stop once
+      // even the best cell in the band has too many errors.
       return error_threshold + 1;
     }
     for (int ai = 0; ai < 5; ai++) {
@@ -422,7 +454,8 @@ void BandedAlign4PatternsToText(int error_threshold, const char **patterns,
   __m128i HP = _mm_setzero_si128();
   __m128i max_mask_vpu = _mm_set1_epi32(0xffffffff);
   __m128i num_errors_at_band_start_position_vpu = _mm_setzero_si128();
-  __m128i early_stop_threshold_vpu = _mm_set1_epi32(error_threshold * 3);
+  __m128i early_stop_threshold_vpu = _mm_set1_epi32(error_threshold);
+  __m128i band_mask_vpu = _mm_set1_epi32(highest_bit_in_band_mask - 1);
   for (int i = 0; i < read_length; i++) {
     uint8_t base0 = CharToUint8(reference_sequence0[i + 2 * error_threshold]);
     uint8_t base1 = CharToUint8(reference_sequence1[i + 2 * error_threshold]);
@@ -450,8 +483,12 @@ void BandedAlign4PatternsToText(int error_threshold, const char **patterns,
     E = _mm_xor_si128(E, lowest_bit_in_band_mask_vpu);
     num_errors_at_band_start_position_vpu =
         _mm_add_epi32(num_errors_at_band_start_position_vpu, E);
-    __m128i early_stop = _mm_cmpgt_epi32(num_errors_at_band_start_position_vpu,
-                                         early_stop_threshold_vpu);
+    // Stop once the best cell in the band has too many errors in all lanes.
+    __m128i min_num_errors_in_band_vpu =
+        _mm_sub_epi32(num_errors_at_band_start_position_vpu,
+                      PopCountEpi32(_mm_and_si128(VN, band_mask_vpu)));
+    __m128i early_stop =
+        _mm_cmpgt_epi32(min_num_errors_in_band_vpu, early_stop_threshold_vpu);
     int tmp = _mm_movemask_epi8(early_stop);
     if (tmp == 0xffff) {
       _mm_store_si128((__m128i *)mapping_edit_distances,
@@ -567,7 +604,8 @@ void BandedAlign8PatternsToText(int error_threshold, const char **patterns,
   __m128i HP = _mm_setzero_si128();
   __m128i max_mask_vpu = _mm_set1_epi16(0xffff);
   __m128i num_errors_at_band_start_position_vpu = _mm_setzero_si128();
-  __m128i early_stop_threshold_vpu = _mm_set1_epi16(error_threshold * 3);
+  __m128i early_stop_threshold_vpu = _mm_set1_epi16(error_threshold);
+  __m128i band_mask_vpu = _mm_set1_epi16(highest_bit_in_band_mask - 1);
   for (int i = 0; i < read_length; i++) {
     uint8_t base0 = CharToUint8(reference_sequence0[i + 2 * error_threshold]);
     uint8_t base1 = CharToUint8(reference_sequence1[i + 2 * error_threshold]);
@@ -603,8 +641,12 @@ void BandedAlign8PatternsToText(int error_threshold, const char **patterns,
     E = _mm_xor_si128(E, lowest_bit_in_band_mask_vpu);
     num_errors_at_band_start_position_vpu =
         _mm_add_epi16(num_errors_at_band_start_position_vpu, E);
-    __m128i early_stop = _mm_cmpgt_epi16(num_errors_at_band_start_position_vpu,
-                                         early_stop_threshold_vpu);
+    // Stop once the best cell in the band has too many errors in all lanes.
+    __m128i min_num_errors_in_band_vpu =
+        _mm_sub_epi16(num_errors_at_band_start_position_vpu,
+                      PopCountEpi16(_mm_and_si128(VN, band_mask_vpu)));
+    __m128i early_stop =
+        _mm_cmpgt_epi16(min_num_errors_in_band_vpu, early_stop_threshold_vpu);
     int tmp = _mm_movemask_epi8(early_stop);
     if (tmp == 0xffff) {
       _mm_store_si128((__m128i *)mapping_edit_distances,
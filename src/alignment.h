@@ -24,9 +24,13 @@ void GenerateNMAndMDTag(const char *pattern, const char *text,
                         int mapping_start_position,
                         MappingInMemory &mapping_in_memory);
 
+// Return 'error_threshold' + 1 as soon as no alignment can end within the
+// error threshold, unless 'find_end_past_error_threshold' is set, when the
+// mapping end position is needed even if the read has more errors.
 int BandedAlignPatternToText(int error_threshold, const char *pattern,
                              const char *text, const int read_length,
-                             int *mapping_end_position);
+                             int *mapping_end_position,
+                             bool find_end_past_error_threshold = false);
 
 // Return negative number if the termination are deemed at the beginning of the
 // read mappping_end_position is relative to pattern (reference)
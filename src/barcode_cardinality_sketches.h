@@ -0,0 +1,147 @@
+#ifndef BARCODE_CARDINALITY_SKETCHES_H_
+#define BARCODE_CARDINALITY_SKETCHES_H_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "utils.h"
+
+namespace chromap {
+
+// HyperLogLog sketches estimating the number of distinct values, e.g. cache
+// slots, seen with each barcode. Each barcode gets a dense sketch id the first
+// time it shows up. A sketch keeps the distinct values themselves until they
+// take as much memory as its registers, so the many barcodes with few values
+// stay small. Like the K-MinHash sketches they replace, the estimates below
+// 'min_num_registers' are reported as 0. The sketches are not thread-safe.
+class BarcodeCardinalitySketches {
+ public:
+  // Each sketch has the smallest power of 2 registers no less than
+  // 'min_num_registers' (at least 16). The relative error of the estimates is
+  // about 1.04 / sqrt(#registers).
+  explicit BarcodeCardinalitySketches(int min_num_registers)
+      : min_cardinality_(std::max(min_num_registers, 0)) {
+    precision_ = 4;
+    while ((1 << precision_) < min_num_registers && precision_ < 16) {
+      ++precision_;
+    }
+    num_registers_ = 1 << precision_;
+    max_num_sparse_values_ = num_registers_ / sizeof(uint32_t);
+  }
+
+  uint32_t GetSketchId(uint64_t barcode) {
+    std::pair<std::unordered_map<uint64_t, uint32_t>::iterator, bool> it =
+        sketch_ids_.emplace(barcode, barcodes_.size());
+    if (it.second) {
+      barcodes_.push_back(barcode);
+      sketches_.emplace_back();
+    }
+    return it.first->second;
+  }
+
+  void Add(uint32_t sketch_id, uint32_t value) {
+    Sketch &sketch = sketches_[sketch_id];
+    if (!sketch.registers) {
+      std::vector<uint32_t> &values = sketch.sparse_values;
+      if (std::find(values.begin(), values.end(), value) != values.end()) {
+        return;
+      }
+      if (values.size() < max_num_sparse_values_) {
+        values.push_back(value);
+        return;
+      }
+      sketch.registers.reset(new uint8_t[num_registers_]());
+      for (uint32_t sparse_value : values) {
+        AddToRegisters(sparse_value, sketch.registers.get());
+      }
+      std::vector<uint32_t>().swap(values);
+    }
+    AddToRegisters(value, sketch.registers.get());
+  }
+
+  // Return the barcodes and the estimated number of their distinct values.
+  std::vector<std::pair<uint64_t, size_t>> GetCardinalities() const {
+    std::vector<std::pair<uint64_t, size_t>> cardinalities;
+    cardinalities.reserve(barcodes_.size());
+    for (size_t si = 0; si < barcodes_.size(); ++si) {
+      const Sketch &sketch = sketches_[si];
+      const size_t cardinality =
+          sketch.registers ? EstimateCardinality(sketch.registers.get())
+                           : sketch.sparse_values.size();
+      cardinalities.emplace_back(
+          barcodes_[si], cardinality < min_cardinality_ ? 0 : cardinality);
+    }
+    return cardinalities;
+  }
+
+ private:
+  // The registers are only allocated once the sparse values are too many.
+  struct Sketch {
+    std::vector<uint32_t> sparse_values;
+    std::unique_ptr<uint8_t[]> registers;
+  };
+
+  inline void AddToRegisters(uint32_t value, uint8_t *registers) const {
+    // The low bits of the hash are better mixed than the high ones for the
+    // small consecutive values, e.g. the cache slots.
+    const uint64_t hash = Hash64(value, ~0ULL);
+    const uint32_t register_index = hash & (num_registers_ - 1);
+    const uint64_t remaining_bits = hash >> precision_;
+    const uint8_t rank =
+        remaining_bits == 0 ? 64 - precision_ + 1
+                            : __builtin_ctzll(remaining_bits) + 1;
+    if (rank > registers[register_index]) {
+      registers[register_index] = rank;
+    }
+  }
+
+  size_t EstimateCardinality(const uint8_t *registers) const {
+    double inverse_sum = 0;
+    uint32_t num_zero_registers = 0;
+    for (uint32_t ri = 0; ri < num_registers_; ++ri) {
+      inverse_sum += std::ldexp(1.0, -registers[ri]);
+      if (registers[ri] == 0) {
+        ++num_zero_registers;
+      }
+    }
+    double estimate =
+        GetAlpha() * num_registers_ * (double)num_registers_ / inverse_sum;
+    // Use linear counting for small cardinalities.
+    if (estimate <= 2.5 * num_registers_ && num_zero_registers > 0) {
+      estimate = num_registers_ *
+                 std::log((double)num_registers_ / num_zero_registers);
+    }
+    return (size_t)(estimate + 0.5);
+  }
+
+  double GetAlpha() const {
+    switch (num_registers_) {
+      case 16:
+        return 0.673;
+      case 32:
+        return 0.697;
+      case 64:
+        return 0.709;
+      default:
+        return 0.7213 / (1.0 + 1.079 / num_registers_);
+    }
+  }
+
+  int precision_;
+  uint32_t num_registers_;
+  size_t max_num_sparse_values_;
+  size_t min_cardinality_;
+  std::unordered_map<uint64_t, uint32_t> sketch_ids_;
+  std::vector<uint64_t> barcodes_;
+  std::vector<Sketch> sketches_;
+};
+
+}  // namespace chromap
+
+#endif  // BARCODE_CARDINALITY_SKETCHES_H_
@@ -0,0 +1,265 @@
+#ifndef BATCH_DUPLICATE_GROUPS_H_
+#define BATCH_DUPLICATE_GROUPS_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "mapping_result_cache.h"
+#include "sequence_batch.h"
+
+namespace chromap {
+
+// Groups the exact duplicate reads (or read pairs) of a batch, so that only
+// the first read of each group to show up, the leader, is mapped. The other
+// reads of a group, the members, get the mappings of their leader with their
+// own read ids and barcodes once the whole batch is mapped. A read only joins
+// the group of a leader that is mapped and whose mappings can be replayed.
+//
+// The groups are found with a lock-free open-addressing table of read indices
+// keyed by the hash of the read sequences. Each thread saves the mappings of
+// its leaders and its members in its own buffers.
+template <typename MappingRecord>
+class BatchDuplicateGroups {
+ public:
+  // Disabled when 'num_threads' is 0.
+  explicit BatchDuplicateGroups(int num_threads) {
+    for (int i = 0; i < num_threads; ++i) {
+      thread_groups_.emplace_back(new ThreadGroups);
+    }
+  }
+
+  inline bool IsEnabled() const { return !thread_groups_.empty(); }
+
+  // Empty the groups before mapping a batch of 'num_reads' reads.
+  void Reset(uint32_t num_reads) {
+    uint32_t num_slots = 1;
+    // Keep the table at most half full, so that probing stays short.
+    while (num_slots < 2 * num_reads) {
+      num_slots <<= 1;
+    }
+    if (num_slots > num_slots_) {
+      num_slots_ = num_slots;
+      slots_.reset(new std::atomic<uint32_t>[num_slots_]);
+      leader_states_.reset(new std::atomic<uint8_t>[num_slots_]);
+    }
+    for (uint32_t i = 0; i < num_slots_; ++i) {
+      slots_[i].store(0, std::memory_order_relaxed);
+    }
+    for (uint32_t i = 0; i < num_reads; ++i) {
+      leader_states_[i].store(LEADER_STATE_MAPPING, std::memory_order_relaxed);
+    }
+    read_hashes_.resize(num_reads);
+    read_lengths_.resize(num_reads);
+    leader_mappings_.resize(num_reads);
+    for (std::unique_ptr<ThreadGroups> &thread_groups : thread_groups_) {
+      thread_groups->mappings.clear();
+      thread_groups->members.clear();
+    }
+  }
+
+  // Return the index of the leader of the group of the read, which is
+  // 'read_index' itself when the read is the first of its group. 'read_batch2'
+  // is NULL for single-end reads.
+  uint32_t FindLeader(const SequenceBatch &read_batch1,
+                      const SequenceBatch *read_batch2, uint32_t read_index) {
+    const uint64_t read_hash = MappingResultCache<MappingRecord>::GetReadHash(
+        read_batch1, read_batch2, read_index);
+    // Published to the other threads by the exchange of the slot. The lengths
+    // are saved as the leader might be trimmed while the others compare to it.
+    read_hashes_[read_index] = read_hash;
+    read_lengths_[read_index] = GetReadLengths(read_batch1, read_batch2,
+                                               read_index);
+    uint32_t slot_index = read_hash & (num_slots_ - 1);
+    while (true) {
+      uint32_t slot = slots_[slot_index].load(std::memory_order_acquire);
+      if (slot == 0 && slots_[slot_index].compare_exchange_strong(
+                           slot, read_index + 1, std::memory_order_acq_rel,
+                           std::memory_order_acquire)) {
+        return read_index;
+      }
+      // Either the slot was taken or another thread just took it.
+      const uint32_t other_read_index = slot - 1;
+      if (read_hashes_[other_read_index] == read_hash &&
+          IsSameRead(read_batch1, read_batch2, read_index, other_read_index)) {
+        return other_read_index;
+      }
+      slot_index = (slot_index + 1) & (num_slots_ - 1);
+    }
+  }
+
+  // Whether the leader is mapped and its mappings can be given to members. A
+  // read whose leader is not is mapped on its own.
+  inline bool IsLeaderReplayable(uint32_t leader_index) const {
+    return leader_states_[leader_index].load(std::memory_order_acquire) ==
+           LEADER_STATE_REPLAYABLE;
+  }
+
+  // The member is only replayed after the batch is mapped.
+  void AddMember(int thread_id, uint32_t read_index, uint32_t leader_index,
+                 uint64_t barcode) {
+    Member member;
+    member.read_index = read_index;
+    member.leader_index = leader_index;
+    member.barcode = barcode;
+    thread_groups_[thread_id]->members.push_back(member);
+  }
+
+  // Save the mappings the leader appended after the marked list ends, unless
+  // they are not replayable, e.g. a random subset of its best mappings.
+  void SaveLeaderMappings(
+      int thread_id, uint32_t leader_index, bool are_mappings_replayable,
+      const MappingResultStats &stats, bool is_cache_hit,
+      const std::vector<std::pair<uint32_t, size_t>> &mapping_list_ends,
+      const std::vector<std::vector<MappingRecord>>
+          &mappings_on_diff_ref_seqs) {
+    if (!are_mappings_replayable) {
+      leader_states_[leader_index].store(LEADER_STATE_NOT_REPLAYABLE,
+                                         std::memory_order_release);
+      return;
+    }
+    ThreadGroups &thread_groups = *thread_groups_[thread_id];
+    LeaderMappings &leader_mappings = leader_mappings_[leader_index];
+    leader_mappings.thread_id = thread_id;
+    leader_mappings.first_mapping_index = thread_groups.mappings.size();
+    for (const std::pair<uint32_t, size_t> &list_end : mapping_list_ends) {
+      const std::vector<MappingRecord> &mappings =
+          mappings_on_diff_ref_seqs[list_end.first];
+      for (size_t mi = list_end.second; mi < mappings.size(); ++mi) {
+        thread_groups.mappings.emplace_back(list_end.first, mappings[mi]);
+      }
+    }
+    leader_mappings.num_mappings =
+        thread_groups.mappings.size() - leader_mappings.first_mapping_index;
+    leader_mappings.stats = stats;
+    leader_mappings.is_cache_hit = is_cache_hit;
+    leader_states_[leader_index].store(LEADER_STATE_REPLAYABLE,
+                                       std::memory_order_release);
+  }
+
+  // The members are kept in one list per thread.
+  inline int GetNumMemberLists() const { return thread_groups_.size(); }
+
+  // Append the mappings of the leaders for the members of the list and return
+  // the number of members. The members also take the stats, the cache hits, the
+  // summary bits and the two cache slots of their leaders, as if they were
+  // mapped. 'read_map_summary' and 'cache_slots' are NULL when not kept. Must
+  // not run concurrently with the mapping of the batch, but the lists can be
+  // replayed concurrently into different mapping buffers.
+  uint32_t ReplayMembers(int member_list_index,
+                         const SequenceBatch &read_batch1,
+                         MappingResultStats &stats, uint32_t &num_cache_hits,
+                         uint8_t *read_map_summary, int *cache_slots,
+                         std::vector<std::vector<MappingRecord>>
+                             &mappings_on_diff_ref_seqs) const {
+    const std::vector<Member> &members =
+        thread_groups_[member_list_index]->members;
+    for (const Member &member : members) {
+      const LeaderMappings &leader_mappings =
+          leader_mappings_[member.leader_index];
+      const std::pair<uint32_t, MappingRecord> *mappings =
+          thread_groups_[leader_mappings.thread_id]->mappings.data() +
+          leader_mappings.first_mapping_index;
+      const uint32_t read_id = read_batch1.GetSequenceIdAt(member.read_index);
+      for (uint32_t mi = 0; mi < leader_mappings.num_mappings; ++mi) {
+        std::vector<MappingRecord> &ref_seq_mappings =
+            mappings_on_diff_ref_seqs[mappings[mi].first];
+        ref_seq_mappings.push_back(mappings[mi].second);
+        SetReadIdAndBarcode(read_id, member.barcode, ref_seq_mappings.back());
+      }
+      stats.num_candidates += leader_mappings.stats.num_candidates;
+      stats.num_mappings += leader_mappings.stats.num_mappings;
+      stats.num_mapped_reads += leader_mappings.stats.num_mapped_reads;
+      stats.num_uniquely_mapped_reads +=
+          leader_mappings.stats.num_uniquely_mapped_reads;
+      if (leader_mappings.is_cache_hit) {
+        ++num_cache_hits;
+      }
+      if (read_map_summary != NULL) {
+        read_map_summary[member.read_index] |=
+            read_map_summary[member.leader_index] & 2;
+      }
+      if (cache_slots != NULL) {
+        cache_slots[2 * member.read_index] =
+            cache_slots[2 * member.leader_index];
+        cache_slots[2 * member.read_index + 1] =
+            cache_slots[2 * member.leader_index + 1];
+      }
+    }
+    return members.size();
+  }
+
+ private:
+  enum LeaderState {
+    LEADER_STATE_MAPPING,
+    LEADER_STATE_REPLAYABLE,
+    LEADER_STATE_NOT_REPLAYABLE
+  };
+
+  struct Member {
+    uint32_t read_index;
+    uint32_t leader_index;
+    uint64_t barcode;
+  };
+
+  // The mappings of a leader in the buffer of the thread that mapped it.
+  struct LeaderMappings {
+    int thread_id = 0;
+    size_t first_mapping_index = 0;
+    uint32_t num_mappings = 0;
+    MappingResultStats stats;
+    bool is_cache_hit = false;
+  };
+
+  struct ThreadGroups {
+    // The reference sequence index and the record of each leader mapping.
+    std::vector<std::pair<uint32_t, MappingRecord>> mappings;
+    std::vector<Member> members;
+  };
+
+  static inline std::pair<uint32_t, uint32_t> GetReadLengths(
+      const SequenceBatch &read_batch1, const SequenceBatch *read_batch2,
+      uint32_t read_index) {
+    return std::make_pair(
+        read_batch1.GetSequenceLengthAt(read_index),
+        read_batch2 == NULL ? 0 : read_batch2->GetSequenceLengthAt(read_index));
+  }
+
+  inline bool IsSameRead(const SequenceBatch &read_batch1,
+                         const SequenceBatch *read_batch2, uint32_t read_index,
+                         uint32_t other_read_index) const {
+    const std::pair<uint32_t, uint32_t> &read_lengths =
+        read_lengths_[read_index];
+    if (read_lengths_[other_read_index] != read_lengths) {
+      return false;
+    }
+    if (memcmp(read_batch1.GetSequenceAt(read_index),
+               read_batch1.GetSequenceAt(other_read_index),
+               read_lengths.first) != 0) {
+      return false;
+    }
+    return read_batch2 == NULL ||
+           memcmp(read_batch2->GetSequenceAt(read_index),
+                  read_batch2->GetSequenceAt(other_read_index),
+                  read_lengths.second) == 0;
+  }
+
+  uint32_t num_slots_ = 0;
+  // The read index plus 1 of the leader of each group, 0 for empty slots.
+  std::unique_ptr<std::atomic<uint32_t>[]> slots_;
+  std::vector<uint64_t> read_hashes_;
+  // The untrimmed lengths of read1 and read2.
+  std::vector<std::pair<uint32_t, uint32_t>> read_lengths_;
+  // The LeaderState of each read, only meaningful for the leaders.
+  std::unique_ptr<std::atomic<uint8_t>[]> leader_states_;
+  std::vector<LeaderMappings> leader_mappings_;
+  std::vector<std::unique_ptr<ThreadGroups>> thread_groups_;
+};
+
+}  // namespace chromap
+
+#endif  // BATCH_DUPLICATE_GROUPS_H_
@@ -0,0 +1,162 @@
+#include "cache_file.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+
+#include "mmcache.hpp"
+#include "utils.h"
+
+namespace chromap {
+namespace {
+
+const char kCacheFileMagic[8] = {'C', 'H', 'R', 'M', 'C', 'A', 'C', 'H'};
+const uint32_t kCacheFileVersion = 1;
+
+void WriteOrExit(const void *data, size_t size, FILE *file,
+                 const std::string &file_path) {
+  if (size > 0 && fwrite(data, size, 1, file) != 1) {
+    ExitWithMessage("Failed to write " + file_path + "!");
+  }
+}
+
+void ReadOrExit(void *data, size_t size, FILE *file,
+                const std::string &file_path) {
+  if (size > 0 && fread(data, size, 1, file) != 1) {
+    ExitWithMessage("Failed to read " + file_path +
+                    ", which might be truncated or not a cache file!");
+  }
+}
+
+// The cached minimizers, offsets and strands identify an entry.
+std::string GetEntryMinimizerKey(const CacheFileEntry &entry) {
+  const _mm_cache_entry_payload *payload =
+      (const _mm_cache_entry_payload *)entry.payload.data();
+  return std::string((const char *)payload->GetMinimizers(),
+                     (const char *)payload->GetStrands() +
+                         payload->num_minimizers);
+}
+
+}  // namespace
+
+bool CacheFileKey::operator==(const CacheFileKey &key) const {
+  return index_fingerprint == key.index_fingerprint &&
+         kmer_size == key.kmer_size && window_size == key.window_size &&
+         error_threshold == key.error_threshold &&
+         min_num_seeds_required_for_mapping ==
+             key.min_num_seeds_required_for_mapping &&
+         max_seed_frequencies[0] == key.max_seed_frequencies[0] &&
+         max_seed_frequencies[1] == key.max_seed_frequencies[1];
+}
+
+void SaveCacheFile(const std::string &file_path, const CacheFileKey &key,
+                   std::vector<CacheFileEntry> &entries) {
+  std::stable_sort(entries.begin(), entries.end(),
+                   [](const CacheFileEntry &a, const CacheFileEntry &b) {
+                     return a.score > b.score;
+                   });
+
+  FILE *cache_file = fopen(file_path.c_str(), "wb");
+  if (cache_file == NULL) {
+    ExitWithMessage("Failed to open " + file_path + " to save the cache!");
+  }
+  WriteOrExit(kCacheFileMagic, sizeof(kCacheFileMagic), cache_file, file_path);
+  WriteOrExit(&kCacheFileVersion, sizeof(kCacheFileVersion), cache_file,
+              file_path);
+  WriteOrExit(&key, sizeof(key), cache_file, file_path);
+  const uint64_t num_entries = entries.size();
+  WriteOrExit(&num_entries, sizeof(num_entries), cache_file, file_path);
+  for (const CacheFileEntry &entry : entries) {
+    const uint32_t payload_size = entry.payload.size();
+    WriteOrExit(&entry.score, sizeof(entry.score), cache_file, file_path);
+    WriteOrExit(&payload_size, sizeof(payload_size), cache_file, file_path);
+    WriteOrExit(entry.payload.data(), payload_size, cache_file, file_path);
+  }
+  fclose(cache_file);
+}
+
+bool LoadCacheFile(const std::string &file_path, CacheFileKey &key,
+                   std::vector<CacheFileEntry> &entries) {
+  FILE *cache_file = fopen(file_path.c_str(), "rb");
+  if (cache_file == NULL) {
+    return false;
+  }
+
+  char magic[sizeof(kCacheFileMagic)];
+  uint32_t version = 0;
+  ReadOrExit(magic, sizeof(magic), cache_file, file_path);
+  ReadOrExit(&version, sizeof(version), cache_file, file_path);
+  if (memcmp(magic, kCacheFileMagic, sizeof(magic)) != 0 ||
+      version != kCacheFileVersion) {
+    ExitWithMessage(file_path + " is not a cache file of this version!");
+  }
+  ReadOrExit(&key, sizeof(key), cache_file, file_path);
+
+  uint64_t num_entries = 0;
+  ReadOrExit(&num_entries, sizeof(num_entries), cache_file, file_path);
+  entries.resize(num_entries);
+  for (CacheFileEntry &entry : entries) {
+    uint32_t payload_size = 0;
+    ReadOrExit(&entry.score, sizeof(entry.score), cache_file, file_path);
+    ReadOrExit(&payload_size, sizeof(payload_size), cache_file, file_path);
+    entry.payload.resize(payload_size);
+    ReadOrExit(entry.payload.data(), payload_size, cache_file, file_path);
+    const _mm_cache_entry_payload *payload =
+        (const _mm_cache_entry_payload *)entry.payload.data();
+    if (payload_size < sizeof(_mm_cache_entry_payload) ||
+        payload->num_minimizers == 0 || payload->GetSize() != payload_size) {
+      ExitWithMessage("Failed to read " + file_path +
+                      ", which has a corrupted entry!");
+    }
+  }
+  fclose(cache_file);
+  return true;
+}
+
+void MergeCacheFiles(const std::vector<std::string> &input_file_paths,
+                     const std::string &output_file_path) {
+  CacheFileKey merged_key;
+  std::vector<CacheFileEntry> merged_entries;
+  std::unordered_map<std::string, size_t> merged_entry_indices;
+
+  for (size_t fi = 0; fi < input_file_paths.size(); ++fi) {
+    CacheFileKey key;
+    std::vector<CacheFileEntry> entries;
+    if (!LoadCacheFile(input_file_paths[fi], key, entries)) {
+      ExitWithMessage("Failed to open " + input_file_paths[fi] + "!");
+    }
+    if (fi == 0) {
+      merged_key = key;
+    } else if (key != merged_key) {
+      ExitWithMessage(input_file_paths[fi] +
+                      " was generated with a different index or different "
+                      "mapping parameters from " +
+                      input_file_paths[0] + "!");
+    }
+
+    for (CacheFileEntry &entry : entries) {
+      auto it = merged_entry_indices.emplace(GetEntryMinimizerKey(entry),
+                                             merged_entries.size());
+      if (it.second) {
+        merged_entries.emplace_back(std::move(entry));
+      } else {
+        CacheFileEntry &merged_entry = merged_entries[it.first->second];
+        merged_entry.score =
+            entry.score > UINT32_MAX - merged_entry.score
+                ? UINT32_MAX
+                : merged_entry.score + entry.score;
+      }
+    }
+    std::cerr << "Merged " << entries.size() << " entries from "
+              << input_file_paths[fi] << ".\n";
+  }
+
+  SaveCacheFile(output_file_path, merged_key, merged_entries);
+  std::cerr << "Saved " << merged_entries.size() << " entries into "
+            << output_file_path << ".\n";
+}
+
+}  // namespace chromap
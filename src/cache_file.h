@@ -0,0 +1,48 @@
+#ifndef CACHE_FILE_H_
+#define CACHE_FILE_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace chromap {
+
+// What the cached candidates depend on. A cache file is only preloaded when
+// its key matches the index and the mapping parameters of the run.
+struct CacheFileKey {
+  uint64_t index_fingerprint = 0;
+  int kmer_size = 0;
+  int window_size = 0;
+  int error_threshold = 0;
+  int min_num_seeds_required_for_mapping = 0;
+  int max_seed_frequencies[2] = {0, 0};
+
+  bool operator==(const CacheFileKey &key) const;
+  bool operator!=(const CacheFileKey &key) const { return !(*this == key); }
+};
+
+// A cache entry saved in a file: the raw bytes of its payload (see
+// _mm_cache_entry_payload) and a score of how hot it was.
+struct CacheFileEntry {
+  uint32_t score = 0;
+  std::vector<char> payload;
+};
+
+// The entries are saved in the descending order of their scores, so that the
+// hottest entries win when they compete for the same cache slots on loading.
+void SaveCacheFile(const std::string &file_path, const CacheFileKey &key,
+                   std::vector<CacheFileEntry> &entries);
+
+// Return false if the file cannot be opened.
+bool LoadCacheFile(const std::string &file_path, CacheFileKey &key,
+                   std::vector<CacheFileEntry> &entries);
+
+// Combine the cache files of several runs with the same key. An entry cached
+// in several runs is kept once with the sum of its scores.
+void MergeCacheFiles(const std::vector<std::string> &input_file_paths,
+                     const std::string &output_file_path);
+
+}  // namespace chromap
+
+#endif  // CACHE_FILE_H_
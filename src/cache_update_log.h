@@ -0,0 +1,121 @@
+#ifndef CACHE_UPDATE_LOG_H_
+#define CACHE_UPDATE_LOG_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "candidate.h"
+#include "mapping_metadata.h"
+#include "minimizer.h"
+#include "mmcache.hpp"
+
+namespace chromap {
+
+// The minimizers and candidates of the reads sampled to update the cache in a
+// batch. Each mapping thread appends to its own flat buffers, so sampling a
+// read neither allocates nor contends with other threads once the buffers have
+// grown, and the buffers are reused by the following batches.
+class CacheUpdateLog {
+ public:
+  explicit CacheUpdateLog(int num_threads) {
+    for (int i = 0; i < num_threads; ++i) {
+      thread_logs_.emplace_back(new ThreadLog);
+    }
+  }
+
+  // Save the minimizers and candidates of the read just looked up in the cache.
+  void Append(int thread_id, const MappingMetadata &mapping_metadata) {
+    ThreadLog &thread_log = *thread_logs_[thread_id];
+    Record record;
+    record.num_minimizers = mapping_metadata.minimizers_.size();
+    record.num_positive_candidates =
+        mapping_metadata.positive_candidates_.size();
+    record.num_negative_candidates =
+        mapping_metadata.negative_candidates_.size();
+    record.repetitive_seed_length = mapping_metadata.repetitive_seed_length_;
+    thread_log.records.push_back(record);
+    thread_log.minimizers.insert(thread_log.minimizers.end(),
+                                 mapping_metadata.minimizers_.begin(),
+                                 mapping_metadata.minimizers_.end());
+    AppendCandidates(mapping_metadata.positive_candidates_, thread_log);
+    AppendCandidates(mapping_metadata.negative_candidates_, thread_log);
+  }
+
+  // Update the cache with the logged reads and empty the log. Can run
+  // concurrently with the cache queries but not with Append.
+  void ApplyTo(mm_cache &cache, bool debug) {
+    for (std::unique_ptr<ThreadLog> &thread_log : thread_logs_) {
+      const Minimizer *minimizers = thread_log->minimizers.data();
+      const uint64_t *candidate_positions =
+          thread_log->candidate_positions.data();
+      const uint8_t *candidate_counts = thread_log->candidate_counts.data();
+      for (const Record &record : thread_log->records) {
+        minimizers_.assign(minimizers, minimizers + record.num_minimizers);
+        minimizers += record.num_minimizers;
+        LoadCandidates(record.num_positive_candidates, candidate_positions,
+                       candidate_counts, positive_candidates_);
+        LoadCandidates(record.num_negative_candidates, candidate_positions,
+                       candidate_counts, negative_candidates_);
+        cache.Update(minimizers_, positive_candidates_, negative_candidates_,
+                     record.repetitive_seed_length, debug);
+      }
+      thread_log->records.clear();
+      thread_log->minimizers.clear();
+      thread_log->candidate_positions.clear();
+      thread_log->candidate_counts.clear();
+    }
+  }
+
+ private:
+  struct Record {
+    uint32_t num_minimizers;
+    uint32_t num_positive_candidates;
+    uint32_t num_negative_candidates;
+    uint32_t repetitive_seed_length;
+  };
+
+  // The minimizers and the positive then negative candidates of the records
+  // are saved back to back. The candidate positions and counts are kept apart
+  // to not log the padding of Candidate.
+  struct ThreadLog {
+    std::vector<Record> records;
+    std::vector<Minimizer> minimizers;
+    std::vector<uint64_t> candidate_positions;
+    std::vector<uint8_t> candidate_counts;
+  };
+
+  static void AppendCandidates(const std::vector<Candidate> &candidates,
+                               ThreadLog &thread_log) {
+    for (const Candidate &candidate : candidates) {
+      thread_log.candidate_positions.push_back(candidate.position);
+      thread_log.candidate_counts.push_back(candidate.count);
+    }
+  }
+
+  // Load the next candidates of the log and move past them.
+  static void LoadCandidates(uint32_t num_candidates,
+                             const uint64_t *&candidate_positions,
+                             const uint8_t *&candidate_counts,
+                             std::vector<Candidate> &candidates) {
+    candidates.resize(num_candidates);
+    for (uint32_t i = 0; i < num_candidates; ++i) {
+      candidates[i].position = candidate_positions[i];
+      candidates[i].count = candidate_counts[i];
+    }
+    candidate_positions += num_candidates;
+    candidate_counts += num_candidates;
+  }
+
+  std::vector<std::unique_ptr<ThreadLog>> thread_logs_;
+
+  // Buffers to pass the logged reads to the cache.
+  std::vector<Minimizer> minimizers_;
+  std::vector<Candidate> positive_candidates_;
+  std::vector<Candidate> negative_candidates_;
+};
+
+}  // namespace chromap
+
+#endif  // CACHE_UPDATE_LOG_H_
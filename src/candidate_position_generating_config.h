@@ -40,8 +40,8 @@ class CandidatePositionGeneratingConfig {
   // considered as repetitive seeds.
   const uint32_t repetitive_seed_frequency_;
 
-  // When the number of candidate positions is really large, use heap merge to
-  // merge sorted candidate lists.
+  // When the number of candidate positions is really large, merge the sorted
+  // candidate lists of the minimizers with a loser tree.
   const bool use_heap_merge_;
 };
 
@@ -1,5 +1,7 @@
 #include "candidate_processor.h"
 
+#include <smmintrin.h>
+
 #include <cinttypes>
 #include <cstring>
 #include <functional>
@@ -8,6 +10,103 @@
 #include <vector>
 
 namespace chromap {
+namespace {
+
+// Return the first index pi in [start, hits.size()) where hits[pi] starts a
+// new cluster after hits[pi - 1], i.e. the reference changes or the position
+// jumps by more than 'error_threshold'. Return hits.size() if there is none.
+// 'start' must be at least 1. Four hits are compared at a time.
+inline uint32_t FindNextHitClusterBoundary(const std::vector<uint64_t> &hits,
+                                           uint32_t start,
+                                           uint32_t error_threshold) {
+  const uint64_t *hit_data = hits.data();
+  const uint32_t num_hits = hits.size();
+  const __m128i sign_bits = _mm_set1_epi32(0x80000000);
+  const __m128i error_thresholds = _mm_set1_epi32(error_threshold);
+  uint32_t pi = start;
+  for (; pi + 4 <= num_hits; pi += 4) {
+    const __m128 current_hits0 =
+        _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(hit_data + pi)));
+    const __m128 current_hits1 = _mm_castsi128_ps(
+        _mm_loadu_si128((const __m128i *)(hit_data + pi + 2)));
+    const __m128 previous_hits0 = _mm_castsi128_ps(
+        _mm_loadu_si128((const __m128i *)(hit_data + pi - 1)));
+    const __m128 previous_hits1 = _mm_castsi128_ps(
+        _mm_loadu_si128((const __m128i *)(hit_data + pi + 1)));
+    // Split the hits into the reference ids and positions.
+    const __m128i current_ids = _mm_castps_si128(_mm_shuffle_ps(
+        current_hits0, current_hits1, _MM_SHUFFLE(3, 1, 3, 1)));
+    const __m128i current_positions = _mm_castps_si128(_mm_shuffle_ps(
+        current_hits0, current_hits1, _MM_SHUFFLE(2, 0, 2, 0)));
+    const __m128i previous_ids = _mm_castps_si128(_mm_shuffle_ps(
+        previous_hits0, previous_hits1, _MM_SHUFFLE(3, 1, 3, 1)));
+    const __m128i previous_positions = _mm_castps_si128(_mm_shuffle_ps(
+        previous_hits0, previous_hits1, _MM_SHUFFLE(2, 0, 2, 0)));
+    // Same as the unsigned 32-bit "current > previous + error_threshold" in
+    // the scalar loop.
+    const __m128i is_far = _mm_cmpgt_epi32(
+        _mm_xor_si128(current_positions, sign_bits),
+        _mm_xor_si128(_mm_add_epi32(previous_positions, error_thresholds),
+                      sign_bits));
+    const __m128i is_same_reference = _mm_cmpeq_epi32(current_ids, previous_ids);
+    const int boundary_mask = _mm_movemask_ps(
+        _mm_castsi128_ps(_mm_or_si128(is_far, _mm_xor_si128(is_same_reference,
+                                                             _mm_set1_epi32(-1)))));
+    if (boundary_mask != 0) {
+      return pi + __builtin_ctz(boundary_mask);
+    }
+  }
+
+  for (; pi < num_hits; ++pi) {
+    if ((uint32_t)(hit_data[pi] >> 32) != (uint32_t)(hit_data[pi - 1] >> 32) ||
+        (uint32_t)hit_data[pi] > (uint32_t)hit_data[pi - 1] + error_threshold) {
+      return pi;
+    }
+  }
+  return num_hits;
+}
+
+// Return the first index i in [start, candidates.size()) such that
+// candidates[i].position + distance >= position, comparing two candidates at a
+// time.
+inline uint32_t FindFirstCandidateWithinDistance(
+    const std::vector<Candidate> &candidates, uint32_t start, uint64_t distance,
+    uint64_t position) {
+  const uint32_t num_candidates = candidates.size();
+  const __m128i sign_bits = _mm_set1_epi32(0x80000000);
+  const __m128i distances = _mm_set1_epi64x(distance);
+  const __m128i positions = _mm_set1_epi64x(position);
+  const __m128i biased_positions = _mm_xor_si128(positions, sign_bits);
+  uint32_t i = start;
+  for (; i + 2 <= num_candidates; i += 2) {
+    const __m128i candidate_positions = _mm_add_epi64(
+        _mm_set_epi64x(candidates[i + 1].position, candidates[i].position),
+        distances);
+    // Unsigned 64-bit "position > candidate position + distance" out of 32-bit
+    // compares: the high halves decide unless they are equal.
+    const __m128i is_greater = _mm_cmpgt_epi32(
+        biased_positions, _mm_xor_si128(candidate_positions, sign_bits));
+    const __m128i is_equal = _mm_cmpeq_epi32(positions, candidate_positions);
+    const __m128i is_greater_in_low_halves =
+        _mm_shuffle_epi32(is_greater, _MM_SHUFFLE(2, 2, 0, 0));
+    const __m128i is_before = _mm_or_si128(
+        is_greater, _mm_and_si128(is_equal, is_greater_in_low_halves));
+    // The sign bits of the high halves hold the 64-bit results.
+    const int is_before_mask = _mm_movemask_pd(_mm_castsi128_pd(is_before));
+    if (is_before_mask != 3) {
+      return i + ((is_before_mask & 1) ? 1 : 0);
+    }
+  }
+
+  for (; i < num_candidates; ++i) {
+    if (!(position > candidates[i].position + distance)) {
+      return i;
+    }
+  }
+  return num_candidates;
+}
+
+}  // namespace
 
 void CandidateProcessor::GenerateCandidates(
     int error_threshold, const Index &index,
@@ -75,10 +174,23 @@ void CandidateProcessor::GenerateCandidates(
 int CandidateProcessor::SupplementCandidates(
     int error_threshold, uint32_t search_range, const Index &index,
     PairedEndMappingMetadata &paired_end_mapping_metadata) const {
-  std::vector<Candidate> augment_positive_candidates1;
-  std::vector<Candidate> augment_positive_candidates2;
-  std::vector<Candidate> augment_negative_candidates1;
-  std::vector<Candidate> augment_negative_candidates2;
+  // Reuse the buffers of the mapping metadata to not allocate for each pair.
+  std::vector<Candidate> &augment_positive_candidates1 =
+      paired_end_mapping_metadata.mapping_metadata1_
+          .augment_positive_candidates_;
+  std::vector<Candidate> &augment_positive_candidates2 =
+      paired_end_mapping_metadata.mapping_metadata2_
+          .augment_positive_candidates_;
+  std::vector<Candidate> &augment_negative_candidates1 =
+      paired_end_mapping_metadata.mapping_metadata1_
+          .augment_negative_candidates_;
+  std::vector<Candidate> &augment_negative_candidates2 =
+      paired_end_mapping_metadata.mapping_metadata2_
+          .augment_negative_candidates_;
+  augment_positive_candidates1.clear();
+  augment_positive_candidates2.clear();
+  augment_negative_candidates1.clear();
+  augment_negative_candidates2.clear();
 
   int ret = 0;
 
@@ -93,6 +205,7 @@ int CandidateProcessor::SupplementCandidates(
     std::vector<Candidate> *augment_positive_candidates;
     std::vector<Candidate> *augment_negative_candidates;
     uint32_t *repetitive_seed_length;
+    std::vector<std::pair<uint64_t, uint64_t>> *boundaries;
 
     if (mate == 0) {
       minimizers = &paired_end_mapping_metadata.mapping_metadata1_.minimizers_;
@@ -112,6 +225,8 @@ int CandidateProcessor::SupplementCandidates(
       augment_negative_candidates = &augment_negative_candidates1;
       repetitive_seed_length = &paired_end_mapping_metadata.mapping_metadata1_
                                     .repetitive_seed_length_;
+      boundaries = &paired_end_mapping_metadata.mapping_metadata1_
+                        .mate_candidate_boundaries_;
     } else {
       minimizers = &paired_end_mapping_metadata.mapping_metadata2_.minimizers_;
       positive_hits =
@@ -130,6 +245,8 @@ int CandidateProcessor::SupplementCandidates(
       augment_negative_candidates = &augment_negative_candidates2;
       repetitive_seed_length = &paired_end_mapping_metadata.mapping_metadata2_
                                     .repetitive_seed_length_;
+      boundaries = &paired_end_mapping_metadata.mapping_metadata2_
+                        .mate_candidate_boundaries_;
     }
 
     uint32_t mm_count = minimizers->size();
@@ -165,7 +282,7 @@ int CandidateProcessor::SupplementCandidates(
             GenerateCandidatesFromRepetitiveReadWithMateInfoOnOneStrand(
                 kNegative, search_range, error_threshold, index, *minimizers,
                 *mate_positive_candidates, *repetitive_seed_length,
-                *negative_hits, *augment_negative_candidates);
+                *boundaries, *negative_hits, *augment_negative_candidates);
       }
 
       if (mate_negative_candidates->size() > 0) {
@@ -173,7 +290,7 @@ int CandidateProcessor::SupplementCandidates(
             GenerateCandidatesFromRepetitiveReadWithMateInfoOnOneStrand(
                 kPositive, search_range, error_threshold, index, *minimizers,
                 *mate_negative_candidates, *repetitive_seed_length,
-                *positive_hits, *augment_positive_candidates);
+                *boundaries, *positive_hits, *augment_positive_candidates);
       }
 
       // If one of the strand did not supplement due to too many best candidate,
@@ -267,13 +384,14 @@ int CandidateProcessor::
         const Strand strand, uint32_t search_range, int error_threshold,
         const Index &index, const std::vector<Minimizer> &minimizers,
         const std::vector<Candidate> &mate_candidates,
-        uint32_t &repetitive_seed_length, std::vector<uint64_t> &hits,
-        std::vector<Candidate> &candidates) const {
+        uint32_t &repetitive_seed_length,
+        std::vector<std::pair<uint64_t, uint64_t>> &boundaries,
+        std::vector<uint64_t> &hits, std::vector<Candidate> &candidates) const {
   int max_seed_count =
       index.GenerateCandidatePositionsFromRepetitiveReadWithMateInfoOnOneStrand(
           strand, search_range, min_num_seeds_required_for_mapping_,
           max_seed_frequencies_[0], error_threshold, minimizers,
-          mate_candidates, repetitive_seed_length, hits);
+          mate_candidates, repetitive_seed_length, boundaries, hits);
 
   GenerateCandidatesOnOneStrand(error_threshold, /*num_seeds_required=*/1,
                                 minimizers.size(), hits, candidates);
@@ -283,61 +401,96 @@ int CandidateProcessor::
 void CandidateProcessor::GenerateCandidatesOnOneStrand(
     int error_threshold, int num_seeds_required, uint32_t num_minimizers,
     std::vector<uint64_t> &hits, std::vector<Candidate> &candidates) const {
+  // The sentinel ends the last cluster.
   hits.emplace_back(UINT64_MAX);
-  if (hits.size() > 0) {
-    int minimizer_count = 1;
-    // The number of seeds with the exact same reference position.
-    int equal_count = 1;
-    int best_equal_count = 1;
-    uint64_t previous_hit = hits[0];
-    uint32_t previous_reference_id = previous_hit >> 32;
-    uint32_t previous_reference_position = previous_hit;
-    uint64_t best_local_hit = hits[0];
-    for (uint32_t pi = 1; pi < hits.size(); ++pi) {
-      uint32_t current_reference_id = hits[pi] >> 32;
-      uint32_t current_reference_position = hits[pi];
+  const uint32_t num_hits = hits.size();
+  uint32_t cluster_start = 0;
+  while (cluster_start + 1 < num_hits) {
+    const uint32_t cluster_end =
+        FindNextHitClusterBoundary(hits, cluster_start + 1, error_threshold);
+    const uint32_t cluster_size = cluster_end - cluster_start;
+    if (cluster_size > num_minimizers) {
+      // Long clusters can be split at the minimizer count.
+      SplitHitClusterIntoCandidates(error_threshold, num_seeds_required,
+                                    num_minimizers, hits, cluster_start,
+                                    cluster_end, candidates);
+    } else if (cluster_size >= (uint32_t)num_seeds_required) {
+      // The candidate is the hit with the longest run of equal hits, and the
+      // first one on ties.
+      uint64_t best_local_hit = hits[cluster_start];
+      uint32_t best_equal_count = 1;
+      uint32_t equal_run_start = cluster_start;
+      for (uint32_t pi = cluster_start + 1; pi < cluster_end; ++pi) {
+        if (hits[pi] != hits[pi - 1]) {
+          equal_run_start = pi;
+        } else if (pi - equal_run_start + 1 > best_equal_count) {
+          best_equal_count = pi - equal_run_start + 1;
+          best_local_hit = hits[pi];
+        }
+      }
 #ifdef LI_DEBUG
-      printf("%s: %d %d\n", __func__, current_reference_id,
-             current_reference_position);
+      for (uint32_t pi = cluster_start; pi < cluster_end; ++pi) {
+        printf("%s: %d %d\n", __func__, (int)(hits[pi] >> 32), (int)hits[pi]);
+      }
 #endif
-      if (current_reference_id != previous_reference_id ||
-          current_reference_position >
-              previous_reference_position + error_threshold ||
-          ((uint32_t)minimizer_count >= num_minimizers &&
-           current_reference_position >
-               (uint32_t)best_local_hit + error_threshold)) {
-        if (minimizer_count >= num_seeds_required) {
-          Candidate candidate;
-          candidate.position = best_local_hit;
-          candidate.count = best_equal_count;
-          candidates.push_back(candidate);
-        }
+      Candidate candidate;
+      candidate.position = best_local_hit;
+      candidate.count = best_equal_count;
+      candidates.push_back(candidate);
+    }
+    cluster_start = cluster_end;
+  }
+}
 
-        minimizer_count = 1;
-        equal_count = 1;
-        best_equal_count = 1;
-        best_local_hit = hits[pi];
-      } else {
-        if (hits[pi] == best_local_hit) {
-          ++equal_count;
-          ++best_equal_count;
-        } else if (hits[pi] == previous_hit) {
-          ++equal_count;
-          if (equal_count > best_equal_count) {
-            best_local_hit = previous_hit;
-            best_equal_count = equal_count;
-          }
-        } else {
-          equal_count = 1;
-        }
+void CandidateProcessor::SplitHitClusterIntoCandidates(
+    int error_threshold, int num_seeds_required, uint32_t num_minimizers,
+    const std::vector<uint64_t> &hits, uint32_t cluster_start,
+    uint32_t cluster_end, std::vector<Candidate> &candidates) const {
+  int minimizer_count = 1;
+  // The number of seeds with the exact same reference position.
+  int equal_count = 1;
+  int best_equal_count = 1;
+  uint64_t previous_hit = hits[cluster_start];
+  uint64_t best_local_hit = hits[cluster_start];
+  for (uint32_t pi = cluster_start + 1; pi <= cluster_end; ++pi) {
+    // The hits in the cluster are close to each other on the same reference,
+    // so a new candidate only starts when the minimizers are used up.
+    if (pi == cluster_end ||
+        ((uint32_t)minimizer_count >= num_minimizers &&
+         (uint32_t)hits[pi] > (uint32_t)best_local_hit + error_threshold)) {
+      if (minimizer_count >= num_seeds_required) {
+        Candidate candidate;
+        candidate.position = best_local_hit;
+        candidate.count = best_equal_count;
+        candidates.push_back(candidate);
+      }
 
-        ++minimizer_count;
+      if (pi == cluster_end) {
+        break;
+      }
+
+      minimizer_count = 1;
+      equal_count = 1;
+      best_equal_count = 1;
+      best_local_hit = hits[pi];
+    } else {
+      if (hits[pi] == best_local_hit) {
+        ++equal_count;
+        ++best_equal_count;
+      } else if (hits[pi] == previous_hit) {
+        ++equal_count;
+        if (equal_count > best_equal_count) {
+          best_local_hit = previous_hit;
+          best_equal_count = equal_count;
+        }
+      } else {
+        equal_count = 1;
       }
 
-      previous_hit = hits[pi];
-      previous_reference_id = current_reference_id;
-      previous_reference_position = current_reference_position;
+      ++minimizer_count;
     }
+
+    previous_hit = hits[pi];
   }
 }
 
@@ -438,6 +591,14 @@ void CandidateProcessor::ReduceCandidatesForPairedEndReadOnOneDirection(
   while (i1 < candidates1.size() && i2 < candidates2.size()) {
     if (candidates1[i1].position >
         candidates2[i2].position + mapping_positions_distance) {
+      if (num_unpaired_candidate2 >= num_unpaired_candidate_threshold) {
+        // No more unpaired candidates are kept, so skip to the candidates
+        // close enough to pair.
+        i2 = FindFirstCandidateWithinDistance(candidates2, i2 + 1,
+                                              mapping_positions_distance,
+                                              candidates1[i1].position);
+        continue;
+      }
       if (i2 >= previous_end_i2 &&
           num_unpaired_candidate2 < num_unpaired_candidate_threshold &&
           (candidates1[i1].position >> 32) ==
@@ -449,6 +610,12 @@ void CandidateProcessor::ReduceCandidatesForPairedEndReadOnOneDirection(
       ++i2;
     } else if (candidates2[i2].position >
                candidates1[i1].position + mapping_positions_distance) {
+      if (num_unpaired_candidate1 >= num_unpaired_candidate_threshold) {
+        i1 = FindFirstCandidateWithinDistance(candidates1, i1 + 1,
+                                              mapping_positions_distance,
+                                              candidates2[i2].position);
+        continue;
+      }
       if (num_unpaired_candidate1 < num_unpaired_candidate_threshold &&
           (candidates1[i1].position >> 32) ==
               (candidates2[i2].position >> 32) &&
@@ -46,12 +46,23 @@ class CandidateProcessor {
                                      std::vector<uint64_t> &hits,
                                      std::vector<Candidate> &candidates) const;
 
+  // Generate the candidates of a cluster of hits with more hits than
+  // minimizers, which is split once all the minimizers are used.
+  void SplitHitClusterIntoCandidates(int error_threshold,
+                                     int num_seeds_required,
+                                     uint32_t num_minimizers,
+                                     const std::vector<uint64_t> &hits,
+                                     uint32_t cluster_start,
+                                     uint32_t cluster_end,
+                                     std::vector<Candidate> &candidates) const;
+
   int GenerateCandidatesFromRepetitiveReadWithMateInfoOnOneStrand(
       const Strand strand, uint32_t search_range, int error_threshold,
       const Index &index, const std::vector<Minimizer> &minimizers,
       const std::vector<Candidate> &mate_candidates,
-      uint32_t &repetitive_seed_length, std::vector<uint64_t> &hits,
-      std::vector<Candidate> &candidates) const;
+      uint32_t &repetitive_seed_length,
+      std::vector<std::pair<uint64_t, uint64_t>> &boundaries,
+      std::vector<uint64_t> &hits, std::vector<Candidate> &candidates) const;
 
   void MergeCandidates(int error_threshold, std::vector<Candidate> &c1,
                        std::vector<Candidate> &c2,
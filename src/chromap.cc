@@ -1,6 +1,7 @@
 #include "chromap.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <math.h>
 
 #include <fstream>
@@ -28,6 +29,28 @@ void Chromap::ConstructIndex() {
   reference.FinalizeLoading();
 }
 
+void Chromap::InitializeReadFileLoading(const std::string &read_file_path,
+                                        bool is_barcode_file,
+                                        SequenceBatch &sequence_batch) {
+  if (!mapping_parameters_.mmap_read_files) {
+    sequence_batch.InitializeLoading(
+        read_file_path, mapping_parameters_.num_decompression_threads);
+    return;
+  }
+
+  const MappingOutputFormat format = mapping_parameters_.mapping_output_format;
+  // Barcode qualities are needed to correct barcodes.
+  const bool load_names =
+      !is_barcode_file && (format == MAPPINGFORMAT_SAM ||
+                           format == MAPPINGFORMAT_PAF ||
+                           format == MAPPINGFORMAT_PAIRS);
+  const bool load_quals = is_barcode_file || format == MAPPINGFORMAT_SAM;
+  sequence_batch.InitializeMappedLoading(
+      read_file_path,
+      std::max(1, mapping_parameters_.num_decompression_threads), load_names,
+      load_quals);
+}
+
 uint32_t Chromap::LoadSingleEndReadsWithBarcodes(SequenceBatch &read_batch,
                                                  SequenceBatch &barcode_batch,
                                                  bool parallel_parsing) {
@@ -175,23 +198,23 @@ uint32_t Chromap::LoadPairedEndReadsWithBarcodes(SequenceBatch &read_batch1,
 
 void Chromap::TrimAdapterForPairedEndRead(uint32_t pair_index,
                                           SequenceBatch &read_batch1,
-                                          SequenceBatch &read_batch2) {
+                                          SequenceBatch &read_batch2,
+                                          std::string &negative_read_buffer) {
   const uint32_t raw_read1_length = read_batch1.GetSequenceLengthAt(pair_index);
   const uint32_t raw_read2_length = read_batch2.GetSequenceLengthAt(pair_index);
   const char *raw_read1 = read_batch1.GetSequenceAt(pair_index);
   const char *raw_read2 = read_batch2.GetSequenceAt(pair_index);
-  const std::string &raw_negative_read1 =
-      read_batch1.GetNegativeSequenceAt(pair_index);
-  const std::string &raw_negative_read2 =
-      read_batch2.GetNegativeSequenceAt(pair_index);
 
   // In the actual adaptor trimming, we assuem length(read1)<=length(read2). So
   // we can have the case that read1 is a subset of read2.
   const char *read1 =
       raw_read1_length <= raw_read2_length ? raw_read1 : raw_read2;
-  const std::string &negative_read2 = raw_read1_length <= raw_read2_length
-                                          ? raw_negative_read2
-                                          : raw_negative_read1;
+  if (raw_read1_length <= raw_read2_length) {
+    read_batch2.GetNegativeSequenceAt(pair_index, negative_read_buffer);
+  } else {
+    read_batch1.GetNegativeSequenceAt(pair_index, negative_read_buffer);
+  }
+  const std::string &negative_read2 = negative_read_buffer;
   const uint32_t read1_length = raw_read1_length <= raw_read2_length
                                     ? raw_read1_length
                                     : raw_read2_length;
@@ -199,95 +222,44 @@ void Chromap::TrimAdapterForPairedEndRead(uint32_t pair_index,
                                     ? raw_read2_length
                                     : raw_read1_length;
 
-  const int min_overlap_length = mapping_parameters_.min_read_length;
-  const int seed_length = min_overlap_length / 2;
-  const int error_threshold_for_merging = 1;
-  bool is_merged = false;
-
-  for (int si = 0; si < error_threshold_for_merging + 1; ++si) {
-    size_t seed_start_position =
-        negative_read2.find(read1 + si * seed_length, 0, seed_length);
-
-    while (seed_start_position != std::string::npos) {
-      const bool before_seed_is_enough_long =
-          seed_start_position >= (size_t)(si * seed_length);
-      const bool overlap_is_enough_long =
-          (int)(read2_length - seed_start_position + seed_length * si) >=
-          min_overlap_length;
-
-      if (!before_seed_is_enough_long || !overlap_is_enough_long) {
-        seed_start_position = negative_read2.find(
-            read1 + si * seed_length, seed_start_position + 1, seed_length);
-        continue;
-      }
-
-      bool can_merge = true;
-      int num_errors = 0;
-
-      // The bases before the seed.
-      for (int i = 0; i < seed_length * si; ++i) {
-        if (negative_read2[seed_start_position - si * seed_length + i] !=
-            read1[i]) {
-          ++num_errors;
-        }
-        if (num_errors > error_threshold_for_merging) {
-          can_merge = false;
-          break;
-        }
-      }
-
-      // The bases after the seed.
-      for (uint32_t i = seed_length; i + seed_start_position < read2_length &&
-                                     si * seed_length + i < read1_length;
-           ++i) {
-        if (negative_read2[seed_start_position + i] !=
-            read1[si * seed_length + i]) {
-          ++num_errors;
-        }
-        if (num_errors > error_threshold_for_merging) {
-          can_merge = false;
-          break;
-        }
-      }
-
-      if (can_merge) {
-        // Trim adapters and TODO: fix sequencing errors
-        int overlap_length =
-            read2_length - seed_start_position + si * seed_length;
-        int read2_offset = 0;
-        // The case that read1 is strictly contained in read2. overlap_length is
-        // inferred from the longer read2, which could be longer than read1. In
-        // that case, we don't trim read1 (make overlap length equal to read1
-        // length) and trim read2 as the original plan.
-        if (overlap_length > (int)read1_length) {
-          read2_offset = overlap_length - read1_length;
-          overlap_length = read1_length;
-        }
-
-        if (raw_read1_length <= raw_read2_length) {
-          read_batch1.TrimSequenceAt(pair_index, overlap_length);
-          read_batch2.TrimSequenceAt(pair_index, overlap_length + read2_offset);
-        } else {
-          read_batch1.TrimSequenceAt(pair_index, overlap_length + read2_offset);
-          read_batch2.TrimSequenceAt(pair_index, overlap_length);
-        }
-
-        is_merged = true;
-        // std::cerr << "Trimed! overlap length: " << overlap_length << ", " <<
-        // read1.GetLength() << " " << read2.GetLength() << "\n";
-        break;
-      }
+  uint32_t overlap_offset = 0;
+  if (!FindMateOverlapOffset(read1, read1_length, negative_read2.data(),
+                             read2_length, mapping_parameters_.min_read_length,
+                             overlap_offset)) {
+    return;
+  }
 
-      seed_start_position = negative_read2.find(
-          read1 + si * seed_length, seed_start_position + 1, seed_length);
-    }
+  // Trim adapters and TODO: fix sequencing errors
+  int overlap_length = read2_length - overlap_offset;
+  int read2_offset = 0;
+  // The case that read1 is strictly contained in read2. overlap_length is
+  // inferred from the longer read2, which could be longer than read1. In that
+  // case, we don't trim read1 (make overlap length equal to read1 length) and
+  // trim read2 as the original plan.
+  if (overlap_length > (int)read1_length) {
+    read2_offset = overlap_length - read1_length;
+    overlap_length = read1_length;
+  }
 
-    if (is_merged) {
-      break;
-    }
+  if (raw_read1_length <= raw_read2_length) {
+    read_batch1.TrimSequenceAt(pair_index, overlap_length);
+    read_batch2.TrimSequenceAt(pair_index, overlap_length + read2_offset);
+  } else {
+    read_batch1.TrimSequenceAt(pair_index, overlap_length + read2_offset);
+    read_batch2.TrimSequenceAt(pair_index, overlap_length);
   }
 }
 
+void Chromap::TrimAdapterForSingleEndRead(uint32_t read_index,
+                                          SequenceBatch &read_batch) {
+  read_batch.TrimSequenceAt(
+      read_index,
+      GetAdapterPosition(read_batch.GetSequenceAt(read_index),
+                         read_batch.GetSequenceLengthAt(read_index),
+                         mapping_parameters_.adapter_sequence,
+                         mapping_parameters_.min_adapter_overlap_length));
+}
+
 bool Chromap::PairedEndReadWithBarcodeIsDuplicate(
     uint32_t pair_index, const SequenceBatch &barcode_batch,
     const SequenceBatch &read_batch1, const SequenceBatch &read_batch2) {
@@ -495,8 +467,9 @@ void Chromap::ComputeBarcodeAbundance(uint64_t max_num_sample_barcodes) {
   for (size_t read_file_index = 0;
        read_file_index < mapping_parameters_.read_file1_paths.size();
        ++read_file_index) {
-    barcode_batch.InitializeLoading(
-        mapping_parameters_.barcode_file_paths[read_file_index]);
+    InitializeReadFileLoading(
+        mapping_parameters_.barcode_file_paths[read_file_index],
+        /*is_barcode_file=*/true, barcode_batch);
     uint32_t num_loaded_barcodes = barcode_batch.LoadBatch();
     while (num_loaded_barcodes > 0) {
       for (uint32_t barcode_index = 0; barcode_index < num_loaded_barcodes;
@@ -820,6 +793,183 @@ void Chromap::OutputMappingStatistics() {
             << ".\n";
   std::cerr << "Number of multi-mappings: "
             << num_mappings_ - num_uniquely_mapped_reads_ << ".\n";
+  if (mapping_parameters_.mapping_result_cache_size > 0) {
+    std::cerr << "Number of mapping cache hits: "
+              << num_mapping_result_cache_hits_ << ", misses: "
+              << num_mapping_result_cache_queries_ -
+                     num_mapping_result_cache_hits_
+              << ".\n";
+  }
+  if (mapping_parameters_.collapse_batch_duplicates) {
+    std::cerr << "Number of collapsed duplicate pairs: "
+              << num_batch_duplicates_ << ".\n";
+  }
+  if (mapping_parameters_.min_read_complexity > 0) {
+    std::cerr << "Number of low-complexity reads filtered: "
+              << num_low_complexity_reads_ << ".\n";
+  }
+}
+
+CacheFileKey Chromap::GetCacheFileKey(const Index &index) const {
+  CacheFileKey cache_file_key;
+  cache_file_key.index_fingerprint = index.GetFingerprint();
+  cache_file_key.kmer_size = index.GetKmerSize();
+  cache_file_key.window_size = index.GetWindowSize();
+  cache_file_key.error_threshold = mapping_parameters_.error_threshold;
+  cache_file_key.min_num_seeds_required_for_mapping =
+      mapping_parameters_.min_num_seeds_required_for_mapping;
+  cache_file_key.max_seed_frequencies[0] =
+      mapping_parameters_.max_seed_frequencies[0];
+  cache_file_key.max_seed_frequencies[1] =
+      mapping_parameters_.max_seed_frequencies[1];
+  return cache_file_key;
+}
+
+void Chromap::LoadCache(const CacheFileKey &cache_file_key,
+                        mm_cache &mm_to_candidates_cache) {
+  if (mapping_parameters_.cache_load_file_path.empty()) {
+    return;
+  }
+
+  const double real_start_time = GetRealTime();
+  CacheFileKey key;
+  std::vector<CacheFileEntry> entries;
+  if (!LoadCacheFile(mapping_parameters_.cache_load_file_path, key, entries)) {
+    ExitWithMessage("Failed to open " +
+                    mapping_parameters_.cache_load_file_path + "!");
+  }
+  if (key != cache_file_key) {
+    std::cerr << "WARNING: " << mapping_parameters_.cache_load_file_path
+              << " was dumped with a different index or different mapping "
+                 "parameters and is not preloaded!\n";
+    return;
+  }
+
+  const uint64_t num_preloaded_entries =
+      mm_to_candidates_cache.ImportEntries(entries);
+  std::cerr << "Preloaded " << num_preloaded_entries << " of "
+            << entries.size() << " cache entries in "
+            << GetRealTime() - real_start_time << "s.\n";
+}
+
+void Chromap::DumpCache(const CacheFileKey &cache_file_key,
+                        mm_cache &mm_to_candidates_cache) {
+  if (mapping_parameters_.cache_dump_file_path.empty()) {
+    return;
+  }
+
+  const double real_start_time = GetRealTime();
+  std::vector<CacheFileEntry> entries;
+  mm_to_candidates_cache.ExportEntries(entries);
+  SaveCacheFile(mapping_parameters_.cache_dump_file_path, cache_file_key,
+                entries);
+  std::cerr << "Dumped " << entries.size() << " cache entries in "
+            << GetRealTime() - real_start_time << "s.\n";
+}
+
+void Chromap::AdaptCacheSize(
+    const std::vector<uint64_t> &cache_queries_per_thread,
+    const std::vector<uint64_t> &cache_query_hits_per_thread,
+    mm_cache &mm_to_candidates_cache) {
+  if (mapping_parameters_.cache_max_memory_mb <= 0) {
+    return;
+  }
+  const int min_cache_size = 65536;
+  const uint64_t max_memory_bytes =
+      (uint64_t)mapping_parameters_.cache_max_memory_mb << 20;
+
+  uint64_t num_cache_queries = 0;
+  uint64_t num_cache_query_hits = 0;
+  for (size_t ti = 0; ti < cache_queries_per_thread.size(); ++ti) {
+    num_cache_queries += cache_queries_per_thread[ti];
+    num_cache_query_hits += cache_query_hits_per_thread[ti];
+  }
+  const int cache_size = mm_to_candidates_cache.GetSize();
+  const uint64_t num_occupied_slots =
+      mm_to_candidates_cache.GetNumOccupiedSlots();
+  const uint64_t num_evictions = mm_to_candidates_cache.GetNumEvictions();
+  mm_to_candidates_cache.ResetNumEvictions();
+  // The retired payloads are reclaimed by the next compaction anyway.
+  const uint64_t memory_bytes = mm_to_candidates_cache.GetLiveMemoryBytes();
+
+  int new_cache_size = cache_size;
+  if (memory_bytes > max_memory_bytes) {
+    // The memory other than the head minimizer bits scales with the slots,
+    // so shrink the cache to fit the limit with some margin at once.
+    const uint64_t head_mm_bytes = HEAD_MM_ARRAY_SIZE * sizeof(uint64_t);
+    new_cache_size = cache_size / 2;
+    if (max_memory_bytes > head_mm_bytes) {
+      new_cache_size = std::min(
+          new_cache_size, (int)(0.9 * cache_size *
+                                (max_memory_bytes - head_mm_bytes) /
+                                (memory_bytes - head_mm_bytes)));
+    }
+  } else if (num_occupied_slots * 2 > (uint64_t)cache_size &&
+             num_evictions * 8 > num_occupied_slots &&
+             num_cache_query_hits * 100 >= num_cache_queries &&
+             2 * memory_bytes <= max_memory_bytes &&
+             cache_size <= INT_MAX / 4) {
+    // The cache is mostly full and its entries keep evicting each other
+    // while it pays off.
+    // Doubling the slots about doubles the cached candidates as well.
+    new_cache_size = cache_size * 2;
+  } else if (num_occupied_slots * 8 < (uint64_t)cache_size &&
+             mm_to_candidates_cache.GetNumUpdatesSinceResize() >=
+                 10 * (uint64_t)mm_to_candidates_cache.GetNumSets()) {
+    // Most slots stay empty although each set has been updated often enough
+    // to find its frequent reads.
+    new_cache_size = cache_size / 2;
+  }
+  new_cache_size = std::max(new_cache_size, min_cache_size);
+  if (new_cache_size == cache_size) {
+    return;
+  }
+
+  mm_to_candidates_cache.Resize(new_cache_size);
+  std::cerr << "Resized the cache from " << cache_size << " to "
+            << mm_to_candidates_cache.GetSize() << " entries.\n";
+}
+
+void Chromap::OutputCacheHitRate(
+    const std::vector<uint64_t> &cache_queries_per_thread,
+    const std::vector<uint64_t> &cache_query_hits_per_thread) {
+  uint64_t num_cache_queries = 0;
+  uint64_t num_cache_query_hits = 0;
+  for (size_t ti = 0; ti < cache_queries_per_thread.size(); ++ti) {
+    num_cache_queries += cache_queries_per_thread[ti];
+    num_cache_query_hits += cache_query_hits_per_thread[ti];
+  }
+  std::cerr << "Cache hits: " << num_cache_query_hits << " of "
+            << num_cache_queries << " queries ("
+            << (num_cache_queries == 0
+                    ? 0.0
+                    : 100.0 * num_cache_query_hits / num_cache_queries)
+            << "%).\n";
+}
+
+void Chromap::OutputMappingThreadBusyTimes(
+    const std::vector<double> &mapping_busy_time_per_thread,
+    double mapping_time, uint32_t num_steals) {
+  if (mapping_time <= 0) {
+    return;
+  }
+  double total_busy_time = 0;
+  double min_busy_time = mapping_busy_time_per_thread[0];
+  double max_busy_time = mapping_busy_time_per_thread[0];
+  for (double busy_time : mapping_busy_time_per_thread) {
+    total_busy_time += busy_time;
+    min_busy_time = std::min(min_busy_time, busy_time);
+    max_busy_time = std::max(max_busy_time, busy_time);
+  }
+  // The threads are idle for the mapping when they wait for the other threads
+  // or run the output tasks.
+  std::cerr << "Mapping threads busy "
+            << 100.0 * total_busy_time /
+                   (mapping_time * mapping_busy_time_per_thread.size())
+            << "% of " << mapping_time << "s (min "
+            << 100.0 * min_busy_time / mapping_time << "%, max "
+            << 100.0 * max_busy_time / mapping_time << "%), " << num_steals
+            << " steals.\n";
 }
 
 void Chromap::ParseReadFormat(const std::string &read_format) {
@@ -6,29 +6,35 @@
 #include <memory>
 #include <random>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <vector>
 
-#include <queue> // Used these two for k-minhash
-#include <unordered_set>
-
 #include <sstream> // Used for frip est params splitting
 
+#include "barcode_cardinality_sketches.h"
+#include "batch_duplicate_groups.h"
+#include "cache_file.h"
+#include "cache_update_log.h"
 #include "candidate_processor.h"
 #include "cxxopts.hpp"
 #include "draft_mapping_generator.h"
 #include "feature_barcode_matrix.h"
 #include "index.h"
+#include "in_flight_read_batch.h"
 #include "index_parameters.h"
 #include "khash.h"
 #include "mapping_generator.h"
 #include "mapping_metadata.h"
 #include "mapping_parameters.h"
 #include "mapping_processor.h"
+#include "mapping_result_cache.h"
 #include "mapping_writer.h"
 #include "minimizer_generator.h"
 #include "mmcache.hpp"
+#include "numa_replicas.h"
 #include "paired_end_mapping_metadata.h"
+#include "read_range_scheduler.h"
 #include "sequence_batch.h"
 #include "sequence_effective_range.h"
 #include "temp_mapping.h"
@@ -38,46 +44,6 @@
 
 namespace chromap {
 
-class K_MinHash {
-public:
-    /*
-     * MinHash Class - used to estimate the number of unique cache slots 
-     *                 hit by each barcode
-     *
-     * @param k - size of MinHash sketch
-     * @param range - range of possible cache ids
-     */
-    K_MinHash(size_t k, size_t range) : k_(k), range_(range) {}
-
-    inline void add(size_t num) {
-      /* If num is not present in queue, we will add it */
-        if (unique_slots_.find(num) == unique_slots_.end()) {
-            unique_slots_.insert(num);
-            pq_.push(num);
-            // only keep smallest k numbers
-            if (pq_.size() > k_) {
-                unique_slots_.erase(pq_.top());
-                pq_.pop();
-            }
-        }
-    }
-
-    inline size_t compute_cardinality() {
-      /* Use k-MinHash estimator to return estimated cardinality */
-      if (pq_.size() < k_) {return 0;}
-      size_t cardinality = (k_ * range_)/pq_.top() - 1;
-      return cardinality;
-    }
-
-private:
-    size_t k_;
-    size_t range_;
-
-    /* Uses an unordered set to have O(1) find queries*/
-    std::priority_queue<uint32_t> pq_; // max-heap
-    std::unordered_set<uint32_t> unique_slots_; // keep track of unique values
-};
-
 class Chromap {
  public:
   Chromap() = delete;
@@ -122,18 +88,45 @@ class Chromap {
   void MapPairedEndReads();
 
  private:
+  // Parse the file through mmap when it is enabled. Read names and qualities
+  // are only loaded when the output format uses them.
+  void InitializeReadFileLoading(const std::string &read_file_path,
+                                 bool is_barcode_file,
+                                 SequenceBatch &sequence_batch);
+
   uint32_t LoadSingleEndReadsWithBarcodes(SequenceBatch &read_batch,
                                           SequenceBatch &barcode_batch,
                                           bool parallel_parsing);
 
+  // Run by the loading thread. Load batches into the free in-flight batches
+  // until the end of the read files, which is passed on as an empty batch.
+  // 'read_batch2_for_loading' is NULL for single-end reads.
+  template <typename MappingRecord>
+  void LoadInFlightReadBatches(
+      SequenceBatch &read_batch1_for_loading,
+      SequenceBatch *read_batch2_for_loading,
+      SequenceBatch &barcode_batch_for_loading,
+      std::vector<std::unique_ptr<InFlightReadBatch<MappingRecord>>>
+          &in_flight_batches,
+      InFlightReadBatchQueue &free_batch_indices,
+      InFlightReadBatchQueue &loaded_batch_indices);
+
   uint32_t LoadPairedEndReadsWithBarcodes(SequenceBatch &read_batch1,
                                           SequenceBatch &read_batch2,
                                           SequenceBatch &barcode_batch,
                                           bool parallel_parsing);
 
+  // 'negative_read_buffer' is scratch space for the reverse complement of the
+  // longer read, so it can be reused across read pairs.
   void TrimAdapterForPairedEndRead(uint32_t pair_index,
                                    SequenceBatch &read_batch1,
-                                   SequenceBatch &read_batch2);
+                                   SequenceBatch &read_batch2,
+                                   std::string &negative_read_buffer);
+
+  // Trim the read at the first position the adapter sequence, or a prefix of
+  // it of at least the min adapter overlap running off the 3' end, matches.
+  void TrimAdapterForSingleEndRead(uint32_t read_index,
+                                   SequenceBatch &read_batch);
 
   bool PairedEndReadWithBarcodeIsDuplicate(uint32_t pair_index,
                                            const SequenceBatch &barcode_batch,
@@ -157,6 +150,33 @@ class Chromap {
 
   void OutputMappingStatistics();
 
+  CacheFileKey GetCacheFileKey(const Index &index) const;
+
+  // Preload the cache from the file given by --cache-load if its key matches.
+  void LoadCache(const CacheFileKey &cache_file_key,
+                 mm_cache &mm_to_candidates_cache);
+
+  void DumpCache(const CacheFileKey &cache_file_key,
+                 mm_cache &mm_to_candidates_cache);
+
+  // Resize the cache within --cache-max-memory from the hit rate of a batch
+  // and the collisions of the last cache update. Must not run concurrently
+  // with the cache queries or updates.
+  void AdaptCacheSize(const std::vector<uint64_t> &cache_queries_per_thread,
+                      const std::vector<uint64_t> &cache_query_hits_per_thread,
+                      mm_cache &mm_to_candidates_cache);
+
+  // Output the cache hit rate of a batch from the counts of each thread.
+  void OutputCacheHitRate(
+      const std::vector<uint64_t> &cache_queries_per_thread,
+      const std::vector<uint64_t> &cache_query_hits_per_thread);
+
+  // Output how busy the mapping threads were over the 'mapping_time' seconds
+  // the reads of a batch were mapped.
+  void OutputMappingThreadBusyTimes(
+      const std::vector<double> &mapping_busy_time_per_thread,
+      double mapping_time, uint32_t num_steals);
+
   void ParseReadFormat(const std::string &read_format);
 
   // User custom rid order file contains a column of reference sequence names
@@ -204,6 +224,13 @@ class Chromap {
   uint64_t num_mapped_reads_ = 0;
   uint64_t num_uniquely_mapped_reads_ = 0;
   uint64_t num_reads_ = 0;
+  // Reads (pairs) looked up in and replayed from the mapping result cache.
+  uint64_t num_mapping_result_cache_queries_ = 0;
+  uint64_t num_mapping_result_cache_hits_ = 0;
+  // Pairs given the mappings of their exact duplicates mapped in their batch.
+  uint64_t num_batch_duplicates_ = 0;
+  // Reads filtered for their low sequence complexity.
+  uint64_t num_low_complexity_reads_ = 0;
   // # identical reads.
   // uint64_t num_duplicated_reads_ = 0;
 
@@ -215,13 +242,67 @@ class Chromap {
   uint32_t barcode_length_ = 0;
 };
 
+template <typename MappingRecord>
+void Chromap::LoadInFlightReadBatches(
+    SequenceBatch &read_batch1_for_loading,
+    SequenceBatch *read_batch2_for_loading,
+    SequenceBatch &barcode_batch_for_loading,
+    std::vector<std::unique_ptr<InFlightReadBatch<MappingRecord>>>
+        &in_flight_batches,
+    InFlightReadBatchQueue &free_batch_indices,
+    InFlightReadBatchQueue &loaded_batch_indices) {
+  // The loading thread is not one of the mapping threads, so it parses the
+  // read files in parallel with a team of its own.
+  const bool parallel_parsing = mapping_parameters_.num_threads >= 12;
+  uint32_t num_loaded_reads = 0;
+  do {
+    const int batch_index = free_batch_indices.Pop();
+    InFlightReadBatch<MappingRecord> &in_flight_batch =
+        *in_flight_batches[batch_index];
+
+    // Load into the memory of the free batch, so that no extra copy of the
+    // batch memory is kept by the loading batches.
+    read_batch1_for_loading.SwapSequenceBatch(in_flight_batch.read_batch1);
+    if (read_batch2_for_loading != NULL) {
+      read_batch2_for_loading->SwapSequenceBatch(in_flight_batch.read_batch2);
+    }
+    barcode_batch_for_loading.SwapSequenceBatch(in_flight_batch.barcode_batch);
+
+#pragma omp parallel num_threads(3) if (parallel_parsing)
+#pragma omp single
+    {
+      if (read_batch2_for_loading == NULL) {
+        num_loaded_reads = LoadSingleEndReadsWithBarcodes(
+            read_batch1_for_loading, barcode_batch_for_loading,
+            parallel_parsing);
+      } else {
+        num_loaded_reads = LoadPairedEndReadsWithBarcodes(
+            read_batch1_for_loading, *read_batch2_for_loading,
+            barcode_batch_for_loading, parallel_parsing);
+      }
+    }
+
+    read_batch1_for_loading.SwapSequenceBatch(in_flight_batch.read_batch1);
+    if (read_batch2_for_loading != NULL) {
+      read_batch2_for_loading->SwapSequenceBatch(in_flight_batch.read_batch2);
+    }
+    barcode_batch_for_loading.SwapSequenceBatch(in_flight_batch.barcode_batch);
+    in_flight_batch.num_loaded_reads = num_loaded_reads;
+    loaded_batch_indices.Push(batch_index);
+  } while (num_loaded_reads > 0);
+}
+
 template <typename MappingRecord>
 void Chromap::MapSingleEndReads() {
   double real_start_time = GetRealTime();
 
+  // The primary index and reference are the replicas of the first node.
+  NumaReplicas numa_replicas(mapping_parameters_.num_threads,
+                             mapping_parameters_.bind_numa_nodes,
+                             mapping_parameters_.num_numa_replicas);
   SequenceBatch reference;
   reference.InitializeLoading(mapping_parameters_.reference_file_path);
-  reference.LoadAllSequences();
+  numa_replicas.LoadPrimary([&] { reference.LoadAllSequences(); });
   uint32_t num_reference_sequences = reference.GetNumSequences();
   if (mapping_parameters_.custom_rid_order_file_path.length() > 0) {
     GenerateCustomRidRanks(mapping_parameters_.custom_rid_order_file_path,
@@ -231,15 +312,18 @@ void Chromap::MapSingleEndReads() {
   }
 
   Index index(mapping_parameters_.index_file_path);
-  index.Load();
+  numa_replicas.LoadPrimary([&] { index.Load(); });
   const int kmer_size = index.GetKmerSize();
   const int window_size = index.GetWindowSize();
   // index.Statistics(num_sequences, reference);
+  numa_replicas.Load(mapping_parameters_.index_file_path,
+                     mapping_parameters_.reference_file_path, custom_rid_rank_);
+  numa_replicas.OutputRemotePageRatios(index, reference);
 
-  SequenceBatch read_batch(read_batch_size_, read1_effective_range_);
+  // The loading batches keep the states of the read files. Reads are loaded
+  // with the memory of the in-flight batches and then swapped into them.
   SequenceBatch read_batch_for_loading(read_batch_size_,
                                        read1_effective_range_);
-  SequenceBatch barcode_batch(read_batch_size_, barcode_effective_range_);
   SequenceBatch barcode_batch_for_loading(read_batch_size_,
                                           barcode_effective_range_);
 
@@ -288,15 +372,50 @@ void Chromap::MapSingleEndReads() {
     max_num_mappings_in_mem = 1 * ((uint64_t)1 << 29) / sizeof(MappingRecord);
   }
 
-  mm_cache mm_to_candidates_cache(2000003);
+  mm_cache mm_to_candidates_cache(2000003,
+                                  mapping_parameters_.cache_associativity);
   mm_to_candidates_cache.SetKmerLength(kmer_size);
-  struct _mm_history *mm_history = new struct _mm_history[read_batch_size_];
-  // Use bit encoding to represent mapping results
+  CacheFileKey cache_file_key;
+  if (!mapping_parameters_.cache_load_file_path.empty() ||
+      !mapping_parameters_.cache_dump_file_path.empty()) {
+    cache_file_key = GetCacheFileKey(index);
+  }
+  LoadCache(cache_file_key, mm_to_candidates_cache);
+  MappingResultCache<MappingRecord> mapping_result_cache(
+      mapping_parameters_.mapping_result_cache_size);
+  // Cache queries and hits of each thread in the current batch.
+  std::vector<uint64_t> cache_queries_per_thread(
+      mapping_parameters_.num_threads, 0);
+  std::vector<uint64_t> cache_query_hits_per_thread(
+      mapping_parameters_.num_threads, 0);
+  // Each mapping thread is a worker of the scheduler. The time each thread
+  // spends mapping the current batch tells how well the batch is balanced.
+  ReadRangeScheduler read_range_scheduler(mapping_parameters_.num_threads);
+  std::vector<double> mapping_busy_time_per_thread(
+      mapping_parameters_.num_threads, 0);
+  // The reads sampled in a batch update the cache while the next batch is
+  // mapped, so one log is filled while the other one is applied. Hence the
+  // updates land one batch late and a read may or may not hit the entries of
+  // the previous batch, depending on how far their update has gone. The cache
+  // hits, and so the cachehit column of the summary, can differ between runs
+  // and from updating the cache right after each batch. The mappings do not,
+  // as a hit returns the candidates the read gets without the cache.
+  std::vector<std::unique_ptr<CacheUpdateLog>> cache_update_logs;
+  for (int li = 0; li < 2; ++li) {
+    cache_update_logs.emplace_back(
+        new CacheUpdateLog(mapping_parameters_.num_threads));
+  }
+  // Use bit encoding to represent mapping results in read_map_summary of each
+  // in-flight batch
   // bit 0: is barcode in whitelist
-  uint8_t *read_map_summary = NULL ; 
-  if (!mapping_parameters_.summary_metadata_file_path.empty()) {
-    read_map_summary = new uint8_t[read_batch_size_];
-    memset(read_map_summary, 1, sizeof(*read_map_summary)*read_batch_size_);
+  std::vector<std::unique_ptr<InFlightReadBatch<MappingRecord>>>
+      in_flight_batches;
+  for (int bi = 0; bi < mapping_parameters_.num_in_flight_batches; ++bi) {
+    in_flight_batches.emplace_back(new InFlightReadBatch<MappingRecord>(
+        read_batch_size_, /*is_paired_end=*/false,
+        !mapping_parameters_.summary_metadata_file_path.empty(),
+        read1_effective_range_, read2_effective_range_,
+        barcode_effective_range_));
   }
 
   static uint64_t thread_num_candidates = 0;
@@ -305,57 +424,53 @@ void Chromap::MapSingleEndReads() {
   static uint64_t thread_num_uniquely_mapped_reads = 0;
   static uint64_t thread_num_barcode_in_whitelist = 0;
   static uint64_t thread_num_corrected_barcode = 0;
-#pragma omp threadprivate(                                               \
-    thread_num_candidates, thread_num_mappings, thread_num_mapped_reads, \
-    thread_num_uniquely_mapped_reads, thread_num_barcode_in_whitelist,   \
-    thread_num_corrected_barcode)
+  static uint64_t thread_num_mapping_result_cache_queries = 0;
+  static uint64_t thread_num_mapping_result_cache_hits = 0;
+  static uint64_t thread_num_low_complexity_reads = 0;
+#pragma omp threadprivate(                                                \
+    thread_num_candidates, thread_num_mappings, thread_num_mapped_reads,  \
+    thread_num_uniquely_mapped_reads, thread_num_barcode_in_whitelist,    \
+    thread_num_corrected_barcode, thread_num_mapping_result_cache_queries, \
+    thread_num_mapping_result_cache_hits, thread_num_low_complexity_reads)
   double real_start_mapping_time = GetRealTime();
   for (size_t read_file_index = 0;
        read_file_index < mapping_parameters_.read_file1_paths.size();
        ++read_file_index) {
-    read_batch_for_loading.InitializeLoading(
-        mapping_parameters_.read_file1_paths[read_file_index]);
+    InitializeReadFileLoading(
+        mapping_parameters_.read_file1_paths[read_file_index],
+        /*is_barcode_file=*/false, read_batch_for_loading);
 
     if (!mapping_parameters_.is_bulk_data) {
-      barcode_batch_for_loading.InitializeLoading(
-          mapping_parameters_.barcode_file_paths[read_file_index]);
+      InitializeReadFileLoading(
+          mapping_parameters_.barcode_file_paths[read_file_index],
+          /*is_barcode_file=*/true, barcode_batch_for_loading);
     }
 
-    uint32_t num_loaded_reads_for_loading = 0;
-    uint32_t num_loaded_reads = LoadSingleEndReadsWithBarcodes(
-        read_batch_for_loading, barcode_batch_for_loading,
-        mapping_parameters_.num_threads >= 3 ? true : false);
-    read_batch_for_loading.SwapSequenceBatch(read_batch);
-
-    if (!mapping_parameters_.is_bulk_data) {
-      barcode_batch_for_loading.SwapSequenceBatch(barcode_batch);
+    // Batches are loaded in the background into free in-flight batches, so
+    // loading can run ahead of mapping by up to all of them.
+    InFlightReadBatchQueue free_batch_indices;
+    InFlightReadBatchQueue loaded_batch_indices;
+    for (int bi = 0; bi < mapping_parameters_.num_in_flight_batches; ++bi) {
+      free_batch_indices.Push(bi);
     }
-
-    std::vector<std::vector<std::vector<MappingRecord>>>
-        mappings_on_diff_ref_seqs_for_diff_threads;
-    std::vector<std::vector<std::vector<MappingRecord>>>
-        mappings_on_diff_ref_seqs_for_diff_threads_for_saving;
-    mappings_on_diff_ref_seqs_for_diff_threads.reserve(
-        mapping_parameters_.num_threads);
-    mappings_on_diff_ref_seqs_for_diff_threads_for_saving.reserve(
-        mapping_parameters_.num_threads);
-    for (int ti = 0; ti < mapping_parameters_.num_threads; ++ti) {
-      mappings_on_diff_ref_seqs_for_diff_threads.emplace_back(
-          std::vector<std::vector<MappingRecord>>(num_reference_sequences));
-      mappings_on_diff_ref_seqs_for_diff_threads_for_saving.emplace_back(
-          std::vector<std::vector<MappingRecord>>(num_reference_sequences));
-      for (uint32_t i = 0; i < num_reference_sequences; ++i) {
-        mappings_on_diff_ref_seqs_for_diff_threads[ti][i].reserve(
-            (num_loaded_reads + num_loaded_reads / 1000 *
-                                    mapping_parameters_.max_num_best_mappings) /
-            mapping_parameters_.num_threads / num_reference_sequences);
-        mappings_on_diff_ref_seqs_for_diff_threads_for_saving[ti][i].reserve(
-            (num_loaded_reads + num_loaded_reads / 1000 *
-                                    mapping_parameters_.max_num_best_mappings) /
-            mapping_parameters_.num_threads / num_reference_sequences);
-      }
+    std::thread loading_thread([&] {
+      LoadInFlightReadBatches(read_batch_for_loading,
+                              /*read_batch2_for_loading=*/NULL,
+                              barcode_batch_for_loading, in_flight_batches,
+                              free_batch_indices, loaded_batch_indices);
+    });
+
+    int batch_index = loaded_batch_indices.Pop();
+    uint32_t num_loaded_reads = in_flight_batches[batch_index]->num_loaded_reads;
+
+    for (auto &in_flight_batch : in_flight_batches) {
+      in_flight_batch->InitializeMappingBuffers(
+          mapping_parameters_.num_threads, num_reference_sequences,
+          (num_loaded_reads + num_loaded_reads / 1000 *
+                                  mapping_parameters_.max_num_best_mappings) /
+              mapping_parameters_.num_threads / num_reference_sequences);
     }
-#pragma omp parallel shared(num_reads_, mm_history, read_map_summary, reference, index, read_batch, barcode_batch, read_batch_for_loading, barcode_batch_for_loading, std::cerr, num_loaded_reads_for_loading, num_loaded_reads, num_reference_sequences, mappings_on_diff_ref_seqs_for_diff_threads, mappings_on_diff_ref_seqs_for_diff_threads_for_saving, mappings_on_diff_ref_seqs, temp_mapping_file_handles, mm_to_candidates_cache, mapping_writer, minimizer_generator, candidate_processor, mapping_processor, draft_mapping_generator, mapping_generator, num_mappings_in_mem, max_num_mappings_in_mem) num_threads(mapping_parameters_.num_threads) reduction(+:num_candidates_, num_mappings_, num_mapped_reads_, num_uniquely_mapped_reads_, num_barcode_in_whitelist_, num_corrected_barcode_)
+#pragma omp parallel shared(num_reads_, cache_update_logs, numa_replicas, read_range_scheduler, mapping_busy_time_per_thread, reference, index, in_flight_batches, free_batch_indices, loaded_batch_indices, batch_index, std::cerr, num_loaded_reads, num_reference_sequences, mappings_on_diff_ref_seqs, temp_mapping_file_handles, mm_to_candidates_cache, mapping_result_cache, mapping_writer, minimizer_generator, candidate_processor, mapping_processor, draft_mapping_generator, mapping_generator, num_mappings_in_mem, max_num_mappings_in_mem) num_threads(mapping_parameters_.num_threads) reduction(+:num_candidates_, num_mappings_, num_mapped_reads_, num_uniquely_mapped_reads_, num_barcode_in_whitelist_, num_corrected_barcode_, num_mapping_result_cache_queries_, num_mapping_result_cache_hits_, num_low_complexity_reads_)
     {
       thread_num_candidates = 0;
       thread_num_mappings = 0;
@@ -363,168 +478,280 @@ void Chromap::MapSingleEndReads() {
       thread_num_uniquely_mapped_reads = 0;
       thread_num_barcode_in_whitelist = 0;
       thread_num_corrected_barcode = 0;
+      thread_num_mapping_result_cache_queries = 0;
+      thread_num_mapping_result_cache_hits = 0;
+      thread_num_low_complexity_reads = 0;
+      numa_replicas.PinCurrentThread();
       MappingMetadata mapping_metadata;
+      std::vector<std::pair<uint32_t, size_t>> mapping_list_ends;
 #pragma omp single
       {
+        // Only used to run the output tasks in the order of the batches.
+        char output_task_order = 0;
+        // Applies the cache update log of the previous batch.
+        std::thread cache_update_thread;
+        int cache_update_log_index = 0;
         while (num_loaded_reads > 0) {
           double real_batch_start_time = GetRealTime();
           num_reads_ += num_loaded_reads;
-#pragma omp task
-          {
-            num_loaded_reads_for_loading = LoadSingleEndReadsWithBarcodes(
-                read_batch_for_loading, barcode_batch_for_loading,
-                mapping_parameters_.num_threads >= 12 ? true : false);
-          }  // end of openmp loading task
+          InFlightReadBatch<MappingRecord> &in_flight_batch =
+              *in_flight_batches[batch_index];
+          SequenceBatch &read_batch = in_flight_batch.read_batch1;
+          SequenceBatch &barcode_batch = in_flight_batch.barcode_batch;
+          std::vector<std::vector<std::vector<MappingRecord>>>
+              &mappings_on_diff_ref_seqs_for_diff_threads =
+                  in_flight_batch.mappings_on_diff_ref_seqs_for_diff_threads;
+          uint8_t *read_map_summary =
+              in_flight_batch.read_map_summary.empty()
+                  ? NULL
+                  : in_flight_batch.read_map_summary.data();
+          CacheUpdateLog *cache_update_log =
+              cache_update_logs[cache_update_log_index].get();
+          std::fill(cache_queries_per_thread.begin(),
+                    cache_queries_per_thread.end(), 0);
+          std::fill(cache_query_hits_per_thread.begin(),
+                    cache_query_hits_per_thread.end(), 0);
           uint32_t history_update_threshold =
           mm_to_candidates_cache.GetUpdateThreshold(num_loaded_reads,
                                                     num_reads_, 
                                                     false,
                                                     0.01);
-          // int grain_size = 10000;
-//#pragma omp taskloop grainsize(grain_size) //num_tasks(num_threads_* 50)
-#pragma omp taskloop num_tasks( \
-    mapping_parameters_.num_threads *mapping_parameters_.num_threads)
-          for (uint32_t read_index = 0; read_index < num_loaded_reads;
-               ++read_index) {
-            bool current_barcode_is_whitelisted = true;
-            if (!mapping_parameters_.barcode_whitelist_file_path.empty()) {
-              current_barcode_is_whitelisted = CorrectBarcodeAt(
-                  read_index, barcode_batch, thread_num_barcode_in_whitelist,
-                  thread_num_corrected_barcode);
-            }
+          // One task per worker maps the reads handed out by the scheduler, so
+          // the reads that are slow to map are balanced over the threads.
+          read_range_scheduler.Reset(num_loaded_reads);
+          std::fill(mapping_busy_time_per_thread.begin(),
+                    mapping_busy_time_per_thread.end(), 0);
+          const double real_mapping_start_time = GetRealTime();
+#pragma omp taskloop num_tasks(read_range_scheduler.GetNumWorkers()) \
+    shared(read_batch, barcode_batch, mappings_on_diff_ref_seqs_for_diff_threads)
+          for (int worker_id = 0;
+               worker_id < read_range_scheduler.GetNumWorkers(); ++worker_id) {
+            const double real_worker_start_time = GetRealTime();
+            // The replicas on the NUMA node of the thread, if any.
+            const Index &node_local_index =
+                numa_replicas.GetIndexOfThread(omp_get_thread_num(), index);
+            const SequenceBatch &node_local_reference =
+                numa_replicas.GetReferenceOfThread(omp_get_thread_num(),
+                                                   reference);
+            uint32_t range_begin = 0;
+            uint32_t range_end = 0;
+            while (read_range_scheduler.GetNextRange(worker_id, range_begin,
+                                                     range_end)) {
+              for (uint32_t read_index = range_begin; read_index < range_end;
+                   ++read_index) {
+                bool current_barcode_is_whitelisted = true;
+                if (!mapping_parameters_.barcode_whitelist_file_path.empty()) {
+                  current_barcode_is_whitelisted = CorrectBarcodeAt(
+                      read_index, barcode_batch, thread_num_barcode_in_whitelist,
+                      thread_num_corrected_barcode);
+                }
 
-            if (!(current_barcode_is_whitelisted ||
-                  mapping_parameters_.output_mappings_not_in_whitelist)) {
-              if (read_map_summary != NULL)
-                read_map_summary[read_index] = 0;
-              continue;
-            }
-            
-            if (read_batch.GetSequenceLengthAt(read_index) <
-                (uint32_t)mapping_parameters_.min_read_length) {
-              continue;  // reads are too short, just drop.
-            }
+                if (!(current_barcode_is_whitelisted ||
+                      mapping_parameters_.output_mappings_not_in_whitelist)) {
+                  if (read_map_summary != NULL)
+                    read_map_summary[read_index] = 0;
+                  continue;
+                }
 
-            read_batch.PrepareNegativeSequenceAt(read_index);
+                if (mapping_parameters_.min_poly_g_tail_length > 0) {
+                  read_batch.TrimPolyGTailAt(
+                      read_index, mapping_parameters_.min_poly_g_tail_length);
+                }
 
-            mapping_metadata.PrepareForMappingNextRead(
-                mapping_parameters_.max_seed_frequencies[0]);
+                if (mapping_parameters_.trim_adapters) {
+                  TrimAdapterForSingleEndRead(read_index, read_batch);
+                }
 
-            minimizer_generator.GenerateMinimizers(
-                read_batch, read_index, mapping_metadata.minimizers_);
+                if (read_batch.GetSequenceLengthAt(read_index) <
+                    (uint32_t)mapping_parameters_.min_read_length) {
+                  continue;  // reads are too short, just drop.
+                }
 
-            if (mapping_metadata.minimizers_.size() > 0) {
-              if (mapping_parameters_.custom_rid_order_file_path.length() > 0) {
-                RerankCandidatesRid(mapping_metadata.positive_candidates_);
-                RerankCandidatesRid(mapping_metadata.negative_candidates_);
-              }
+                if (mapping_parameters_.min_read_complexity > 0 &&
+                    read_batch.GetComplexityAt(read_index) <
+                        mapping_parameters_.min_read_complexity) {
+                  ++thread_num_low_complexity_reads;
+                  continue;
+                }
 
-              if (mm_to_candidates_cache.Query(
-                      mapping_metadata,
-                      read_batch.GetSequenceLengthAt(read_index)) == -1) {
-                candidate_processor.GenerateCandidates(
-                    mapping_parameters_.error_threshold, index,
-                    mapping_metadata);
-              }
+                uint64_t read_hash = 0;
+                bool is_read_cacheable = false;
+                MappingResultStats stats_before_read;
+                if (mapping_result_cache.IsEnabled()) {
+                  ++thread_num_mapping_result_cache_queries;
+                  read_hash =
+                      mapping_result_cache.GetReadHash(read_batch, NULL, read_index);
+                  const uint64_t barcode_key =
+                      mapping_parameters_.is_bulk_data
+                          ? 0
+                          : barcode_batch.GenerateSeedFromSequenceAt(
+                                read_index, /*start_position=*/0,
+                                barcode_batch.GetSequenceLengthAt(read_index));
+                  MappingResultStats replayed_stats;
+                  if (mapping_result_cache.Replay(
+                          read_hash, read_batch, NULL, read_index, barcode_key,
+                          replayed_stats,
+                          mappings_on_diff_ref_seqs_for_diff_threads
+                              [omp_get_thread_num()],
+                          /*mapping_list_ends=*/NULL)) {
+                    ++thread_num_mapping_result_cache_hits;
+                    replayed_stats.AddTo(thread_num_candidates, thread_num_mappings,
+                                         thread_num_mapped_reads,
+                                         thread_num_uniquely_mapped_reads);
+                    continue;
+                  }
+                  is_read_cacheable = mapping_result_cache.Admit(read_hash);
+                  mapping_list_ends.clear();
+                  stats_before_read = MappingResultStats(
+                      thread_num_candidates, thread_num_mappings,
+                      thread_num_mapped_reads, thread_num_uniquely_mapped_reads);
+                }
 
-              if (read_index < history_update_threshold) {
-                mm_history[read_index].timestamp = num_reads_;
-                mm_history[read_index].minimizers =
-                    mapping_metadata.minimizers_;
-                mm_history[read_index].positive_candidates =
-                    mapping_metadata.positive_candidates_;
-                mm_history[read_index].negative_candidates =
-                    mapping_metadata.negative_candidates_;
-                mm_history[read_index].repetitive_seed_length =
-                    mapping_metadata.repetitive_seed_length_;
-              }
+                mapping_metadata.PrepareForMappingNextRead(
+                    mapping_parameters_.max_seed_frequencies[0]);
 
-              size_t current_num_candidates =
-                  mapping_metadata.GetNumCandidates();
-              if (current_num_candidates > 0) {
-                thread_num_candidates += current_num_candidates;
-                draft_mapping_generator.GenerateDraftMappings(
-                    read_batch, read_index, reference, mapping_metadata);
-
-                const size_t current_num_draft_mappings =
-                    mapping_metadata.GetNumDraftMappings();
-                if (current_num_draft_mappings > 0) {
-                  std::vector<std::vector<MappingRecord>>
-                      &mappings_on_diff_ref_seqs =
-                          mappings_on_diff_ref_seqs_for_diff_threads
-                              [omp_get_thread_num()];
+                minimizer_generator.GenerateMinimizers(
+                    read_batch, read_index, mapping_metadata.minimizers_);
 
-                  mapping_generator.GenerateBestMappingsForSingleEndRead(
-                      read_batch, read_index, reference, barcode_batch,
-                      mapping_metadata, mappings_on_diff_ref_seqs);
+                if (mapping_metadata.minimizers_.size() > 0) {
+                  if (mapping_parameters_.custom_rid_order_file_path.length() > 0) {
+                    RerankCandidatesRid(mapping_metadata.positive_candidates_);
+                    RerankCandidatesRid(mapping_metadata.negative_candidates_);
+                  }
 
-                  thread_num_mappings +=
-                      std::min(mapping_metadata.GetNumBestMappings(),
-                               mapping_parameters_.max_num_best_mappings);
-                  ++thread_num_mapped_reads;
+                  ++cache_queries_per_thread[omp_get_thread_num()];
+                  if (mm_to_candidates_cache.Query(
+                          mapping_metadata,
+                          read_batch.GetSequenceLengthAt(read_index)) == -1) {
+                    candidate_processor.GenerateCandidates(
+                        mapping_parameters_.error_threshold, node_local_index,
+                        mapping_metadata);
+                  } else {
+                    ++cache_query_hits_per_thread[omp_get_thread_num()];
+                  }
 
-                  if (mapping_metadata.GetNumBestMappings() == 1) {
-                    ++thread_num_uniquely_mapped_reads;
+                  if (read_index < history_update_threshold) {
+                    cache_update_log->Append(omp_get_thread_num(),
+                                             mapping_metadata);
                   }
+
+                  size_t current_num_candidates =
+                      mapping_metadata.GetNumCandidates();
+                  if (current_num_candidates > 0) {
+                    thread_num_candidates += current_num_candidates;
+                    draft_mapping_generator.GenerateDraftMappings(
+                        read_batch, read_index, node_local_reference,
+                        mapping_metadata);
+
+                    const size_t current_num_draft_mappings =
+                        mapping_metadata.GetNumDraftMappings();
+                    if (current_num_draft_mappings > 0) {
+                      std::vector<std::vector<MappingRecord>>
+                          &mappings_on_diff_ref_seqs =
+                              mappings_on_diff_ref_seqs_for_diff_threads
+                                  [omp_get_thread_num()];
+
+                      if (is_read_cacheable) {
+                        mapping_result_cache.MarkMappingListEnds(
+                            mapping_metadata, mappings_on_diff_ref_seqs,
+                            mapping_list_ends);
+                      }
+
+                      mapping_generator.GenerateBestMappingsForSingleEndRead(
+                          read_batch, read_index, node_local_reference,
+                          barcode_batch, mapping_metadata,
+                          mappings_on_diff_ref_seqs);
+
+                      thread_num_mappings +=
+                          std::min(mapping_metadata.GetNumBestMappings(),
+                                   mapping_parameters_.max_num_best_mappings);
+                      ++thread_num_mapped_reads;
+
+                      if (mapping_metadata.GetNumBestMappings() == 1) {
+                        ++thread_num_uniquely_mapped_reads;
+                      }
+                    }
+                  }
+                }
+
+                if (is_read_cacheable) {
+                  mapping_result_cache.Insert(
+                      read_hash, read_batch, NULL, read_index,
+                      MappingResultStats(thread_num_candidates, thread_num_mappings,
+                                         thread_num_mapped_reads,
+                                         thread_num_uniquely_mapped_reads) -
+                          stats_before_read,
+                      mapping_list_ends,
+                      mappings_on_diff_ref_seqs_for_diff_threads
+                          [omp_get_thread_num()]);
                 }
               }
             }
+            mapping_busy_time_per_thread[omp_get_thread_num()] +=
+                GetRealTime() - real_worker_start_time;
           }
-#pragma omp taskwait
-          for (uint32_t read_index = 0; read_index < history_update_threshold;
-               ++read_index) {
-            if (mm_history[read_index].timestamp != num_reads_) continue;
-            mm_to_candidates_cache.Update(
-                mm_history[read_index].minimizers,
-                mm_history[read_index].positive_candidates,
-                mm_history[read_index].negative_candidates,
-                mm_history[read_index].repetitive_seed_length);
-            if (mm_history[read_index].positive_candidates.size() <
-                mm_history[read_index].positive_candidates.capacity() / 2) {
-              std::vector<Candidate>().swap(
-                  mm_history[read_index].positive_candidates);
-            }
-            if (mm_history[read_index].negative_candidates.size() <
-                mm_history[read_index].negative_candidates.capacity() / 2) {
-              std::vector<Candidate>().swap(
-                  mm_history[read_index].negative_candidates);
-            }
+          const double mapping_time = GetRealTime() - real_mapping_start_time;
+          // Neither queries nor updates are running once the previous log
+          // is applied. Then this log is applied while the next batch is
+          // mapped.
+          if (cache_update_thread.joinable()) {
+            cache_update_thread.join();
           }
+          mm_to_candidates_cache.CompactPayloads();
+          AdaptCacheSize(cache_queries_per_thread, cache_query_hits_per_thread,
+                         mm_to_candidates_cache);
+          mapping_result_cache.ReclaimRetiredEntries();
+          cache_update_thread = std::thread([&mm_to_candidates_cache,
+                                             cache_update_log] {
+            cache_update_log->ApplyTo(mm_to_candidates_cache,
+                                      /*debug=*/false);
+          });
+          cache_update_log_index ^= 1;
           // std::cerr<<"cache memusage: " <<
           // mm_to_candidates_cache.GetMemoryBytes() <<"\n" ;
-          if (!mapping_parameters_.summary_metadata_file_path.empty()) {
-            if (mapping_parameters_.is_bulk_data) 
-              mapping_writer.UpdateSummaryMetadata(0, SUMMARY_METADATA_TOTAL, 
-                  num_loaded_reads) ;
-            else {
-              uint32_t nonwhitelist_count = 0;
-              for (uint32_t read_index = 0; read_index < num_loaded_reads; ++read_index)
-                if (read_map_summary[read_index] & 1) {
-                  mapping_writer.UpdateSummaryMetadata(
-                      barcode_batch.GenerateSeedFromSequenceAt(read_index, 0, barcode_length_), 
-                      SUMMARY_METADATA_TOTAL, 1);
-                } else {
-                  ++nonwhitelist_count;
-                }
-              
-              mapping_writer.UpdateSpeicalCategorySummaryMetadata(/*nonwhitelist*/0, 
-                  SUMMARY_METADATA_TOTAL, nonwhitelist_count);
+          std::cerr << "Mapped " << num_loaded_reads << " reads in "
+                    << GetRealTime() - real_batch_start_time << "s.\n";
+          OutputCacheHitRate(cache_queries_per_thread,
+                             cache_query_hits_per_thread);
+          OutputMappingThreadBusyTimes(mapping_busy_time_per_thread,
+                                       mapping_time,
+                                       read_range_scheduler.GetNumSteals());
+
+          // Summarize and save the mappings of the batch while the following
+          // batches are mapped. The output tasks run in the order of the
+          // batches and then release the batch for loading.
+#pragma omp task firstprivate(batch_index) depend(inout : output_task_order)
+          {
+            InFlightReadBatch<MappingRecord> &output_batch =
+                *in_flight_batches[batch_index];
+            if (!mapping_parameters_.summary_metadata_file_path.empty()) {
+              if (mapping_parameters_.is_bulk_data) 
+                mapping_writer.UpdateSummaryMetadata(0, SUMMARY_METADATA_TOTAL, 
+                    output_batch.num_loaded_reads) ;
+              else {
+                uint32_t nonwhitelist_count = 0;
+                for (uint32_t read_index = 0; read_index < output_batch.num_loaded_reads; ++read_index)
+                  if (output_batch.read_map_summary[read_index] & 1) {
+                    mapping_writer.UpdateSummaryMetadata(
+                        output_batch.barcode_batch.GenerateSeedFromSequenceAt(read_index, 0, barcode_length_), 
+                        SUMMARY_METADATA_TOTAL, 1);
+                  } else {
+                    ++nonwhitelist_count;
+                  }
+                
+                mapping_writer.UpdateSpeicalCategorySummaryMetadata(/*nonwhitelist*/0, 
+                    SUMMARY_METADATA_TOTAL, nonwhitelist_count);
+              }
+
+              // By default, set the lowest bit to 1 (whether the barcode is in the whitelist)
+              std::fill(output_batch.read_map_summary.begin(),
+                        output_batch.read_map_summary.end(), 1);
             }
 
-            // By default, set the lowest bit to 1 (whether the barcode is in the whitelist)
-            memset(read_map_summary, 1, sizeof(*read_map_summary)*read_batch_size_);
-          }
-          num_loaded_reads = num_loaded_reads_for_loading;
-          read_batch_for_loading.SwapSequenceBatch(read_batch);
-          barcode_batch_for_loading.SwapSequenceBatch(barcode_batch);
-          mappings_on_diff_ref_seqs_for_diff_threads.swap(
-              mappings_on_diff_ref_seqs_for_diff_threads_for_saving);
-#pragma omp task
-          {
             num_mappings_in_mem +=
                 mapping_processor.MoveMappingsInBuffersToMappingContainer(
                     num_reference_sequences,
-                    mappings_on_diff_ref_seqs_for_diff_threads_for_saving,
+                    output_batch.mappings_on_diff_ref_seqs_for_diff_threads,
                     mappings_on_diff_ref_seqs);
             if (mapping_parameters_.low_memory_mode &&
                 num_mappings_in_mem > max_num_mappings_in_mem) {
@@ -542,9 +769,19 @@ void Chromap::MapSingleEndReads() {
               }
               num_mappings_in_mem = 0;
             }
+            free_batch_indices.Push(batch_index);
+          }  // end of openmp output task
+
+          if (!loaded_batch_indices.TryPop(batch_index)) {
+            // The loading thread might be waiting for the batches held by the
+            // output tasks, so finish them before waiting for the next batch.
+#pragma omp taskwait
+            batch_index = loaded_batch_indices.Pop();
           }
-          std::cerr << "Mapped " << num_loaded_reads << " reads in "
-                    << GetRealTime() - real_batch_start_time << "s.\n";
+          num_loaded_reads = in_flight_batches[batch_index]->num_loaded_reads;
+        }
+        if (cache_update_thread.joinable()) {
+          cache_update_thread.join();
         }
       }  // end of openmp single
       {
@@ -554,8 +791,13 @@ void Chromap::MapSingleEndReads() {
         num_mappings_ += thread_num_mappings;
         num_mapped_reads_ += thread_num_mapped_reads;
         num_uniquely_mapped_reads_ += thread_num_uniquely_mapped_reads;
+        num_mapping_result_cache_queries_ +=
+            thread_num_mapping_result_cache_queries;
+        num_mapping_result_cache_hits_ += thread_num_mapping_result_cache_hits;
+        num_low_complexity_reads_ += thread_num_low_complexity_reads;
       }  // end of updating shared mapping stats
     }    // end of openmp parallel region
+    loading_thread.join();
     read_batch_for_loading.FinalizeLoading();
     if (!mapping_parameters_.is_bulk_data) {
       barcode_batch_for_loading.FinalizeLoading();
@@ -564,10 +806,13 @@ void Chromap::MapSingleEndReads() {
 
   std::cerr << "Mapped all reads in " << GetRealTime() - real_start_mapping_time
             << "s.\n";
-
-  delete[] mm_history;
-  if (read_map_summary != NULL)
-    delete[] read_map_summary;
+  std::cerr << "Cache memory: "
+            << mm_to_candidates_cache.GetMemoryBytes() / (1024.0 * 1024.0)
+            << "MB, including "
+            << mm_to_candidates_cache.GetLivePayloadBytes() / (1024.0 * 1024.0)
+            << "MB cached candidates.\n";
+  OutputHugePageUsage();
+  DumpCache(cache_file_key, mm_to_candidates_cache);
 
   OutputMappingStatistics();
   if (!mapping_parameters_.is_bulk_data) {
@@ -637,10 +882,14 @@ template <typename MappingRecord>
 void Chromap::MapPairedEndReads() {
   double real_start_time = GetRealTime();
 
+  // The primary index and reference are the replicas of the first node.
+  NumaReplicas numa_replicas(mapping_parameters_.num_threads,
+                             mapping_parameters_.bind_numa_nodes,
+                             mapping_parameters_.num_numa_replicas);
   // Load reference
   SequenceBatch reference;
   reference.InitializeLoading(mapping_parameters_.reference_file_path);
-  reference.LoadAllSequences();
+  numa_replicas.LoadPrimary([&] { reference.LoadAllSequences(); });
   uint32_t num_reference_sequences = reference.GetNumSequences();
   
   // Debugging Info (printing out reference information)
@@ -665,15 +914,16 @@ void Chromap::MapPairedEndReads() {
 
   // Load index
   Index index(mapping_parameters_.index_file_path);
-  index.Load();
+  numa_replicas.LoadPrimary([&] { index.Load(); });
   const int kmer_size = index.GetKmerSize();
   const int window_size = index.GetWindowSize();
   // index.Statistics(num_sequences, reference);
+  numa_replicas.Load(mapping_parameters_.index_file_path,
+                     mapping_parameters_.reference_file_path, custom_rid_rank_);
+  numa_replicas.OutputRemotePageRatios(index, reference);
 
-  // Initialize read batches
-  SequenceBatch read_batch1(read_batch_size_, read1_effective_range_);
-  SequenceBatch read_batch2(read_batch_size_, read2_effective_range_);
-  SequenceBatch barcode_batch(read_batch_size_, barcode_effective_range_);
+  // Initialize read batches for loading. They keep the states of the read
+  // files while the reads are swapped into the in-flight batches.
   SequenceBatch read_batch1_for_loading(read_batch_size_,
                                         read1_effective_range_);
   SequenceBatch read_batch2_for_loading(read_batch_size_,
@@ -683,9 +933,9 @@ void Chromap::MapPairedEndReads() {
 
   // Check cache-related parameters
   std::cerr << "Cache Size: " << mapping_parameters_.cache_size << std::endl;
+  std::cerr << "Cache Associativity: "
+            << mapping_parameters_.cache_associativity << std::endl;
   std::cerr << "Cache Update Param: " << mapping_parameters_.cache_update_param << std::endl;
-  
-  std::vector<uint64_t> seeds_for_batch(500000, 0);
 
   // Variables used for counting number of associated cache slots
   bool output_num_cache_slots_info = mapping_parameters_.output_num_uniq_cache_slots;
@@ -697,11 +947,10 @@ void Chromap::MapPairedEndReads() {
   std::cerr << "Output number of associated cache slots: " << output_num_cache_slots_info << std::endl;
   std::cerr << "K for MinHash: " << k_for_minhash << std::endl;
 
-  int num_locks_for_map = 1000;
-  omp_lock_t map_locks[num_locks_for_map];
-  for (int i = 0; i < num_locks_for_map; ++i) {omp_init_lock(&map_locks[i]);}
-  
-  std::vector<std::unordered_map<size_t, K_MinHash>> barcode_peak_map(num_locks_for_map);
+  // The mapping threads save the cache slots hit by each pair in its batch,
+  // and the output task of the batch adds them to the sketches of the
+  // barcodes.
+  BarcodeCardinalitySketches cache_slot_sketches(k_for_minhash);
 
   // Parse out the parameters for chromap score (const, fric, dup, unmapped, lowmapq)
   std::vector<double> frip_est_params; 
@@ -729,18 +978,55 @@ void Chromap::MapPairedEndReads() {
   // Initialize vector to keep track of cache hits for each thread
   std::vector<int> cache_hits_per_thread(mapping_parameters_.num_threads, 0);
 
+  // Cache queries and hits of each thread in the current batch, counted per
+  // read rather than per pair.
+  std::vector<uint64_t> cache_queries_per_thread(
+      mapping_parameters_.num_threads, 0);
+  std::vector<uint64_t> cache_query_hits_per_thread(
+      mapping_parameters_.num_threads, 0);
+  // Each mapping thread is a worker of the scheduler. The time each thread
+  // spends mapping the current batch tells how well the batch is balanced.
+  ReadRangeScheduler read_range_scheduler(mapping_parameters_.num_threads);
+  std::vector<double> mapping_busy_time_per_thread(
+      mapping_parameters_.num_threads, 0);
+
   // Initialize cache
-  mm_cache mm_to_candidates_cache(mapping_parameters_.cache_size);
+  mm_cache mm_to_candidates_cache(mapping_parameters_.cache_size,
+                                  mapping_parameters_.cache_associativity);
   mm_to_candidates_cache.SetKmerLength(kmer_size);
-
-  struct _mm_history *mm_history1 = new struct _mm_history[read_batch_size_];
-  struct _mm_history *mm_history2 = new struct _mm_history[read_batch_size_];
+  CacheFileKey cache_file_key;
+  if (!mapping_parameters_.cache_load_file_path.empty() ||
+      !mapping_parameters_.cache_dump_file_path.empty()) {
+    cache_file_key = GetCacheFileKey(index);
+  }
+  LoadCache(cache_file_key, mm_to_candidates_cache);
+  MappingResultCache<MappingRecord> mapping_result_cache(
+      mapping_parameters_.mapping_result_cache_size);
+  BatchDuplicateGroups<MappingRecord> batch_duplicate_groups(
+      mapping_parameters_.collapse_batch_duplicates
+          ? mapping_parameters_.num_threads
+          : 0);
+
+  // The explanation for cache_update_logs is in the single-end mapping
+  // function.
+  std::vector<std::unique_ptr<CacheUpdateLog>> cache_update_logs;
+  for (int li = 0; li < 2; ++li) {
+    cache_update_logs.emplace_back(
+        new CacheUpdateLog(mapping_parameters_.num_threads));
+  }
   
   // The explanation for read_map_summary is in the single-end mapping function
-  uint8_t *read_map_summary = NULL ;
-  if (!mapping_parameters_.summary_metadata_file_path.empty()) {
-    read_map_summary = new uint8_t[read_batch_size_];
-    memset(read_map_summary, 1, sizeof(*read_map_summary)*read_batch_size_);
+  std::vector<std::unique_ptr<InFlightReadBatch<MappingRecord>>>
+      in_flight_batches;
+  for (int bi = 0; bi < mapping_parameters_.num_in_flight_batches; ++bi) {
+    in_flight_batches.emplace_back(new InFlightReadBatch<MappingRecord>(
+        read_batch_size_, /*is_paired_end=*/true,
+        !mapping_parameters_.summary_metadata_file_path.empty(),
+        read1_effective_range_, read2_effective_range_,
+        barcode_effective_range_));
+    if (output_num_cache_slots_info) {
+      in_flight_batches.back()->cache_slots.resize(2 * read_batch_size_, -1);
+    }
   }
   std::vector<std::vector<MappingRecord>> mappings_on_diff_ref_seqs;
   
@@ -793,62 +1079,59 @@ void Chromap::MapPairedEndReads() {
   static uint64_t thread_num_uniquely_mapped_reads = 0;
   static uint64_t thread_num_barcode_in_whitelist = 0;
   static uint64_t thread_num_corrected_barcode = 0;
-#pragma omp threadprivate(                                               \
-    thread_num_candidates, thread_num_mappings, thread_num_mapped_reads, \
-    thread_num_uniquely_mapped_reads, thread_num_barcode_in_whitelist,   \
-    thread_num_corrected_barcode)
+  static uint64_t thread_num_mapping_result_cache_queries = 0;
+  static uint64_t thread_num_mapping_result_cache_hits = 0;
+  static uint64_t thread_num_low_complexity_reads = 0;
+  static uint64_t thread_num_batch_duplicates = 0;
+#pragma omp threadprivate(                                                \
+    thread_num_candidates, thread_num_mappings, thread_num_mapped_reads,  \
+    thread_num_uniquely_mapped_reads, thread_num_barcode_in_whitelist,    \
+    thread_num_corrected_barcode, thread_num_mapping_result_cache_queries, \
+    thread_num_mapping_result_cache_hits, thread_num_low_complexity_reads, \
+    thread_num_batch_duplicates)
   double real_start_mapping_time = GetRealTime();
   for (size_t read_file_index = 0;
        read_file_index < mapping_parameters_.read_file1_paths.size();
        ++read_file_index) {
     // Set read batches to the current read files.
-    read_batch1_for_loading.InitializeLoading(
-        mapping_parameters_.read_file1_paths[read_file_index]);
-    read_batch2_for_loading.InitializeLoading(
-        mapping_parameters_.read_file2_paths[read_file_index]);
+    InitializeReadFileLoading(
+        mapping_parameters_.read_file1_paths[read_file_index],
+        /*is_barcode_file=*/false, read_batch1_for_loading);
+    InitializeReadFileLoading(
+        mapping_parameters_.read_file2_paths[read_file_index],
+        /*is_barcode_file=*/false, read_batch2_for_loading);
     if (!mapping_parameters_.is_bulk_data) {
-      barcode_batch_for_loading.InitializeLoading(
-          mapping_parameters_.barcode_file_paths[read_file_index]);
+      InitializeReadFileLoading(
+          mapping_parameters_.barcode_file_paths[read_file_index],
+          /*is_barcode_file=*/true, barcode_batch_for_loading);
     }
 
-    // Load the first batches.
-    uint32_t num_loaded_pairs_for_loading = 0;
-    uint32_t num_loaded_pairs = LoadPairedEndReadsWithBarcodes(
-        read_batch1_for_loading, read_batch2_for_loading,
-        barcode_batch_for_loading, mapping_parameters_.num_threads >= 3 ? true : false);
-    read_batch1_for_loading.SwapSequenceBatch(read_batch1);
-    read_batch2_for_loading.SwapSequenceBatch(read_batch2);
-    if (!mapping_parameters_.is_bulk_data) {
-      barcode_batch_for_loading.SwapSequenceBatch(barcode_batch);
+    // Batches are loaded in the background into free in-flight batches, so
+    // loading can run ahead of mapping by up to all of them.
+    InFlightReadBatchQueue free_batch_indices;
+    InFlightReadBatchQueue loaded_batch_indices;
+    for (int bi = 0; bi < mapping_parameters_.num_in_flight_batches; ++bi) {
+      free_batch_indices.Push(bi);
     }
+    std::thread loading_thread([&] {
+      LoadInFlightReadBatches(read_batch1_for_loading, &read_batch2_for_loading,
+                              barcode_batch_for_loading, in_flight_batches,
+                              free_batch_indices, loaded_batch_indices);
+    });
+
+    int batch_index = loaded_batch_indices.Pop();
+    uint32_t num_loaded_pairs = in_flight_batches[batch_index]->num_loaded_reads;
 
     // Setup thread private vectors to save mapping results.
-    std::vector<std::vector<std::vector<MappingRecord>>>
-        mappings_on_diff_ref_seqs_for_diff_threads;
-    std::vector<std::vector<std::vector<MappingRecord>>>
-        mappings_on_diff_ref_seqs_for_diff_threads_for_saving;
-    mappings_on_diff_ref_seqs_for_diff_threads.reserve(
-        mapping_parameters_.num_threads);
-    mappings_on_diff_ref_seqs_for_diff_threads_for_saving.reserve(
-        mapping_parameters_.num_threads);
-    for (int ti = 0; ti < mapping_parameters_.num_threads; ++ti) {
-      mappings_on_diff_ref_seqs_for_diff_threads.emplace_back(
-          std::vector<std::vector<MappingRecord>>(num_reference_sequences));
-      mappings_on_diff_ref_seqs_for_diff_threads_for_saving.emplace_back(
-          std::vector<std::vector<MappingRecord>>(num_reference_sequences));
-      for (uint32_t i = 0; i < num_reference_sequences; ++i) {
-        mappings_on_diff_ref_seqs_for_diff_threads[ti][i].reserve(
-            (num_loaded_pairs + num_loaded_pairs / 1000 *
-                                    mapping_parameters_.max_num_best_mappings) /
-            mapping_parameters_.num_threads / num_reference_sequences);
-        mappings_on_diff_ref_seqs_for_diff_threads_for_saving[ti][i].reserve(
-            (num_loaded_pairs + num_loaded_pairs / 1000 *
-                                    mapping_parameters_.max_num_best_mappings) /
-            mapping_parameters_.num_threads / num_reference_sequences);
-      }
+    for (auto &in_flight_batch : in_flight_batches) {
+      in_flight_batch->InitializeMappingBuffers(
+          mapping_parameters_.num_threads, num_reference_sequences,
+          (num_loaded_pairs + num_loaded_pairs / 1000 *
+                                  mapping_parameters_.max_num_best_mappings) /
+              mapping_parameters_.num_threads / num_reference_sequences);
     }
 
-#pragma omp parallel shared(num_reads_, num_reference_sequences, reference, index, read_batch1, read_batch2, barcode_batch, read_batch1_for_loading, read_batch2_for_loading, barcode_batch_for_loading, minimizer_generator, candidate_processor, mapping_processor, draft_mapping_generator, mapping_generator, mapping_writer, std::cerr, num_loaded_pairs_for_loading, num_loaded_pairs, mappings_on_diff_ref_seqs_for_diff_threads, mappings_on_diff_ref_seqs_for_diff_threads_for_saving, mappings_on_diff_ref_seqs, num_mappings_in_mem, max_num_mappings_in_mem, temp_mapping_file_handles, mm_to_candidates_cache, mm_history1, mm_history2, read_map_summary) num_threads(mapping_parameters_.num_threads) reduction(+:num_candidates_, num_mappings_, num_mapped_reads_, num_uniquely_mapped_reads_, num_barcode_in_whitelist_, num_corrected_barcode_)
+#pragma omp parallel shared(num_reads_, num_reference_sequences, reference, index, numa_replicas, in_flight_batches, free_batch_indices, loaded_batch_indices, batch_index, minimizer_generator, candidate_processor, mapping_processor, draft_mapping_generator, mapping_generator, mapping_writer, std::cerr, num_loaded_pairs, mappings_on_diff_ref_seqs, num_mappings_in_mem, max_num_mappings_in_mem, temp_mapping_file_handles, mm_to_candidates_cache, mapping_result_cache, batch_duplicate_groups, cache_update_logs, read_range_scheduler, mapping_busy_time_per_thread) num_threads(mapping_parameters_.num_threads) reduction(+:num_candidates_, num_mappings_, num_mapped_reads_, num_uniquely_mapped_reads_, num_barcode_in_whitelist_, num_corrected_barcode_, num_mapping_result_cache_queries_, num_mapping_result_cache_hits_, num_low_complexity_reads_, num_batch_duplicates_)
     {
       thread_num_candidates = 0;
       thread_num_mappings = 0;
@@ -856,27 +1139,46 @@ void Chromap::MapPairedEndReads() {
       thread_num_uniquely_mapped_reads = 0;
       thread_num_barcode_in_whitelist = 0;
       thread_num_corrected_barcode = 0;
+      thread_num_mapping_result_cache_queries = 0;
+      thread_num_mapping_result_cache_hits = 0;
+      thread_num_low_complexity_reads = 0;
+      thread_num_batch_duplicates = 0;
+      numa_replicas.PinCurrentThread();
       PairedEndMappingMetadata paired_end_mapping_metadata;
+      std::string negative_read_buffer;
+      std::vector<std::pair<uint32_t, size_t>> mapping_list_ends;
 
       std::vector<int> best_mapping_indices(
           mapping_parameters_.max_num_best_mappings);
       std::mt19937 generator(11);
 #pragma omp single
       {
-        double real_batch_start_time = GetRealTime();
+        // Only used to run the output tasks in the order of the batches.
+        char output_task_order = 0;
+        // Applies the cache update log of the previous batch.
+        std::thread cache_update_thread;
+        int cache_update_log_index = 0;
         while (num_loaded_pairs > 0) {
+          double real_batch_start_time = GetRealTime();
           num_reads_ += num_loaded_pairs;
           num_reads_ += num_loaded_pairs;
+          InFlightReadBatch<MappingRecord> &in_flight_batch =
+              *in_flight_batches[batch_index];
+          SequenceBatch &read_batch1 = in_flight_batch.read_batch1;
+          SequenceBatch &read_batch2 = in_flight_batch.read_batch2;
+          SequenceBatch &barcode_batch = in_flight_batch.barcode_batch;
+          std::vector<std::vector<std::vector<MappingRecord>>>
+              &mappings_on_diff_ref_seqs_for_diff_threads =
+                  in_flight_batch.mappings_on_diff_ref_seqs_for_diff_threads;
+          uint8_t *read_map_summary =
+              in_flight_batch.read_map_summary.empty()
+                  ? NULL
+                  : in_flight_batch.read_map_summary.data();
+          CacheUpdateLog *cache_update_log =
+              cache_update_logs[cache_update_log_index].get();
+          uint64_t *seeds_for_batch = in_flight_batch.barcode_seeds.data();
+          int *cache_slots_for_batch = in_flight_batch.cache_slots.data();
 
-#pragma omp task
-          {
-            num_loaded_pairs_for_loading = LoadPairedEndReadsWithBarcodes(
-                read_batch1_for_loading, read_batch2_for_loading,
-                barcode_batch_for_loading, 
-                mapping_parameters_.num_threads >= 12 ? true : false);
-          }  // end of openmp loading task
-
-          int grain_size = 5000;
           uint32_t history_update_threshold =
           mm_to_candidates_cache.GetUpdateThreshold(num_loaded_pairs,
                                                     num_reads_, 
@@ -884,263 +1186,459 @@ void Chromap::MapPairedEndReads() {
                                                     mapping_parameters_.cache_update_param
                                                     );
           std::fill(cache_hits_per_thread.begin(), cache_hits_per_thread.end(), 0);
+          std::fill(cache_queries_per_thread.begin(),
+                    cache_queries_per_thread.end(), 0);
+          std::fill(cache_query_hits_per_thread.begin(),
+                    cache_query_hits_per_thread.end(), 0);
 
           if (mapping_parameters_.debug_cache) {
             std::cout << "[DEBUG][UPDATE] update_threshold = " << history_update_threshold << std::endl;
           }
 
-#pragma omp taskloop grainsize(grain_size)
-          for (uint32_t pair_index = 0; pair_index < num_loaded_pairs;
-               ++pair_index) {
-            int thread_id = omp_get_thread_num();
-            
-            bool current_barcode_is_whitelisted = true;
-            if (!mapping_parameters_.barcode_whitelist_file_path.empty()) {
-              current_barcode_is_whitelisted = CorrectBarcodeAt(
-                  pair_index, barcode_batch, thread_num_barcode_in_whitelist,
-                  thread_num_corrected_barcode);
-            }
-
-            // calculate seed value for each barcode to use later (below and summary update)
-            size_t curr_seed_val = barcode_batch.GenerateSeedFromSequenceAt(pair_index, 0, barcode_length_);
-            seeds_for_batch[pair_index] = curr_seed_val;
-
-            if (current_barcode_is_whitelisted ||
-                mapping_parameters_.output_mappings_not_in_whitelist) {
-              
-              if (read_batch1.GetSequenceLengthAt(pair_index) <
-                  (uint32_t)mapping_parameters_.min_read_length ||
-                  read_batch2.GetSequenceLengthAt(pair_index) <
-                  (uint32_t)mapping_parameters_.min_read_length) {
-                continue;  // reads are too short, just drop.
-              }
-
-              read_batch1.PrepareNegativeSequenceAt(pair_index);
-              read_batch2.PrepareNegativeSequenceAt(pair_index);
-
-              if (mapping_parameters_.trim_adapters) {
-                TrimAdapterForPairedEndRead(pair_index, read_batch1,
-                                            read_batch2);
-              }
-
-              paired_end_mapping_metadata.PreparedForMappingNextReadPair(
-                  mapping_parameters_.max_seed_frequencies[0]);
-
-              minimizer_generator.GenerateMinimizers(
-                  read_batch1, pair_index,
-                  paired_end_mapping_metadata.mapping_metadata1_.minimizers_);
-              minimizer_generator.GenerateMinimizers(
-                  read_batch2, pair_index,
-                  paired_end_mapping_metadata.mapping_metadata2_.minimizers_);
-
-              if (paired_end_mapping_metadata.BothEndsHaveMinimizers()) {
-                // declare temp local variable for cache result
-                int cache_query_result1 = 0;
-                int cache_query_result2 = 0;
-                int cache_miss = 0;
-
-                cache_query_result1 = mm_to_candidates_cache.Query(paired_end_mapping_metadata.mapping_metadata1_,
-                                                                  read_batch1.GetSequenceLengthAt(pair_index));
-                if (cache_query_result1 == -1) 
-                {
-                  candidate_processor.GenerateCandidates(
-                      mapping_parameters_.error_threshold, 
-                      index,
-                      paired_end_mapping_metadata.mapping_metadata1_
-                      );
-                  ++cache_miss;
-                }
-                size_t current_num_candidates1 = paired_end_mapping_metadata.mapping_metadata1_.GetNumCandidates();
-
-
-                cache_query_result2 = mm_to_candidates_cache.Query(paired_end_mapping_metadata.mapping_metadata2_,
-                                                                  read_batch2.GetSequenceLengthAt(pair_index));
-                if (cache_query_result2 == -1) 
-                {
-                  candidate_processor.GenerateCandidates(
-                      mapping_parameters_.error_threshold, 
-                      index,
-                      paired_end_mapping_metadata.mapping_metadata2_
-                      );
-                  ++cache_miss;
-                }
-                size_t current_num_candidates2 = paired_end_mapping_metadata.mapping_metadata2_.GetNumCandidates();
+          if (batch_duplicate_groups.IsEnabled()) {
+            batch_duplicate_groups.Reset(num_loaded_pairs);
+          }
 
-                // increment variable for cache_hits
-                bool curr_read_hit_cache = false;
-                if (cache_query_result1 >= 0 || cache_query_result2 >= 0) {
-                  cache_hits_per_thread[thread_id]++;
-                  curr_read_hit_cache = true;
+          // The explanation is in the single-end mapping function.
+          read_range_scheduler.Reset(num_loaded_pairs);
+          std::fill(mapping_busy_time_per_thread.begin(),
+                    mapping_busy_time_per_thread.end(), 0);
+          const double real_mapping_start_time = GetRealTime();
+#pragma omp taskloop num_tasks(read_range_scheduler.GetNumWorkers()) \
+    shared(read_batch1, read_batch2, barcode_batch, \
+           mappings_on_diff_ref_seqs_for_diff_threads)
+          for (int worker_id = 0;
+               worker_id < read_range_scheduler.GetNumWorkers(); ++worker_id) {
+            const double real_worker_start_time = GetRealTime();
+            // The replicas on the NUMA node of the thread, if any.
+            const Index &node_local_index =
+                numa_replicas.GetIndexOfThread(omp_get_thread_num(), index);
+            const SequenceBatch &node_local_reference =
+                numa_replicas.GetReferenceOfThread(omp_get_thread_num(),
+                                                   reference);
+            uint32_t range_begin = 0;
+            uint32_t range_end = 0;
+            while (read_range_scheduler.GetNextRange(worker_id, range_begin,
+                                                     range_end)) {
+              for (uint32_t pair_index = range_begin; pair_index < range_end;
+                   ++pair_index) {
+                int thread_id = omp_get_thread_num();
+            
+                bool current_barcode_is_whitelisted = true;
+                if (!mapping_parameters_.barcode_whitelist_file_path.empty()) {
+                  current_barcode_is_whitelisted = CorrectBarcodeAt(
+                      pair_index, barcode_batch, thread_num_barcode_in_whitelist,
+                      thread_num_corrected_barcode);
                 }
 
-                // update the peak counting data-structure
-                if (output_num_cache_slots_info && curr_read_hit_cache) {
-                  // calculate which map this barcode is in
-                  size_t map_id = curr_seed_val % num_locks_for_map;
-                
-                  // grab lock for this map, and add to the K-MinHash for this particular barcode
-                  omp_set_lock(&map_locks[map_id]);
-                  auto it = barcode_peak_map[map_id].emplace(curr_seed_val, K_MinHash(k_for_minhash, mapping_parameters_.cache_size)).first;
-                  if (cache_query_result1 >= 0) {it->second.add(cache_query_result1);}
-                  if (cache_query_result2 >= 0) {it->second.add(cache_query_result2);}
-                  omp_unset_lock(&map_locks[map_id]);
-                }
+                // calculate seed value for each barcode to use later (below and summary update)
+                size_t curr_seed_val = barcode_batch.GenerateSeedFromSequenceAt(pair_index, 0, barcode_length_);
+                seeds_for_batch[pair_index] = curr_seed_val;
+
+                if (current_barcode_is_whitelisted ||
+                    mapping_parameters_.output_mappings_not_in_whitelist) {
+                  if (mapping_parameters_.min_poly_g_tail_length > 0) {
+                    read_batch1.TrimPolyGTailAt(
+                        pair_index, mapping_parameters_.min_poly_g_tail_length);
+                    read_batch2.TrimPolyGTailAt(
+                        pair_index, mapping_parameters_.min_poly_g_tail_length);
+                  }
 
-                if (pair_index < history_update_threshold) {
-                  mm_history1[pair_index].timestamp =
-                      mm_history2[pair_index].timestamp = num_reads_;
-                  mm_history1[pair_index].minimizers =
-                      paired_end_mapping_metadata.mapping_metadata1_
-                          .minimizers_;
-                  mm_history1[pair_index].positive_candidates =
-                      paired_end_mapping_metadata.mapping_metadata1_
-                          .positive_candidates_;
-                  mm_history1[pair_index].negative_candidates =
-                      paired_end_mapping_metadata.mapping_metadata1_
-                          .negative_candidates_;
-                  mm_history1[pair_index].repetitive_seed_length =
-                      paired_end_mapping_metadata.mapping_metadata1_
-                          .repetitive_seed_length_;
-                  mm_history2[pair_index].minimizers =
-                      paired_end_mapping_metadata.mapping_metadata2_
-                          .minimizers_;
-                  mm_history2[pair_index].positive_candidates =
-                      paired_end_mapping_metadata.mapping_metadata2_
-                          .positive_candidates_;
-                  mm_history2[pair_index].negative_candidates =
-                      paired_end_mapping_metadata.mapping_metadata2_
-                          .negative_candidates_;
-                  mm_history2[pair_index].repetitive_seed_length =
-                      paired_end_mapping_metadata.mapping_metadata2_
-                          .repetitive_seed_length_;
-                }
+                  if (read_batch1.GetSequenceLengthAt(pair_index) <
+                      (uint32_t)mapping_parameters_.min_read_length ||
+                      read_batch2.GetSequenceLengthAt(pair_index) <
+                      (uint32_t)mapping_parameters_.min_read_length) {
+                    continue;  // reads are too short, just drop.
+                  }
 
-                // Test whether we need to augment the candidate list with mate
-                // information.
-                int supplementCandidateResult = 0;
-                if (!mapping_parameters_.split_alignment) {
-                  supplementCandidateResult =
-                      candidate_processor.SupplementCandidates(
-                          mapping_parameters_.error_threshold,
-                          /*search_range=*/2 *
-                              mapping_parameters_.max_insert_size,
-                          index, paired_end_mapping_metadata);
-                  current_num_candidates1 =
-                      paired_end_mapping_metadata.mapping_metadata1_
-                          .GetNumCandidates();
-                  current_num_candidates2 =
-                      paired_end_mapping_metadata.mapping_metadata2_
-                          .GetNumCandidates();
-                }
+                  // The pair is filtered when either read is low-complexity.
+                  if (mapping_parameters_.min_read_complexity > 0 &&
+                      (read_batch1.GetComplexityAt(pair_index) <
+                           mapping_parameters_.min_read_complexity ||
+                       read_batch2.GetComplexityAt(pair_index) <
+                           mapping_parameters_.min_read_complexity)) {
+                    thread_num_low_complexity_reads += 2;
+                    continue;
+                  }
 
-                if (current_num_candidates1 > 0 &&
-                    current_num_candidates2 > 0 &&
-                    !mapping_parameters_.split_alignment) {
-                  paired_end_mapping_metadata.MoveCandidiatesToBuffer();
-
-                  // Paired-end filter
-                  candidate_processor.ReduceCandidatesForPairedEndRead(
-                      mapping_parameters_.max_insert_size,
-                      paired_end_mapping_metadata);
-
-                  current_num_candidates1 =
-                      paired_end_mapping_metadata.mapping_metadata1_
-                          .GetNumCandidates();
-                  current_num_candidates2 =
-                      paired_end_mapping_metadata.mapping_metadata2_
-                          .GetNumCandidates();
-                }
+                  // Exact duplicates of a pair seen earlier in the batch get its
+                  // mappings once the batch is mapped. Identical pairs are trimmed
+                  // the same way, so they are grouped before trimming. A pair
+                  // whose leader is still being mapped, or reported a random
+                  // subset of its best mappings, is mapped on its own.
+                  bool is_group_leader = false;
+                  if (batch_duplicate_groups.IsEnabled()) {
+                    const uint32_t leader_index = batch_duplicate_groups.FindLeader(
+                        read_batch1, &read_batch2, pair_index);
+                    is_group_leader = leader_index == pair_index;
+                    if (!is_group_leader &&
+                        batch_duplicate_groups.IsLeaderReplayable(leader_index)) {
+                      const uint64_t barcode_key =
+                          mapping_parameters_.is_bulk_data
+                              ? 0
+                              : barcode_batch.GenerateSeedFromSequenceAt(
+                                    pair_index, /*start_position=*/0,
+                                    barcode_batch.GetSequenceLengthAt(pair_index));
+                      batch_duplicate_groups.AddMember(thread_id, pair_index,
+                                                       leader_index, barcode_key);
+                      continue;
+                    }
+                  }
 
-                // Verify candidates
-                if (current_num_candidates1 > 0 &&
-                    current_num_candidates2 > 0) {
-                  thread_num_candidates +=
-                      current_num_candidates1 + current_num_candidates2;
-
-                  if (mapping_parameters_.custom_rid_order_file_path.length() >
-                      0) {
-                    RerankCandidatesRid(
-                        paired_end_mapping_metadata.mapping_metadata1_
-                            .positive_candidates_);
-                    RerankCandidatesRid(
-                        paired_end_mapping_metadata.mapping_metadata1_
-                            .negative_candidates_);
-                    RerankCandidatesRid(
-                        paired_end_mapping_metadata.mapping_metadata2_
-                            .positive_candidates_);
-                    RerankCandidatesRid(
-                        paired_end_mapping_metadata.mapping_metadata2_
-                            .negative_candidates_);
+                  if (mapping_parameters_.trim_adapters) {
+                    TrimAdapterForPairedEndRead(pair_index, read_batch1,
+                                                read_batch2, negative_read_buffer);
                   }
 
-                  draft_mapping_generator.GenerateDraftMappings(
-                      read_batch1, pair_index, reference,
-                      paired_end_mapping_metadata.mapping_metadata1_);
+                  // The mappings of the leaders of the duplicate groups and of the
+                  // cacheable pairs are saved after they are appended.
+                  MappingResultStats stats_before_read;
+                  bool is_cache_hit = false;
+                  if (mapping_result_cache.IsEnabled() || is_group_leader) {
+                    mapping_list_ends.clear();
+                    stats_before_read = MappingResultStats(
+                        thread_num_candidates, thread_num_mappings,
+                        thread_num_mapped_reads, thread_num_uniquely_mapped_reads);
+                  }
 
-                  const size_t current_num_draft_mappings1 =
-                      paired_end_mapping_metadata.mapping_metadata1_
-                          .GetNumDraftMappings();
+                  // Look up the pair after trimming, as the trimmed reads are
+                  // mapped.
+                  uint64_t read_hash = 0;
+                  bool is_read_cacheable = false;
+                  bool are_mappings_replayable = true;
+                  if (mapping_result_cache.IsEnabled()) {
+                    ++thread_num_mapping_result_cache_queries;
+                    read_hash = mapping_result_cache.GetReadHash(
+                        read_batch1, &read_batch2, pair_index);
+                    const uint64_t barcode_key =
+                        mapping_parameters_.is_bulk_data
+                            ? 0
+                            : barcode_batch.GenerateSeedFromSequenceAt(
+                                  pair_index, /*start_position=*/0,
+                                  barcode_batch.GetSequenceLengthAt(pair_index));
+                    MappingResultStats replayed_stats;
+                    if (mapping_result_cache.Replay(
+                            read_hash, read_batch1, &read_batch2, pair_index,
+                            barcode_key, replayed_stats,
+                            mappings_on_diff_ref_seqs_for_diff_threads[thread_id],
+                            is_group_leader ? &mapping_list_ends : NULL)) {
+                      ++thread_num_mapping_result_cache_hits;
+                      replayed_stats.AddTo(
+                          thread_num_candidates, thread_num_mappings,
+                          thread_num_mapped_reads,
+                          thread_num_uniquely_mapped_reads);
+                      // The cache hits and the summary bit 2 are kept for
+                      // the hits of the minimizer cache, which a replayed
+                      // pair does not query.
+                      if (is_group_leader) {
+                        batch_duplicate_groups.SaveLeaderMappings(
+                            thread_id, pair_index,
+                            /*are_mappings_replayable=*/true, replayed_stats,
+                            /*is_cache_hit=*/false, mapping_list_ends,
+                            mappings_on_diff_ref_seqs_for_diff_threads[thread_id]);
+                      }
+                      continue;
+                    }
+                    is_read_cacheable = mapping_result_cache.Admit(read_hash);
+                  }
 
-                  draft_mapping_generator.GenerateDraftMappings(
-                      read_batch2, pair_index, reference,
-                      paired_end_mapping_metadata.mapping_metadata2_);
+                  paired_end_mapping_metadata.PreparedForMappingNextReadPair(
+                      mapping_parameters_.max_seed_frequencies[0]);
+
+                  minimizer_generator.GenerateMinimizers(
+                      read_batch1, pair_index,
+                      paired_end_mapping_metadata.mapping_metadata1_.minimizers_);
+                  minimizer_generator.GenerateMinimizers(
+                      read_batch2, pair_index,
+                      paired_end_mapping_metadata.mapping_metadata2_.minimizers_);
+
+                  if (paired_end_mapping_metadata.BothEndsHaveMinimizers()) {
+                    // declare temp local variable for cache result
+                    int cache_query_result1 = 0;
+                    int cache_query_result2 = 0;
+                    int cache_miss = 0;
+
+                    cache_query_result1 = mm_to_candidates_cache.Query(paired_end_mapping_metadata.mapping_metadata1_,
+                                                                      read_batch1.GetSequenceLengthAt(pair_index));
+                    if (cache_query_result1 == -1) 
+                    {
+                      candidate_processor.GenerateCandidates(
+                          mapping_parameters_.error_threshold, 
+                          node_local_index,
+                          paired_end_mapping_metadata.mapping_metadata1_
+                          );
+                      ++cache_miss;
+                    }
+                    size_t current_num_candidates1 = paired_end_mapping_metadata.mapping_metadata1_.GetNumCandidates();
+
+
+                    cache_query_result2 = mm_to_candidates_cache.Query(paired_end_mapping_metadata.mapping_metadata2_,
+                                                                      read_batch2.GetSequenceLengthAt(pair_index));
+                    if (cache_query_result2 == -1) 
+                    {
+                      candidate_processor.GenerateCandidates(
+                          mapping_parameters_.error_threshold, 
+                          node_local_index,
+                          paired_end_mapping_metadata.mapping_metadata2_
+                          );
+                      ++cache_miss;
+                    }
+                    size_t current_num_candidates2 = paired_end_mapping_metadata.mapping_metadata2_.GetNumCandidates();
+
+                    // increment variable for cache_hits
+                    cache_queries_per_thread[thread_id] += 2;
+                    cache_query_hits_per_thread[thread_id] += 2 - cache_miss;
+                    bool curr_read_hit_cache = false;
+                    if (cache_query_result1 >= 0 || cache_query_result2 >= 0) {
+                      cache_hits_per_thread[thread_id]++;
+                      curr_read_hit_cache = true;
+                      is_cache_hit = true;
+                    }
 
-                  const size_t current_num_draft_mappings2 =
-                      paired_end_mapping_metadata.mapping_metadata2_
-                          .GetNumDraftMappings();
+                    // save the cache slots for the sketch of the barcode
+                    if (output_num_cache_slots_info && curr_read_hit_cache) {
+                      cache_slots_for_batch[2 * pair_index] =
+                          cache_query_result1;
+                      cache_slots_for_batch[2 * pair_index + 1] =
+                          cache_query_result2;
+                    }
 
-                  if (current_num_draft_mappings1 > 0 &&
-                      current_num_draft_mappings2 > 0) {
-                    std::vector<std::vector<MappingRecord>>
-                        &mappings_on_diff_ref_seqs =
-                            mappings_on_diff_ref_seqs_for_diff_threads
-                                [omp_get_thread_num()];
+                    if (pair_index < history_update_threshold) {
+                      cache_update_log->Append(
+                          thread_id,
+                          paired_end_mapping_metadata.mapping_metadata1_);
+                      cache_update_log->Append(
+                          thread_id,
+                          paired_end_mapping_metadata.mapping_metadata2_);
+                    }
 
+                    // Test whether we need to augment the candidate list with mate
+                    // information.
+                    int supplementCandidateResult = 0;
                     if (!mapping_parameters_.split_alignment) {
-                      // GenerateBestMappingsForPairedEndRead assumes the
-                      // mappings are sorted by coordinate for non split
-                      // alignments. In split alignment, we don't want to sort
-                      // and this keeps mapping and split_sites vectors
-                      // consistent.
-                      paired_end_mapping_metadata.SortMappingsByPositions();
+                      supplementCandidateResult =
+                          candidate_processor.SupplementCandidates(
+                              mapping_parameters_.error_threshold,
+                              /*search_range=*/2 *
+                                  mapping_parameters_.max_insert_size,
+                              node_local_index, paired_end_mapping_metadata);
+                      current_num_candidates1 =
+                          paired_end_mapping_metadata.mapping_metadata1_
+                              .GetNumCandidates();
+                      current_num_candidates2 =
+                          paired_end_mapping_metadata.mapping_metadata2_
+                              .GetNumCandidates();
                     }
 
-                    int force_mapq = -1;
-                    if (supplementCandidateResult != 0) {
-                      force_mapq = 0;
+                    // The fast path below maps against the reordered reference,
+                    // so its single candidates are reranked first. Others are
+                    // reranked after the paired-end filter, which needs them
+                    // sorted by the original rids.
+                    const bool has_custom_rid_order =
+                        mapping_parameters_.custom_rid_order_file_path.length() >
+                        0;
+                    bool are_candidates_reranked = false;
+                    if (has_custom_rid_order &&
+                        current_num_candidates1 == 1 &&
+                        current_num_candidates2 == 1) {
+                      RerankCandidatesRid(
+                          paired_end_mapping_metadata.mapping_metadata1_
+                              .positive_candidates_);
+                      RerankCandidatesRid(
+                          paired_end_mapping_metadata.mapping_metadata1_
+                              .negative_candidates_);
+                      RerankCandidatesRid(
+                          paired_end_mapping_metadata.mapping_metadata2_
+                              .positive_candidates_);
+                      RerankCandidatesRid(
+                          paired_end_mapping_metadata.mapping_metadata2_
+                              .negative_candidates_);
+                      are_candidates_reranked = true;
                     }
 
-                    mapping_generator.GenerateBestMappingsForPairedEndRead(
-                        pair_index, read_batch1, read_batch2, barcode_batch,
-                        reference, best_mapping_indices, generator, force_mapq,
-                        paired_end_mapping_metadata, mappings_on_diff_ref_seqs);
-
-                    if (paired_end_mapping_metadata.GetNumBestMappings() == 1) {
-                      ++thread_num_uniquely_mapped_reads;
-                      ++thread_num_uniquely_mapped_reads;
+                    // Most pairs map uniquely and concordantly, and then skip the
+                    // paired-end filter and the verification.
+                    const bool is_pair_supported_by_all_minimizers =
+                        draft_mapping_generator
+                            .GeneratePairedEndDraftMappingsSupportedByAllMinimizers(
+                                read_batch1, read_batch2, pair_index,
+                                node_local_reference,
+                                mapping_parameters_.max_insert_size,
+                                paired_end_mapping_metadata);
+
+                    if (!is_pair_supported_by_all_minimizers &&
+                        current_num_candidates1 > 0 &&
+                        current_num_candidates2 > 0 &&
+                        !mapping_parameters_.split_alignment) {
+                      paired_end_mapping_metadata.MoveCandidiatesToBuffer();
+
+                      // Paired-end filter
+                      candidate_processor.ReduceCandidatesForPairedEndRead(
+                          mapping_parameters_.max_insert_size,
+                          paired_end_mapping_metadata);
+
+                      current_num_candidates1 =
+                          paired_end_mapping_metadata.mapping_metadata1_
+                              .GetNumCandidates();
+                      current_num_candidates2 =
+                          paired_end_mapping_metadata.mapping_metadata2_
+                              .GetNumCandidates();
                     }
 
-                    thread_num_mappings += std::min(
-                        paired_end_mapping_metadata.GetNumBestMappings(),
-                        mapping_parameters_.max_num_best_mappings);
-                    thread_num_mappings += std::min(
-                        paired_end_mapping_metadata.GetNumBestMappings(),
-                        mapping_parameters_.max_num_best_mappings);
-                    if (paired_end_mapping_metadata.GetNumBestMappings() > 0) {
-                      ++thread_num_mapped_reads;
-                      ++thread_num_mapped_reads;
+                    // Verify candidates
+                    if (current_num_candidates1 > 0 &&
+                        current_num_candidates2 > 0) {
+                      thread_num_candidates +=
+                          current_num_candidates1 + current_num_candidates2;
+
+                      if (has_custom_rid_order && !are_candidates_reranked) {
+                        RerankCandidatesRid(
+                            paired_end_mapping_metadata.mapping_metadata1_
+                                .positive_candidates_);
+                        RerankCandidatesRid(
+                            paired_end_mapping_metadata.mapping_metadata1_
+                                .negative_candidates_);
+                        RerankCandidatesRid(
+                            paired_end_mapping_metadata.mapping_metadata2_
+                                .positive_candidates_);
+                        RerankCandidatesRid(
+                            paired_end_mapping_metadata.mapping_metadata2_
+                                .negative_candidates_);
+                      }
+
+                      if (!is_pair_supported_by_all_minimizers) {
+                        draft_mapping_generator.GenerateDraftMappings(
+                            read_batch1, pair_index, node_local_reference,
+                            paired_end_mapping_metadata.mapping_metadata1_);
+                        draft_mapping_generator.GenerateDraftMappings(
+                            read_batch2, pair_index, node_local_reference,
+                            paired_end_mapping_metadata.mapping_metadata2_);
+                      }
+
+                      const size_t current_num_draft_mappings1 =
+                          paired_end_mapping_metadata.mapping_metadata1_
+                              .GetNumDraftMappings();
+                      const size_t current_num_draft_mappings2 =
+                          paired_end_mapping_metadata.mapping_metadata2_
+                              .GetNumDraftMappings();
+
+                      if (current_num_draft_mappings1 > 0 &&
+                          current_num_draft_mappings2 > 0) {
+                        std::vector<std::vector<MappingRecord>>
+                            &mappings_on_diff_ref_seqs =
+                                mappings_on_diff_ref_seqs_for_diff_threads
+                                    [omp_get_thread_num()];
+
+                        if (!mapping_parameters_.split_alignment &&
+                            !is_pair_supported_by_all_minimizers) {
+                          // GenerateBestMappingsForPairedEndRead assumes the
+                          // mappings are sorted by coordinate for non split
+                          // alignments. In split alignment, we don't want to sort
+                          // and this keeps mapping and split_sites vectors
+                          // consistent.
+                          paired_end_mapping_metadata.SortMappingsByPositions();
+                        }
+
+                        int force_mapq = -1;
+                        if (supplementCandidateResult != 0) {
+                          force_mapq = 0;
+                        }
+
+                        // The mappings of a pair are saved with those of read1.
+                        if (is_read_cacheable || is_group_leader) {
+                          mapping_result_cache.MarkMappingListEnds(
+                              paired_end_mapping_metadata.mapping_metadata1_,
+                              mappings_on_diff_ref_seqs, mapping_list_ends);
+                        }
+
+                        mapping_generator.GenerateBestMappingsForPairedEndRead(
+                            pair_index, read_batch1, read_batch2, barcode_batch,
+                            node_local_reference, best_mapping_indices,
+                            generator, force_mapq, paired_end_mapping_metadata,
+                            mappings_on_diff_ref_seqs);
+                        // The reported mappings are a random subset of the
+                        // best ones, which the duplicates must draw on their
+                        // own.
+                        if (paired_end_mapping_metadata.GetNumBestMappings() >
+                            mapping_parameters_.max_num_best_mappings) {
+                          is_read_cacheable = false;
+                          are_mappings_replayable = false;
+                        }
+
+                        if (paired_end_mapping_metadata.GetNumBestMappings() == 1) {
+                          ++thread_num_uniquely_mapped_reads;
+                          ++thread_num_uniquely_mapped_reads;
+                        }
+
+                        thread_num_mappings += std::min(
+                            paired_end_mapping_metadata.GetNumBestMappings(),
+                            mapping_parameters_.max_num_best_mappings);
+                        thread_num_mappings += std::min(
+                            paired_end_mapping_metadata.GetNumBestMappings(),
+                            mapping_parameters_.max_num_best_mappings);
+                        if (paired_end_mapping_metadata.GetNumBestMappings() > 0) {
+                          ++thread_num_mapped_reads;
+                          ++thread_num_mapped_reads;
+
+                          if (read_map_summary != NULL)
+                            read_map_summary[pair_index] |= (cache_miss < 2 ? 2 : 0) ;
+                        }
+                      }
+                    }  // verify candidate
+                  }
 
-                      if (read_map_summary != NULL)
-                        read_map_summary[pair_index] |= (cache_miss < 2 ? 2 : 0) ;
-                    }
+                  const MappingResultStats read_stats =
+                      MappingResultStats(thread_num_candidates,
+                                         thread_num_mappings,
+                                         thread_num_mapped_reads,
+                                         thread_num_uniquely_mapped_reads) -
+                      stats_before_read;
+                  if (is_read_cacheable) {
+                    mapping_result_cache.Insert(
+                        read_hash, read_batch1, &read_batch2, pair_index,
+                        read_stats, mapping_list_ends,
+                        mappings_on_diff_ref_seqs_for_diff_threads[thread_id]);
                   }
-                }  // verify candidate
-              }
-            } else {
-              if (read_map_summary != NULL)
-                read_map_summary[pair_index] = 0 ;
+                  if (is_group_leader) {
+                    batch_duplicate_groups.SaveLeaderMappings(
+                        thread_id, pair_index, are_mappings_replayable,
+                        read_stats, is_cache_hit,
+                        mapping_list_ends,
+                        mappings_on_diff_ref_seqs_for_diff_threads[thread_id]);
+                  }
+                } else {
+                  if (read_map_summary != NULL)
+                    read_map_summary[pair_index] = 0 ;
+                }
+              }  // end of for pair_index
             }
-          }  // end of for pair_index
+            mapping_busy_time_per_thread[omp_get_thread_num()] +=
+                GetRealTime() - real_worker_start_time;
+          }
+          const double mapping_time = GetRealTime() - real_mapping_start_time;
+
+          // The members found by each thread are replayed by a task, into
+          // the mapping buffer of the thread running it.
+          if (batch_duplicate_groups.IsEnabled()) {
+#pragma omp taskloop num_tasks(batch_duplicate_groups.GetNumMemberLists()) \
+    shared(read_batch1, mappings_on_diff_ref_seqs_for_diff_threads)
+            for (int member_list_index = 0;
+                 member_list_index < batch_duplicate_groups.GetNumMemberLists();
+                 ++member_list_index) {
+              const int thread_id = omp_get_thread_num();
+              MappingResultStats replayed_stats;
+              uint32_t num_cache_hits = 0;
+              thread_num_batch_duplicates += batch_duplicate_groups.ReplayMembers(
+                  member_list_index, read_batch1, replayed_stats,
+                  num_cache_hits, read_map_summary,
+                  output_num_cache_slots_info ? cache_slots_for_batch : NULL,
+                  mappings_on_diff_ref_seqs_for_diff_threads[thread_id]);
+              replayed_stats.AddTo(thread_num_candidates, thread_num_mappings,
+                                   thread_num_mapped_reads,
+                                   thread_num_uniquely_mapped_reads);
+              cache_hits_per_thread[thread_id] += num_cache_hits;
+            }
+          }
 
           // if (num_reads_ / 2 > initial_num_sample_barcodes_) {
           //  if (!is_bulk_data_) {
@@ -1149,108 +1647,109 @@ void Chromap::MapPairedEndReads() {
           //    }
           //  }
           //}
-#pragma omp taskloop grainsize( std::max(history_update_threshold / mapping_parameters_.num_threads, (unsigned int)grain_size) )
-          // Update cache
-          for (uint32_t pair_index = 0; pair_index < history_update_threshold;
-               ++pair_index) {
-            if (mm_history1[pair_index].timestamp != num_reads_) continue;
-
-            mm_to_candidates_cache.Update(
-                mm_history1[pair_index].minimizers,
-                mm_history1[pair_index].positive_candidates,
-                mm_history1[pair_index].negative_candidates,
-                mm_history1[pair_index].repetitive_seed_length,
-                mapping_parameters_.debug_cache);
-            mm_to_candidates_cache.Update(
-                mm_history2[pair_index].minimizers,
-                mm_history2[pair_index].positive_candidates,
-                mm_history2[pair_index].negative_candidates,
-                mm_history2[pair_index].repetitive_seed_length,
-                mapping_parameters_.debug_cache);
-
-            if (mm_history1[pair_index].positive_candidates.size() > 50) {
-              std::vector<Candidate>().swap(
-                  mm_history1[pair_index].positive_candidates);
-            }
-            if (mm_history1[pair_index].negative_candidates.size() > 50) {
-              std::vector<Candidate>().swap(
-                  mm_history1[pair_index].negative_candidates);
-            }
-            if (mm_history2[pair_index].positive_candidates.size() > 50) {
-              std::vector<Candidate>().swap(
-                  mm_history2[pair_index].positive_candidates);
-            }
-            if (mm_history2[pair_index].negative_candidates.size() > 50) {
-              std::vector<Candidate>().swap(
-                  mm_history2[pair_index].negative_candidates);
-            }
+          // The explanation is in the single-end mapping function.
+          if (cache_update_thread.joinable()) {
+            cache_update_thread.join();
+          }
+          mm_to_candidates_cache.CompactPayloads();
+          AdaptCacheSize(cache_queries_per_thread, cache_query_hits_per_thread,
+                         mm_to_candidates_cache);
+          mapping_result_cache.ReclaimRetiredEntries();
+          cache_update_thread = std::thread([this, &mm_to_candidates_cache,
+                                             cache_update_log] {
+            cache_update_log->ApplyTo(mm_to_candidates_cache,
+                                      mapping_parameters_.debug_cache);
+          });
+          cache_update_log_index ^= 1;
+
+          // Sum up cache hits for each thread
+          in_flight_batch.num_cache_hits = 0;
+          for (int hits : cache_hits_per_thread) {
+            in_flight_batch.num_cache_hits += hits;
           }
 
-#pragma omp taskwait
-          if (!mapping_parameters_.summary_metadata_file_path.empty()) {
-            // Update total read count and number of cache hits
-            if (mapping_parameters_.is_bulk_data) {
-              // Sum up cache hits for each thread
-              int cache_hits_for_batch = 0;
-              for (int hits: cache_hits_per_thread) {
-                cache_hits_for_batch += hits;
+          std::cerr << "Mapped " << num_loaded_pairs << " read pairs in "
+                    << GetRealTime() - real_batch_start_time << "s.\n";
+          OutputCacheHitRate(cache_queries_per_thread,
+                             cache_query_hits_per_thread);
+          OutputMappingThreadBusyTimes(mapping_busy_time_per_thread,
+                                       mapping_time,
+                                       read_range_scheduler.GetNumSteals());
+
+          // Summarize and save the mappings of the batch while the following
+          // batches are mapped. The output tasks run in the order of the
+          // batches and then release the batch for loading.
+#pragma omp task firstprivate(batch_index) depend(inout : output_task_order)
+          {
+            InFlightReadBatch<MappingRecord> &output_batch =
+                *in_flight_batches[batch_index];
+            if (!mapping_parameters_.summary_metadata_file_path.empty()) {
+              // Update total read count and number of cache hits
+              if (mapping_parameters_.is_bulk_data) {
+                mapping_writer.UpdateSummaryMetadata(0, 
+                                                     SUMMARY_METADATA_TOTAL, 
+                                                     output_batch.num_loaded_reads);
+                mapping_writer.UpdateSummaryMetadata(0,
+                                                     SUMMARY_METADATA_CACHEHIT, 
+                                                     output_batch.num_cache_hits);
               }
-              mapping_writer.UpdateSummaryMetadata(0, 
-                                                   SUMMARY_METADATA_TOTAL, 
-                                                   num_loaded_pairs);
-              mapping_writer.UpdateSummaryMetadata(0,
-                                                   SUMMARY_METADATA_CACHEHIT, 
-                                                   cache_hits_for_batch);
-            }
-            else {
-              uint32_t nonwhitelist_count = 0;
-              for (uint32_t pair_index = 0; pair_index < num_loaded_pairs; ++pair_index) {
-                uint64_t pair_seed = seeds_for_batch[pair_index];
-                if (read_map_summary[pair_index] & 1) {
-                  mapping_writer.UpdateSummaryMetadata(
-                                            pair_seed, 
-                                            SUMMARY_METADATA_TOTAL, 
-                                            1);
-                } else {
-                  ++nonwhitelist_count ;
-                }
+              else {
+                uint32_t nonwhitelist_count = 0;
+                for (uint32_t pair_index = 0; pair_index < output_batch.num_loaded_reads; ++pair_index) {
+                  uint64_t pair_seed = output_batch.barcode_seeds[pair_index];
+                  if (output_batch.read_map_summary[pair_index] & 1) {
+                    mapping_writer.UpdateSummaryMetadata(
+                                              pair_seed, 
+                                              SUMMARY_METADATA_TOTAL, 
+                                              1);
+                  } else {
+                    ++nonwhitelist_count ;
+                  }
 
-                if (read_map_summary[pair_index] & 2) {
-                  mapping_writer.UpdateSummaryMetadata( 
-                                            pair_seed,
-                                            SUMMARY_METADATA_CACHEHIT, 
-                                            1);
+                  if (output_batch.read_map_summary[pair_index] & 2) {
+                    mapping_writer.UpdateSummaryMetadata( 
+                                              pair_seed,
+                                              SUMMARY_METADATA_CACHEHIT, 
+                                              1);
+                  }
                 }
-              }
-              mapping_writer.UpdateSpeicalCategorySummaryMetadata(/*nonwhitelist*/0, 
-                  SUMMARY_METADATA_TOTAL, nonwhitelist_count);
-            }  
-
-            memset(read_map_summary, 1, sizeof(*read_map_summary)*read_batch_size_);
-          }
+                mapping_writer.UpdateSpeicalCategorySummaryMetadata(/*nonwhitelist*/0, 
+                    SUMMARY_METADATA_TOTAL, nonwhitelist_count);
+              }  
 
-          std::cerr << "Mapped " << num_loaded_pairs << " read pairs in "
-                    << GetRealTime() - real_batch_start_time << "s.\n";
-          real_batch_start_time = GetRealTime();
+              std::fill(output_batch.read_map_summary.begin(),
+                        output_batch.read_map_summary.end(), 1);
+            }
 
-          // Swap to next batch
-          num_loaded_pairs = num_loaded_pairs_for_loading;
-          read_batch1_for_loading.SwapSequenceBatch(read_batch1);
-          read_batch2_for_loading.SwapSequenceBatch(read_batch2);
-          barcode_batch_for_loading.SwapSequenceBatch(barcode_batch);
-          mappings_on_diff_ref_seqs_for_diff_threads.swap(
-              mappings_on_diff_ref_seqs_for_diff_threads_for_saving);
+            if (output_num_cache_slots_info) {
+              for (uint32_t pair_index = 0;
+                   pair_index < output_batch.num_loaded_reads; ++pair_index) {
+                const int *pair_cache_slots =
+                    output_batch.cache_slots.data() + 2 * pair_index;
+                if (pair_cache_slots[0] < 0 && pair_cache_slots[1] < 0) {
+                  continue;
+                }
+                const uint32_t sketch_id = cache_slot_sketches.GetSketchId(
+                    output_batch.barcode_seeds[pair_index]);
+                for (int mi = 0; mi < 2; ++mi) {
+                  if (pair_cache_slots[mi] >= 0) {
+                    cache_slot_sketches.Add(sketch_id, pair_cache_slots[mi]);
+                  }
+                }
+              }
+              std::fill(output_batch.cache_slots.begin(),
+                        output_batch.cache_slots.end(), -1);
+            }
 
-          // Reset for next batch
-          std::fill(seeds_for_batch.begin(), seeds_for_batch.end(), 0);
+            // Reset for next batch
+            std::fill(output_batch.barcode_seeds.begin(),
+                      output_batch.barcode_seeds.end(), 0);
 
-#pragma omp task
-          {
             // Handle output
             num_mappings_in_mem +=
                 mapping_processor.MoveMappingsInBuffersToMappingContainer(
                     num_reference_sequences,
-                    mappings_on_diff_ref_seqs_for_diff_threads_for_saving,
+                    output_batch.mappings_on_diff_ref_seqs_for_diff_threads,
                     mappings_on_diff_ref_seqs);
             if (mapping_parameters_.low_memory_mode &&
                 num_mappings_in_mem > max_num_mappings_in_mem) {
@@ -1267,8 +1766,20 @@ void Chromap::MapPairedEndReads() {
               }
               num_mappings_in_mem = 0;
             }
+            free_batch_indices.Push(batch_index);
           }  // end of omp task to handle output
+
+          if (!loaded_batch_indices.TryPop(batch_index)) {
+            // The loading thread might be waiting for the batches held by the
+            // output tasks, so finish them before waiting for the next batch.
+#pragma omp taskwait
+            batch_index = loaded_batch_indices.Pop();
+          }
+          num_loaded_pairs = in_flight_batches[batch_index]->num_loaded_reads;
         }    // end of while num_loaded_pairs
+        if (cache_update_thread.joinable()) {
+          cache_update_thread.join();
+        }
       }      // end of openmp single
 
       num_barcode_in_whitelist_ += thread_num_barcode_in_whitelist;
@@ -1277,8 +1788,14 @@ void Chromap::MapPairedEndReads() {
       num_mappings_ += thread_num_mappings;
       num_mapped_reads_ += thread_num_mapped_reads;
       num_uniquely_mapped_reads_ += thread_num_uniquely_mapped_reads;
+      num_mapping_result_cache_queries_ +=
+          thread_num_mapping_result_cache_queries;
+      num_mapping_result_cache_hits_ += thread_num_mapping_result_cache_hits;
+      num_low_complexity_reads_ += thread_num_low_complexity_reads;
+      num_batch_duplicates_ += thread_num_batch_duplicates;
     }  // end of openmp parallel region
 
+    loading_thread.join();
     read_batch1_for_loading.FinalizeLoading();
     read_batch2_for_loading.FinalizeLoading();
 
@@ -1289,11 +1806,13 @@ void Chromap::MapPairedEndReads() {
 
   std::cerr << "Mapped all reads in " << GetRealTime() - real_start_mapping_time
             << "s.\n";
-
-  delete[] mm_history1;
-  delete[] mm_history2;
-  if (read_map_summary != NULL)
-    delete[] read_map_summary;
+  std::cerr << "Cache memory: "
+            << mm_to_candidates_cache.GetMemoryBytes() / (1024.0 * 1024.0)
+            << "MB, including "
+            << mm_to_candidates_cache.GetLivePayloadBytes() / (1024.0 * 1024.0)
+            << "MB cached candidates.\n";
+  OutputHugePageUsage();
+  DumpCache(cache_file_key, mm_to_candidates_cache);
 
   OutputMappingStatistics();
   if (!mapping_parameters_.is_bulk_data) {
@@ -1377,23 +1896,13 @@ void Chromap::MapPairedEndReads() {
   if (mapping_parameters_.mapping_output_format == MAPPINGFORMAT_SAM)
     mapping_writer.AdjustSummaryPairedEndOverCount() ;
 
-  // Destory the locks used for map
-  for (int i = 0; i < num_locks_for_map; ++i) {
-    omp_destroy_lock(&map_locks[i]);
-  }
-
   // Add cardinality information to summary metadata
   if (output_num_cache_slots_info) {
-    for (auto curr_map: barcode_peak_map) {
-      for (auto &pair: curr_map) {
-        size_t curr_seed = pair.first;
-        size_t est_num_slots = pair.second.compute_cardinality();
-
-        mapping_writer.UpdateSummaryMetadata( 
-                          curr_seed,
-                          SUMMARY_METADATA_CARDINALITY, 
-                          est_num_slots);
-      }
+    for (const std::pair<uint64_t, size_t> &cardinality :
+         cache_slot_sketches.GetCardinalities()) {
+      mapping_writer.UpdateSummaryMetadata(cardinality.first,
+                                           SUMMARY_METADATA_CARDINALITY,
+                                           cardinality.second);
     }
   }
 
@@ -2,11 +2,13 @@
 
 #include <glob.h>
 
+#include <algorithm>
 #include <cassert>
 #include <iomanip>
 #include <string>
 #include <vector>
 
+#include "cache_file.h"
 #include "chromap.h"
 #include "cxxopts.hpp"
 
@@ -61,8 +63,22 @@ void AddMappingOptions(cxxopts::Options &options) {
       // multi-mapping allocation [11]", cxxopts::value<int>(), "INT")
       //("drop-repetitive-reads", "Drop reads with too many best mappings
       //[500000]", cxxopts::value<int>(), "INT")
-      ("trim-adapters", "Try to trim adapters on 3'")("remove-pcr-duplicates",
-                                                      "Remove PCR duplicates")(
+      ("trim-adapters", "Try to trim adapters on 3'")(
+          "adapter-sequence",
+          "Adapter trimmed from single-end reads [CTGTCTCTTATACACATCT]",
+          cxxopts::value<std::string>(), "STR")(
+          "min-adapter-overlap",
+          "Min length of an adapter match at the 3' end of single-end reads "
+          "[8]",
+          cxxopts::value<int>(), "INT")(
+          "trim-poly-g",
+          "Trim 3' poly-G tails of at least INT bases, 0 to disable [0]",
+          cxxopts::value<int>(), "INT")(
+          "min-read-complexity",
+          "Drop reads (pairs) with a normalized triplet entropy below FLT, "
+          "0 to disable [0]",
+          cxxopts::value<double>(), "FLT")("remove-pcr-duplicates",
+                                           "Remove PCR duplicates")(
           "remove-pcr-duplicates-at-bulk-level",
           "Remove PCR duplicates at bulk level for single cell data")(
           "remove-pcr-duplicates-at-cell-level",
@@ -124,7 +140,8 @@ void AddOutputOptions(cxxopts::Options &options) {
                   "Convert barcode to the specified sequences during output",
                   cxxopts::value<std::string>(), "FILE")(
           "summary",
-          "Summarize the mapping statistics at bulk or barcode level",
+          "Summarize the mapping statistics at bulk or barcode level. The "
+          "cache hits can vary slightly between runs",
           cxxopts::value<std::string>(), "FILE");
   //("PAF", "Output mappings in PAF format (only for test)");
 }
@@ -153,9 +170,22 @@ void AddDevelopmentOptions(cxxopts::Options &options) {
       "skip-barcode-check",
       "Do not check whether too few barcodes are in the whitelist")
       ("cache-size", "number of cache entries [4000003]", cxxopts::value<int>(), "INT")
+      ("cache-associativity", "number of cache entries a read can be cached in, 1 for direct-mapped [1]", cxxopts::value<int>(), "INT")
+      ("cache-max-memory", "resize the cache between batches by its hit rate and collisions within INT MB, 0 to keep --cache-size [0]", cxxopts::value<int>(), "INT")
       ("cache-update-param", "value used to control number of reads sampled [0.01]", cxxopts::value<double>(), "FLT")
+      ("cache-load", "Preload the cache from a file dumped by previous runs with the same index and parameters", cxxopts::value<std::string>(), "FILE")
+      ("cache-dump", "Dump the cache into a file after mapping", cxxopts::value<std::string>(), "FILE")
+      ("merge-caches", "Merge cache files dumped by several runs into the output file", cxxopts::value<std::vector<std::string>>(), "FILE[,FILE]")
+      ("mapping-cache-size", "number of reads whose mappings are cached and replayed for their exact duplicates, only for BED and TagAlign, 0 to disable [0]", cxxopts::value<int>(), "INT")
+      ("collapse-batch-duplicates", "map each group of exact duplicate read pairs in a batch once, only for BED and TagAlign")
       ("debug-cache", "verbose output for debugging cache used in chromap")
-      ("k-for-minhash", "number of values stored in each MinHash sketch [250]", cxxopts::value<int>(), "INT");
+      ("k-for-minhash", "size of the sketch of the cache slots of each barcode, rounded up to a power of 2 [250]", cxxopts::value<int>(), "INT")
+      ("decompression-threads", "# threads decompressing each read file ahead of parsing, in parallel only for BGZF files, 0 to decompress while parsing [0]", cxxopts::value<int>(), "INT")
+      ("mmap-reads", "Parse uncompressed FASTQ read and barcode files in parallel through mmap without copying them")
+      ("in-flight-batches", "# read batches being loaded, mapped or output at the same time [3]", cxxopts::value<int>(), "INT")
+      ("numa", "Pin the mapping threads to the NUMA nodes in contiguous blocks and report the placement of the index and reference")
+      ("numa-replicas", "# NUMA nodes with their own copy of the index and reference, implies --numa, 0 to share one copy [0]", cxxopts::value<int>(), "INT")
+      ("huge-pages", "Back the index, reference and cache with huge pages: off, thp for transparent huge pages or hugetlb for the hugetlbfs pool, falling back to thp [off]", cxxopts::value<std::string>(), "STR");
 }
 
 void AddPeakOptions(cxxopts::Options &options) {
@@ -331,6 +361,51 @@ void ChromapDriver::ParseArgsAndRun(int argc, char *argv[]) {
   if (result.count("t")) {
     mapping_parameters.num_threads = result["num-threads"].as<int>();
   }
+  if (result.count("decompression-threads")) {
+    mapping_parameters.num_decompression_threads =
+        result["decompression-threads"].as<int>();
+    if (mapping_parameters.num_decompression_threads < 0) {
+      chromap::ExitWithMessage(
+          "Invalid number of decompression threads (--decompression-threads)");
+    }
+  }
+  if (result.count("mmap-reads")) {
+    mapping_parameters.mmap_read_files = true;
+  }
+  if (result.count("in-flight-batches")) {
+    mapping_parameters.num_in_flight_batches =
+        result["in-flight-batches"].as<int>();
+    if (mapping_parameters.num_in_flight_batches < 1) {
+      chromap::ExitWithMessage(
+          "Invalid number of in-flight batches (--in-flight-batches)");
+    }
+  }
+  if (result.count("numa")) {
+    mapping_parameters.bind_numa_nodes = true;
+  }
+  if (result.count("numa-replicas")) {
+    mapping_parameters.num_numa_replicas = result["numa-replicas"].as<int>();
+    if (mapping_parameters.num_numa_replicas < 0) {
+      chromap::ExitWithMessage(
+          "Invalid number of NUMA replicas (--numa-replicas)");
+    }
+    if (mapping_parameters.num_numa_replicas > 0) {
+      mapping_parameters.bind_numa_nodes = true;
+    }
+  }
+  if (result.count("huge-pages")) {
+    const std::string huge_page_mode = result["huge-pages"].as<std::string>();
+    if (huge_page_mode == "off") {
+      mapping_parameters.huge_page_mode = chromap::HUGE_PAGE_MODE_OFF;
+    } else if (huge_page_mode == "thp") {
+      mapping_parameters.huge_page_mode = chromap::HUGE_PAGE_MODE_TRANSPARENT;
+    } else if (huge_page_mode == "hugetlb") {
+      mapping_parameters.huge_page_mode = chromap::HUGE_PAGE_MODE_HUGETLB;
+    } else {
+      chromap::ExitWithMessage("Unrecognized huge page mode (--huge-pages) " +
+                               huge_page_mode);
+    }
+  }
 
 
   // check cache-related parameters
@@ -346,6 +421,33 @@ void ChromapDriver::ParseArgsAndRun(int argc, char *argv[]) {
         chromap::ExitWithMessage("cache size is not in appropriate range\n");
     }
   }
+  if (result.count("cache-associativity")) {
+    mapping_parameters.cache_associativity = result["cache-associativity"].as<int>();
+    if (mapping_parameters.cache_associativity < 1 || mapping_parameters.cache_associativity > 16) {
+      chromap::ExitWithMessage("cache associativity must be in the range [1, 16]\n");
+    }
+  }
+  if (result.count("cache-max-memory")) {
+    mapping_parameters.cache_max_memory_mb = result["cache-max-memory"].as<int>();
+    if (mapping_parameters.cache_max_memory_mb < 0) {
+      chromap::ExitWithMessage("cache max memory must not be negative\n");
+    }
+  }
+  if (result.count("cache-load")) {
+    mapping_parameters.cache_load_file_path = result["cache-load"].as<std::string>();
+  }
+  if (result.count("cache-dump")) {
+    mapping_parameters.cache_dump_file_path = result["cache-dump"].as<std::string>();
+  }
+  if (result.count("mapping-cache-size")) {
+    mapping_parameters.mapping_result_cache_size = result["mapping-cache-size"].as<int>();
+    if (mapping_parameters.mapping_result_cache_size < 0) {
+      chromap::ExitWithMessage("mapping cache size must not be negative\n");
+    }
+  }
+  if (result.count("collapse-batch-duplicates")) {
+    mapping_parameters.collapse_batch_duplicates = true;
+  }
   if (result.count("debug-cache")) {
     mapping_parameters.debug_cache = true;
   }
@@ -358,7 +460,7 @@ void ChromapDriver::ParseArgsAndRun(int argc, char *argv[]) {
   if (result.count("k-for-minhash")) {
     mapping_parameters.k_for_minhash = result["k-for-minhash"].as<int>();
     if (mapping_parameters.k_for_minhash < 1 || mapping_parameters.k_for_minhash >= 2000) {
-      chromap::ExitWithMessage("Invalid paramter for size of MinHash sketch (--k-for-minhash)");
+      chromap::ExitWithMessage("Invalid paramter for size of the cache slot sketch (--k-for-minhash)");
     }
   }
 
@@ -389,6 +491,39 @@ void ChromapDriver::ParseArgsAndRun(int argc, char *argv[]) {
   if (result.count("trim-adapters")) {
     mapping_parameters.trim_adapters = true;
   }
+  if (result.count("adapter-sequence")) {
+    mapping_parameters.adapter_sequence =
+        result["adapter-sequence"].as<std::string>();
+    if (mapping_parameters.adapter_sequence.empty()) {
+      chromap::ExitWithMessage(
+          "Invalid parameter for adapter sequence (--adapter-sequence)");
+    }
+  }
+  if (result.count("min-adapter-overlap")) {
+    mapping_parameters.min_adapter_overlap_length =
+        result["min-adapter-overlap"].as<int>();
+    if (mapping_parameters.min_adapter_overlap_length <= 0) {
+      chromap::ExitWithMessage(
+          "Invalid parameter for adapter overlap (--min-adapter-overlap)");
+    }
+  }
+  if (result.count("trim-poly-g")) {
+    mapping_parameters.min_poly_g_tail_length =
+        result["trim-poly-g"].as<int>();
+    if (mapping_parameters.min_poly_g_tail_length < 0) {
+      chromap::ExitWithMessage(
+          "Invalid parameter for poly-G tail length (--trim-poly-g)");
+    }
+  }
+  if (result.count("min-read-complexity")) {
+    mapping_parameters.min_read_complexity =
+        result["min-read-complexity"].as<double>();
+    if (mapping_parameters.min_read_complexity < 0 ||
+        mapping_parameters.min_read_complexity > 1) {
+      chromap::ExitWithMessage(
+          "Invalid parameter for read complexity (--min-read-complexity)");
+    }
+  }
   if (result.count("remove-pcr-duplicates")) {
     mapping_parameters.remove_pcr_duplicates = true;
   }
@@ -426,6 +561,16 @@ void ChromapDriver::ParseArgsAndRun(int argc, char *argv[]) {
   if (result.count("SAM")) {
     mapping_parameters.mapping_output_format = MAPPINGFORMAT_SAM;
   }
+  if (mapping_parameters.mapping_result_cache_size > 0 &&
+      mapping_parameters.mapping_output_format != MAPPINGFORMAT_BED &&
+      mapping_parameters.mapping_output_format != MAPPINGFORMAT_TAGALIGN) {
+    chromap::ExitWithMessage("mapping cache only supports BED and TagAlign output\n");
+  }
+  if (mapping_parameters.collapse_batch_duplicates &&
+      mapping_parameters.mapping_output_format != MAPPINGFORMAT_BED &&
+      mapping_parameters.mapping_output_format != MAPPINGFORMAT_TAGALIGN) {
+    chromap::ExitWithMessage("collapsing batch duplicates only supports BED and TagAlign output\n");
+  }
   if (result.count("low-mem")) {
     mapping_parameters.low_memory_mode = true;
   }
@@ -469,6 +614,13 @@ void ChromapDriver::ParseArgsAndRun(int argc, char *argv[]) {
               << "\n";
     chromap::Chromap chromap_for_indexing(index_parameters);
     chromap_for_indexing.ConstructIndex();
+  } else if (result.count("merge-caches")) {
+    if (!result.count("o")) {
+      chromap::ExitWithMessage("No output file specified!");
+    }
+    chromap::MergeCacheFiles(
+        result["merge-caches"].as<std::vector<std::string>>(),
+        result["output"].as<std::string>());
   } else if (result.count("1")) {
     std::cerr << "Start to map reads.\n";
     if (result.count("r")) {
@@ -548,6 +700,14 @@ void ChromapDriver::ParseArgsAndRun(int argc, char *argv[]) {
     if (result.count("summary")) {
       mapping_parameters.summary_metadata_file_path =
           result["summary"].as<std::string>();
+      // A resize renumbers the cache slots, so the slots of a barcode would be
+      // counted again after each resize.
+      if (mapping_parameters.cache_max_memory_mb > 0 &&
+          mapping_parameters.output_num_uniq_cache_slots) {
+        chromap::ExitWithMessage(
+            "--cache-max-memory with --summary needs "
+            "--turn-off-num-uniq-cache-slots\n");
+      }
     }
 
     if (result.count("skip-barcode-check")) {
@@ -586,7 +746,27 @@ void ChromapDriver::ParseArgsAndRun(int argc, char *argv[]) {
               << mapping_parameters.barcode_correction_probability_threshold
               << "\n";
     std::cerr << "Number of threads: " << mapping_parameters.num_threads
-              << "\n";
+              << ", number of decompression threads per read file: "
+              << mapping_parameters.num_decompression_threads
+              << ", number of in-flight batches: "
+              << mapping_parameters.num_in_flight_batches << "\n";
+    if (mapping_parameters.mmap_read_files) {
+      std::cerr << "Will parse uncompressed FASTQ files through mmap.\n";
+    }
+    if (mapping_parameters.bind_numa_nodes) {
+      std::cerr << "Will pin the mapping threads to NUMA nodes with "
+                << mapping_parameters.num_numa_replicas
+                << " index and reference replicas.\n";
+    }
+    if (mapping_parameters.huge_page_mode ==
+        chromap::HUGE_PAGE_MODE_TRANSPARENT) {
+      std::cerr << "Will back the index, reference and cache with transparent "
+                   "huge pages.\n";
+    } else if (mapping_parameters.huge_page_mode ==
+               chromap::HUGE_PAGE_MODE_HUGETLB) {
+      std::cerr << "Will back the index, reference and cache with hugetlbfs "
+                   "pages.\n";
+    }
     if (mapping_parameters.is_bulk_data) {
       std::cerr << "Analyze bulk data.\n";
     } else {
@@ -699,6 +879,8 @@ void ChromapDriver::ParseArgsAndRun(int argc, char *argv[]) {
                 << mapping_parameters.matrix_output_prefix << "\n";
     }
 
+    // Set once, before the index, reference and cache are allocated.
+    chromap::SetHugePageMode(mapping_parameters.huge_page_mode);
     chromap::Chromap chromap_for_mapping(mapping_parameters);
 
     if (result.count("2") == 0) {
@@ -9,10 +9,7 @@ namespace chromap {
 void DraftMappingGenerator::GenerateDraftMappings(
     const SequenceBatch &read_batch, uint32_t read_index,
     const SequenceBatch &reference, MappingMetadata &mapping_metadata) {
-  mapping_metadata.SetMinNumErrors(error_threshold_ + 1);
-  mapping_metadata.SetNumBestMappings(0);
-  mapping_metadata.SetSecondMinNumErrors(error_threshold_ + 1);
-  mapping_metadata.SetNumSecondBestMappings(0);
+  ResetMappingStats(mapping_metadata);
 
   // Directly obtain the non-split mapping in ideal case and return without
   // running actual verification.
@@ -56,6 +53,70 @@ void DraftMappingGenerator::GenerateDraftMappings(
   }
 }
 
+bool DraftMappingGenerator::
+    GeneratePairedEndDraftMappingsSupportedByAllMinimizers(
+        const SequenceBatch &read_batch1, const SequenceBatch &read_batch2,
+        uint32_t pair_index, const SequenceBatch &reference,
+        uint32_t max_insert_size,
+        PairedEndMappingMetadata &paired_end_mapping_metadata) {
+  if (split_alignment_) {
+    return false;
+  }
+
+  MappingMetadata &mapping_metadata1 =
+      paired_end_mapping_metadata.mapping_metadata1_;
+  MappingMetadata &mapping_metadata2 =
+      paired_end_mapping_metadata.mapping_metadata2_;
+  if (mapping_metadata1.GetNumCandidates() != 1 ||
+      mapping_metadata2.GetNumCandidates() != 1) {
+    return false;
+  }
+
+  // The candidates must pass the paired-end filter, so the full path would
+  // verify the same two candidates.
+  const bool is_read1_positive =
+      mapping_metadata1.GetNumPositiveCandidates() > 0;
+  const bool is_read2_positive =
+      mapping_metadata2.GetNumPositiveCandidates() > 0;
+  if (is_read1_positive == is_read2_positive) {
+    return false;
+  }
+
+  const uint64_t position1 =
+      is_read1_positive ? mapping_metadata1.positive_candidates_[0].position
+                        : mapping_metadata1.negative_candidates_[0].position;
+  const uint64_t position2 =
+      is_read2_positive ? mapping_metadata2.positive_candidates_[0].position
+                        : mapping_metadata2.negative_candidates_[0].position;
+  const uint64_t distance = position1 > position2 ? position1 - position2
+                                                  : position2 - position1;
+  if (distance > max_insert_size) {
+    return false;
+  }
+
+  ResetMappingStats(mapping_metadata1);
+  ResetMappingStats(mapping_metadata2);
+  if (!GenerateNonSplitDraftMappingSupportedByAllMinimizers(
+          read_batch1, pair_index, reference, mapping_metadata1)) {
+    return false;
+  }
+  if (!GenerateNonSplitDraftMappingSupportedByAllMinimizers(
+          read_batch2, pair_index, reference, mapping_metadata2)) {
+    mapping_metadata1.positive_mappings_.clear();
+    mapping_metadata1.negative_mappings_.clear();
+    return false;
+  }
+  return true;
+}
+
+void DraftMappingGenerator::ResetMappingStats(
+    MappingMetadata &mapping_metadata) const {
+  mapping_metadata.SetMinNumErrors(error_threshold_ + 1);
+  mapping_metadata.SetNumBestMappings(0);
+  mapping_metadata.SetSecondMinNumErrors(error_threshold_ + 1);
+  mapping_metadata.SetNumSecondBestMappings(0);
+}
+
 bool DraftMappingGenerator::IsValidCandidate(uint32_t rid, uint32_t position,
                                              uint32_t read_length,
                                              const SequenceBatch &reference) {
@@ -162,12 +223,14 @@ void DraftMappingGenerator::GenerateDraftMappingsOnOneStrandUsingSIMD(
     MappingMetadata &mapping_metadata) {
   const char *read = read_batch.GetSequenceAt(read_index);
   const uint32_t read_length = read_batch.GetSequenceLengthAt(read_index);
-  const std::string &negative_read =
-      read_batch.GetNegativeSequenceAt(read_index);
 
   const std::vector<Candidate> &candidates =
       candidate_strand == kPositive ? mapping_metadata.positive_candidates_
                                     : mapping_metadata.negative_candidates_;
+  const char *negative_read =
+      candidate_strand == kNegative && !candidates.empty()
+          ? mapping_metadata.GetNegativeRead(read_batch, read_index).data()
+          : nullptr;
   std::vector<DraftMapping> &mappings =
       candidate_strand == kPositive ? mapping_metadata.positive_mappings_
                                     : mapping_metadata.negative_mappings_;
@@ -222,7 +285,7 @@ void DraftMappingGenerator::GenerateDraftMappingsOnOneStrandUsingSIMD(
                                    mapping_end_positions);
       } else {
         BandedAlign8PatternsToText(
-            error_threshold_, valid_candidate_starts, negative_read.data(),
+            error_threshold_, valid_candidate_starts, negative_read,
             read_length, mapping_edit_distances, mapping_end_positions);
       }
       for (int mi = 0; mi < num_vpu_lanes_; ++mi) {
@@ -267,7 +330,7 @@ void DraftMappingGenerator::GenerateDraftMappingsOnOneStrandUsingSIMD(
                                    mapping_end_positions);
       } else {
         BandedAlign4PatternsToText(
-            error_threshold_, valid_candidate_starts, negative_read.data(),
+            error_threshold_, valid_candidate_starts, negative_read,
             read_length, mapping_edit_distances, mapping_end_positions);
       }
       for (int mi = 0; mi < num_vpu_lanes_; ++mi) {
@@ -327,7 +390,7 @@ void DraftMappingGenerator::GenerateDraftMappingsOnOneStrandUsingSIMD(
       num_errors = BandedAlignPatternToText(
           error_threshold_,
           reference.GetSequenceAt(rid) + position - error_threshold_,
-          negative_read.data(), read_length, &mapping_end_position);
+          negative_read, read_length, &mapping_end_position);
     }
     if (num_errors <= error_threshold_) {
       if (num_errors < min_num_errors) {
@@ -362,12 +425,14 @@ void DraftMappingGenerator::GenerateDraftMappingsOnOneStrand(
     MappingMetadata &mapping_metadata) {
   const char *read = read_batch.GetSequenceAt(read_index);
   const uint32_t read_length = read_batch.GetSequenceLengthAt(read_index);
-  const std::string &negative_read =
-      read_batch.GetNegativeSequenceAt(read_index);
 
   const std::vector<Candidate> &candidates =
       candidate_strand == kPositive ? mapping_metadata.positive_candidates_
                                     : mapping_metadata.negative_candidates_;
+  const char *negative_read =
+      candidate_strand == kNegative && !candidates.empty()
+          ? mapping_metadata.GetNegativeRead(read_batch, read_index).data()
+          : nullptr;
   std::vector<DraftMapping> &mappings =
       candidate_strand == kPositive ? mapping_metadata.positive_mappings_
                                     : mapping_metadata.negative_mappings_;
@@ -441,7 +506,7 @@ void DraftMappingGenerator::GenerateDraftMappingsOnOneStrand(
         num_errors = BandedAlignPatternToTextWithDropOffFrom3End(
             error_threshold_,
             reference.GetSequenceAt(rid) + position - error_threshold_,
-            negative_read.data(), read_length, &mapping_end_position,
+            negative_read, read_length, &mapping_end_position,
             &read_mapping_length);
         if (mapping_end_position < 0 && allow_gap_beginning > 0) {
           int backup_num_errors = num_errors;
@@ -450,7 +515,7 @@ void DraftMappingGenerator::GenerateDraftMappingsOnOneStrand(
           num_errors = BandedAlignPatternToTextWithDropOffFrom3End(
               error_threshold_,
               reference.GetSequenceAt(rid) + position - error_threshold_,
-              negative_read.data(), read_length - allow_gap_beginning,
+              negative_read, read_length - allow_gap_beginning,
               &mapping_end_position, &read_mapping_length);
           if (num_errors > error_threshold_ || mapping_end_position < 0) {
             num_errors = backup_num_errors;
@@ -478,7 +543,7 @@ void DraftMappingGenerator::GenerateDraftMappingsOnOneStrand(
           } else {
             longest_match =
                 GetLongestMatchLength(reference.GetSequenceAt(rid) + position,
-                                      negative_read.data(), read_length);
+                                      negative_read, read_length);
           }
         }
       } else {
@@ -495,7 +560,7 @@ void DraftMappingGenerator::GenerateDraftMappingsOnOneStrand(
         num_errors = BandedAlignPatternToText(
             error_threshold_,
             reference.GetSequenceAt(rid) + position - error_threshold_,
-            negative_read.data(), read_length, &mapping_end_position);
+            negative_read, read_length, &mapping_end_position);
       }
     }
 
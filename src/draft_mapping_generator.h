@@ -6,6 +6,7 @@
 #include "draft_mapping.h"
 #include "mapping_metadata.h"
 #include "mapping_parameters.h"
+#include "paired_end_mapping_metadata.h"
 #include "sequence_batch.h"
 #include "utils.h"
 
@@ -28,7 +29,19 @@ class DraftMappingGenerator {
                              const SequenceBatch &reference,
                              MappingMetadata &mapping_metadata);
 
+  // Return true when each mate has one candidate supported by all its
+  // minimizers, the two candidates are on opposite strands within
+  // 'max_insert_size', and their draft mappings are generated without
+  // verification. Otherwise no draft mapping is generated.
+  bool GeneratePairedEndDraftMappingsSupportedByAllMinimizers(
+      const SequenceBatch &read_batch1, const SequenceBatch &read_batch2,
+      uint32_t pair_index, const SequenceBatch &reference,
+      uint32_t max_insert_size,
+      PairedEndMappingMetadata &paired_end_mapping_metadata);
+
  private:
+  void ResetMappingStats(MappingMetadata &mapping_metadata) const;
+
   // Return true if the candidate position is valid on the reference with rid.
   // Note only the position is checked and the input rid is not checked in this
   // function. So the input rid must be valid.
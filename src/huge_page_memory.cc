@@ -0,0 +1,241 @@
+#include "huge_page_memory.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#if defined(MAP_HUGETLB) && !defined(MAP_HUGE_SHIFT)
+#define MAP_HUGE_SHIFT 26
+#endif
+
+// Only in the headers of recent kernels, older kernels reject it.
+#if defined(MADV_HUGEPAGE) && !defined(MADV_COLLAPSE)
+#define MADV_COLLAPSE 25
+#endif
+
+namespace chromap {
+
+namespace {
+
+constexpr size_t kHugePageSize = (size_t)1 << 21;
+constexpr size_t kGiganticPageSize = (size_t)1 << 30;
+
+enum HugePageKind {
+  HUGE_PAGE_KIND_GIGANTIC_HUGETLB,
+  HUGE_PAGE_KIND_HUGETLB,
+  HUGE_PAGE_KIND_TRANSPARENT,
+  NUM_HUGE_PAGE_KINDS
+};
+
+struct HugePageMapping {
+  void *address;
+  size_t num_bytes;
+  HugePageKind kind;
+  // Asked for hugetlbfs pages but got transparent huge pages.
+  bool is_hugetlb_fallback;
+};
+
+HugePageMode huge_page_mode = HUGE_PAGE_MODE_OFF;
+std::mutex huge_page_mappings_lock;
+// The mappings of the allocations on huge pages by the returned memory. Other
+// allocations come from calloc.
+std::unordered_map<void *, HugePageMapping> huge_page_mappings;
+// The bytes of the live mappings of each kind.
+size_t num_mapped_bytes[NUM_HUGE_PAGE_KINDS] = {0, 0, 0};
+size_t num_hugetlb_fallback_bytes = 0;
+size_t num_collapsed_bytes = 0;
+size_t num_collapse_failed_bytes = 0;
+
+inline size_t RoundUp(size_t num_bytes, size_t alignment) {
+  return (num_bytes + alignment - 1) / alignment * alignment;
+}
+
+#ifdef MAP_HUGETLB
+void *MapHugetlbPages(size_t num_bytes, size_t page_size, int page_shift) {
+  void *address = mmap(NULL, RoundUp(num_bytes, page_size),
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                           (page_shift << MAP_HUGE_SHIFT),
+                       -1, 0);
+  return address == MAP_FAILED ? NULL : address;
+}
+#endif
+
+// Map the memory aligned to huge pages, so every full huge page of it can be
+// backed by a transparent huge page.
+void *MapTransparentHugePages(size_t num_bytes, size_t &num_mapped_bytes) {
+  num_mapped_bytes = RoundUp(num_bytes, kHugePageSize);
+  char *address = (char *)mmap(NULL, num_mapped_bytes + kHugePageSize,
+                               PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if ((void *)address == MAP_FAILED) {
+    return NULL;
+  }
+  char *aligned_address = (char *)RoundUp((uintptr_t)address, kHugePageSize);
+  if (aligned_address > address) {
+    munmap(address, aligned_address - address);
+  }
+  char *aligned_end = aligned_address + num_mapped_bytes;
+  char *end = address + num_mapped_bytes + kHugePageSize;
+  if (end > aligned_end) {
+    munmap(aligned_end, end - aligned_end);
+  }
+#ifdef MADV_HUGEPAGE
+  // Not an error when the kernel has transparent huge pages disabled.
+  madvise(aligned_address, num_mapped_bytes, MADV_HUGEPAGE);
+#endif
+  return aligned_address;
+}
+
+// Return the bytes of the process on transparent huge pages in /proc, or -1
+// when they are unknown.
+long long GetNumAnonymousHugePageBytes() {
+  std::ifstream smaps_file("/proc/self/smaps_rollup");
+  std::string line;
+  while (std::getline(smaps_file, line)) {
+    if (line.compare(0, 14, "AnonHugePages:") == 0) {
+      return atoll(line.c_str() + 14) * 1024;
+    }
+  }
+  return -1;
+}
+
+}  // namespace
+
+void SetHugePageMode(HugePageMode mode) { huge_page_mode = mode; }
+
+HugePageMode GetHugePageMode() { return huge_page_mode; }
+
+void *AllocateHugePageMemory(size_t num_bytes) {
+  if (huge_page_mode == HUGE_PAGE_MODE_OFF || num_bytes < kHugePageSize) {
+    return calloc(num_bytes, 1);
+  }
+
+  HugePageMapping mapping;
+  mapping.address = NULL;
+#ifdef MAP_HUGETLB
+  if (huge_page_mode == HUGE_PAGE_MODE_HUGETLB) {
+    // Gigantic pages only when rounding up wastes at most 1/8 of the memory.
+    if (num_bytes >= kGiganticPageSize &&
+        RoundUp(num_bytes, kGiganticPageSize) - num_bytes <= num_bytes / 8) {
+      mapping.address = MapHugetlbPages(num_bytes, kGiganticPageSize, 30);
+      mapping.num_bytes = RoundUp(num_bytes, kGiganticPageSize);
+      mapping.kind = HUGE_PAGE_KIND_GIGANTIC_HUGETLB;
+    }
+    if (mapping.address == NULL) {
+      mapping.address = MapHugetlbPages(num_bytes, kHugePageSize, 21);
+      mapping.num_bytes = RoundUp(num_bytes, kHugePageSize);
+      mapping.kind = HUGE_PAGE_KIND_HUGETLB;
+    }
+  }
+#endif
+  mapping.is_hugetlb_fallback =
+      huge_page_mode == HUGE_PAGE_MODE_HUGETLB && mapping.address == NULL;
+  if (mapping.address == NULL) {
+    mapping.address = MapTransparentHugePages(num_bytes, mapping.num_bytes);
+    mapping.kind = HUGE_PAGE_KIND_TRANSPARENT;
+  }
+  if (mapping.address == NULL) {
+    return NULL;
+  }
+
+  std::lock_guard<std::mutex> lock(huge_page_mappings_lock);
+  huge_page_mappings[mapping.address] = mapping;
+  num_mapped_bytes[mapping.kind] += mapping.num_bytes;
+  if (mapping.is_hugetlb_fallback) {
+    num_hugetlb_fallback_bytes += mapping.num_bytes;
+  }
+  return mapping.address;
+}
+
+void FreeHugePageMemory(void *memory) {
+  // With the mode off, all the memory comes from calloc.
+  if (huge_page_mode == HUGE_PAGE_MODE_OFF) {
+    free(memory);
+    return;
+  }
+  if (memory == NULL) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(huge_page_mappings_lock);
+    std::unordered_map<void *, HugePageMapping>::iterator mapping_it =
+        huge_page_mappings.find(memory);
+    if (mapping_it != huge_page_mappings.end()) {
+      const HugePageMapping &mapping = mapping_it->second;
+      munmap(mapping.address, mapping.num_bytes);
+      num_mapped_bytes[mapping.kind] -= mapping.num_bytes;
+      if (mapping.is_hugetlb_fallback) {
+        num_hugetlb_fallback_bytes -= mapping.num_bytes;
+      }
+      huge_page_mappings.erase(mapping_it);
+      return;
+    }
+  }
+  free(memory);
+}
+
+void CollapseIntoHugePages(const void *memory, size_t num_bytes) {
+#ifdef MADV_HUGEPAGE
+  if (huge_page_mode == HUGE_PAGE_MODE_OFF) {
+    return;
+  }
+  // Only the huge pages fully inside the memory can be collapsed.
+  char *begin = (char *)RoundUp((uintptr_t)memory, kHugePageSize);
+  char *end =
+      (char *)(((uintptr_t)memory + num_bytes) / kHugePageSize * kHugePageSize);
+  if (begin >= end) {
+    return;
+  }
+  madvise(begin, end - begin, MADV_HUGEPAGE);
+  // Without MADV_COLLAPSE, khugepaged collapses the pages in the background.
+  const bool is_collapsed = madvise(begin, end - begin, MADV_COLLAPSE) == 0;
+  std::lock_guard<std::mutex> lock(huge_page_mappings_lock);
+  if (is_collapsed) {
+    num_collapsed_bytes += end - begin;
+  } else {
+    num_collapse_failed_bytes += end - begin;
+  }
+#endif
+}
+
+void OutputHugePageUsage() {
+  if (huge_page_mode == HUGE_PAGE_MODE_OFF) {
+    return;
+  }
+  const double kMB = 1024.0 * 1024.0;
+  std::lock_guard<std::mutex> lock(huge_page_mappings_lock);
+  if (huge_page_mode == HUGE_PAGE_MODE_HUGETLB) {
+    std::cerr << "Huge pages: "
+              << num_mapped_bytes[HUGE_PAGE_KIND_GIGANTIC_HUGETLB] / kMB
+              << "MB on 1GB hugetlbfs pages, "
+              << num_mapped_bytes[HUGE_PAGE_KIND_HUGETLB] / kMB
+              << "MB on 2MB hugetlbfs pages, "
+              << num_hugetlb_fallback_bytes / kMB
+              << "MB fell back to transparent huge pages.\n";
+  }
+  std::cerr << "Transparent huge pages: "
+            << num_mapped_bytes[HUGE_PAGE_KIND_TRANSPARENT] / kMB
+            << "MB mapped for them, " << num_collapsed_bytes / kMB
+            << "MB collapsed into them";
+  if (num_collapse_failed_bytes > 0) {
+    std::cerr << ", " << num_collapse_failed_bytes / kMB
+              << "MB left to khugepaged";
+  }
+  const long long num_anonymous_huge_page_bytes =
+      GetNumAnonymousHugePageBytes();
+  if (num_anonymous_huge_page_bytes >= 0) {
+    std::cerr << ", " << num_anonymous_huge_page_bytes / kMB
+              << "MB of the process on them";
+  }
+  std::cerr << ".\n";
+}
+
+}  // namespace chromap
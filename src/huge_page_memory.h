@@ -0,0 +1,85 @@
+#ifndef HUGE_PAGE_MEMORY_H_
+#define HUGE_PAGE_MEMORY_H_
+
+#include <stddef.h>
+
+#include <new>
+#include <vector>
+
+namespace chromap {
+
+enum HugePageMode {
+  HUGE_PAGE_MODE_OFF,
+  // Transparent huge pages, requested with madvise(MADV_HUGEPAGE).
+  HUGE_PAGE_MODE_TRANSPARENT,
+  // Huge pages preallocated in the hugetlbfs pool, 1 GB pages for the large
+  // allocations and 2 MB pages otherwise. Falls back to transparent huge pages
+  // when the pool runs out.
+  HUGE_PAGE_MODE_HUGETLB
+};
+
+// The memory of the long-lived, randomly accessed structures, i.e. the index
+// tables, the reference and the cache, comes from here. Allocations of at
+// least one huge page are mapped on huge pages unless the mode is off, so a
+// random lookup takes fewer TLB misses. The mode must be set once, before any
+// of them is allocated, since freeing relies on it.
+void SetHugePageMode(HugePageMode mode);
+
+HugePageMode GetHugePageMode();
+
+// Return zeroed memory, which must be freed by FreeHugePageMemory, or NULL
+// when the memory is exhausted.
+void *AllocateHugePageMemory(size_t num_bytes);
+
+void FreeHugePageMemory(void *memory);
+
+// Ask to move memory that is already in use, e.g. allocated by malloc, onto
+// transparent huge pages. Untouched pages get huge pages when first touched.
+void CollapseIntoHugePages(const void *memory, size_t num_bytes);
+
+// Output the memory that asked for huge pages and what it got.
+void OutputHugePageUsage();
+
+struct HugePageMemoryDeleter {
+  void operator()(void *memory) const { FreeHugePageMemory(memory); }
+};
+
+template <typename T>
+class HugePageAllocator {
+ public:
+  typedef T value_type;
+
+  HugePageAllocator() = default;
+
+  template <typename U>
+  HugePageAllocator(const HugePageAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    void *memory = AllocateHugePageMemory(n * sizeof(T));
+    if (memory == NULL) {
+      throw std::bad_alloc();
+    }
+    return (T *)memory;
+  }
+
+  void deallocate(T *memory, size_t) { FreeHugePageMemory(memory); }
+};
+
+template <typename T, typename U>
+inline bool operator==(const HugePageAllocator<T> &,
+                       const HugePageAllocator<U> &) {
+  return true;
+}
+
+template <typename T, typename U>
+inline bool operator!=(const HugePageAllocator<T> &,
+                       const HugePageAllocator<U> &) {
+  return false;
+}
+
+template <typename T>
+using HugePageVector = std::vector<T, HugePageAllocator<T>>;
+
+}  // namespace chromap
+
+#endif  // HUGE_PAGE_MEMORY_H_
@@ -0,0 +1,115 @@
+#ifndef IN_FLIGHT_READ_BATCH_H_
+#define IN_FLIGHT_READ_BATCH_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "sequence_batch.h"
+#include "sequence_effective_range.h"
+
+namespace chromap {
+
+// A batch of reads moving through the mapping pipeline, together with the
+// per-batch buffers of the stages after mapping. A fixed number of them
+// circulate between the loading thread and the mapping threads, which bounds
+// how far loading can run ahead of mapping and output.
+template <typename MappingRecord>
+struct InFlightReadBatch {
+  InFlightReadBatch(uint32_t read_batch_size, bool is_paired_end,
+                    bool has_summary,
+                    const SequenceEffectiveRange &read1_effective_range,
+                    const SequenceEffectiveRange &read2_effective_range,
+                    const SequenceEffectiveRange &barcode_effective_range)
+      : read_batch1(read_batch_size, read1_effective_range),
+        read_batch2(is_paired_end ? read_batch_size : 0,
+                    read2_effective_range),
+        barcode_batch(read_batch_size, barcode_effective_range),
+        barcode_seeds(is_paired_end ? read_batch_size : 0, 0) {
+    if (has_summary) {
+      read_map_summary.resize(read_batch_size, 1);
+    }
+  }
+
+  // Replace the mapping buffers by empty ones for each thread, reserving
+  // 'num_reserved_mappings' for each reference sequence.
+  inline void InitializeMappingBuffers(int num_threads,
+                                       uint32_t num_reference_sequences,
+                                       size_t num_reserved_mappings) {
+    mappings_on_diff_ref_seqs_for_diff_threads.clear();
+    mappings_on_diff_ref_seqs_for_diff_threads.reserve(num_threads);
+    for (int ti = 0; ti < num_threads; ++ti) {
+      mappings_on_diff_ref_seqs_for_diff_threads.emplace_back(
+          std::vector<std::vector<MappingRecord>>(num_reference_sequences));
+      for (uint32_t i = 0; i < num_reference_sequences; ++i) {
+        mappings_on_diff_ref_seqs_for_diff_threads[ti][i].reserve(
+            num_reserved_mappings);
+      }
+    }
+  }
+
+  // Read 2 is only used for paired-end reads.
+  SequenceBatch read_batch1;
+  SequenceBatch read_batch2;
+  SequenceBatch barcode_batch;
+
+  // 0 marks the end of the read files.
+  uint32_t num_loaded_reads = 0;
+
+  // Mappings generated by each thread for this batch.
+  std::vector<std::vector<std::vector<MappingRecord>>>
+      mappings_on_diff_ref_seqs_for_diff_threads;
+
+  // Bit encoding of the mapping results of each read for the summary. Empty
+  // when the summary is not requested.
+  std::vector<uint8_t> read_map_summary;
+  std::vector<uint64_t> barcode_seeds;
+  // The cache slots hit by read1 and read2 of each pair, -1 for a miss. Empty
+  // when the cache slots are not summarized.
+  std::vector<int> cache_slots;
+  int num_cache_hits = 0;
+};
+
+// Hands over the indices of in-flight batches between pipeline stages. Pop()
+// blocks until an index is available.
+class InFlightReadBatchQueue {
+ public:
+  inline void Push(int batch_index) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      batch_indices_.push_back(batch_index);
+    }
+    condition_.notify_one();
+  }
+
+  // Return false if no index is available.
+  inline bool TryPop(int &batch_index) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (batch_indices_.empty()) {
+      return false;
+    }
+    batch_index = batch_indices_.front();
+    batch_indices_.pop_front();
+    return true;
+  }
+
+  inline int Pop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [this] { return !batch_indices_.empty(); });
+    const int batch_index = batch_indices_.front();
+    batch_indices_.pop_front();
+    return batch_index;
+  }
+
+ private:
+  std::deque<int> batch_indices_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+};
+
+}  // namespace chromap
+
+#endif  // IN_FLIGHT_READ_BATCH_H_
@@ -4,6 +4,7 @@
 
 #include <algorithm>
 #include <iostream>
+#include <limits>
 
 #include "minimizer_generator.h"
 
@@ -88,6 +89,23 @@ void Index::Construct(uint32_t num_sequences, const SequenceBatch &reference) {
             << "s.\n";
 }
 
+uint64_t Index::GetFingerprint() const {
+  const uint64_t mask = std::numeric_limits<uint64_t>::max();
+  uint64_t fingerprint =
+      Hash64(((uint64_t)kmer_size_ << 32) | window_size_, mask);
+  for (khiter_t it = kh_begin(lookup_table_); it != kh_end(lookup_table_);
+       ++it) {
+    if (kh_exist(lookup_table_, it)) {
+      fingerprint = Hash64(fingerprint ^ kh_key(lookup_table_, it), mask);
+      fingerprint = Hash64(fingerprint ^ kh_value(lookup_table_, it), mask);
+    }
+  }
+  for (const uint64_t occurrence : occurrence_table_) {
+    fingerprint = Hash64(fingerprint ^ occurrence, mask);
+  }
+  return fingerprint;
+}
+
 void Index::Save() const {
   const double real_start_time = GetRealTime();
   FILE *index_file = fopen(index_file_path_.c_str(), "wb");
@@ -146,6 +164,14 @@ void Index::Load() {
   assert(err != 0);
 
   kh_load(k64, lookup_table_, index_file);
+  // The lookup table is allocated by khash, so it can only be moved onto huge
+  // pages once loaded.
+  if (lookup_table_->n_buckets > 0) {
+    CollapseIntoHugePages(lookup_table_->keys,
+                          lookup_table_->n_buckets * sizeof(uint64_t));
+    CollapseIntoHugePages(lookup_table_->vals,
+                          lookup_table_->n_buckets * sizeof(uint64_t));
+  }
 
   uint32_t occurrence_table_size = 0;
   err = fread(&occurrence_table_size, sizeof(uint32_t), 1, index_file);
@@ -160,6 +186,8 @@ void Index::Load() {
 
   fclose(index_file);
 
+  SampleOccurrenceTable();
+
   std::cerr << "Kmer size: " << kmer_size_ << ", window size: " << window_size_
             << ".\n";
   std::cerr << "Lookup table size: " << kh_size(lookup_table_)
@@ -168,6 +196,36 @@ void Index::Load() {
             << GetRealTime() - real_start_time << "s.\n";
 }
 
+std::vector<std::pair<const void *, size_t>> Index::GetTableMemoryRanges()
+    const {
+  std::vector<std::pair<const void *, size_t>> memory_ranges;
+  if (lookup_table_ != nullptr && lookup_table_->n_buckets > 0) {
+    memory_ranges.emplace_back(lookup_table_->keys,
+                               lookup_table_->n_buckets * sizeof(uint64_t));
+    memory_ranges.emplace_back(lookup_table_->vals,
+                               lookup_table_->n_buckets * sizeof(uint64_t));
+  }
+  memory_ranges.emplace_back(occurrence_table_.data(),
+                             occurrence_table_.size() * sizeof(uint64_t));
+  memory_ranges.emplace_back(
+      occurrence_table_samples_.data(),
+      occurrence_table_samples_.size() * sizeof(uint64_t));
+  return memory_ranges;
+}
+
+void Index::SampleOccurrenceTable() {
+  occurrence_table_samples_.clear();
+  occurrence_table_samples_.reserve(occurrence_table_.size() /
+                                        kOccurrenceSampleInterval +
+                                    1);
+  for (size_t i = 0; i < occurrence_table_.size();
+       i += kOccurrenceSampleInterval) {
+    occurrence_table_samples_.push_back(
+        GenerateCandidatePositionFromOccurrenceTableEntry(
+            occurrence_table_[i]));
+  }
+}
+
 void Index::Statistics(uint32_t num_sequences,
                        const SequenceBatch &reference) const {
   double real_start_time = GetRealTime();
@@ -240,13 +298,25 @@ int Index::GenerateCandidatePositions(
   const uint32_t num_minimizers = mapping_metadata.GetNumMinimizers();
   const std::vector<Minimizer> &minimizers = mapping_metadata.minimizers_;
 
-  std::vector<std::vector<uint64_t>> positive_candidate_position_lists;
-  std::vector<std::vector<uint64_t>> negative_candidate_position_lists;
+  // With merge, the candidate positions of each minimizer are saved as a
+  // sorted list in the scratch buffers and merged afterwards.
+  std::vector<uint64_t> &positive_candidate_positions =
+      generating_config.UseHeapMerge()
+          ? mapping_metadata.positive_candidate_position_lists_
+          : mapping_metadata.positive_hits_;
+  std::vector<uint64_t> &negative_candidate_positions =
+      generating_config.UseHeapMerge()
+          ? mapping_metadata.negative_candidate_position_lists_
+          : mapping_metadata.negative_hits_;
+  std::vector<uint32_t> &positive_list_offsets =
+      mapping_metadata.positive_candidate_position_list_offsets_;
+  std::vector<uint32_t> &negative_list_offsets =
+      mapping_metadata.negative_candidate_position_list_offsets_;
   if (generating_config.UseHeapMerge()) {
-    for (uint32_t i = 0; i < num_minimizers; ++i) {
-      positive_candidate_position_lists.emplace_back(std::vector<uint64_t>());
-      negative_candidate_position_lists.emplace_back(std::vector<uint64_t>());
-    }
+    positive_candidate_positions.clear();
+    negative_candidate_positions.clear();
+    positive_list_offsets.clear();
+    negative_list_offsets.clear();
   }
   bool is_candidate_position_list_sorted = true;
 
@@ -257,6 +327,11 @@ int Index::GenerateCandidatePositions(
 
   RepetitiveSeedStats repetitive_seed_stats;
   for (uint32_t mi = 0; mi < num_minimizers; ++mi) {
+    if (generating_config.UseHeapMerge()) {
+      positive_list_offsets.push_back(positive_candidate_positions.size());
+      negative_list_offsets.push_back(negative_candidate_positions.size());
+    }
+
     khiter_t khash_iterator =
         kh_get(k64, lookup_table_,
                GenerateHashInLookupTable(minimizers[mi].GetHash()));
@@ -265,13 +340,6 @@ int Index::GenerateCandidatePositions(
       continue;
     }
 
-    std::vector<uint64_t> &positive_candidate_positions =
-        generating_config.UseHeapMerge() ? positive_candidate_position_lists[mi]
-                                         : mapping_metadata.positive_hits_;
-    std::vector<uint64_t> &negative_candidate_positions =
-        generating_config.UseHeapMerge() ? negative_candidate_position_lists[mi]
-                                         : mapping_metadata.negative_hits_;
-
     const uint64_t lookup_key = kh_key(lookup_table_, khash_iterator);
     const uint64_t lookup_value = kh_value(lookup_table_, khash_iterator);
     const uint64_t read_hit = minimizers[mi].GetHit();
@@ -315,17 +383,27 @@ int Index::GenerateCandidatePositions(
   }
 
   if (generating_config.UseHeapMerge()) {
+    positive_list_offsets.push_back(positive_candidate_positions.size());
+    negative_list_offsets.push_back(negative_candidate_positions.size());
     // TODO: try to remove this sorting.
     if (!is_candidate_position_list_sorted) {
       for (uint32_t mi = 0; mi < num_minimizers; ++mi) {
-        std::sort(positive_candidate_position_lists[mi].begin(),
-                  positive_candidate_position_lists[mi].end());
+        std::sort(
+            positive_candidate_positions.begin() + positive_list_offsets[mi],
+            positive_candidate_positions.begin() +
+                positive_list_offsets[mi + 1]);
       }
     }
-    HeapMergeCandidatePositionLists(positive_candidate_position_lists,
-                                    mapping_metadata.positive_hits_);
-    HeapMergeCandidatePositionLists(negative_candidate_position_lists,
-                                    mapping_metadata.negative_hits_);
+    MergeSortedCandidatePositionLists(
+        positive_candidate_positions, positive_list_offsets,
+        mapping_metadata.candidate_position_list_ranges_,
+        mapping_metadata.candidate_position_list_losers_,
+        mapping_metadata.positive_hits_);
+    MergeSortedCandidatePositionLists(
+        negative_candidate_positions, negative_list_offsets,
+        mapping_metadata.candidate_position_list_ranges_,
+        mapping_metadata.candidate_position_list_losers_,
+        mapping_metadata.negative_hits_);
   } else {
     std::sort(mapping_metadata.positive_hits_.begin(),
               mapping_metadata.positive_hits_.end());
@@ -354,6 +432,7 @@ int Index::GenerateCandidatePositionsFromRepetitiveReadWithMateInfoOnOneStrand(
     int error_threshold, const std::vector<Minimizer> &minimizers,
     const std::vector<Candidate> &mate_candidates,
     uint32_t &repetitive_seed_length,
+    std::vector<std::pair<uint64_t, uint64_t>> &boundaries,
     std::vector<uint64_t> &candidate_positions) const {
   const uint32_t mate_candidates_size = mate_candidates.size();
   int max_minimizer_count = 0;
@@ -380,7 +459,7 @@ int Index::GenerateCandidatePositionsFromRepetitiveReadWithMateInfoOnOneStrand(
   }
 
   // TODO: reduce the search range based on the strand.
-  std::vector<std::pair<uint64_t, uint64_t>> boundaries;
+  boundaries.clear();
   boundaries.reserve(best_candidate_num);
   for (uint32_t ci = 0; ci < mate_candidates_size; ++ci) {
     if (mate_candidates[ci].count == max_minimizer_count) {
@@ -440,28 +519,15 @@ int Index::GenerateCandidatePositionsFromRepetitiveReadWithMateInfoOnOneStrand(
     const uint32_t offset = GenerateOffsetInOccurrenceTable(lookup_value);
     const uint32_t num_occurrences =
         GenerateNumOccurrenceInOccurrenceTable(lookup_value);
-    int32_t prev_l = 0;
+    uint32_t first_occurrence = 0;
     for (uint32_t bi = 0; bi < boundary_size; ++bi) {
-      // Use binary search to locate the coordinate near mate position.
-      int32_t l = prev_l, m = 0, r = num_occurrences - 1;
-      uint64_t boundary = boundaries[bi].first;
-      while (l <= r) {
-        m = (l + r) / 2;
-        uint64_t candidate_position =
-            GenerateCandidatePositionFromOccurrenceTableEntry(
-                occurrence_table_[offset + m]);
-        if (candidate_position < boundary) {
-          l = m + 1;
-        } else if (candidate_position > boundary) {
-          r = m - 1;
-        } else {
-          break;
-        }
-      }
-      // For next boundary, we don't have to start from l=0.
-      prev_l = m;
+      // The boundaries are sorted, so the search for the next boundary starts
+      // from the first occurrence of this one.
+      first_occurrence = GetFirstOccurrenceNotBefore(
+          occurrence_table_.data(), occurrence_table_samples_.data(), offset,
+          num_occurrences, first_occurrence, boundaries[bi].first);
 
-      for (uint32_t oi = m; oi < num_occurrences; ++oi) {
+      for (uint32_t oi = first_occurrence; oi < num_occurrences; ++oi) {
         const uint64_t reference_hit = occurrence_table_[offset + oi];
         if ((GenerateCandidatePositionFromOccurrenceTableEntry(reference_hit)) >
             boundaries[bi].second) {
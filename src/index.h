@@ -4,9 +4,11 @@
 #include <limits>
 #include <queue>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "candidate_position_generating_config.h"
+#include "huge_page_memory.h"
 #include "index_parameters.h"
 #include "index_utils.h"
 #include "mapping_metadata.h"
@@ -43,7 +45,8 @@ class Index {
       lookup_table_ = nullptr;
     }
 
-    std::vector<uint64_t>().swap(occurrence_table_);
+    HugePageVector<uint64_t>().swap(occurrence_table_);
+    HugePageVector<uint64_t>().swap(occurrence_table_samples_);
   }
 
   void Construct(uint32_t num_sequences, const SequenceBatch &reference);
@@ -58,6 +61,10 @@ class Index {
   // Check the index for some reference genome. Only for debug.
   void CheckIndex(uint32_t num_sequences, const SequenceBatch &reference) const;
 
+  // Return the memory of the lookup and occurrence tables, e.g. to check on
+  // which NUMA nodes their pages are.
+  std::vector<std::pair<const void *, size_t>> GetTableMemoryRanges() const;
+
   // Return the number of repetitive seeds.
   int GenerateCandidatePositions(
       const CandidatePositionGeneratingConfig &generating_config,
@@ -74,6 +81,7 @@ class Index {
       int error_threshold, const std::vector<Minimizer> &minimizers,
       const std::vector<Candidate> &mate_candidates,
       uint32_t &repetitive_seed_length,
+      std::vector<std::pair<uint64_t, uint64_t>> &boundaries,
       std::vector<uint64_t> &candidate_positions) const;
 
   int GetKmerSize() const { return kmer_size_; }
@@ -82,6 +90,10 @@ class Index {
 
   uint32_t GetLookupTableSize() const { return kh_size(lookup_table_); }
 
+  // Return a hash of the whole index, e.g. to check whether data derived from
+  // an index was generated with the same index.
+  uint64_t GetFingerprint() const;
+
  private:
   uint64_t GenerateCandidatePositionFromHits(uint64_t reference_hit,
                                              uint64_t read_hit) const;
@@ -89,13 +101,21 @@ class Index {
   void UpdateRepetitiveSeedStats(uint32_t read_position,
                                  RepetitiveSeedStats &stats) const;
 
+  // Sample the candidate positions in the occurrence table after loading it.
+  void SampleOccurrenceTable();
+
   int kmer_size_ = 0;
   int window_size_ = 0;
   // Number of threads to build the index, which is not used right now.
   int num_threads_ = 1;
   const std::string index_file_path_;
   khash_t(k64) *lookup_table_ = nullptr;
-  std::vector<uint64_t> occurrence_table_;
+  HugePageVector<uint64_t> occurrence_table_;
+  // The candidate position of every kOccurrenceSampleInterval-th entry in the
+  // occurrence table. Searching the samples first narrows a search in a long
+  // occurrence list down to one sample interval, and the samples of a list are
+  // packed densely enough to take a few cache misses at most.
+  HugePageVector<uint64_t> occurrence_table_samples_;
 };
 
 }  // namespace chromap
@@ -3,6 +3,10 @@
 
 #include <stdint.h>
 
+#include <algorithm>
+#include <utility>
+#include <vector>
+
 #include "khash.h"
 
 // Note that the max kmer size is 28 and its hash value is always saved in the
@@ -57,49 +61,142 @@ inline static bool IsSingletonLookupKey(uint64_t lookup_key) {
   return (lookup_key & 1) > 0;
 }
 
-// Only used in Index to merge sorted candidate position lists using heap.
-struct CandidatePositionWithListIndex {
-  uint32_t list_index;
-  uint64_t position;
+// The candidate position of every kOccurrenceSampleInterval-th entry in the
+// occurrence table is sampled. Shorter occurrence lists than
+// kMinNumOccurrencesToSearchSamples are searched without the samples.
+constexpr uint32_t kOccurrenceSampleInterval = 16;
+constexpr uint32_t kMinNumOccurrencesToSearchSamples = 64;
+
+// Only used in Index. Return the index of the first occurrence, from
+// 'first_occurrence' on, in the occurrence list at 'offset' whose candidate
+// position is no less than 'candidate_position'. Return 'num_occurrences' if
+// there is none.
+inline static uint32_t GetFirstOccurrenceNotBefore(
+    const uint64_t *occurrence_table, const uint64_t *occurrence_table_samples,
+    uint32_t offset, uint32_t num_occurrences, uint32_t first_occurrence,
+    uint64_t candidate_position) {
+  // The occurrences are sorted by their candidate positions.
+  uint32_t search_start = offset + first_occurrence;
+  uint32_t search_end = offset + num_occurrences;
+
+  if (num_occurrences - first_occurrence >=
+      kMinNumOccurrencesToSearchSamples) {
+    // The samples taken inside the search range.
+    const uint32_t samples_start =
+        (search_start + kOccurrenceSampleInterval - 1) /
+        kOccurrenceSampleInterval;
+    const uint32_t samples_end =
+        (search_end - 1) / kOccurrenceSampleInterval + 1;
+    const uint32_t sample_index =
+        std::lower_bound(occurrence_table_samples + samples_start,
+                         occurrence_table_samples + samples_end,
+                         candidate_position) -
+        occurrence_table_samples;
+    // The occurrence is after the previous sample and no later than this one.
+    if (sample_index > samples_start) {
+      search_start = (sample_index - 1) * kOccurrenceSampleInterval + 1;
+    }
+    if (sample_index < samples_end) {
+      search_end = sample_index * kOccurrenceSampleInterval;
+    }
+  }
 
-  CandidatePositionWithListIndex(uint32_t list_index, uint64_t position)
-      : list_index(list_index), position(position) {}
+  const uint64_t *occurrence = std::lower_bound(
+      occurrence_table + search_start, occurrence_table + search_end,
+      candidate_position, [](uint64_t entry, uint64_t position) {
+        return GenerateCandidatePositionFromOccurrenceTableEntry(entry) <
+               position;
+      });
+  return occurrence - occurrence_table - offset;
+}
 
-  bool operator<(const CandidatePositionWithListIndex &h) const {
-    // The inversed direction is to make a min-heap.
-    return position > h.position;
+// Only used in Index to merge sorted candidate position lists with a loser
+// tree. The lists are saved back to back in 'candidate_position_lists', and list
+// i spans [list_offsets[i], list_offsets[i + 1]). 'list_ranges' and 'losers' are
+// scratch buffers reused across reads so that the merge does not allocate.
+inline static void MergeSortedCandidatePositionLists(
+    const std::vector<uint64_t> &candidate_position_lists,
+    const std::vector<uint32_t> &list_offsets,
+    std::vector<std::pair<uint32_t, uint32_t>> &list_ranges,
+    std::vector<uint32_t> &losers,
+    std::vector<uint64_t> &candidate_positions) {
+  // Only merge the non-empty lists. Each range is the next position to merge
+  // and the end of its list.
+  list_ranges.clear();
+  uint32_t num_candidate_positions = 0;
+  for (size_t li = 0; li + 1 < list_offsets.size(); ++li) {
+    if (list_offsets[li] < list_offsets[li + 1]) {
+      list_ranges.emplace_back(list_offsets[li], list_offsets[li + 1]);
+      num_candidate_positions += list_offsets[li + 1] - list_offsets[li];
+    }
   }
-};
 
-inline static void HeapMergeCandidatePositionLists(
-    const std::vector<std::vector<uint64_t>> sorted_candidate_position_lists,
-    std::vector<uint64_t> &candidate_positions) {
-  std::priority_queue<CandidatePositionWithListIndex> heap;
-  std::vector<uint32_t> candidate_position_list_indices(
-      sorted_candidate_position_lists.size(), 0);
+  const uint32_t num_lists = list_ranges.size();
+  if (num_lists == 0) {
+    return;
+  }
+
+  candidate_positions.reserve(candidate_positions.size() +
+                              num_candidate_positions);
+  if (num_lists == 1) {
+    candidate_positions.insert(
+        candidate_positions.end(),
+        candidate_position_lists.begin() + list_ranges[0].first,
+        candidate_position_lists.begin() + list_ranges[0].second);
+    return;
+  }
 
-  for (uint32_t li = 0; li < sorted_candidate_position_lists.size(); ++li) {
-    if (sorted_candidate_position_lists[li].size() == 0) {
-      continue;
+  // Pad the leaves to a power of 2 with empty lists.
+  uint32_t num_leaves = 1;
+  while (num_leaves < num_lists) {
+    num_leaves <<= 1;
+  }
+  list_ranges.resize(num_leaves, std::make_pair(0u, 0u));
+
+  // An exhausted list is larger than any list with positions left.
+  auto is_less = [&candidate_position_lists, &list_ranges](uint32_t li1,
+                                                           uint32_t li2) {
+    if (list_ranges[li1].first == list_ranges[li1].second) {
+      return false;
+    }
+    if (list_ranges[li2].first == list_ranges[li2].second) {
+      return true;
+    }
+    return candidate_position_lists[list_ranges[li1].first] <
+           candidate_position_lists[list_ranges[li2].first];
+  };
+
+  // Internal node t keeps the loser at losers[t]. The winner of node t is only
+  // needed to build the tree, and is kept at losers[num_leaves + t].
+  losers.resize(2 * num_leaves);
+  for (uint32_t t = num_leaves - 1; t > 0; --t) {
+    const uint32_t left_child = 2 * t;
+    const uint32_t right_child = 2 * t + 1;
+    const uint32_t left_winner = left_child >= num_leaves
+                                     ? left_child - num_leaves
+                                     : losers[num_leaves + left_child];
+    const uint32_t right_winner = right_child >= num_leaves
+                                      ? right_child - num_leaves
+                                      : losers[num_leaves + right_child];
+    if (is_less(right_winner, left_winner)) {
+      losers[t] = left_winner;
+      losers[num_leaves + t] = right_winner;
+    } else {
+      losers[t] = right_winner;
+      losers[num_leaves + t] = left_winner;
     }
-    heap.emplace(li, sorted_candidate_position_lists[li][0]);
   }
 
-  while (!heap.empty()) {
-    const CandidatePositionWithListIndex min_candidate_position = heap.top();
-    heap.pop();
-    candidate_positions.push_back(min_candidate_position.position);
-    ++candidate_position_list_indices[min_candidate_position.list_index];
-
-    const uint32_t min_candidate_position_list_index =
-        candidate_position_list_indices[min_candidate_position.list_index];
-    const std::vector<uint64_t> &min_sorted_candidate_position_list =
-        sorted_candidate_position_lists[min_candidate_position.list_index];
-    if (min_candidate_position_list_index <
-        min_sorted_candidate_position_list.size()) {
-      heap.emplace(min_candidate_position.list_index,
-                   min_sorted_candidate_position_list
-                       [min_candidate_position_list_index]);
+  uint32_t winner = losers[num_leaves + 1];
+  for (uint32_t pi = 0; pi < num_candidate_positions; ++pi) {
+    candidate_positions.push_back(
+        candidate_position_lists[list_ranges[winner].first]);
+    ++list_ranges[winner].first;
+    // Replay the matches on the path from the leaf of the winner to the root.
+    for (uint32_t t = (num_leaves + winner) >> 1; t > 0; t >>= 1) {
+      if (is_less(losers[t], winner)) {
+        std::swap(losers[t], winner);
+      }
     }
   }
 }
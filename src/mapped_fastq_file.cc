@@ -0,0 +1,239 @@
+#include "mapped_fastq_file.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "utils.h"
+
+namespace chromap {
+
+bool MappedFastqFile::Open(const std::string &file_path, int num_threads) {
+  Close();
+  file_path_ = file_path;
+  num_threads_ = num_threads > 0 ? num_threads : 1;
+
+  const int fd = open(file_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  // Map the file privately and writable, so that trimming and barcode
+  // correction can modify the views without touching the file.
+  size_ = file_stat.st_size;
+  void *data =
+      mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, /*offset=*/0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    size_ = 0;
+    return false;
+  }
+  data_ = (char *)data;
+
+  if (data_[0] != '@') {
+    Close();
+    return false;
+  }
+
+  madvise(data_, size_, MADV_SEQUENTIAL);
+  return true;
+}
+
+void MappedFastqFile::Close() {
+  if (data_ != NULL) {
+    munmap(data_, size_);
+    data_ = NULL;
+  }
+  size_ = 0;
+  num_parsed_bytes_ = 0;
+  chunk_records_.clear();
+  current_chunk_index_ = 0;
+  current_record_index_ = 0;
+}
+
+bool MappedFastqFile::ReadRecord(FastqRecordView &record) {
+  while (current_chunk_index_ >= chunk_records_.size() ||
+         current_record_index_ >=
+             chunk_records_[current_chunk_index_].size()) {
+    if (current_chunk_index_ + 1 < chunk_records_.size()) {
+      ++current_chunk_index_;
+      current_record_index_ = 0;
+      continue;
+    }
+
+    if (num_parsed_bytes_ >= size_) {
+      return false;
+    }
+
+    ParseNextBlock();
+  }
+
+  record = chunk_records_[current_chunk_index_][current_record_index_];
+  ++current_record_index_;
+  return true;
+}
+
+void MappedFastqFile::ParseNextBlock() {
+  const size_t block_start = num_parsed_bytes_;
+  const size_t block_end =
+      FindRecordStart(std::min(size_, block_start + kBlockSize));
+  const size_t block_size = block_end - block_start;
+
+  const size_t num_chunks = std::max(
+      (size_t)1, std::min((size_t)num_threads_, block_size / kMinChunkSize));
+  std::vector<size_t> chunk_starts(num_chunks + 1);
+  chunk_starts[0] = block_start;
+  for (size_t ci = 1; ci < num_chunks; ++ci) {
+    chunk_starts[ci] =
+        FindRecordStart(block_start + ci * (block_size / num_chunks));
+  }
+  chunk_starts[num_chunks] = block_end;
+
+  chunk_records_.resize(num_chunks);
+  std::vector<char> is_chunk_parsed(num_chunks);
+  std::vector<std::thread> parsing_threads;
+  for (size_t ci = 1; ci < num_chunks; ++ci) {
+    parsing_threads.emplace_back([this, ci, &chunk_starts, &is_chunk_parsed] {
+      is_chunk_parsed[ci] = ParseRecords(chunk_starts[ci], chunk_starts[ci + 1],
+                                         chunk_records_[ci]);
+    });
+  }
+  is_chunk_parsed[0] =
+      ParseRecords(chunk_starts[0], chunk_starts[1], chunk_records_[0]);
+  for (std::thread &parsing_thread : parsing_threads) {
+    parsing_thread.join();
+  }
+
+  for (size_t ci = 0; ci < num_chunks; ++ci) {
+    if (!is_chunk_parsed[ci]) {
+      ExitWithMessage("Failed to parse " + file_path_ +
+                      ", which might be corrupted or not a FASTQ file with "
+                      "four lines per record!");
+    }
+  }
+
+  // Let the kernel read the next block while the current one is consumed.
+  if (block_end < size_) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t prefetch_start = block_end / page_size * page_size;
+    const size_t prefetch_size = size_ - prefetch_start < kBlockSize
+                                     ? size_ - prefetch_start
+                                     : kBlockSize;
+    madvise(data_ + prefetch_start, prefetch_size, MADV_WILLNEED);
+  }
+
+  num_parsed_bytes_ = block_end;
+  current_chunk_index_ = 0;
+  current_record_index_ = 0;
+}
+
+size_t MappedFastqFile::GetNextLineStart(size_t offset) const {
+  if (offset >= size_) {
+    return size_;
+  }
+  const char *line_end = (const char *)memchr(data_ + offset, '\n',
+                                              size_ - offset);
+  return line_end == NULL ? size_ : line_end - data_ + 1;
+}
+
+size_t MappedFastqFile::FindRecordStart(size_t offset) const {
+  if (offset == 0 || offset >= size_) {
+    return std::min(offset, size_);
+  }
+
+  // Both headers and quality lines can start with '@'. But only for a header,
+  // the line after the next one starts with '+'.
+  size_t line_start =
+      data_[offset - 1] == '\n' ? offset : GetNextLineStart(offset);
+  while (line_start < size_) {
+    const size_t next_line_start = GetNextLineStart(line_start);
+    if (data_[line_start] == '@') {
+      const size_t plus_line_start = GetNextLineStart(next_line_start);
+      if (plus_line_start >= size_) {
+        return next_line_start >= size_ ? size_ : line_start;
+      }
+      if (data_[plus_line_start] == '+') {
+        return line_start;
+      }
+    }
+    line_start = next_line_start;
+  }
+  return size_;
+}
+
+bool MappedFastqFile::ParseRecords(
+    size_t start, size_t end, std::vector<FastqRecordView> &records) const {
+  records.clear();
+  size_t record_start = start;
+  while (record_start < end) {
+    // Skip empty lines between records.
+    if (data_[record_start] == '\n' || data_[record_start] == '\r') {
+      ++record_start;
+      continue;
+    }
+
+    if (data_[record_start] != '@') {
+      return false;
+    }
+
+    const size_t sequence_start = GetNextLineStart(record_start);
+    const size_t plus_line_start = GetNextLineStart(sequence_start);
+    if (plus_line_start >= size_ || data_[plus_line_start] != '+') {
+      return false;
+    }
+    const size_t qual_start = GetNextLineStart(plus_line_start);
+    const size_t next_record_start = GetNextLineStart(qual_start);
+
+    // Exclude the line breaks, including the '\r' of DOS line breaks.
+    size_t sequence_end = plus_line_start - 1;
+    if (sequence_end > sequence_start && data_[sequence_end - 1] == '\r') {
+      --sequence_end;
+    }
+    size_t qual_end = next_record_start;
+    if (qual_end > qual_start && data_[qual_end - 1] == '\n') {
+      --qual_end;
+    }
+    if (qual_end > qual_start && data_[qual_end - 1] == '\r') {
+      --qual_end;
+    }
+
+    const uint32_t sequence_length = sequence_end - sequence_start;
+    if (qual_end - qual_start != sequence_length) {
+      return false;
+    }
+
+    // Like kseq, the name stops at the first whitespace and empty sequences
+    // are skipped.
+    if (sequence_length > 0) {
+      size_t name_end = record_start + 1;
+      while (name_end < sequence_start && !isspace(data_[name_end])) {
+        ++name_end;
+      }
+
+      FastqRecordView record;
+      record.name = data_ + record_start + 1;
+      record.name_length = name_end - record_start - 1;
+      record.sequence = data_ + sequence_start;
+      record.qual = data_ + qual_start;
+      record.length = sequence_length;
+      records.push_back(record);
+    }
+
+    record_start = next_record_start;
+  }
+  return true;
+}
+
+}  // namespace chromap
@@ -0,0 +1,77 @@
+#ifndef MAPPED_FASTQ_FILE_H_
+#define MAPPED_FASTQ_FILE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+namespace chromap {
+
+// The fields of a FASTQ record as views into the mapped file. The views are
+// not terminated by '\0'.
+struct FastqRecordView {
+  const char *name;
+  uint32_t name_length;
+  char *sequence;
+  char *qual;
+  uint32_t length;
+};
+
+// Parses an uncompressed FASTQ file with four lines per record without copying
+// it. The file is mapped privately, so the callers can modify the bases in
+// place. Records are parsed block by block: each block is split into
+// record-aligned chunks that are parsed by 'num_threads' threads in parallel.
+// The views stay valid until Close().
+class MappedFastqFile {
+ public:
+  MappedFastqFile() = default;
+
+  MappedFastqFile(const MappedFastqFile &) = delete;
+  MappedFastqFile &operator=(const MappedFastqFile &) = delete;
+
+  ~MappedFastqFile() { Close(); }
+
+  // Return false if the file cannot be mapped or does not look like an
+  // uncompressed FASTQ file, e.g. a gzip or FASTA file.
+  bool Open(const std::string &file_path, int num_threads);
+
+  void Close();
+
+  inline bool IsOpen() const { return data_ != NULL; }
+
+  // Return false when reaching the end of the file.
+  bool ReadRecord(FastqRecordView &record);
+
+ private:
+  void ParseNextBlock();
+
+  // Return the offset of the first record starting at or after 'offset'.
+  size_t FindRecordStart(size_t offset) const;
+
+  // Return the offset of the line following the one containing 'offset'.
+  size_t GetNextLineStart(size_t offset) const;
+
+  // Parse the records starting in [start, end). Return false if any record is
+  // malformed.
+  bool ParseRecords(size_t start, size_t end,
+                    std::vector<FastqRecordView> &records) const;
+
+  static constexpr size_t kBlockSize = (size_t)1 << 26;
+  static constexpr size_t kMinChunkSize = (size_t)1 << 20;
+
+  std::string file_path_;
+  int num_threads_ = 1;
+  char *data_ = NULL;
+  size_t size_ = 0;
+  size_t num_parsed_bytes_ = 0;
+
+  std::vector<std::vector<FastqRecordView>> chunk_records_;
+  size_t current_chunk_index_ = 0;
+  size_t current_record_index_ = 0;
+};
+
+}  // namespace chromap
+
+#endif  // MAPPED_FASTQ_FILE_H_
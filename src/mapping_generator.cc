@@ -32,7 +32,8 @@ void MappingGenerator<PAFMapping>::EmplaceBackSingleEndMappingRecord(
     MappingInMemory &mapping_in_memory,
     std::vector<std::vector<PAFMapping>> &mappings_on_diff_ref_seqs) {
   mappings_on_diff_ref_seqs[mapping_in_memory.rid].emplace_back(
-      mapping_in_memory.read_id, std::string(mapping_in_memory.read_name),
+      mapping_in_memory.read_id, std::string(mapping_in_memory.read_name,
+                  mapping_in_memory.read_name_length),
       mapping_in_memory.read_length,
       mapping_in_memory.GetFragmentStartPosition(),
       mapping_in_memory.GetFragmentLength(), mapping_in_memory.mapq,
@@ -45,15 +46,18 @@ void MappingGenerator<SAMMapping>::EmplaceBackSingleEndMappingRecord(
     MappingInMemory &mapping_in_memory,
     std::vector<std::vector<SAMMapping>> &mappings_on_diff_ref_seqs) {
   mappings_on_diff_ref_seqs[mapping_in_memory.rid].emplace_back(
-      mapping_in_memory.read_id, std::string(mapping_in_memory.read_name),
+      mapping_in_memory.read_id, std::string(mapping_in_memory.read_name,
+                  mapping_in_memory.read_name_length),
       mapping_in_memory.barcode_key, /*num_dups=*/1,
       mapping_in_memory.GetFragmentStartPosition(), mapping_in_memory.rid,
       /*mpos=*/0, /*mrid=*/-1, /*tlen=*/0, 
       mapping_in_memory.SAM_flag, mapping_in_memory.GetStrand(),
       /*is_alt=*/0, mapping_in_memory.is_unique, mapping_in_memory.mapq,
       mapping_in_memory.NM, mapping_in_memory.n_cigar, mapping_in_memory.cigar,
-      mapping_in_memory.MD_tag, std::string(mapping_in_memory.read_sequence),
-      std::string(mapping_in_memory.qual_sequence));
+      mapping_in_memory.MD_tag, std::string(mapping_in_memory.read_sequence,
+                                           mapping_in_memory.read_length),
+      std::string(mapping_in_memory.qual_sequence,
+                  mapping_in_memory.read_length));
 }
 
 template <>
@@ -93,7 +97,8 @@ void MappingGenerator<SAMMapping>::EmplaceBackPairedEndMappingRecord(
         paired_end_mapping_in_memory.mapping_in_memory1);
   
     mappings_on_diff_ref_seqs[mapping_in_memory.rid].emplace_back(
-      mapping_in_memory.read_id, std::string(mapping_in_memory.read_name),
+      mapping_in_memory.read_id, std::string(mapping_in_memory.read_name,
+                  mapping_in_memory.read_name_length),
       mapping_in_memory.barcode_key, /*num_dups=*/1,
       mapping_in_memory.GetFragmentStartPosition(), mapping_in_memory.rid,
       /*mpos=*/mate_mapping_in_memory.GetFragmentStartPosition(), 
@@ -102,8 +107,10 @@ void MappingGenerator<SAMMapping>::EmplaceBackPairedEndMappingRecord(
       mapping_in_memory.SAM_flag, mapping_in_memory.GetStrand(),
       /*is_alt=*/0, mapping_in_memory.is_unique, mapping_in_memory.mapq,
       mapping_in_memory.NM, mapping_in_memory.n_cigar, mapping_in_memory.cigar,
-      mapping_in_memory.MD_tag, std::string(mapping_in_memory.read_sequence),
-      std::string(mapping_in_memory.qual_sequence));
+      mapping_in_memory.MD_tag, std::string(mapping_in_memory.read_sequence,
+                                           mapping_in_memory.read_length),
+      std::string(mapping_in_memory.qual_sequence,
+                  mapping_in_memory.read_length));
   }
 }
 
@@ -150,9 +157,11 @@ void MappingGenerator<PairedPAFMapping>::EmplaceBackPairedEndMappingRecord(
       .emplace_back(
           paired_end_mapping_in_memory.GetReadId(),
           std::string(
-              paired_end_mapping_in_memory.mapping_in_memory1.read_name),
+              paired_end_mapping_in_memory.mapping_in_memory1.read_name,
+              paired_end_mapping_in_memory.mapping_in_memory1.read_name_length),
           std::string(
-              paired_end_mapping_in_memory.mapping_in_memory2.read_name),
+              paired_end_mapping_in_memory.mapping_in_memory2.read_name,
+              paired_end_mapping_in_memory.mapping_in_memory2.read_name_length),
           paired_end_mapping_in_memory.mapping_in_memory1.read_length,
           paired_end_mapping_in_memory.mapping_in_memory2.read_length,
           paired_end_mapping_in_memory.GetFragmentStartPosition(),
@@ -203,7 +212,9 @@ void MappingGenerator<PairsMapping>::EmplaceBackPairedEndMappingRecord(
 
   mappings_on_diff_ref_seqs[rid1].emplace_back(
       paired_end_mapping_in_memory.GetReadId(),
-      std::string(paired_end_mapping_in_memory.mapping_in_memory1.read_name),
+      std::string(
+          paired_end_mapping_in_memory.mapping_in_memory1.read_name,
+          paired_end_mapping_in_memory.mapping_in_memory1.read_name_length),
       paired_end_mapping_in_memory.GetBarcode(), rid1, rid2, position1,
       position2, strand1, strand2, paired_end_mapping_in_memory.mapq,
       paired_end_mapping_in_memory.is_unique, /*num_dups=*/1);
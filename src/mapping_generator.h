@@ -271,12 +271,16 @@ void MappingGenerator<MappingRecord>::ProcessBestMappingsForSingleEndRead(
   const uint32_t read_id = read_batch.GetSequenceIdAt(read_index);
   const char *read_name = read_batch.GetSequenceNameAt(read_index);
   const uint32_t read_length = read_batch.GetSequenceLengthAt(read_index);
-  const std::string &negative_read =
-      read_batch.GetNegativeSequenceAt(read_index);
+  const char *negative_read =
+      mapping_strand == kNegative
+          ? mapping_metadata.GetNegativeRead(read_batch, read_index).data()
+          : nullptr;
 
   MappingInMemory mapping_in_memory;
   mapping_in_memory.read_id = read_id;
   mapping_in_memory.read_name = read_name;
+  mapping_in_memory.read_name_length =
+      read_batch.GetSequenceNameLengthAt(read_index);
   mapping_in_memory.is_unique = (mapping_metadata.num_best_mappings_ == 1);
 
   uint64_t barcode_key = 0;
@@ -289,7 +293,7 @@ void MappingGenerator<MappingRecord>::ProcessBestMappingsForSingleEndRead(
 
   mapping_in_memory.strand = mapping_strand;
   mapping_in_memory.read_sequence =
-      mapping_strand == kPositive ? read : negative_read.data();
+      mapping_strand == kPositive ? read : negative_read;
   mapping_in_memory.read_length = read_length;
 
   for (uint32_t mi = 0; mi < mappings.size(); ++mi) {
@@ -505,10 +509,18 @@ void MappingGenerator<MappingRecord>::
   const uint32_t read2_length = read_batch2.GetSequenceLengthAt(pair_index);
   const char *read1_name = read_batch1.GetSequenceNameAt(pair_index);
   const char *read2_name = read_batch2.GetSequenceNameAt(pair_index);
-  const std::string &negative_read1 =
-      read_batch1.GetNegativeSequenceAt(pair_index);
-  const std::string &negative_read2 =
-      read_batch2.GetNegativeSequenceAt(pair_index);
+  const char *negative_read1 =
+      first_read_strand == kNegative
+          ? paired_end_mapping_metadata.mapping_metadata1_
+                .GetNegativeRead(read_batch1, pair_index)
+                .data()
+          : nullptr;
+  const char *negative_read2 =
+      second_read_strand == kNegative
+          ? paired_end_mapping_metadata.mapping_metadata2_
+                .GetNegativeRead(read_batch2, pair_index)
+                .data()
+          : nullptr;
   const uint32_t read_id = read_batch1.GetSequenceIdAt(pair_index);
 
   paired_end_mapping_in_memory.mapping_in_memory1.read_id = read_id;
@@ -516,6 +528,10 @@ void MappingGenerator<MappingRecord>::
 
   paired_end_mapping_in_memory.mapping_in_memory1.read_name = read1_name;
   paired_end_mapping_in_memory.mapping_in_memory2.read_name = read2_name;
+  paired_end_mapping_in_memory.mapping_in_memory1.read_name_length =
+      read_batch1.GetSequenceNameLengthAt(pair_index);
+  paired_end_mapping_in_memory.mapping_in_memory2.read_name_length =
+      read_batch2.GetSequenceNameLengthAt(pair_index);
 
   paired_end_mapping_in_memory.mapping_in_memory1.read_length = read1_length;
   paired_end_mapping_in_memory.mapping_in_memory2.read_length = read2_length;
@@ -579,9 +595,9 @@ void MappingGenerator<MappingRecord>::
       paired_end_mapping_in_memory.mapping_in_memory2.rid = rid2;
 
       paired_end_mapping_in_memory.mapping_in_memory1.read_sequence =
-          first_read_strand == kPositive ? read1 : negative_read1.data();
+          first_read_strand == kPositive ? read1 : negative_read1;
       paired_end_mapping_in_memory.mapping_in_memory2.read_sequence =
-          second_read_strand == kPositive ? read2 : negative_read2.data();
+          second_read_strand == kPositive ? read2 : negative_read2;
 
       if (mapping_parameters_.split_alignment) {
         paired_end_mapping_in_memory.mapping_in_memory1.read_split_site =
@@ -884,11 +900,14 @@ void MappingGenerator<MappingRecord>::GetRefStartEndPositionForReadFromMapping(
       // reference.GetSequenceAt(rid)
       // + verification_window_start_position, read + read_start_site,
       // read_length, &mapping_end_position);
+      // Unlike the verifiers, this keeps the old stopping rule: a split read
+      // can have more errors than the threshold, and it still needs the end
+      // position, which the early exit on the band lower bound would skip.
       BandedAlignPatternToText(
           mapping_parameters_.error_threshold,
           reference.GetSequenceAt(rid) + verification_window_start_position,
           mapping_in_memory.read_sequence + read_start_site, read_length,
-          &mapping_end_position);
+          &mapping_end_position, /*find_end_past_error_threshold=*/true);
       // seems banded align's mapping end position is included?
       mapping_end_position += 1;
     }
@@ -32,6 +32,7 @@ struct MappingInMemory {
 
   // It does NOT own read or read qual.
   const char *read_name = nullptr;
+  uint32_t read_name_length = 0;
   const char *read_sequence = nullptr;
   const char *qual_sequence = nullptr;
 
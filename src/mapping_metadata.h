@@ -3,22 +3,27 @@
 
 #include <algorithm>
 #include <cstdio>
+#include <string>
 #include <utility>
 #include <vector>
 
 #include "minimizer.h"
 #include "candidate.h"
 #include "draft_mapping.h"
+#include "sequence_batch.h"
 
 namespace chromap {
 
 class mm_cache;
+class CacheUpdateLog;
 class Index;
 class CandidateProcessor;
 class PairedEndMappingMetadata;
 class DraftMappingGenerator;
 template <typename MappingRecord>
 class MappingGenerator;
+template <typename MappingRecord>
+class MappingResultCache;
 class Chromap;
 
 class MappingMetadata {
@@ -56,6 +61,18 @@ class MappingMetadata {
     negative_candidates_.clear();
   }
 
+  // Return the reverse complement of the read. It is only generated the first
+  // time it is requested after PrepareForMappingNextRead, so reads without
+  // negative strand candidates or mappings never pay for it.
+  inline const std::string &GetNegativeRead(const SequenceBatch &read_batch,
+                                            uint32_t read_index) const {
+    if (!is_negative_read_generated_) {
+      read_batch.GetNegativeSequenceAt(read_index, negative_read_);
+      is_negative_read_generated_ = true;
+    }
+    return negative_read_;
+  }
+
   // Callback function to update all candidates.
   inline void UpdateCandidates(void (*Update)(std::vector<Candidate> &)) {
     Update(positive_candidates_);
@@ -139,6 +156,7 @@ class MappingMetadata {
     negative_mappings_.clear();
     positive_split_sites_.clear();
     negative_split_sites_.clear();
+    is_negative_read_generated_ = false;
   }
 
   int min_num_errors_, second_min_num_errors_;
@@ -157,6 +175,22 @@ class MappingMetadata {
   std::vector<Candidate> positive_candidates_buffer_;
   std::vector<Candidate> negative_candidates_buffer_;
 
+  // The candidates supplemented with the mate info.
+  std::vector<Candidate> augment_positive_candidates_;
+  std::vector<Candidate> augment_negative_candidates_;
+  // The reference ranges around the mate candidates searched to rescue the
+  // read.
+  std::vector<std::pair<uint64_t, uint64_t>> mate_candidate_boundaries_;
+
+  // Scratch buffers to merge the sorted candidate position lists of the
+  // minimizers. The lists are saved back to back with their offsets.
+  std::vector<uint64_t> positive_candidate_position_lists_;
+  std::vector<uint64_t> negative_candidate_position_lists_;
+  std::vector<uint32_t> positive_candidate_position_list_offsets_;
+  std::vector<uint32_t> negative_candidate_position_list_offsets_;
+  std::vector<std::pair<uint32_t, uint32_t>> candidate_position_list_ranges_;
+  std::vector<uint32_t> candidate_position_list_losers_;
+
   // The first element is ed, and the second element is position.
   std::vector<DraftMapping> positive_mappings_;
   std::vector<DraftMapping> negative_mappings_;
@@ -164,13 +198,20 @@ class MappingMetadata {
   std::vector<int> positive_split_sites_;
   std::vector<int> negative_split_sites_;
 
+  // Reused across reads to avoid allocating a new string for every read.
+  mutable std::string negative_read_;
+  mutable bool is_negative_read_generated_ = false;
+
   friend class mm_cache;
+  friend class CacheUpdateLog;
   friend class Index;
   friend class CandidateProcessor;
   friend class PairedEndMappingMetadata;
   friend class DraftMappingGenerator;
   template <typename MappingRecord>
   friend class MappingGenerator;
+  template <typename MappingRecord>
+  friend class MappingResultCache;
   friend class Chromap;
 };
 
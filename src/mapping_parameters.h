@@ -4,6 +4,8 @@
 #include <cstdint>
 #include <string>
 
+#include "huge_page_memory.h"
+
 namespace chromap {
 
 enum MappingOutputFormat {
@@ -26,6 +28,20 @@ struct MappingParameters {
 
   double cache_update_param = 0.01;
   int cache_size = 4000003;
+  // Grow or shrink the cache between batches within this many MB, when it is
+  // positive. Otherwise the cache keeps its size.
+  int cache_max_memory_mb = 0;
+  // Number of cache entries per set, 1 for a direct-mapped cache.
+  int cache_associativity = 1;
+  // Preload the cache from this file and dump the cache into that file after
+  // mapping, when they are not empty.
+  std::string cache_load_file_path;
+  std::string cache_dump_file_path;
+  // Number of reads (pairs) whose final mappings are cached to be replayed
+  // for their exact duplicates, 0 to disable the cache.
+  int mapping_result_cache_size = 0;
+  // Map each group of exact duplicate read pairs of a batch once.
+  bool collapse_batch_duplicates = false;
   bool debug_cache = false;
   std::string frip_est_params = "-1.0996;4.2391;3.0164e-05;-2.1087e-04;-5.5825e-05";
   bool output_num_uniq_cache_slots = true;
@@ -37,6 +53,22 @@ struct MappingParameters {
   int max_insert_size = 1000;
   uint8_t mapq_threshold = 30;
   int num_threads = 1;
+  // Number of background threads decompressing each read file. When it is 0,
+  // read files are decompressed by the threads parsing them.
+  int num_decompression_threads = 0;
+  // Parse uncompressed FASTQ read and barcode files through mmap. Each file is
+  // then parsed by max(1, num_decompression_threads) threads.
+  bool mmap_read_files = false;
+  // Number of read batches in the mapping pipeline at the same time. Loading
+  // can run ahead of mapping and output by up to this many batches.
+  int num_in_flight_batches = 3;
+  // Pin the mapping threads to the NUMA nodes, in contiguous blocks of threads.
+  bool bind_numa_nodes = false;
+  // Number of NUMA nodes with their own replica of the index and reference,
+  // which need the threads to be pinned. 0 maps with the primary copies only.
+  int num_numa_replicas = 0;
+  // Back the index, reference and cache with huge pages.
+  HugePageMode huge_page_mode = HUGE_PAGE_MODE_OFF;
   int min_read_length = 30;
   int barcode_correction_error_threshold = 1;
   double barcode_correction_probability_threshold = 0.9;
@@ -45,6 +77,17 @@ struct MappingParameters {
   // Read with more than this number of mappings will be dropped.
   int drop_repetitive_reads = 500000;
   bool trim_adapters = false;
+  // The adapter trimmed from the 3' of single-end reads. Paired-end reads are
+  // trimmed by their overlap instead.
+  std::string adapter_sequence = "CTGTCTCTTATACACATCT";
+  // Shorter matches of the adapter at the 3' end are too likely to be random.
+  int min_adapter_overlap_length = 8;
+  // Trim 3' poly-G tails, e.g. from 2-color sequencers, of at least this
+  // length. 0 disables the trimming.
+  int min_poly_g_tail_length = 0;
+  // Drop reads (pairs) whose triplet entropy, from 0 to 1, is below this.
+  // 0 disables the filter.
+  double min_read_complexity = 0;
   bool remove_pcr_duplicates = false;
   bool remove_pcr_duplicates_at_bulk_level = true;
   bool is_bulk_data = true;
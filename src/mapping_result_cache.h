@@ -0,0 +1,294 @@
+#ifndef MAPPING_RESULT_CACHE_H_
+#define MAPPING_RESULT_CACHE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bed_mapping.h"
+#include "mapping_metadata.h"
+#include "sequence_batch.h"
+
+namespace chromap {
+
+// The mapping stats a read or a read pair added when it was mapped.
+struct MappingResultStats {
+  uint64_t num_candidates = 0;
+  uint64_t num_mappings = 0;
+  uint64_t num_mapped_reads = 0;
+  uint64_t num_uniquely_mapped_reads = 0;
+
+  MappingResultStats() = default;
+  MappingResultStats(uint64_t num_candidates, uint64_t num_mappings,
+                     uint64_t num_mapped_reads,
+                     uint64_t num_uniquely_mapped_reads)
+      : num_candidates(num_candidates),
+        num_mappings(num_mappings),
+        num_mapped_reads(num_mapped_reads),
+        num_uniquely_mapped_reads(num_uniquely_mapped_reads) {}
+
+  MappingResultStats operator-(const MappingResultStats &stats) const {
+    return MappingResultStats(
+        num_candidates - stats.num_candidates,
+        num_mappings - stats.num_mappings,
+        num_mapped_reads - stats.num_mapped_reads,
+        num_uniquely_mapped_reads - stats.num_uniquely_mapped_reads);
+  }
+
+  void AddTo(uint64_t &total_num_candidates, uint64_t &total_num_mappings,
+             uint64_t &total_num_mapped_reads,
+             uint64_t &total_num_uniquely_mapped_reads) const {
+    total_num_candidates += num_candidates;
+    total_num_mappings += num_mappings;
+    total_num_mapped_reads += num_mapped_reads;
+    total_num_uniquely_mapped_reads += num_uniquely_mapped_reads;
+  }
+};
+
+// Only BED and TagAlign mappings are cached, as the mappings of exact
+// duplicates only differ in their read ids and barcodes. The other records
+// keep the read names and sequences and are never replayed.
+inline void SetReadIdAndBarcode(uint32_t read_id, uint64_t barcode,
+                                MappingWithBarcode &mapping) {
+  mapping.read_id_ = read_id;
+  mapping.cell_barcode_ = barcode;
+}
+
+inline void SetReadIdAndBarcode(uint32_t read_id, uint64_t /*barcode*/,
+                                MappingWithoutBarcode &mapping) {
+  mapping.read_id_ = read_id;
+}
+
+inline void SetReadIdAndBarcode(uint32_t read_id, uint64_t barcode,
+                                PairedEndMappingWithBarcode &mapping) {
+  mapping.read_id_ = read_id;
+  mapping.cell_barcode_ = barcode;
+}
+
+inline void SetReadIdAndBarcode(uint32_t read_id, uint64_t /*barcode*/,
+                                PairedEndMappingWithoutBarcode &mapping) {
+  mapping.read_id_ = read_id;
+}
+
+template <typename MappingRecord>
+inline void SetReadIdAndBarcode(uint32_t /*read_id*/, uint64_t /*barcode*/,
+                                MappingRecord & /*mapping*/) {}
+
+// A direct-mapped cache of the final mappings of reads (or read pairs) keyed
+// by their full sequences, so that the exact duplicates of a read replay its
+// mappings instead of being mapped again. A read is only cached the second
+// time its hash shows up, which keeps the reads seen once out of the cache.
+// A read pair with more best mappings than reported is never cached, as each
+// pair draws its own random subset of them. Single-end reads draw from a
+// generator seeded for every read, so their duplicates draw the same subset.
+//
+// Lookups are lock-free. Each slot points to an immutable entry and a new
+// entry replaces the old one by exchanging the pointer. The replaced entries
+// are retired and only freed between the batches, when no lookup runs.
+template <typename MappingRecord>
+class MappingResultCache {
+ public:
+  // A cache of 0 slots is disabled.
+  explicit MappingResultCache(uint32_t num_slots) : num_slots_(num_slots) {
+    if (num_slots_ == 0) {
+      return;
+    }
+    slots_.reset(new std::atomic<Entry *>[num_slots_]);
+    seen_read_hashes_.reset(new std::atomic<uint64_t>[num_slots_]);
+    for (uint32_t i = 0; i < num_slots_; ++i) {
+      slots_[i].store(NULL, std::memory_order_relaxed);
+      seen_read_hashes_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  ~MappingResultCache() {
+    ReclaimRetiredEntries();
+    for (uint32_t i = 0; i < num_slots_; ++i) {
+      delete slots_[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  inline bool IsEnabled() const { return num_slots_ > 0; }
+
+  // 'read_batch2' is NULL for single-end reads.
+  static uint64_t GetReadHash(const SequenceBatch &read_batch1,
+                              const SequenceBatch *read_batch2,
+                              uint32_t read_index) {
+    uint64_t read_hash = 14695981039346656037ULL;
+    HashSequence(read_batch1.GetSequenceAt(read_index),
+                 read_batch1.GetSequenceLengthAt(read_index), read_hash);
+    // Separate the mates so that moving bases between them changes the hash.
+    read_hash = (read_hash ^ 0xff) * 1099511628211ULL;
+    if (read_batch2 != NULL) {
+      HashSequence(read_batch2->GetSequenceAt(read_index),
+                   read_batch2->GetSequenceLengthAt(read_index), read_hash);
+    }
+    return read_hash;
+  }
+
+  // Append the cached mappings of an exact duplicate of the read with its read
+  // id and barcode. Return false on a cache miss. The ends of the mapping lists
+  // before the replayed mappings are appended to 'mapping_list_ends' if it is
+  // not NULL.
+  bool Replay(
+      uint64_t read_hash, const SequenceBatch &read_batch1,
+      const SequenceBatch *read_batch2, uint32_t read_index, uint64_t barcode,
+      MappingResultStats &stats,
+      std::vector<std::vector<MappingRecord>> &mappings_on_diff_ref_seqs,
+      std::vector<std::pair<uint32_t, size_t>> *mapping_list_ends) const {
+    const Entry *entry =
+        slots_[read_hash % num_slots_].load(std::memory_order_acquire);
+    if (entry == NULL || entry->read_hash != read_hash ||
+        !IsSameRead(*entry, read_batch1, read_batch2, read_index)) {
+      return false;
+    }
+
+    const uint32_t read_id = read_batch1.GetSequenceIdAt(read_index);
+    for (const std::pair<uint32_t, MappingRecord> &mapping : entry->mappings) {
+      // The mappings are saved in the order of their reference sequences.
+      if (mapping_list_ends != NULL && (mapping_list_ends->empty() ||
+                                        mapping_list_ends->back().first !=
+                                            mapping.first)) {
+        mapping_list_ends->emplace_back(
+            mapping.first, mappings_on_diff_ref_seqs[mapping.first].size());
+      }
+      mappings_on_diff_ref_seqs[mapping.first].push_back(mapping.second);
+      SetReadIdAndBarcode(read_id, barcode,
+                          mappings_on_diff_ref_seqs[mapping.first].back());
+    }
+    stats = entry->stats;
+    return true;
+  }
+
+  // Whether the mappings of the read should be cached after it is mapped.
+  bool Admit(uint64_t read_hash) {
+    std::atomic<uint64_t> &seen_read_hash =
+        seen_read_hashes_[read_hash % num_slots_];
+    if (seen_read_hash.load(std::memory_order_relaxed) == read_hash) {
+      return true;
+    }
+    seen_read_hash.store(read_hash, std::memory_order_relaxed);
+    return false;
+  }
+
+  // Save the ends of the mapping lists the mappings of the read will be
+  // appended to, which are on the reference sequences of its draft mappings.
+  void MarkMappingListEnds(
+      const MappingMetadata &mapping_metadata,
+      const std::vector<std::vector<MappingRecord>> &mappings_on_diff_ref_seqs,
+      std::vector<std::pair<uint32_t, size_t>> &mapping_list_ends) const {
+    mapping_list_ends.clear();
+    for (const DraftMapping &mapping : mapping_metadata.positive_mappings_) {
+      const uint32_t rid = mapping.GetReferenceSequenceIndex();
+      mapping_list_ends.emplace_back(rid,
+                                     mappings_on_diff_ref_seqs[rid].size());
+    }
+    for (const DraftMapping &mapping : mapping_metadata.negative_mappings_) {
+      const uint32_t rid = mapping.GetReferenceSequenceIndex();
+      mapping_list_ends.emplace_back(rid,
+                                     mappings_on_diff_ref_seqs[rid].size());
+    }
+    std::sort(mapping_list_ends.begin(), mapping_list_ends.end());
+    mapping_list_ends.erase(
+        std::unique(mapping_list_ends.begin(), mapping_list_ends.end()),
+        mapping_list_ends.end());
+  }
+
+  // Cache the mappings appended after the marked list ends.
+  void Insert(uint64_t read_hash, const SequenceBatch &read_batch1,
+              const SequenceBatch *read_batch2, uint32_t read_index,
+              const MappingResultStats &stats,
+              const std::vector<std::pair<uint32_t, size_t>> &mapping_list_ends,
+              const std::vector<std::vector<MappingRecord>>
+                  &mappings_on_diff_ref_seqs) {
+    Entry *entry = new Entry;
+    entry->read_hash = read_hash;
+    entry->read1_length = read_batch1.GetSequenceLengthAt(read_index);
+    entry->sequences.assign(read_batch1.GetSequenceAt(read_index),
+                            entry->read1_length);
+    if (read_batch2 != NULL) {
+      entry->sequences.append(read_batch2->GetSequenceAt(read_index),
+                              read_batch2->GetSequenceLengthAt(read_index));
+    }
+    for (const std::pair<uint32_t, size_t> &list_end : mapping_list_ends) {
+      const std::vector<MappingRecord> &mappings =
+          mappings_on_diff_ref_seqs[list_end.first];
+      for (size_t mi = list_end.second; mi < mappings.size(); ++mi) {
+        entry->mappings.emplace_back(list_end.first, mappings[mi]);
+      }
+    }
+    entry->stats = stats;
+
+    Entry *replaced_entry = slots_[read_hash % num_slots_].exchange(
+        entry, std::memory_order_acq_rel);
+    if (replaced_entry != NULL) {
+      std::lock_guard<std::mutex> lock(retired_entries_lock_);
+      retired_entries_.push_back(replaced_entry);
+    }
+  }
+
+  // Must not run concurrently with the lookups.
+  void ReclaimRetiredEntries() {
+    for (Entry *entry : retired_entries_) {
+      delete entry;
+    }
+    retired_entries_.clear();
+  }
+
+ private:
+  struct Entry {
+    uint64_t read_hash = 0;
+    uint32_t read1_length = 0;
+    // The sequence of read1 followed by the one of read2.
+    std::string sequences;
+    // The reference sequence index and the record of each mapping.
+    std::vector<std::pair<uint32_t, MappingRecord>> mappings;
+    MappingResultStats stats;
+  };
+
+  static inline void HashSequence(const char *sequence, uint32_t length,
+                                  uint64_t &hash) {
+    for (uint32_t i = 0; i < length; ++i) {
+      hash = (hash ^ (uint8_t)sequence[i]) * 1099511628211ULL;
+    }
+  }
+
+  static inline bool IsSameRead(const Entry &entry,
+                                const SequenceBatch &read_batch1,
+                                const SequenceBatch *read_batch2,
+                                uint32_t read_index) {
+    const uint32_t read1_length = read_batch1.GetSequenceLengthAt(read_index);
+    const uint32_t read2_length =
+        read_batch2 == NULL ? 0 : read_batch2->GetSequenceLengthAt(read_index);
+    if (entry.read1_length != read1_length ||
+        entry.sequences.size() != (size_t)read1_length + read2_length) {
+      return false;
+    }
+    if (memcmp(entry.sequences.data(), read_batch1.GetSequenceAt(read_index),
+               read1_length) != 0) {
+      return false;
+    }
+    return read_batch2 == NULL ||
+           memcmp(entry.sequences.data() + read1_length,
+                  read_batch2->GetSequenceAt(read_index), read2_length) == 0;
+  }
+
+  const uint32_t num_slots_;
+  std::unique_ptr<std::atomic<Entry *>[]> slots_;
+  // The hash of the last read that missed each slot, to admit a read on its
+  // second appearance.
+  std::unique_ptr<std::atomic<uint64_t>[]> seen_read_hashes_;
+  std::vector<Entry *> retired_entries_;
+  std::mutex retired_entries_lock_;
+};
+
+}  // namespace chromap
+
+#endif  // MAPPING_RESULT_CACHE_H_
@@ -1,8 +1,15 @@
 #ifndef CHROMAP_CACHE_H_
 #define CHROMAP_CACHE_H_
 
+#include "cache_file.h"
+#include "huge_page_memory.h"
 #include "index.h"
 #include "minimizer.h"
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <mutex>
 
 #define FINGER_PRINT_SIZE 103
@@ -10,49 +17,276 @@
 #define HEAD_MM_ARRAY_SIZE 4194304   // 2^22
 #define HEAD_MM_ARRAY_MASK 0x3fffff  // 22 positions
 
+#define PAYLOAD_SLAB_SIZE 4194304  // 4MB
+
 namespace chromap {
+// The cached minimizers and candidates of an entry, stored contiguously in the
+// payload slabs of the cache: this header, then the minimizers, offsets,
+// strands and, 8-byte aligned, the candidates as arrays of the positive then
+// negative positions followed by the positive then negative counts. Keeping
+// the positions and counts apart saves the padding of Candidate, so each
+// candidate takes 9 bytes instead of 16. A payload is never modified once
+// published, so that queries can read it without locking. Renewing an entry
+// publishes a new payload and retires the old one.
+struct _mm_cache_entry_payload {
+  uint32_t num_minimizers;
+  uint32_t num_positive_candidates;
+  uint32_t num_negative_candidates;
+  uint32_t repetitive_seed_length;
+
+  // The size is a multiple of 8 to keep the next payload in a slab aligned.
+  static size_t GetSize(uint32_t num_minimizers,
+                        uint32_t num_positive_candidates,
+                        uint32_t num_negative_candidates) {
+    const size_t size = GetCandidatePositionsOffset(num_minimizers) +
+                        (num_positive_candidates + num_negative_candidates) *
+                            (sizeof(uint64_t) + sizeof(uint8_t));
+    return (size + 7) & ~(size_t)7;
+  }
+
+  size_t GetSize() const {
+    return GetSize(num_minimizers, num_positive_candidates,
+                   num_negative_candidates);
+  }
+
+  const uint64_t *GetMinimizers() const { return (const uint64_t *)(this + 1); }
+  uint64_t *GetMinimizers() { return (uint64_t *)(this + 1); }
+
+  // The distance to the next minimizer.
+  const int *GetOffsets() const {
+    return (const int *)(GetMinimizers() + num_minimizers);
+  }
+  int *GetOffsets() { return (int *)(GetMinimizers() + num_minimizers); }
+
+  const uint8_t *GetStrands() const {
+    return (const uint8_t *)(GetOffsets() + num_minimizers - 1);
+  }
+  uint8_t *GetStrands() {
+    return (uint8_t *)(GetOffsets() + num_minimizers - 1);
+  }
+
+  const uint64_t *GetPositiveCandidatePositions() const {
+    return (const uint64_t *)((const char *)this +
+                              GetCandidatePositionsOffset(num_minimizers));
+  }
+  uint64_t *GetPositiveCandidatePositions() {
+    return (uint64_t *)((char *)this +
+                        GetCandidatePositionsOffset(num_minimizers));
+  }
+
+  const uint64_t *GetNegativeCandidatePositions() const {
+    return GetPositiveCandidatePositions() + num_positive_candidates;
+  }
+  uint64_t *GetNegativeCandidatePositions() {
+    return GetPositiveCandidatePositions() + num_positive_candidates;
+  }
+
+  const uint8_t *GetPositiveCandidateCounts() const {
+    return (const uint8_t *)(GetNegativeCandidatePositions() +
+                             num_negative_candidates);
+  }
+  uint8_t *GetPositiveCandidateCounts() {
+    return (uint8_t *)(GetNegativeCandidatePositions() +
+                       num_negative_candidates);
+  }
+
+  const uint8_t *GetNegativeCandidateCounts() const {
+    return GetPositiveCandidateCounts() + num_positive_candidates;
+  }
+  uint8_t *GetNegativeCandidateCounts() {
+    return GetPositiveCandidateCounts() + num_positive_candidates;
+  }
+
+ private:
+  static size_t GetCandidatePositionsOffset(uint32_t num_minimizers) {
+    const size_t size = sizeof(struct _mm_cache_entry_payload) +
+                        num_minimizers * sizeof(uint64_t) +
+                        (num_minimizers - 1) * sizeof(int) + num_minimizers;
+    return (size + 7) & ~(size_t)7;
+  }
+};
+
+// A fixed-size slot of the cache. All-zero slots are empty, so the slots are
+// allocated zeroed instead of being initialized one by one. The slots are
+// grouped into sets of 'associativity' consecutive slots, and the first slot
+// of a set also holds the state of the set.
 struct _mm_cache_entry {
-  std::vector<uint64_t> minimizers;
-  std::vector<int> offsets;  // the distance to the next minimizer
-  std::vector<uint8_t> strands;
-  std::vector<Candidate> positive_candidates;
-  std::vector<Candidate> negative_candidates;
+  std::atomic<const struct _mm_cache_entry_payload *> payload;
+  // The low 32 bits of the hash of the payload, checked before the payload.
+  std::atomic<uint32_t> signature;
+  // Odd while an update holds the set. The statistics below, and the finger
+  // print counts of the set, are only accessed by the holder.
+  std::atomic<uint32_t> version;
   int weight;
-  unsigned short finger_print_cnt[FINGER_PRINT_SIZE];
-  int finger_print_cnt_sum;
-  uint32_t repetitive_seed_length;
+  int finger_print_cnt_sum;  // of the set
   int activated;
+  // Set by query hits and cleared by the clock sweep of set-associative caches.
+  std::atomic<uint8_t> referenced;
+  uint8_t clock_hand;  // of the set
 };
 
 class mm_cache {
  private:
   int cache_size;
+  // Direct-mapped when it is 1. Otherwise a read can be cached in any slot of
+  // its set, and the slots are replaced in clock order.
+  int associativity;
+  int num_sets;
   struct _mm_cache_entry *cache;
-  int num_locks_for_cache = 1000;
-  omp_lock_t entry_locks_omp[1000];
+  // FINGER_PRINT_SIZE counts for each set. They are only needed by updates,
+  // so they are kept apart from the entries.
+  unsigned short *finger_print_cnts;
   std::mutex print_lock;
   int kmer_length;
   int update_limit;
   int saturate_count;
-  uint64_t *
-      head_mm;  // the first and last minimizer for each cached minimizer vector
+  std::atomic<uint64_t>
+      *head_mm;  // the first and last minimizer for each cached minimizer vector
+
+  // The payloads are bump-allocated in slabs. Retired payloads are only
+  // counted and their space is reclaimed by CompactPayloads().
+  std::vector<std::unique_ptr<uint64_t[], HugePageMemoryDeleter>>
+      payload_slabs;
+  std::vector<size_t> payload_slab_capacities;
+  size_t payload_slab_used_size = 0;
+  uint64_t num_live_payload_bytes = 0;
+  uint64_t num_retired_payload_bytes = 0;
+  std::mutex payload_slabs_lock;
+
+  // Feedback for resizing the cache.
+  std::atomic<uint64_t> num_occupied_slots{0};
+  // Renewals that replaced another cached entry.
+  std::atomic<uint64_t> num_evictions{0};
+  std::atomic<uint64_t> num_updates_since_resize{0};
+
+  // Must be called with 'payload_slabs_lock' held.
+  struct _mm_cache_entry_payload *AllocatePayload(size_t size) {
+    if (payload_slabs.empty() ||
+        payload_slab_used_size + size > payload_slab_capacities.back()) {
+      // Large payloads get their own slab.
+      const size_t capacity =
+          size > PAYLOAD_SLAB_SIZE ? size : PAYLOAD_SLAB_SIZE;
+      uint64_t *payload_slab = (uint64_t *)AllocateHugePageMemory(capacity);
+      if (payload_slab == NULL) {
+        ExitWithMessage("Failed to allocate the cache!");
+      }
+      payload_slabs.emplace_back(payload_slab);
+      payload_slab_capacities.push_back(capacity);
+      payload_slab_used_size = 0;
+    }
+    char *memory = (char *)payload_slabs.back().get() + payload_slab_used_size;
+    payload_slab_used_size += size;
+    num_live_payload_bytes += size;
+    return (struct _mm_cache_entry_payload *)memory;
+  }
+
+  void LockEntry(struct _mm_cache_entry &entry) {
+    uint32_t version = entry.version.load(std::memory_order_relaxed);
+    while ((version & 1) ||
+           !entry.version.compare_exchange_weak(version, version + 1,
+                                                std::memory_order_acquire,
+                                                std::memory_order_relaxed)) {
+      version = entry.version.load(std::memory_order_relaxed);
+    }
+  }
+
+  void UnlockEntry(struct _mm_cache_entry &entry) {
+    entry.version.fetch_add(1, std::memory_order_release);
+  }
+
+  // Return the slot of a locked set to be replaced, preferring empty slots and
+  // then the first slot without a recent hit from the clock hand.
+  int FindVictimInSet(struct _mm_cache_entry *set) {
+    for (int way = 0; way < associativity; ++way) {
+      if (set[way].payload.load(std::memory_order_relaxed) == NULL) return way;
+    }
+    while (true) {
+      const int way = set[0].clock_hand;
+      set[0].clock_hand = (way + 1) % associativity;
+      if (set[way].referenced.load(std::memory_order_relaxed) == 0) return way;
+      set[way].referenced.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // Do not cache if any candidate is too near the start.
+  bool AreCandidatesCacheable(const std::vector<Minimizer> &minimizers,
+                              const std::vector<Candidate> &pos_candidates,
+                              const std::vector<Candidate> &neg_candidates) {
+    int msize = minimizers.size();
+    int shift = (int)minimizers[0].GetSequencePosition();
+    int size = pos_candidates.size();
+    for (int i = 0; i < size; ++i)
+      if ((int)pos_candidates[i].position < kmer_length + shift) return false;
+
+    size = neg_candidates.size();
+    for (int i = 0; i < size; ++i)
+      if ((int)neg_candidates[i].position -
+              ((int)minimizers[msize - 1].GetSequencePosition()) <
+          kmer_length + shift)
+        return false;
+    return true;
+  }
+
+  // Publish the new payload of a locked entry.
+  void ReplacePayload(struct _mm_cache_entry &entry,
+                      const struct _mm_cache_entry_payload *payload) {
+    const struct _mm_cache_entry_payload *old_payload =
+        entry.payload.exchange(payload, std::memory_order_acq_rel);
+    if (old_payload == NULL) {
+      if (payload != NULL) {
+        num_occupied_slots.fetch_add(1, std::memory_order_relaxed);
+      }
+      return;
+    }
+    if (payload == NULL) {
+      num_occupied_slots.fetch_sub(1, std::memory_order_relaxed);
+    } else {
+      num_evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+    RetirePayload(old_payload);
+  }
+
+  void RetirePayload(const struct _mm_cache_entry_payload *payload) {
+    std::lock_guard<std::mutex> lock(payload_slabs_lock);
+    num_live_payload_bytes -= payload->GetSize();
+    num_retired_payload_bytes += payload->GetSize();
+  }
+
+  static uint64_t GetPayloadHash(const struct _mm_cache_entry_payload *payload) {
+    const uint64_t *minimizers = payload->GetMinimizers();
+    const uint32_t msize = payload->num_minimizers;
+    return msize == 1 ? minimizers[0] : minimizers[0] + minimizers[msize - 1];
+  }
+
+  static int GetPrimeAtLeast(int n) {
+    for (;; ++n) {
+      bool is_prime = n > 1;
+      for (int d = 2; (int64_t)d * d <= n && is_prime; ++d) {
+        if (n % d == 0) is_prime = false;
+      }
+      if (is_prime) return n;
+    }
+  }
 
   // 0: not match. -1: opposite order. 1: same order
   int IsMinimizersMatchCache(const std::vector<Minimizer> &minimizers,
-                             const struct _mm_cache_entry &cache) {
-    if (cache.minimizers.size() != minimizers.size()) return 0;
+                             const struct _mm_cache_entry_payload *cache) {
+    if (cache == NULL || cache->num_minimizers != minimizers.size()) return 0;
+    const uint64_t *cache_minimizers = cache->GetMinimizers();
+    const int *cache_offsets = cache->GetOffsets();
+    const uint8_t *cache_strands = cache->GetStrands();
     int size = minimizers.size();
     int i, j;
     int direction = 0;
     for (i = 0; i < size; ++i) {
-      if (cache.minimizers[i] != minimizers[i].GetHash() ||
-          (minimizers[i].GetHit() & 1) != cache.strands[i])
+      if (cache_minimizers[i] != minimizers[i].GetHash() ||
+          (minimizers[i].GetHit() & 1) != cache_strands[i])
         break;
     }
     if (i >= size) {
       for (i = 0; i < size - 1; ++i) {
-        if (cache.offsets[i] != ((int)minimizers[i + 1].GetSequencePosition() -
-                                 (int)minimizers[i].GetSequencePosition()))
+        if (cache_offsets[i] != ((int)minimizers[i + 1].GetSequencePosition() -
+                                  (int)minimizers[i].GetSequencePosition()))
           break;
       }
       if (i >= size - 1) direction = 1;
@@ -61,13 +295,13 @@ class mm_cache {
     if (direction == 1) return 1;
 
     for (i = 0, j = size - 1; i < size; ++i, --j) {
-      if (cache.minimizers[i] != minimizers[j].GetHash() ||
-          (minimizers[j].GetHit() & 1) == cache.strands[i])
+      if (cache_minimizers[i] != minimizers[j].GetHash() ||
+          (minimizers[j].GetHit() & 1) == cache_strands[i])
         break;
     }
     if (i >= size) {
       for (i = 0, j = size - 1; i < size - 1; ++i, --j) {
-        if (cache.offsets[i] !=
+        if (cache_offsets[i] !=
             ((int)minimizers[j].GetSequencePosition()) -
                 ((int)minimizers[j - 1].GetSequencePosition()))
           break;
@@ -81,53 +315,205 @@ class mm_cache {
   }
 
  public:
-  mm_cache(int size) {
-    cache = new struct _mm_cache_entry[size];
-    head_mm = new uint64_t[HEAD_MM_ARRAY_SIZE];
-    cache_size = size;
-    // memset(cache, 0, sizeof(cache[0]) * size) ;
-    for (int i = 0; i < size; ++i) {
-      cache[i].weight = 0;
-      memset(cache[i].finger_print_cnt, 0,
-             sizeof(unsigned short) * FINGER_PRINT_SIZE);
-      cache[i].finger_print_cnt_sum = 0;
-      cache[i].activated = 0;
+  mm_cache(int size, int ways = 1) {
+    associativity = ways;
+    num_sets = size / ways;
+    size = num_sets * ways;
+    // The zeroed memory leaves the pages untouched until they are used, which
+    // keeps the startup fast for large caches.
+    cache = (struct _mm_cache_entry *)AllocateHugePageMemory(
+        (size_t)size * sizeof(cache[0]));
+    finger_print_cnts = (unsigned short *)AllocateHugePageMemory(
+        (size_t)num_sets * FINGER_PRINT_SIZE * sizeof(unsigned short));
+    head_mm = (std::atomic<uint64_t> *)AllocateHugePageMemory(
+        HEAD_MM_ARRAY_SIZE * sizeof(head_mm[0]));
+    if (cache == NULL || finger_print_cnts == NULL || head_mm == NULL) {
+      ExitWithMessage("Failed to allocate the cache!");
     }
-    memset(head_mm, 0, sizeof(uint64_t) * HEAD_MM_ARRAY_SIZE);
+    cache_size = size;
     update_limit = 10;
     saturate_count = 100;
+  }
+
+  ~mm_cache() {
+    FreeHugePageMemory(cache);
+    FreeHugePageMemory(finger_print_cnts);
+    FreeHugePageMemory(head_mm);
+  }
 
-    // initialize the array of OpenMP locks
-    for (int i = 0; i < num_locks_for_cache; ++i) {
-        omp_init_lock(&entry_locks_omp[i]);
+  void SetKmerLength(int kl) { kmer_length = kl; }
+
+  // Move the live payloads into new slabs once retired payloads take more
+  // space than them. Must not run concurrently with Query or Update, e.g. call
+  // it once the cache update of a batch is done.
+  void CompactPayloads() {
+    if (num_retired_payload_bytes <= num_live_payload_bytes) return;
+    std::vector<std::unique_ptr<uint64_t[], HugePageMemoryDeleter>>
+        old_payload_slabs;
+    old_payload_slabs.swap(payload_slabs);
+    payload_slab_capacities.clear();
+    payload_slab_used_size = 0;
+    num_live_payload_bytes = 0;
+    num_retired_payload_bytes = 0;
+    for (int i = 0; i < cache_size; ++i) {
+      const struct _mm_cache_entry_payload *payload =
+          cache[i].payload.load(std::memory_order_relaxed);
+      if (payload == NULL) continue;
+      const size_t size = payload->GetSize();
+      struct _mm_cache_entry_payload *new_payload = AllocatePayload(size);
+      memcpy(new_payload, payload, size);
+      cache[i].payload.store(new_payload, std::memory_order_relaxed);
     }
   }
 
-  ~mm_cache() {
-    delete[] cache;
-    delete[] head_mm;
-  
-    // destory OpenMP locks for parallelizing cache update
-    for (int i = 0; i < num_locks_for_cache; ++i) {
-      omp_destroy_lock(&entry_locks_omp[i]);
+  // Rehash the cached entries into about 'size' slots, rounded so that the
+  // number of sets is a prime. An entry whose new set is full is dropped,
+  // unless it outweighs the entry in a direct-mapped slot. The finger print
+  // counts restart from zero. Must not run concurrently with Query or Update.
+  void Resize(int size) {
+    const int new_num_sets = GetPrimeAtLeast(std::max(size / associativity, 1));
+    const int new_cache_size = new_num_sets * associativity;
+    struct _mm_cache_entry *new_cache =
+        (struct _mm_cache_entry *)AllocateHugePageMemory(
+            (size_t)new_cache_size * sizeof(new_cache[0]));
+    unsigned short *new_finger_print_cnts =
+        (unsigned short *)AllocateHugePageMemory(
+            (size_t)new_num_sets * FINGER_PRINT_SIZE * sizeof(unsigned short));
+    if (new_cache == NULL || new_finger_print_cnts == NULL) {
+      ExitWithMessage("Failed to allocate the cache!");
     }
+
+    uint64_t new_num_occupied_slots = 0;
+    for (int i = 0; i < cache_size; ++i) {
+      const struct _mm_cache_entry_payload *payload =
+          cache[i].payload.load(std::memory_order_relaxed);
+      if (payload == NULL) continue;
+      const uint64_t h = GetPayloadHash(payload);
+      struct _mm_cache_entry *set =
+          new_cache + (size_t)(h % new_num_sets) * associativity;
+      int way = 0;
+      while (way < associativity &&
+             set[way].payload.load(std::memory_order_relaxed) != NULL) {
+        ++way;
+      }
+      if (way == associativity) {
+        if (associativity > 1 || cache[i].weight <= set[0].weight) {
+          RetirePayload(payload);
+          continue;
+        }
+        way = 0;
+        RetirePayload(set[0].payload.load(std::memory_order_relaxed));
+      } else {
+        ++new_num_occupied_slots;
+      }
+      set[way].payload.store(payload, std::memory_order_relaxed);
+      set[way].signature.store((uint32_t)h, std::memory_order_relaxed);
+      set[way].weight = cache[i].weight;
+      set[way].activated = cache[i].activated;
+      set[way].referenced.store(
+          cache[i].referenced.load(std::memory_order_relaxed),
+          std::memory_order_relaxed);
+    }
+
+    FreeHugePageMemory(cache);
+    FreeHugePageMemory(finger_print_cnts);
+    cache = new_cache;
+    finger_print_cnts = new_finger_print_cnts;
+    num_sets = new_num_sets;
+    cache_size = new_cache_size;
+    num_occupied_slots.store(new_num_occupied_slots, std::memory_order_relaxed);
+    num_updates_since_resize.store(0, std::memory_order_relaxed);
   }
 
-  void SetKmerLength(int kl) { kmer_length = kl; }
+  int GetSize() const { return cache_size; }
+
+  int GetNumSets() const { return num_sets; }
+
+  uint64_t GetNumUpdatesSinceResize() const {
+    return num_updates_since_resize.load(std::memory_order_relaxed);
+  }
+
+  uint64_t GetNumOccupiedSlots() const {
+    return num_occupied_slots.load(std::memory_order_relaxed);
+  }
 
-  // Return the hash entry index. -1 if failed.
+  uint64_t GetNumEvictions() const {
+    return num_evictions.load(std::memory_order_relaxed);
+  }
+
+  void ResetNumEvictions() { num_evictions.store(0, std::memory_order_relaxed); }
+
+  // Append the cached entries, scored by their weights. Must not run
+  // concurrently with Update.
+  void ExportEntries(std::vector<CacheFileEntry> &entries) {
+    for (int i = 0; i < cache_size; ++i) {
+      const struct _mm_cache_entry_payload *payload =
+          cache[i].payload.load(std::memory_order_acquire);
+      if (payload == NULL) continue;
+      entries.emplace_back();
+      entries.back().score = cache[i].weight > 1 ? cache[i].weight : 1;
+      entries.back().payload.assign((const char *)payload,
+                                    (const char *)payload + payload->GetSize());
+    }
+  }
+
+  // Insert the entries in order into empty slots, like freshly renewed
+  // entries. Entries whose slots are taken are skipped. Return the number of
+  // inserted entries. Must not run concurrently with Query or Update.
+  uint64_t ImportEntries(const std::vector<CacheFileEntry> &entries) {
+    uint64_t num_imported_entries = 0;
+    for (const CacheFileEntry &file_entry : entries) {
+      const struct _mm_cache_entry_payload *file_payload =
+          (const struct _mm_cache_entry_payload *)file_entry.payload.data();
+      const uint64_t *file_minimizers = file_payload->GetMinimizers();
+      const uint32_t msize = file_payload->num_minimizers;
+      const uint64_t h = GetPayloadHash(file_payload);
+      struct _mm_cache_entry *set =
+          cache + (size_t)(h % num_sets) * associativity;
+      int way = 0;
+      while (way < associativity &&
+             set[way].payload.load(std::memory_order_relaxed) != NULL) {
+        ++way;
+      }
+      if (way == associativity) continue;
+
+      struct _mm_cache_entry_payload *payload =
+          AllocatePayload(file_entry.payload.size());
+      memcpy(payload, file_payload, file_entry.payload.size());
+      set[way].weight = 1;
+      set[way].activated = 1;
+      set[way].referenced.store(1, std::memory_order_relaxed);
+      set[way].signature.store((uint32_t)h, std::memory_order_relaxed);
+      set[way].payload.store(payload, std::memory_order_release);
+      num_occupied_slots.fetch_add(1, std::memory_order_relaxed);
+      head_mm[(file_minimizers[0] >> 6) & HEAD_MM_ARRAY_MASK].fetch_or(
+          1ull << (file_minimizers[0] & 0x3f), std::memory_order_relaxed);
+      head_mm[(file_minimizers[msize - 1] >> 6) & HEAD_MM_ARRAY_MASK].fetch_or(
+          1ull << (file_minimizers[msize - 1] & 0x3f),
+          std::memory_order_relaxed);
+      ++num_imported_entries;
+    }
+    return num_imported_entries;
+  }
+
+  // Return the hash entry index. -1 if failed. Safe to run concurrently with
+  // Update, and never waits for it.
   int Query(MappingMetadata &mapping_metadata, uint32_t read_len) {
-    const std::vector<Minimizer> &minimizers = mapping_metadata.minimizers_;
-    std::vector<Candidate> &pos_candidates =
-        mapping_metadata.positive_candidates_;
-    std::vector<Candidate> &neg_candidates =
-        mapping_metadata.negative_candidates_;
-    uint32_t &repetitive_seed_length = mapping_metadata.repetitive_seed_length_;
+    return Query(mapping_metadata.minimizers_,
+                 mapping_metadata.positive_candidates_,
+                 mapping_metadata.negative_candidates_,
+                 mapping_metadata.repetitive_seed_length_, read_len);
+  }
 
+  int Query(const std::vector<Minimizer> &minimizers,
+            std::vector<Candidate> &pos_candidates,
+            std::vector<Candidate> &neg_candidates,
+            uint32_t &repetitive_seed_length, uint32_t read_len) {
     int i;
     int msize = minimizers.size();
     if (msize == 0) return -1;
-    if ((head_mm[(minimizers[0].GetHash() >> 6) & HEAD_MM_ARRAY_MASK] &
+    if ((head_mm[(minimizers[0].GetHash() >> 6) & HEAD_MM_ARRAY_MASK].load(
+             std::memory_order_relaxed) &
          (1ull << (minimizers[0].GetHash() & 0x3f))) == 0)
       return -1;
     uint64_t h = 0;
@@ -139,44 +525,80 @@ class mm_cache {
       h = minimizers[0].GetHash() + minimizers[msize - 1].GetHash();
     }
 
-    int hidx = h % cache_size;
-    int direction = IsMinimizersMatchCache(minimizers, cache[hidx]);
+    struct _mm_cache_entry *set =
+        cache + (size_t)(h % num_sets) * associativity;
+    // All the fields below come from a single payload, so the result stays
+    // consistent even if the entry is renewed in the meantime.
+    const struct _mm_cache_entry_payload *payload = NULL;
+    int direction = 0;
+    int way = 0;
+    for (; way < associativity; ++way) {
+      if (set[way].signature.load(std::memory_order_relaxed) != (uint32_t)h)
+        continue;
+      payload = set[way].payload.load(std::memory_order_acquire);
+      direction = IsMinimizersMatchCache(minimizers, payload);
+      if (direction != 0) break;
+    }
+    int hidx = set - cache + way;
+    if (direction != 0 && associativity > 1 &&
+        set[way].referenced.load(std::memory_order_relaxed) == 0) {
+      set[way].referenced.store(1, std::memory_order_relaxed);
+    }
     if (direction == 1) {
-      pos_candidates = cache[hidx].positive_candidates;
-      neg_candidates = cache[hidx].negative_candidates;
-      repetitive_seed_length = cache[hidx].repetitive_seed_length;
-      int size = pos_candidates.size();
+      const uint64_t *cache_pos_positions =
+          payload->GetPositiveCandidatePositions();
+      const uint8_t *cache_pos_counts = payload->GetPositiveCandidateCounts();
+      int size = payload->num_positive_candidates;
       int shift = (int)minimizers[0].GetSequencePosition();
+      pos_candidates.resize(size);
       for (i = 0; i < size; ++i) {
-        uint64_t rid = pos_candidates[i].position >> 32;
-        int rpos = (int)pos_candidates[i].position;
+        uint64_t rid = cache_pos_positions[i] >> 32;
+        int rpos = (int)cache_pos_positions[i];
         pos_candidates[i].position = (rid << 32) + (uint32_t)(rpos - shift);
+        pos_candidates[i].count = cache_pos_counts[i];
+      }
+      const uint64_t *cache_neg_positions =
+          payload->GetNegativeCandidatePositions();
+      const uint8_t *cache_neg_counts = payload->GetNegativeCandidateCounts();
+      size = payload->num_negative_candidates;
+      neg_candidates.resize(size);
+      for (i = 0; i < size; ++i) {
+        neg_candidates[i].position = cache_neg_positions[i] + shift;
+        neg_candidates[i].count = cache_neg_counts[i];
       }
-      size = neg_candidates.size();
-      for (i = 0; i < size; ++i) neg_candidates[i].position += shift;
+      repetitive_seed_length = payload->repetitive_seed_length;
       return hidx;
     } else if (direction == -1) {  // The "read" is on the other direction of
                                    // the cached "read"
-      int size = cache[hidx].negative_candidates.size();
+      const uint64_t *cache_neg_positions =
+          payload->GetNegativeCandidatePositions();
+      const uint8_t *cache_neg_counts = payload->GetNegativeCandidateCounts();
+      const uint64_t *cache_pos_positions =
+          payload->GetPositiveCandidatePositions();
+      const uint8_t *cache_pos_counts = payload->GetPositiveCandidateCounts();
+      int size = payload->num_negative_candidates;
       // Start position of the last minimizer shoud equal the first minimizer's
       // end position in rc "read".
       int shift = read_len -
                   ((int)minimizers[msize - 1].GetSequencePosition()) - 1 +
                   kmer_length - 1;
 
-      pos_candidates = cache[hidx].negative_candidates;
+      pos_candidates.resize(size);
       for (i = 0; i < size; ++i) {
-        uint64_t rid = cache[hidx].negative_candidates[i].position >> 32;
-        int rpos = (int)cache[hidx].negative_candidates[i].position;
+        uint64_t rid = cache_neg_positions[i] >> 32;
+        int rpos = (int)cache_neg_positions[i];
         pos_candidates[i].position =
             (rid << 32) + (uint32_t)(rpos + shift - read_len + 1);
+        pos_candidates[i].count = cache_neg_counts[i];
       }
-      size = cache[hidx].positive_candidates.size();
-      neg_candidates = cache[hidx].positive_candidates;
-      for (i = 0; i < size; ++i)
+      size = payload->num_positive_candidates;
+      neg_candidates.resize(size);
+      for (i = 0; i < size; ++i) {
         neg_candidates[i].position =
-            cache[hidx].positive_candidates[i].position - shift + read_len - 1;
-      repetitive_seed_length = cache[hidx].repetitive_seed_length;
+            cache_pos_positions[i] - shift + read_len - 1;
+        neg_candidates[i].count = cache_pos_counts[i];
+      }
+      repetitive_seed_length = payload->repetitive_seed_length;
 
       return hidx;
     } else {
@@ -184,6 +606,8 @@ class mm_cache {
     }
   }
 
+  // Only one update holds an entry at a time. Updates of different entries
+  // and queries are not blocked.
   void Update(const std::vector<Minimizer> &minimizers,
               std::vector<Candidate> &pos_candidates,
               std::vector<Candidate> &neg_candidates,
@@ -197,162 +621,201 @@ class mm_cache {
 
     if (msize == 0)
       return;
-    else if (msize == 1) {
+    num_updates_since_resize.fetch_add(1, std::memory_order_relaxed);
+    if (msize == 1) {
       h = f = (minimizers[0].GetHash());
     } else {
       h = minimizers[0].GetHash() + minimizers[msize - 1].GetHash();
       f = minimizers[0].GetHash() ^ minimizers[msize - 1].GetHash();
     }
-    int hidx = h % cache_size;
+    int set_index = h % num_sets;
     int finger_print = f % FINGER_PRINT_SIZE;
+    struct _mm_cache_entry *set = cache + (size_t)set_index * associativity;
 
     // beginning of locking phase - make sure to release it wherever we exit
-    int lock_index = hidx % num_locks_for_cache;
-    omp_set_lock(&entry_locks_omp[lock_index]);  
+    LockEntry(set[0]);
 
-    ++cache[hidx].finger_print_cnt[finger_print];
-    ++cache[hidx].finger_print_cnt_sum;
+    unsigned short *finger_print_cnt =
+        finger_print_cnts + (size_t)set_index * FINGER_PRINT_SIZE;
+    ++finger_print_cnt[finger_print];
+    ++set[0].finger_print_cnt_sum;
 
     // case 1: already saturated
-    if (cache[hidx].finger_print_cnt_sum > saturate_count){ 
-      omp_unset_lock(&entry_locks_omp[lock_index]);
+    if (set[0].finger_print_cnt_sum > saturate_count * associativity) {
+      UnlockEntry(set[0]);
       return;
     }
 
     // case 2: no heavy hitter or not enough yet
-    if (cache[hidx].finger_print_cnt_sum < 10 ||
-        (int)cache[hidx].finger_print_cnt[finger_print] * 5 <
-            cache[hidx].finger_print_cnt_sum) {
-      omp_unset_lock(&entry_locks_omp[lock_index]);
+    if (set[0].finger_print_cnt_sum < 10 ||
+        (int)finger_print_cnt[finger_print] * 5 <
+            set[0].finger_print_cnt_sum) {
+      UnlockEntry(set[0]);
       return;
     }
 
-    int direction = IsMinimizersMatchCache(minimizers, cache[hidx]);
-    if (direction != 0)
-      ++cache[hidx].weight;
-    else
-      --cache[hidx].weight;
-    cache[hidx].activated = 1;
+    int way = 0;
+    int direction = 0;
+    for (; way < associativity; ++way) {
+      direction = IsMinimizersMatchCache(
+          minimizers, set[way].payload.load(std::memory_order_relaxed));
+      if (direction != 0) break;
+    }
 
-    // Renew the cache
-    if (cache[hidx].weight < 0) {
-      cache[hidx].weight = 1;
-      cache[hidx].minimizers.resize(msize);
-
-      if (msize == 0) {
-        cache[hidx].offsets.clear();
-        cache[hidx].strands.clear();
-        omp_unset_lock(&entry_locks_omp[lock_index]);
+    if (associativity == 1) {
+      way = 0;
+      if (direction != 0)
+        ++set[0].weight;
+      else
+        --set[0].weight;
+      set[0].activated = 1;
+      if (set[0].weight >= 0) {
+        UnlockEntry(set[0]);
+        return;
+      }
+      set[0].weight = 1;
+      if (!AreCandidatesCacheable(minimizers, pos_candidates,
+                                  neg_candidates)) {
+        ReplacePayload(set[0], NULL);
+        UnlockEntry(set[0]);
         return;
       }
+    } else {
+      if (direction != 0) {
+        set[way].activated = 1;
+        set[way].referenced.store(1, std::memory_order_relaxed);
+        UnlockEntry(set[0]);
+        return;
+      }
+      if (!AreCandidatesCacheable(minimizers, pos_candidates,
+                                  neg_candidates)) {
+        UnlockEntry(set[0]);
+        return;
+      }
+      way = FindVictimInSet(set);
+      set[way].activated = 1;
+      set[way].referenced.store(1, std::memory_order_relaxed);
+    }
 
-      int size = pos_candidates.size();
+    // Renew the cache
+    {
+      struct _mm_cache_entry &entry = set[way];
+      int hidx = set_index * associativity + way;
+      int size = 0;
       int shift = (int)minimizers[0].GetSequencePosition();
 
-      // Do not cache if it is too near the start.
-      for (i = 0; i < size; ++i)
-        if ((int)pos_candidates[i].position < kmer_length + shift) {
-          cache[hidx].offsets.clear();
-          cache[hidx].strands.clear();
-          cache[hidx].minimizers.clear();
-
-          omp_unset_lock(&entry_locks_omp[lock_index]);
-          return;
-        }
-
-      size = neg_candidates.size();
-      for (i = 0; i < size; ++i)
-        if ((int)neg_candidates[i].position -
-                ((int)minimizers[msize - 1].GetSequencePosition()) <
-            kmer_length + shift) {
-          cache[hidx].offsets.clear();
-          cache[hidx].strands.clear();
-          cache[hidx].minimizers.clear();
-
-          omp_unset_lock(&entry_locks_omp[lock_index]);
-          return;
-        }
-      cache[hidx].offsets.resize(msize - 1);
-      cache[hidx].strands.resize(msize);
+      struct _mm_cache_entry_payload *payload;
+      {
+        std::lock_guard<std::mutex> lock(payload_slabs_lock);
+        payload = AllocatePayload(_mm_cache_entry_payload::GetSize(
+            msize, pos_candidates.size(), neg_candidates.size()));
+      }
+      payload->num_minimizers = msize;
+      payload->num_positive_candidates = pos_candidates.size();
+      payload->num_negative_candidates = neg_candidates.size();
+      payload->repetitive_seed_length = repetitive_seed_length;
+      uint64_t *cache_minimizers = payload->GetMinimizers();
+      int *cache_offsets = payload->GetOffsets();
+      uint8_t *cache_strands = payload->GetStrands();
       for (i = 0; i < msize; ++i) {
-        cache[hidx].minimizers[i] = minimizers[i].GetHash();
-        cache[hidx].strands[i] = (minimizers[i].GetHit() & 1);
+        cache_minimizers[i] = minimizers[i].GetHash();
+        cache_strands[i] = (minimizers[i].GetHit() & 1);
       }
       for (i = 0; i < msize - 1; ++i) {
-        cache[hidx].offsets[i] =
+        cache_offsets[i] =
             ((int)minimizers[i + 1].GetSequencePosition()) -
             ((int)minimizers[i].GetSequencePosition());
       }
-      std::vector<Candidate>().swap(cache[hidx].positive_candidates);
-      std::vector<Candidate>().swap(cache[hidx].negative_candidates);
-      cache[hidx].positive_candidates = pos_candidates;
-      cache[hidx].negative_candidates = neg_candidates;
-      cache[hidx].repetitive_seed_length = repetitive_seed_length;
 
       // adjust the candidate position.
-      size = cache[hidx].positive_candidates.size();
-      for (i = 0; i < size; ++i)
-        cache[hidx].positive_candidates[i].position += shift;
-      size = cache[hidx].negative_candidates.size();
-      for (i = 0; i < size; ++i)
-        cache[hidx].negative_candidates[i].position -= shift;
+      uint64_t *cache_pos_positions = payload->GetPositiveCandidatePositions();
+      uint8_t *cache_pos_counts = payload->GetPositiveCandidateCounts();
+      size = payload->num_positive_candidates;
+      for (i = 0; i < size; ++i) {
+        cache_pos_positions[i] = pos_candidates[i].position + shift;
+        cache_pos_counts[i] = pos_candidates[i].count;
+      }
+      uint64_t *cache_neg_positions = payload->GetNegativeCandidatePositions();
+      uint8_t *cache_neg_counts = payload->GetNegativeCandidateCounts();
+      size = payload->num_negative_candidates;
+      for (i = 0; i < size; ++i) {
+        cache_neg_positions[i] = neg_candidates[i].position - shift;
+        cache_neg_counts[i] = neg_candidates[i].count;
+      }
 
       // Debugging output (candidate stored in cache)
       if (debug) {
         print_lock.lock();
         std::cout << "[DEBUG][CACHE][1] hidx = " << hidx << std::endl;
         std::cout << "[DEBUG][CACHE][2]" << " pos.size() = " 
-                                << cache[hidx].positive_candidates.size() 
+                                << payload->num_positive_candidates
                                 << " , " << "neg.size() = " 
-                                << cache[hidx].negative_candidates.size()  
+                                << payload->num_negative_candidates
                                 << " , msize = " << msize << std::endl;
         std::cout << "[DEBUG][CACHE][3] ";
         for (const auto &minimizer : minimizers) {
           std::cout << minimizer.GetHash() << " ";
         } std::cout << std::endl;
 
-        for (size_t j = 0; j < cache[hidx].positive_candidates.size(); ++j) {
+        for (size_t j = 0; j < payload->num_positive_candidates; ++j) {
           std::cout << "[DEBUG][CACHE][+] " 
                     << "hidx = " << hidx
-                    << " , cand_ref_seq = " << cache[hidx].positive_candidates[j].GetReferenceSequenceIndex() 
-                    << " , cand_ref_pos = " << cache[hidx].positive_candidates[j].GetReferenceSequencePosition()
-                    << " , support = " << unsigned(cache[hidx].positive_candidates[j].GetCount()) << std::endl;
+                    << " , cand_ref_seq = " << (cache_pos_positions[j] >> 32)
+                    << " , cand_ref_pos = " << (uint32_t)cache_pos_positions[j]
+                    << " , support = " << unsigned(cache_pos_counts[j]) << std::endl;
         }
 
-        for (size_t j = 0; j < cache[hidx].negative_candidates.size(); ++j) {
+        for (size_t j = 0; j < payload->num_negative_candidates; ++j) {
           std::cout << "[DEBUG][CACHE][-] " 
                     << "hidx = " << hidx
-                    << " , cand_ref_seq = " << cache[hidx].negative_candidates[j].GetReferenceSequenceIndex() 
-                    << " , cand_ref_pos = " << cache[hidx].negative_candidates[j].GetReferenceSequencePosition() 
-                    << " , support = " << unsigned(cache[hidx].negative_candidates[j].GetCount()) << std::endl;
+                    << " , cand_ref_seq = " << (cache_neg_positions[j] >> 32)
+                    << " , cand_ref_pos = " << (uint32_t)cache_neg_positions[j] 
+                    << " , support = " << unsigned(cache_neg_counts[j]) << std::endl;
         }
         print_lock.unlock();
       }
 
+      entry.signature.store((uint32_t)h, std::memory_order_relaxed);
+      ReplacePayload(entry, payload);
+
       // Update head mm array
-      head_mm[(minimizers[0].GetHash() >> 6) & HEAD_MM_ARRAY_MASK] |=
-          (1ull << (minimizers[0].GetHash() & 0x3f));
-      head_mm[(minimizers[msize - 1].GetHash() >> 6) & HEAD_MM_ARRAY_MASK] |=
-          (1ull << (minimizers[msize - 1].GetHash() & 0x3f));
+      head_mm[(minimizers[0].GetHash() >> 6) & HEAD_MM_ARRAY_MASK].fetch_or(
+          1ull << (minimizers[0].GetHash() & 0x3f), std::memory_order_relaxed);
+      head_mm[(minimizers[msize - 1].GetHash() >> 6) & HEAD_MM_ARRAY_MASK]
+          .fetch_or(1ull << (minimizers[msize - 1].GetHash() & 0x3f),
+                    std::memory_order_relaxed);
     }
-    omp_unset_lock(&entry_locks_omp[lock_index]);
+    UnlockEntry(set[0]);
   }
 
-  void DirectUpdateWeight(int idx, int weight) { cache[idx].weight += weight; }
+  void DirectUpdateWeight(int idx, int weight) {
+    struct _mm_cache_entry &first_entry = cache[idx - idx % associativity];
+    LockEntry(first_entry);
+    cache[idx].weight += weight;
+    UnlockEntry(first_entry);
+  }
 
   uint64_t GetMemoryBytes() {
-    int i;
-    uint64_t ret = 0;
-    for (i = 0; i < cache_size; ++i) {
-      ret += sizeof(cache[i]) +
-             cache[i].minimizers.capacity() * sizeof(uint64_t) +
-             cache[i].offsets.capacity() * sizeof(int) +
-             cache[i].positive_candidates.capacity() * sizeof(Candidate) +
-             cache[i].negative_candidates.capacity() * sizeof(Candidate);
+    uint64_t ret = GetSlotMemoryBytes();
+    for (size_t i = 0; i < payload_slab_capacities.size(); ++i) {
+      ret += payload_slab_capacities[i];
     }
     return ret;
   }
 
+  // The memory once the retired payloads are reclaimed.
+  uint64_t GetLiveMemoryBytes() {
+    return GetSlotMemoryBytes() + num_live_payload_bytes;
+  }
+
+  uint64_t GetLivePayloadBytes() { return num_live_payload_bytes; }
+
+  uint64_t GetSlotMemoryBytes() {
+    return (uint64_t)cache_size * sizeof(cache[0]) +
+           (uint64_t)num_sets * FINGER_PRINT_SIZE * sizeof(unsigned short) +
+           HEAD_MM_ARRAY_SIZE * sizeof(head_mm[0]);
+  }
+
   // How many reads from a batch we want to use to update the cache.
   // paired end data has twice the amount reads, so the threshold is lower
   uint32_t GetUpdateThreshold(uint32_t num_loaded_reads, 
@@ -370,17 +833,24 @@ class mm_cache {
 
   void PrintStats() {
     for (int i = 0; i < cache_size; ++i) {
-      printf("%d %d %d %d ", cache[i].weight, cache[i].finger_print_cnt_sum,
-             int(cache[i].positive_candidates.size() +
-                 cache[i].negative_candidates.size()),
+      const struct _mm_cache_entry_payload *payload =
+          cache[i].payload.load(std::memory_order_acquire);
+      const struct _mm_cache_entry &first_entry =
+          cache[i - i % associativity];
+      printf("%d %d %d %d ", cache[i].weight, first_entry.finger_print_cnt_sum,
+             payload == NULL ? 0
+                             : int(payload->num_positive_candidates +
+                                   payload->num_negative_candidates),
              cache[i].activated);
+      const unsigned short *finger_print_cnt =
+          finger_print_cnts + (size_t)(i / associativity) * FINGER_PRINT_SIZE;
       int tmp = 0;
       for (int j = 0; j < FINGER_PRINT_SIZE; ++j)
-        if (cache[i].finger_print_cnt[j] > tmp)
-          tmp = cache[i].finger_print_cnt[j];
+        if (finger_print_cnt[j] > tmp)
+          tmp = finger_print_cnt[j];
       printf("%d", tmp);
       for (int j = 0; j < FINGER_PRINT_SIZE; ++j)
-        printf(" %u", cache[i].finger_print_cnt[j]);
+        printf(" %u", finger_print_cnt[j]);
       printf("\n");
     }
   }
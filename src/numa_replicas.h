@@ -0,0 +1,183 @@
+#ifndef NUMA_REPLICAS_H_
+#define NUMA_REPLICAS_H_
+
+#include <omp.h>
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "index.h"
+#include "numa_topology.h"
+#include "sequence_batch.h"
+
+namespace chromap {
+
+// Places the mapping threads on the NUMA nodes and keeps replicas of the
+// read-only index and reference on the nodes, so that the threads do not read
+// them across the interconnect. Thread i of n runs on the node
+// NumaTopology::GetNodeOfThread(i, n) and maps with the replica of its node.
+// The primary index and reference are loaded on the first node and serve as
+// its replica, so n replicas take n copies. With fewer replicas than nodes,
+// the nodes share the replicas round-robin. Without replicas, the threads map
+// with the primary index and reference.
+class NumaReplicas {
+ public:
+  // The threads are pinned when 'pin_threads' is true, which replicas need.
+  NumaReplicas(int num_threads, bool pin_threads, int num_replicas)
+      : pin_threads_(pin_threads) {
+    if (!pin_threads_) {
+      return;
+    }
+    for (int ti = 0; ti < num_threads; ++ti) {
+      thread_nodes_.push_back(topology_.GetNodeOfThread(ti, num_threads));
+    }
+    if (num_replicas > topology_.GetNumNodes()) {
+      std::cerr << "Only " << topology_.GetNumNodes()
+                << " NUMA nodes, so only " << topology_.GetNumNodes()
+                << " index replicas are used.\n";
+      num_replicas = topology_.GetNumNodes();
+    }
+    index_replicas_.resize(num_replicas);
+    reference_replicas_.resize(num_replicas);
+  }
+
+  // Run 'load_primary' on a thread pinned to the first node when the threads
+  // are pinned, so that the primary index and reference it loads are first
+  // touched there.
+  template <typename LoadFunction>
+  void LoadPrimary(LoadFunction load_primary) const {
+    if (!pin_threads_) {
+      load_primary();
+      return;
+    }
+    std::thread loading_thread([&] {
+      topology_.PinCurrentThreadToNode(0);
+      load_primary();
+    });
+    loading_thread.join();
+  }
+
+  // Load the replicas of the other nodes at the same time, each by a thread
+  // pinned to its node, so that the pages of the replica are first touched
+  // there. The reference sequences are reordered by 'custom_rid_rank' unless
+  // it is empty.
+  void Load(const std::string &index_file_path,
+            const std::string &reference_file_path,
+            const std::vector<int> &custom_rid_rank) {
+    if (index_replicas_.size() <= 1) {
+      return;
+    }
+    std::cerr << "Load the index and reference replicas of "
+              << index_replicas_.size() - 1 << " more NUMA nodes.\n";
+    std::vector<std::thread> loading_threads;
+    for (size_t ri = 1; ri < index_replicas_.size(); ++ri) {
+      loading_threads.emplace_back([&, ri] {
+        topology_.PinCurrentThreadToNode(ri);
+        reference_replicas_[ri].reset(new SequenceBatch());
+        reference_replicas_[ri]->InitializeLoading(reference_file_path);
+        reference_replicas_[ri]->LoadAllSequences();
+        reference_replicas_[ri]->FinalizeLoading();
+        if (!custom_rid_rank.empty()) {
+          reference_replicas_[ri]->ReorderSequences(custom_rid_rank);
+        }
+        index_replicas_[ri].reset(new Index(index_file_path));
+        index_replicas_[ri]->Load();
+      });
+    }
+    for (std::thread &loading_thread : loading_threads) {
+      loading_thread.join();
+    }
+  }
+
+  // Pin the calling OpenMP thread to its node when the threads are pinned.
+  void PinCurrentThread() const {
+    if (pin_threads_) {
+      topology_.PinCurrentThreadToNode(thread_nodes_[omp_get_thread_num()]);
+    }
+  }
+
+  inline const Index &GetIndexOfThread(int thread_id,
+                                       const Index &primary_index) const {
+    const int replica = GetReplicaOfThread(thread_id);
+    return replica == 0 ? primary_index : *index_replicas_[replica];
+  }
+
+  inline const SequenceBatch &GetReferenceOfThread(
+      int thread_id, const SequenceBatch &primary_reference) const {
+    const int replica = GetReplicaOfThread(thread_id);
+    return replica == 0 ? primary_reference : *reference_replicas_[replica];
+  }
+
+  // Output the fraction of the pages of the index and reference each node maps
+  // with that are on other nodes, which is the expected fraction of the reads
+  // of the index and reference across the interconnect.
+  void OutputRemotePageRatios(const Index &primary_index,
+                              const SequenceBatch &primary_reference) const {
+    if (!pin_threads_) {
+      return;
+    }
+    for (int node = 0; node < topology_.GetNumNodes(); ++node) {
+      int num_node_threads = 0;
+      int first_node_thread_id = -1;
+      for (size_t ti = 0; ti < thread_nodes_.size(); ++ti) {
+        if (thread_nodes_[ti] == node) {
+          if (first_node_thread_id < 0) {
+            first_node_thread_id = ti;
+          }
+          ++num_node_threads;
+        }
+      }
+      if (num_node_threads == 0) {
+        continue;
+      }
+
+      std::vector<std::pair<const void *, size_t>> memory_ranges =
+          GetIndexOfThread(first_node_thread_id, primary_index)
+              .GetTableMemoryRanges();
+      const std::vector<std::pair<const void *, size_t>>
+          reference_memory_ranges =
+              GetReferenceOfThread(first_node_thread_id, primary_reference)
+                  .GetSequenceMemoryRanges();
+      memory_ranges.insert(memory_ranges.end(),
+                           reference_memory_ranges.begin(),
+                           reference_memory_ranges.end());
+      const double remote_page_ratio = topology_.GetRemotePageRatio(
+          memory_ranges, node, kMaxNumSampledPages);
+
+      std::cerr << "NUMA node " << node << ": " << num_node_threads
+                << " mapping threads on " << topology_.GetNodeCpus(node).size()
+                << " CPUs, ";
+      if (remote_page_ratio < 0) {
+        std::cerr << "unknown placement of the index and reference pages.\n";
+      } else {
+        std::cerr << 100.0 * remote_page_ratio
+                  << "% of the sampled index and reference pages on other "
+                     "nodes.\n";
+      }
+    }
+  }
+
+ private:
+  static constexpr size_t kMaxNumSampledPages = 4096;
+
+  // Replica 0 is the primary index and reference.
+  inline int GetReplicaOfThread(int thread_id) const {
+    return index_replicas_.empty()
+               ? 0
+               : thread_nodes_[thread_id] % index_replicas_.size();
+  }
+
+  NumaTopology topology_;
+  const bool pin_threads_;
+  std::vector<int> thread_nodes_;
+  // The first entries are empty, as the first node uses the primary ones.
+  std::vector<std::unique_ptr<Index>> index_replicas_;
+  std::vector<std::unique_ptr<SequenceBatch>> reference_replicas_;
+};
+
+}  // namespace chromap
+
+#endif  // NUMA_REPLICAS_H_
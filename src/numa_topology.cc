@@ -0,0 +1,190 @@
+#include "numa_topology.h"
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <thread>
+
+namespace chromap {
+
+namespace {
+
+// Parse a CPU list of sysfs, e.g. "0-3,8-11".
+std::vector<int> ParseCpuList(const std::string &cpu_list) {
+  std::vector<int> cpus;
+  size_t position = 0;
+  while (position < cpu_list.size()) {
+    size_t next_position = cpu_list.find(',', position);
+    if (next_position == std::string::npos) {
+      next_position = cpu_list.size();
+    }
+    const std::string cpu_range =
+        cpu_list.substr(position, next_position - position);
+    const size_t dash_position = cpu_range.find('-');
+    const int first_cpu = atoi(cpu_range.c_str());
+    const int last_cpu = dash_position == std::string::npos
+                             ? first_cpu
+                             : atoi(cpu_range.c_str() + dash_position + 1);
+    for (int cpu = first_cpu; cpu <= last_cpu; ++cpu) {
+      cpus.push_back(cpu);
+    }
+    position = next_position + 1;
+  }
+  return cpus;
+}
+
+// Return the CPUs the process may run on in increasing order, or none when
+// they are unknown.
+std::vector<int> GetAllowedCpus() {
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t allowed_cpu_set;
+  CPU_ZERO(&allowed_cpu_set);
+  if (sched_getaffinity(0, sizeof(allowed_cpu_set), &allowed_cpu_set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &allowed_cpu_set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+#endif
+  return cpus;
+}
+
+}  // namespace
+
+NumaTopology::NumaTopology() {
+  const std::vector<int> allowed_cpus = GetAllowedCpus();
+
+  const char *node_directory_path = "/sys/devices/system/node";
+  DIR *node_directory = opendir(node_directory_path);
+  if (node_directory != NULL) {
+    struct dirent *entry = NULL;
+    while ((entry = readdir(node_directory)) != NULL) {
+      if (strncmp(entry->d_name, "node", 4) != 0 ||
+          entry->d_name[4] < '0' || entry->d_name[4] > '9') {
+        continue;
+      }
+      node_ids_.push_back(atoi(entry->d_name + 4));
+    }
+    closedir(node_directory);
+  }
+  std::sort(node_ids_.begin(), node_ids_.end());
+
+  // Drop the nodes the process cannot run on, e.g. memory-only nodes.
+  std::vector<int> node_ids;
+  for (int node_id : node_ids_) {
+    std::ifstream cpu_list_file(std::string(node_directory_path) + "/node" +
+                                std::to_string(node_id) + "/cpulist");
+    std::string cpu_list;
+    std::getline(cpu_list_file, cpu_list);
+    std::vector<int> cpus;
+    for (int cpu : ParseCpuList(cpu_list)) {
+      if (allowed_cpus.empty() ||
+          std::binary_search(allowed_cpus.begin(), allowed_cpus.end(), cpu)) {
+        cpus.push_back(cpu);
+      }
+    }
+    if (!cpus.empty()) {
+      node_ids.push_back(node_id);
+      node_cpus_.push_back(cpus);
+    }
+  }
+  node_ids_.swap(node_ids);
+
+  if (node_cpus_.empty()) {
+    node_ids_.assign(1, 0);
+    node_cpus_.push_back(allowed_cpus);
+    if (allowed_cpus.empty()) {
+      for (int cpu = 0; cpu < (int)std::thread::hardware_concurrency();
+           ++cpu) {
+        node_cpus_[0].push_back(cpu);
+      }
+    }
+  }
+}
+
+bool NumaTopology::PinCurrentThreadToNode(int node) const {
+#ifdef __linux__
+  const std::vector<int> &cpus = node_cpus_[node];
+  if (cpus.empty()) {
+    return false;
+  }
+  cpu_set_t node_cpu_set;
+  CPU_ZERO(&node_cpu_set);
+  for (int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &node_cpu_set);
+    }
+  }
+  return sched_setaffinity(0, sizeof(node_cpu_set), &node_cpu_set) == 0;
+#else
+  return false;
+#endif
+}
+
+double NumaTopology::GetRemotePageRatio(
+    const std::vector<std::pair<const void *, size_t>> &memory_ranges,
+    int node, size_t max_num_sampled_pages) const {
+#ifdef __linux__
+  const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  size_t num_pages = 0;
+  for (const std::pair<const void *, size_t> &memory_range : memory_ranges) {
+    num_pages += (memory_range.second + page_size - 1) / page_size;
+  }
+  if (num_pages == 0 || max_num_sampled_pages == 0) {
+    return -1;
+  }
+
+  const size_t page_stride =
+      std::max((size_t)1, num_pages / max_num_sampled_pages);
+  std::vector<void *> sampled_pages;
+  size_t page_index = 0;
+  for (const std::pair<const void *, size_t> &memory_range : memory_ranges) {
+    const uintptr_t range_begin = (uintptr_t)memory_range.first;
+    const uintptr_t range_end = range_begin + memory_range.second;
+    for (uintptr_t page = range_begin & ~(page_size - 1); page < range_end;
+         page += page_size, ++page_index) {
+      if (page_index % page_stride == 0) {
+        sampled_pages.push_back((void *)page);
+      }
+    }
+  }
+
+  // Without target nodes, move_pages only reports the node of each page.
+  std::vector<int> page_nodes(sampled_pages.size(), -1);
+  if (syscall(SYS_move_pages, 0, sampled_pages.size(), sampled_pages.data(),
+              NULL, page_nodes.data(), 0) != 0) {
+    return -1;
+  }
+
+  size_t num_placed_pages = 0;
+  size_t num_remote_pages = 0;
+  for (int page_node : page_nodes) {
+    // Pages not touched yet have negative error codes.
+    if (page_node >= 0) {
+      ++num_placed_pages;
+      if (page_node != node_ids_[node]) {
+        ++num_remote_pages;
+      }
+    }
+  }
+  return num_placed_pages == 0 ? -1
+                               : (double)num_remote_pages / num_placed_pages;
+#else
+  return -1;
+#endif
+}
+
+}  // namespace chromap
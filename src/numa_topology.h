@@ -0,0 +1,50 @@
+#ifndef NUMA_TOPOLOGY_H_
+#define NUMA_TOPOLOGY_H_
+
+#include <stddef.h>
+
+#include <utility>
+#include <vector>
+
+namespace chromap {
+
+// The NUMA nodes of the host with the CPUs the process may run on, read from
+// sysfs. A host without NUMA support, or whose topology cannot be read, is seen
+// as one node with all the CPUs. Only Linux is supported, elsewhere pinning
+// does nothing and the node of the memory is unknown.
+class NumaTopology {
+ public:
+  NumaTopology();
+
+  inline int GetNumNodes() const { return node_cpus_.size(); }
+
+  inline const std::vector<int> &GetNodeCpus(int node) const {
+    return node_cpus_[node];
+  }
+
+  // The threads are split over the nodes in contiguous blocks, so the threads
+  // with close ids share a node.
+  inline int GetNodeOfThread(int thread_id, int num_threads) const {
+    return (long long)thread_id * GetNumNodes() / num_threads;
+  }
+
+  // Restrict the calling thread to the CPUs of the node, so its memory is
+  // first touched on the node. Return false if the thread cannot be pinned.
+  bool PinCurrentThreadToNode(int node) const;
+
+  // Return the fraction of the sampled pages of the memory ranges that are not
+  // on the node, sampling at most 'max_num_sampled_pages' pages, or -1 when
+  // the nodes of the pages are unknown. The pages are queried, not moved.
+  double GetRemotePageRatio(
+      const std::vector<std::pair<const void *, size_t>> &memory_ranges,
+      int node, size_t max_num_sampled_pages) const;
+
+ private:
+  // The node ids in sysfs, which can have gaps.
+  std::vector<int> node_ids_;
+  std::vector<std::vector<int>> node_cpus_;
+};
+
+}  // namespace chromap
+
+#endif  // NUMA_TOPOLOGY_H_
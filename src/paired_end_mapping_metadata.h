@@ -118,6 +118,7 @@ class PairedEndMappingMetadata {
   std::vector<std::pair<uint32_t, uint32_t>> R1R2_best_mappings_;
 
   friend class CandidateProcessor;
+  friend class DraftMappingGenerator;
   template <typename MappingRecord>
   friend class MappingGenerator;
   friend class Chromap;
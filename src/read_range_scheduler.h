@@ -0,0 +1,150 @@
+#ifndef READ_RANGE_SCHEDULER_H_
+#define READ_RANGE_SCHEDULER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+
+namespace chromap {
+
+// Hands out the reads of a batch to the mapping workers in ranges. Each worker
+// starts with an equal share of the reads and takes chunks from its front,
+// which shrink as the share runs out. A worker without reads left steals the
+// back half of the largest share left, so the slow reads of a batch are spread
+// over the workers rather than leaving a tail on one of them.
+//
+// Each share is a [begin, end) pair packed into one atomic word. The owner
+// moves the begin and the thieves move the end, both with compare-and-swap.
+class ReadRangeScheduler {
+ public:
+  explicit ReadRangeScheduler(int num_workers)
+      : num_workers_(num_workers),
+        worker_ranges_(new WorkerRange[num_workers]) {}
+
+  inline int GetNumWorkers() const { return num_workers_; }
+
+  // Split 'num_reads' reads over the workers. Must not run concurrently with
+  // GetNextRange.
+  void Reset(uint32_t num_reads) {
+    for (int wi = 0; wi < num_workers_; ++wi) {
+      const uint32_t range_begin = (uint64_t)num_reads * wi / num_workers_;
+      const uint32_t range_end =
+          (uint64_t)num_reads * (wi + 1) / num_workers_;
+      worker_ranges_[wi].range.store(PackRange(range_begin, range_end),
+                                     std::memory_order_relaxed);
+    }
+    num_steals_.store(0, std::memory_order_relaxed);
+  }
+
+  // Get the next range of reads for the worker to map, stealing from the other
+  // workers when its share is done. Return false once all the reads are given
+  // out.
+  bool GetNextRange(int worker_id, uint32_t &range_begin,
+                    uint32_t &range_end) {
+    std::atomic<uint64_t> &worker_range = worker_ranges_[worker_id].range;
+    uint64_t range = worker_range.load(std::memory_order_acquire);
+    while (true) {
+      const uint32_t begin = GetRangeBegin(range);
+      const uint32_t end = GetRangeEnd(range);
+      if (begin < end) {
+        const uint32_t range_length = end - begin;
+        uint32_t chunk_size = range_length / kChunkDivisor;
+        if (chunk_size < kMinChunkSize) {
+          chunk_size = kMinChunkSize;
+        }
+        if (chunk_size > range_length) {
+          chunk_size = range_length;
+        }
+        // On failure 'range' is reloaded, e.g. after a steal.
+        if (worker_range.compare_exchange_weak(
+                range, PackRange(begin + chunk_size, end),
+                std::memory_order_acq_rel, std::memory_order_acquire)) {
+          range_begin = begin;
+          range_end = begin + chunk_size;
+          return true;
+        }
+        continue;
+      }
+
+      if (!StealRange(worker_id)) {
+        return false;
+      }
+      range = worker_range.load(std::memory_order_acquire);
+    }
+  }
+
+  inline uint32_t GetNumSteals() const {
+    return num_steals_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // The owner takes at least this many reads at once, so the compare-and-swap
+  // is amortized over the reads.
+  static constexpr uint32_t kMinChunkSize = 16;
+  // The owner takes this fraction of its share left at once.
+  static constexpr uint32_t kChunkDivisor = 8;
+
+  // Padded to a cache line, so the workers do not contend on their shares.
+  struct WorkerRange {
+    std::atomic<uint64_t> range{0};
+    char padding[64 - sizeof(std::atomic<uint64_t>)];
+  };
+
+  static inline uint64_t PackRange(uint32_t begin, uint32_t end) {
+    return ((uint64_t)begin << 32) | end;
+  }
+
+  static inline uint32_t GetRangeBegin(uint64_t range) { return range >> 32; }
+
+  static inline uint32_t GetRangeEnd(uint64_t range) { return (uint32_t)range; }
+
+  // Move the back half of the largest share left, rounded up, to the thief,
+  // whose share must be empty. Return false when all the shares are empty.
+  bool StealRange(int thief_id) {
+    while (true) {
+      int victim_id = -1;
+      uint64_t victim_range = 0;
+      uint32_t max_range_length = 0;
+      for (int wi = 0; wi < num_workers_; ++wi) {
+        if (wi == thief_id) {
+          continue;
+        }
+        const uint64_t range =
+            worker_ranges_[wi].range.load(std::memory_order_acquire);
+        const uint32_t range_length =
+            GetRangeEnd(range) - GetRangeBegin(range);
+        if (range_length > max_range_length) {
+          victim_id = wi;
+          victim_range = range;
+          max_range_length = range_length;
+        }
+      }
+      if (victim_id < 0) {
+        return false;
+      }
+
+      const uint32_t begin = GetRangeBegin(victim_range);
+      const uint32_t end = GetRangeEnd(victim_range);
+      const uint32_t middle = begin + (end - begin) / 2;
+      // A share never gets back to a range it had, so there is no ABA.
+      if (worker_ranges_[victim_id].range.compare_exchange_strong(
+              victim_range, PackRange(begin, middle),
+              std::memory_order_acq_rel, std::memory_order_acquire)) {
+        // Only the thief changes its share once it is empty.
+        worker_ranges_[thief_id].range.store(PackRange(middle, end),
+                                             std::memory_order_release);
+        num_steals_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+  }
+
+  const int num_workers_;
+  std::unique_ptr<WorkerRange[]> worker_ranges_;
+  std::atomic<uint32_t> num_steals_{0};
+};
+
+}  // namespace chromap
+
+#endif  // READ_RANGE_SCHEDULER_H_
@@ -0,0 +1,94 @@
+#ifndef SEQUENCE_ARENA_H_
+#define SEQUENCE_ARENA_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "huge_page_memory.h"
+
+namespace chromap {
+
+// A bump allocator that keeps the strings of a sequence batch in a few large
+// blocks instead of one heap buffer per sequence. Strings never span blocks,
+// so a returned pointer stays valid until the next Clear(). Clear() keeps the
+// blocks, thus loading the following batches does not allocate at all. The
+// blocks are on huge pages when they are enabled, which helps the randomly
+// accessed reference most.
+class SequenceArena {
+ public:
+  SequenceArena() = default;
+
+  SequenceArena(const SequenceArena &) = delete;
+  SequenceArena &operator=(const SequenceArena &) = delete;
+
+  // Copy the string into the arena with a trailing '\0' and return the copy.
+  inline char *Append(const char *s, size_t length) {
+    char *copy = Allocate(length + 1);
+    memcpy(copy, s, length);
+    copy[length] = '\0';
+    return copy;
+  }
+
+  inline void Clear() {
+    current_block_index_ = 0;
+    current_block_size_ = 0;
+  }
+
+  inline void Swap(SequenceArena &arena) {
+    blocks_.swap(arena.blocks_);
+    block_capacities_.swap(arena.block_capacities_);
+    std::swap(current_block_index_, arena.current_block_index_);
+    std::swap(current_block_size_, arena.current_block_size_);
+  }
+
+  inline uint64_t GetMemoryBytes() const {
+    uint64_t memory_bytes = 0;
+    for (size_t capacity : block_capacities_) {
+      memory_bytes += capacity;
+    }
+    return memory_bytes;
+  }
+
+ private:
+  inline char *Allocate(size_t size) {
+    while (current_block_index_ < blocks_.size()) {
+      if (current_block_size_ + size <=
+          block_capacities_[current_block_index_]) {
+        char *memory =
+            blocks_[current_block_index_].get() + current_block_size_;
+        current_block_size_ += size;
+        return memory;
+      }
+      ++current_block_index_;
+      current_block_size_ = 0;
+    }
+
+    // Sequences longer than a block, e.g. chromosomes, get their own block.
+    const size_t capacity = size > kBlockSize ? size : kBlockSize;
+    char *block = (char *)AllocateHugePageMemory(capacity);
+    if (block == NULL) {
+      throw std::bad_alloc();
+    }
+    blocks_.emplace_back(block);
+    block_capacities_.push_back(capacity);
+    current_block_index_ = blocks_.size() - 1;
+    current_block_size_ = size;
+    return blocks_.back().get();
+  }
+
+  static constexpr size_t kBlockSize = (size_t)1 << 24;
+
+  std::vector<std::unique_ptr<char[], HugePageMemoryDeleter>> blocks_;
+  std::vector<size_t> block_capacities_;
+  size_t current_block_index_ = 0;
+  size_t current_block_size_ = 0;
+};
+
+}  // namespace chromap
+
+#endif  // SEQUENCE_ARENA_H_
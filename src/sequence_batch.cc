@@ -6,22 +6,53 @@
 
 namespace chromap {
 
-void SequenceBatch::InitializeLoading(const std::string &sequence_file_path) {
-  sequence_file_ = gzopen(sequence_file_path.c_str(), "r");
-  if (sequence_file_ == NULL) {
+void SequenceBatch::InitializeLoading(const std::string &sequence_file_path,
+                                      int num_decompression_threads) {
+  if (!sequence_file_reader_.Open(sequence_file_path,
+                                  num_decompression_threads)) {
     ExitWithMessage("Cannot find sequence file " + sequence_file_path);
   }
-  sequence_kseq_ = kseq_init(sequence_file_);
+  sequence_kseq_ = kseq_init(&sequence_file_reader_);
+}
+
+void SequenceBatch::InitializeMappedLoading(
+    const std::string &sequence_file_path, int num_parsing_threads,
+    bool load_names, bool load_quals) {
+  load_names_ = load_names;
+  load_quals_ = load_quals;
+  if (!mapped_fastq_file_.Open(sequence_file_path, num_parsing_threads)) {
+    load_names_ = true;
+    load_quals_ = true;
+    InitializeLoading(sequence_file_path, num_parsing_threads);
+  }
 }
 
 void SequenceBatch::FinalizeLoading() {
+  if (mapped_fastq_file_.IsOpen()) {
+    mapped_fastq_file_.Close();
+    return;
+  }
   kseq_destroy(sequence_kseq_);
-  gzclose(sequence_file_);
+  sequence_kseq_ = nullptr;
+  sequence_file_reader_.Close();
 }
 
 bool SequenceBatch::LoadOneSequenceAndSaveAt(uint32_t sequence_index) {
   if (sequence_index == 0) {
     num_loaded_sequences_ = 0;
+    sequence_arena_.Clear();
+    qual_arena_.Clear();
+    name_arena_.Clear();
+  }
+
+  if (mapped_fastq_file_.IsOpen()) {
+    FastqRecordView record;
+    if (!mapped_fastq_file_.ReadRecord(record)) {
+      return true;
+    }
+    AddLoadedSequenceAt(sequence_index);
+    SaveMappedSequenceAt(sequence_index, record);
+    return false;
   }
 
   int length = kseq_read(sequence_kseq_);
@@ -30,26 +61,8 @@ bool SequenceBatch::LoadOneSequenceAndSaveAt(uint32_t sequence_index) {
   }
 
   if (length > 0) {
-    kseq_t *sequence = sequence_batch_[sequence_index];
-    std::swap(sequence_kseq_->seq, sequence->seq);
-    ReplaceByEffectiveRange(sequence->seq, /*is_seq=*/true);
-    std::swap(sequence_kseq_->name, sequence->name);
-    std::swap(sequence_kseq_->comment, sequence->comment);
-    sequence->id = total_num_loaded_sequences_;
-    ++total_num_loaded_sequences_;
-
-    if (sequence_index >= num_loaded_sequences_) {
-      ++num_loaded_sequences_;
-    } else if (sequence_index + 1 != num_loaded_sequences_) {
-      std::cerr << sequence_index << " " << num_loaded_sequences_ << "\n";
-      ExitWithMessage(
-          "Shouldn't override other sequences rather than the last!");
-    }
-
-    if (sequence_kseq_->qual.l != 0) {  // fastq file
-      std::swap(sequence_kseq_->qual, sequence->qual);
-      ReplaceByEffectiveRange(sequence->qual, /*is_seq=*/false);
-    }
+    AddLoadedSequenceAt(sequence_index);
+    SaveLoadedSequenceAt(sequence_index);
     return false;
   }
 
@@ -83,24 +96,13 @@ uint32_t SequenceBatch::LoadBatch() {
 
 void SequenceBatch::LoadAllSequences() {
   double real_start_time = GetRealTime();
-  sequence_batch_.reserve(200);
   num_loaded_sequences_ = 0;
   num_bases_ = 0;
   int length = kseq_read(sequence_kseq_);
   while (length >= 0) {
     if (length > 0) {
-      sequence_batch_.emplace_back((kseq_t *)calloc(1, sizeof(kseq_t)));
-      kseq_t *sequence = sequence_batch_.back();
-      std::swap(sequence_kseq_->seq, sequence->seq);
-      ReplaceByEffectiveRange(sequence->seq, /*is_seq=*/true);
-      std::swap(sequence_kseq_->name, sequence->name);
-      std::swap(sequence_kseq_->comment, sequence->comment);
-      if (sequence_kseq_->qual.l != 0) {  // fastq file
-        std::swap(sequence_kseq_->qual, sequence->qual);
-        ReplaceByEffectiveRange(sequence->qual, /*is_seq=*/false);
-      }
-      sequence->id = total_num_loaded_sequences_;
-      ++total_num_loaded_sequences_;
+      ResizeBatch(num_loaded_sequences_ + 1);
+      SaveLoadedSequenceAt(num_loaded_sequences_);
       ++num_loaded_sequences_;
       num_bases_ += length;
     }
@@ -119,6 +121,58 @@ void SequenceBatch::LoadAllSequences() {
   std::cerr << "number of bases: " << num_bases_ << ".\n";
 }
 
+void SequenceBatch::SaveLoadedSequenceAt(uint32_t sequence_index) {
+  kstring_t &seq = sequence_kseq_->seq;
+  ReplaceByEffectiveRange(seq, /*is_seq=*/true);
+  sequences_[sequence_index] = sequence_arena_.Append(seq.s, seq.l);
+  sequence_lengths_[sequence_index] = seq.l;
+
+  const kstring_t &name = sequence_kseq_->name;
+  sequence_names_[sequence_index] = name_arena_.Append(name.s, name.l);
+  sequence_name_lengths_[sequence_index] = name.l;
+
+  kstring_t &qual = sequence_kseq_->qual;
+  if (qual.l != 0) {  // fastq file
+    ReplaceByEffectiveRange(qual, /*is_seq=*/false);
+    sequence_quals_[sequence_index] = qual_arena_.Append(qual.s, qual.l);
+  } else {
+    sequence_quals_[sequence_index] = NULL;
+  }
+
+  sequence_ids_[sequence_index] = total_num_loaded_sequences_;
+  ++total_num_loaded_sequences_;
+}
+
+void SequenceBatch::SaveMappedSequenceAt(uint32_t sequence_index,
+                                         const FastqRecordView &record) {
+  if (effective_range_.IsFullRangeAndPositiveStrand()) {
+    sequences_[sequence_index] = record.sequence;
+    sequence_lengths_[sequence_index] = record.length;
+    sequence_quals_[sequence_index] = load_quals_ ? record.qual : NULL;
+  } else {
+    char *sequence = sequence_arena_.Append(record.sequence, record.length);
+    sequences_[sequence_index] = sequence;
+    sequence_lengths_[sequence_index] = effective_range_.Replace(
+        sequence, record.length, /*need_complement=*/true);
+    sequence_quals_[sequence_index] = NULL;
+    if (load_quals_) {
+      char *qual = qual_arena_.Append(record.qual, record.length);
+      effective_range_.Replace(qual, record.length, /*need_complement=*/false);
+      sequence_quals_[sequence_index] = qual;
+    }
+  }
+
+  // The names are copied so that they are terminated, and are empty when they
+  // are not loaded.
+  const uint32_t name_length = load_names_ ? record.name_length : 0;
+  sequence_names_[sequence_index] =
+      name_arena_.Append(record.name, name_length);
+  sequence_name_lengths_[sequence_index] = name_length;
+
+  sequence_ids_[sequence_index] = total_num_loaded_sequences_;
+  ++total_num_loaded_sequences_;
+}
+
 void SequenceBatch::ReplaceByEffectiveRange(kstring_t &seq, bool is_seq) {
   seq.l = effective_range_.Replace(seq.s, seq.l, is_seq);
 }
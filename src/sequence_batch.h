@@ -6,17 +6,21 @@
 
 #include <iostream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "kseq.h"
+#include "mapped_fastq_file.h"
+#include "sequence_arena.h"
 #include "sequence_effective_range.h"
+#include "sequence_file_reader.h"
 #include "utils.h"
 
 namespace chromap {
 
 class SequenceBatch {
  public:
-  KSEQ_INIT(gzFile, gzread);
+  KSEQ_INIT(SequenceFileReader *, ReadSequenceFile);
 
   // When 'max_num_sequences' is not specified. This batch can be used to load
   // any number of sequences with a positive full effective range.
@@ -27,20 +31,7 @@ class SequenceBatch {
                 const SequenceEffectiveRange &effective_range)
       : max_num_sequences_(max_num_sequences),
         effective_range_(effective_range) {
-    sequence_batch_.reserve(max_num_sequences_);
-    for (uint32_t i = 0; i < max_num_sequences_; ++i) {
-      sequence_batch_.emplace_back((kseq_t *)calloc(1, sizeof(kseq_t)));
-      sequence_batch_.back()->f = NULL;
-    }
-    negative_sequence_batch_.assign(max_num_sequences_, "");
-  }
-
-  ~SequenceBatch() {
-    if (sequence_batch_.size() > 0) {
-      for (uint32_t i = 0; i < sequence_batch_.size(); ++i) {
-        kseq_destroy(sequence_batch_[i]);
-      }
-    }
+    ResizeBatch(max_num_sequences_);
   }
 
   inline uint64_t GetNumSequences() const { return num_loaded_sequences_; }
@@ -49,38 +40,56 @@ class SequenceBatch {
 
   inline uint64_t GetNumBases() const { return num_bases_; }
 
-  inline std::vector<kseq_t *> &GetSequenceBatch() { return sequence_batch_; }
-
-  inline std::vector<std::string> &GetNegativeSequenceBatch() {
-    return negative_sequence_batch_;
+  // Return the memory of the sequences, e.g. to check on which NUMA nodes
+  // their pages are.
+  inline std::vector<std::pair<const void *, size_t>> GetSequenceMemoryRanges()
+      const {
+    std::vector<std::pair<const void *, size_t>> memory_ranges;
+    for (uint64_t si = 0; si < num_loaded_sequences_; ++si) {
+      memory_ranges.emplace_back(sequences_[si], sequence_lengths_[si]);
+    }
+    return memory_ranges;
   }
 
+  // The sequences and the qualities read from a mapped FASTQ file are views
+  // into the file and are NOT terminated, so they must be used with
+  // GetSequenceLengthAt.
   inline const char *GetSequenceAt(uint32_t sequence_index) const {
-    return sequence_batch_[sequence_index]->seq.s;
+    return sequences_[sequence_index];
   }
 
   inline uint32_t GetSequenceLengthAt(uint32_t sequence_index) const {
-    return sequence_batch_[sequence_index]->seq.l;
+    return sequence_lengths_[sequence_index];
   }
 
+  // Return an empty name when the names are not loaded.
   inline const char *GetSequenceNameAt(uint32_t sequence_index) const {
-    return sequence_batch_[sequence_index]->name.s;
+    return sequence_names_[sequence_index];
   }
 
   inline uint32_t GetSequenceNameLengthAt(uint32_t sequence_index) const {
-    return sequence_batch_[sequence_index]->name.l;
+    return sequence_name_lengths_[sequence_index];
   }
 
+  // Return NULL when the sequences are loaded from a FASTA file or the
+  // qualities are not loaded.
   inline const char *GetSequenceQualAt(uint32_t sequence_index) const {
-    return sequence_batch_[sequence_index]->qual.s;
+    return sequence_quals_[sequence_index];
   }
+
   inline uint32_t GetSequenceIdAt(uint32_t sequence_index) const {
-    return sequence_batch_[sequence_index]->id;
+    return sequence_ids_[sequence_index];
   }
 
-  inline const std::string &GetNegativeSequenceAt(
-      uint32_t sequence_index) const {
-    return negative_sequence_batch_[sequence_index];
+  // Generate the reverse complement of the sequence into 'negative_sequence'.
+  // It is computed on demand so that the caller can keep one buffer per
+  // thread instead of one string per sequence in the batch.
+  inline void GetNegativeSequenceAt(uint32_t sequence_index,
+                                    std::string &negative_sequence) const {
+    const uint32_t sequence_length = sequence_lengths_[sequence_index];
+    negative_sequence.resize(sequence_length);
+    GenerateReverseComplement(sequences_[sequence_index], sequence_length,
+                              &negative_sequence[0]);
   }
 
   // big_endian: N_pos is in the order of sequence
@@ -90,8 +99,8 @@ class SequenceBatch {
   //      little endian returns N at 0.
   inline void GetSequenceNsAt(uint32_t sequence_index, bool little_endian,
                               std::vector<int> &N_pos) {
-    const int l = sequence_batch_[sequence_index]->seq.l;
-    const char *s = sequence_batch_[sequence_index]->seq.s;
+    const int l = sequence_lengths_[sequence_index];
+    const char *s = sequences_[sequence_index];
     N_pos.clear();
     if (little_endian) {
       for (int i = l - 1; i >= 0; --i) {
@@ -105,57 +114,69 @@ class SequenceBatch {
   }
 
   inline bool IsNInSequenceAt(uint32_t sequence_index) {
-    const int l = sequence_batch_[sequence_index]->seq.l;
-    const char *s = sequence_batch_[sequence_index]->seq.s;
+    const int l = sequence_lengths_[sequence_index];
+    const char *s = sequences_[sequence_index];
     for (int i = 0 ; i < l ; ++i)
       if (s[i] == 'N')
         return true;
     return false;
   }
 
-  //  inline char GetReverseComplementBaseOfSequenceAt(uint32_t sequence_index,
-  //  uint32_t position) {
-  //    kseq_t *sequence = sequence_batch_[sequence_index];
-  //    return Uint8ToChar(((uint8_t)3) ^
-  //    (CharToUint8((sequence->seq.s)[sequence->seq.l - position - 1])));
-  //  }
-
-  inline void PrepareNegativeSequenceAt(uint32_t sequence_index) {
-    kseq_t *sequence = sequence_batch_[sequence_index];
-    uint32_t sequence_length = sequence->seq.l;
-    std::string &negative_sequence = negative_sequence_batch_[sequence_index];
-    negative_sequence.clear();
-    negative_sequence.reserve(sequence_length);
-    for (uint32_t i = 0; i < sequence_length; ++i) {
-      negative_sequence.push_back(Uint8ToChar(
-          ((uint8_t)3) ^
-          (CharToUint8((sequence->seq.s)[sequence_length - i - 1]))));
+  // Trim the 3' poly-G tail if it has at least 'min_tail_length' bases. Two
+  // color sequencers call G when there is no signal.
+  inline void TrimPolyGTailAt(uint32_t sequence_index,
+                              uint32_t min_tail_length) {
+    const uint32_t sequence_length = sequence_lengths_[sequence_index];
+    const uint32_t tail_length =
+        GetPolyGTailLength(sequences_[sequence_index], sequence_length);
+    if (tail_length >= min_tail_length) {
+      sequence_lengths_[sequence_index] = sequence_length - tail_length;
     }
   }
 
+  // The normalized triplet entropy, which is low for poly-G, short repeats
+  // and other low-complexity sequences.
+  inline double GetComplexityAt(uint32_t sequence_index) const {
+    return GetTripletEntropy(sequences_[sequence_index],
+                             sequence_lengths_[sequence_index]);
+  }
+
   inline void TrimSequenceAt(uint32_t sequence_index, int length_after_trim) {
-    kseq_t *sequence = sequence_batch_[sequence_index];
-    if (length_after_trim >= (int)sequence->seq.l) {
+    if (length_after_trim >= (int)sequence_lengths_[sequence_index]) {
       return;
     }
 
-    negative_sequence_batch_[sequence_index].erase(
-        negative_sequence_batch_[sequence_index].begin(),
-        negative_sequence_batch_[sequence_index].begin() + sequence->seq.l -
-            length_after_trim);
-
-    sequence->seq.l = length_after_trim;
-    sequence->seq.s[sequence->seq.l] = '\0';
-    sequence->qual.l = length_after_trim;
-    sequence->qual.s[sequence->qual.l] = '\0';
+    // The sequences might be views into a mapped file, so they are trimmed by
+    // their lengths only.
+    sequence_lengths_[sequence_index] = length_after_trim;
   }
 
+  // Only swap the loaded sequences. The loading states stay with each batch.
   inline void SwapSequenceBatch(SequenceBatch &batch) {
-    sequence_batch_.swap(batch.GetSequenceBatch());
-    negative_sequence_batch_.swap(batch.GetNegativeSequenceBatch());
+    sequences_.swap(batch.sequences_);
+    sequence_lengths_.swap(batch.sequence_lengths_);
+    sequence_quals_.swap(batch.sequence_quals_);
+    sequence_names_.swap(batch.sequence_names_);
+    sequence_name_lengths_.swap(batch.sequence_name_lengths_);
+    sequence_ids_.swap(batch.sequence_ids_);
+    sequence_arena_.Swap(batch.sequence_arena_);
+    qual_arena_.Swap(batch.qual_arena_);
+    name_arena_.Swap(batch.name_arena_);
   }
 
-  void InitializeLoading(const std::string &sequence_file_path);
+  // When 'num_decompression_threads' is positive, the file is decompressed
+  // ahead of parsing by that many background threads.
+  void InitializeLoading(const std::string &sequence_file_path,
+                         int num_decompression_threads = 0);
+
+  // Load an uncompressed FASTQ file through a MappedFastqFile, which parses
+  // it with 'num_parsing_threads' threads. When the effective range is full,
+  // the sequences and qualities are views into the mapped file instead of
+  // copies. Names and qualities are skipped unless requested. Fall back to
+  // InitializeLoading() when the file is not an uncompressed FASTQ file.
+  void InitializeMappedLoading(const std::string &sequence_file_path,
+                               int num_parsing_threads, bool load_names,
+                               bool load_quals);
 
   void FinalizeLoading();
 
@@ -175,8 +196,7 @@ class SequenceBatch {
 
   inline void CorrectBaseAt(uint32_t sequence_index, uint32_t base_position,
                             char correct_base) {
-    kseq_t *sequence = sequence_batch_[sequence_index];
-    sequence->seq.s[base_position] = correct_base;
+    sequences_[sequence_index][base_position] = correct_base;
   }
 
   inline uint64_t GenerateSeedFromSequenceAt(uint32_t sequence_index,
@@ -189,18 +209,12 @@ class SequenceBatch {
   }
 
   inline void ReorderSequences(const std::vector<int> &rid_rank) {
-    std::vector<kseq_t *> tmp_sequence_batch_ = sequence_batch_;
-    std::vector<std::string> tmp_negative_sequence_batch_ =
-        negative_sequence_batch_;
-    for (size_t i = 0; i < sequence_batch_.size(); ++i) {
-      sequence_batch_[rid_rank[i]] = tmp_sequence_batch_[i];
-    }
-
-    if (negative_sequence_batch_.size() > 0) {
-      for (size_t i = 0; i < sequence_batch_.size(); ++i) {
-        negative_sequence_batch_[rid_rank[i]] = tmp_negative_sequence_batch_[i];
-      }
-    }
+    ReorderByRank(rid_rank, sequences_);
+    ReorderByRank(rid_rank, sequence_lengths_);
+    ReorderByRank(rid_rank, sequence_quals_);
+    ReorderByRank(rid_rank, sequence_names_);
+    ReorderByRank(rid_rank, sequence_name_lengths_);
+    ReorderByRank(rid_rank, sequence_ids_);
   }
 
  protected:
@@ -208,6 +222,43 @@ class SequenceBatch {
   // necessary. Otherwise, it will just reverse the sequence.
   void ReplaceByEffectiveRange(kstring_t &seq, bool is_seq);
 
+  // Copy the sequence just read by 'sequence_kseq_' into the arenas.
+  void SaveLoadedSequenceAt(uint32_t sequence_index);
+
+  // Save the views of the record, or copies when the effective range is not
+  // full.
+  void SaveMappedSequenceAt(uint32_t sequence_index,
+                            const FastqRecordView &record);
+
+  // Count the sequence to be saved at 'sequence_index'.
+  inline void AddLoadedSequenceAt(uint32_t sequence_index) {
+    if (sequence_index >= num_loaded_sequences_) {
+      ++num_loaded_sequences_;
+    } else if (sequence_index + 1 != num_loaded_sequences_) {
+      std::cerr << sequence_index << " " << num_loaded_sequences_ << "\n";
+      ExitWithMessage(
+          "Shouldn't override other sequences rather than the last!");
+    }
+  }
+
+  inline void ResizeBatch(uint32_t num_sequences) {
+    sequences_.resize(num_sequences);
+    sequence_lengths_.resize(num_sequences);
+    sequence_quals_.resize(num_sequences);
+    sequence_names_.resize(num_sequences);
+    sequence_name_lengths_.resize(num_sequences);
+    sequence_ids_.resize(num_sequences);
+  }
+
+  template <typename T>
+  inline void ReorderByRank(const std::vector<int> &rank,
+                            std::vector<T> &values) {
+    const std::vector<T> tmp_values = values;
+    for (size_t i = 0; i < tmp_values.size(); ++i) {
+      values[rank[i]] = tmp_values[i];
+    }
+  }
+
   // This is the accumulated number of sequences that have ever been loaded into
   // the batch. It is useful for tracking read ids.
   uint32_t total_num_loaded_sequences_ = 0;
@@ -223,12 +274,27 @@ class SequenceBatch {
   // is set to 0 when there is no such restriction.
   uint32_t max_num_sequences_ = 0;
 
-  gzFile sequence_file_;
+  SequenceFileReader sequence_file_reader_;
   kseq_t *sequence_kseq_ = nullptr;
-  std::vector<kseq_t *> sequence_batch_;
 
-  // TODO: avoid constructing the negative sequence batch.
-  std::vector<std::string> negative_sequence_batch_;
+  // Used instead of the kseq parser when it is open.
+  MappedFastqFile mapped_fastq_file_;
+  bool load_names_ = true;
+  bool load_quals_ = true;
+
+  // The sequences are stored as a structure of arrays. Bases, qualities and
+  // names of the whole batch live in their own arenas and the arrays below
+  // point into them, so loading a batch does not allocate per sequence.
+  std::vector<char *> sequences_;
+  std::vector<uint32_t> sequence_lengths_;
+  std::vector<char *> sequence_quals_;
+  std::vector<char *> sequence_names_;
+  std::vector<uint32_t> sequence_name_lengths_;
+  std::vector<uint32_t> sequence_ids_;
+
+  SequenceArena sequence_arena_;
+  SequenceArena qual_arena_;
+  SequenceArena name_arena_;
 
   // Actual range within each sequence.
   const SequenceEffectiveRange effective_range_;
@@ -75,6 +75,14 @@ class SequenceEffectiveRange {
     return true;
   }
 
+  bool IsFullRangeAndPositiveStrand() const {
+    if (strand == '+' && starts[0] == 0 && ends[0] == -1) {
+      return true;
+    }
+
+    return false;
+  }
+
   // Replace by the range specified in the starts, ends section, but does not
   // apply the strand operation. Return new length.
   int Replace(char *s, int len, bool need_complement) const {
@@ -118,13 +126,6 @@ class SequenceEffectiveRange {
   }
 
  private:
-  bool IsFullRangeAndPositiveStrand() const {
-    if (strand == '+' && starts[0] == 0 && ends[0] == -1) {
-      return true;
-    }
-
-    return false;
-  }
 
   std::vector<int> starts = {0};
   std::vector<int> ends = {-1};
@@ -0,0 +1,345 @@
+#include "sequence_file_reader.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "utils.h"
+
+namespace chromap {
+
+namespace {
+
+// The BGZF header is a gzip header with a 6-byte extra field that stores the
+// size of the compressed block.
+constexpr uint32_t kBGZFHeaderSize = 18;
+constexpr uint32_t kBGZFFooterSize = 8;
+constexpr uint32_t kBGZFMaxBlockSize = 65536;
+
+inline uint32_t LoadLittleEndian32(const uint8_t *bytes) {
+  return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) |
+         ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+}  // namespace
+
+bool SequenceFileReader::Open(const std::string &file_path, int num_threads) {
+  Close();
+  file_path_ = file_path;
+  num_threads_ = num_threads;
+  is_bgzf_ = false;
+
+  if (num_threads_ > 0) {
+    FILE *file = fopen(file_path.c_str(), "rb");
+    if (file == NULL) {
+      return false;
+    }
+    uint8_t header[kBGZFHeaderSize];
+    is_bgzf_ = fread(header, 1, kBGZFHeaderSize, file) == kBGZFHeaderSize &&
+               IsBGZFHeader(header);
+    if (is_bgzf_) {
+      rewind(file);
+      bgzf_file_ = file;
+    } else {
+      fclose(file);
+    }
+  }
+
+  if (!is_bgzf_) {
+    gz_file_ = gzopen(file_path.c_str(), "r");
+    if (gz_file_ == NULL) {
+      return false;
+    }
+    gzbuffer(gz_file_, 1 << 17);
+  }
+
+  if (num_threads_ > 0) {
+    chunks_ = std::vector<Chunk>(kNumChunks);
+    for (Chunk &chunk : chunks_) {
+      free_chunks_.push_back(&chunk);
+    }
+    is_closing_ = false;
+    current_chunk_ = NULL;
+    current_chunk_offset_ = 0;
+    if (is_bgzf_) {
+      decompression_thread_ =
+          std::thread(&SequenceFileReader::GenerateBGZFChunks, this);
+    } else {
+      decompression_thread_ =
+          std::thread(&SequenceFileReader::GenerateGzipChunks, this);
+    }
+  }
+  return true;
+}
+
+void SequenceFileReader::Close() {
+  if (decompression_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(chunk_mutex_);
+      is_closing_ = true;
+    }
+    chunk_condition_.notify_all();
+    decompression_thread_.join();
+  }
+
+  if (gz_file_ != NULL) {
+    gzclose(gz_file_);
+    gz_file_ = NULL;
+  }
+
+  if (bgzf_file_ != NULL) {
+    fclose(bgzf_file_);
+    bgzf_file_ = NULL;
+  }
+
+  free_chunks_.clear();
+  filled_chunks_.clear();
+  chunks_.clear();
+  current_chunk_ = NULL;
+}
+
+int SequenceFileReader::Read(void *buffer, unsigned size) {
+  if (num_threads_ == 0) {
+    const int num_read_bytes = gzread(gz_file_, buffer, size);
+    if (num_read_bytes <= 0) {
+      ExitIfCorrupted();
+    }
+    return num_read_bytes;
+  }
+
+  char *output = (char *)buffer;
+  size_t num_copied_bytes = 0;
+  while (num_copied_bytes < size) {
+    if (current_chunk_ != NULL &&
+        current_chunk_offset_ < current_chunk_->size) {
+      const size_t num_bytes =
+          std::min(size - num_copied_bytes,
+                   current_chunk_->size - current_chunk_offset_);
+      memcpy(output + num_copied_bytes,
+             current_chunk_->data.data() + current_chunk_offset_, num_bytes);
+      num_copied_bytes += num_bytes;
+      current_chunk_offset_ += num_bytes;
+      continue;
+    }
+
+    if (current_chunk_ != NULL) {
+      if (current_chunk_->is_corrupted) {
+        ExitIfCorrupted();
+      }
+      if (current_chunk_->is_last) {
+        break;
+      }
+      ReleaseChunk(current_chunk_);
+    }
+
+    current_chunk_ = PopFilledChunk();
+    current_chunk_offset_ = 0;
+  }
+
+  return num_copied_bytes;
+}
+
+bool SequenceFileReader::IsGzipFileCorrupted() const {
+  // A truncated file reads as the end of the file with an error set.
+  int error_number = Z_OK;
+  gzerror(gz_file_, &error_number);
+  return error_number != Z_OK;
+}
+
+void SequenceFileReader::ExitIfCorrupted() const {
+  // kseq would take an error for the end of the file, so the reads after it
+  // would be dropped silently.
+  if ((current_chunk_ != NULL && current_chunk_->is_corrupted) ||
+      (gz_file_ != NULL && IsGzipFileCorrupted())) {
+    ExitWithMessage("Failed to decompress " + file_path_ +
+                    ", which might be corrupted!");
+  }
+}
+
+bool SequenceFileReader::IsBGZFHeader(const uint8_t *header) {
+  return header[0] == 31 && header[1] == 139 && header[2] == 8 &&
+         (header[3] & 4) != 0 && header[10] == 6 && header[11] == 0 &&
+         header[12] == 'B' && header[13] == 'C' && header[14] == 2 &&
+         header[15] == 0;
+}
+
+void SequenceFileReader::GenerateGzipChunks() {
+  while (true) {
+    Chunk *chunk = AcquireFreeChunk();
+    if (chunk == NULL) {
+      return;
+    }
+
+    if (chunk->data.size() < kGzipChunkSize) {
+      chunk->data.resize(kGzipChunkSize);
+    }
+    const int size = gzread(gz_file_, chunk->data.data(), kGzipChunkSize);
+    chunk->size = size > 0 ? size : 0;
+    chunk->is_corrupted = size <= 0 && IsGzipFileCorrupted();
+    chunk->is_last = size <= 0;
+    PushFilledChunk(chunk);
+
+    if (chunk->is_last) {
+      return;
+    }
+  }
+}
+
+void SequenceFileReader::GenerateBGZFChunks() {
+  std::vector<std::vector<uint8_t>> blocks(kNumBGZFBlocksPerChunk);
+  std::vector<size_t> inflated_block_offsets(kNumBGZFBlocksPerChunk);
+  std::vector<uint32_t> inflated_block_sizes(kNumBGZFBlocksPerChunk);
+
+  bool is_last = false;
+  while (!is_last) {
+    // Load the compressed blocks serially and then inflate them in parallel.
+    bool is_corrupted = false;
+    int num_blocks = 0;
+    size_t chunk_size = 0;
+    while (num_blocks < kNumBGZFBlocksPerChunk) {
+      const int block_size = LoadBGZFBlock(blocks[num_blocks]);
+      if (block_size <= 0) {
+        is_corrupted = block_size < 0;
+        is_last = true;
+        break;
+      }
+
+      const uint32_t inflated_block_size = LoadLittleEndian32(
+          blocks[num_blocks].data() + block_size - 4);
+      if (inflated_block_size > kBGZFMaxBlockSize) {
+        is_corrupted = true;
+        is_last = true;
+        break;
+      }
+
+      inflated_block_offsets[num_blocks] = chunk_size;
+      inflated_block_sizes[num_blocks] = inflated_block_size;
+      chunk_size += inflated_block_size;
+      ++num_blocks;
+    }
+
+    Chunk *chunk = AcquireFreeChunk();
+    if (chunk == NULL) {
+      return;
+    }
+
+    if (chunk->data.size() < chunk_size) {
+      chunk->data.resize(chunk_size);
+    }
+
+    int num_corrupted_blocks = 0;
+#pragma omp parallel for num_threads(num_threads_) schedule(dynamic, 1) \
+    reduction(+ : num_corrupted_blocks)
+    for (int bi = 0; bi < num_blocks; ++bi) {
+      if (!InflateBGZFBlock(blocks[bi],
+                            chunk->data.data() + inflated_block_offsets[bi],
+                            inflated_block_sizes[bi])) {
+        ++num_corrupted_blocks;
+      }
+    }
+
+    chunk->size = chunk_size;
+    chunk->is_corrupted = is_corrupted || num_corrupted_blocks > 0;
+    chunk->is_last = is_last || chunk->is_corrupted;
+    is_last = chunk->is_last;
+    PushFilledChunk(chunk);
+  }
+}
+
+int SequenceFileReader::LoadBGZFBlock(std::vector<uint8_t> &block) {
+  uint8_t header[kBGZFHeaderSize];
+  const size_t num_header_bytes =
+      fread(header, 1, kBGZFHeaderSize, bgzf_file_);
+  if (num_header_bytes == 0 && feof(bgzf_file_)) {
+    return 0;
+  }
+
+  if (num_header_bytes != kBGZFHeaderSize || !IsBGZFHeader(header)) {
+    return -1;
+  }
+
+  const uint32_t block_size = ((uint32_t)header[16] | (header[17] << 8)) + 1;
+  if (block_size < kBGZFHeaderSize + kBGZFFooterSize) {
+    return -1;
+  }
+
+  block.resize(block_size);
+  memcpy(block.data(), header, kBGZFHeaderSize);
+  const size_t num_body_bytes = block_size - kBGZFHeaderSize;
+  if (fread(block.data() + kBGZFHeaderSize, 1, num_body_bytes, bgzf_file_) !=
+      num_body_bytes) {
+    return -1;
+  }
+  return block_size;
+}
+
+bool SequenceFileReader::InflateBGZFBlock(const std::vector<uint8_t> &block,
+                                          char *output,
+                                          uint32_t output_size) const {
+  // The empty block marking the end of the file has nothing to inflate.
+  if (output_size == 0) {
+    return true;
+  }
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit2(&stream, -15) != Z_OK) {
+    return false;
+  }
+
+  stream.next_in = (Bytef *)block.data() + kBGZFHeaderSize;
+  stream.avail_in = block.size() - kBGZFHeaderSize - kBGZFFooterSize;
+  stream.next_out = (Bytef *)output;
+  stream.avail_out = output_size;
+  const int status = inflate(&stream, Z_FINISH);
+  const bool is_inflated =
+      status == Z_STREAM_END && stream.total_out == output_size;
+  inflateEnd(&stream);
+
+  if (!is_inflated) {
+    return false;
+  }
+
+  const uint32_t crc = LoadLittleEndian32(block.data() + block.size() -
+                                          kBGZFFooterSize);
+  return crc32(crc32(0L, Z_NULL, 0), (const Bytef *)output, output_size) ==
+         crc;
+}
+
+SequenceFileReader::Chunk *SequenceFileReader::AcquireFreeChunk() {
+  std::unique_lock<std::mutex> lock(chunk_mutex_);
+  chunk_condition_.wait(
+      lock, [this] { return is_closing_ || !free_chunks_.empty(); });
+  if (is_closing_) {
+    return NULL;
+  }
+  Chunk *chunk = free_chunks_.front();
+  free_chunks_.pop_front();
+  return chunk;
+}
+
+void SequenceFileReader::PushFilledChunk(Chunk *chunk) {
+  {
+    std::lock_guard<std::mutex> lock(chunk_mutex_);
+    filled_chunks_.push_back(chunk);
+  }
+  chunk_condition_.notify_all();
+}
+
+SequenceFileReader::Chunk *SequenceFileReader::PopFilledChunk() {
+  std::unique_lock<std::mutex> lock(chunk_mutex_);
+  chunk_condition_.wait(lock, [this] { return !filled_chunks_.empty(); });
+  Chunk *chunk = filled_chunks_.front();
+  filled_chunks_.pop_front();
+  return chunk;
+}
+
+void SequenceFileReader::ReleaseChunk(Chunk *chunk) {
+  {
+    std::lock_guard<std::mutex> lock(chunk_mutex_);
+    free_chunks_.push_back(chunk);
+  }
+  chunk_condition_.notify_all();
+}
+
+}  // namespace chromap
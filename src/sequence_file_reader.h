@@ -0,0 +1,106 @@
+#ifndef SEQUENCE_FILE_READER_H_
+#define SEQUENCE_FILE_READER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <zlib.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace chromap {
+
+// Provides the decompressed bytes of a plain, gzip or BGZF file to kseq.
+// When 'num_threads' is 0, the file is inflated by zlib in the calling thread
+// as before. Otherwise a background thread decompresses the file ahead of the
+// parser and hands over large chunks through a bounded queue. For BGZF files,
+// the blocks in each chunk are inflated in parallel by 'num_threads' threads.
+// For other gzip files, which can only be inflated serially, the background
+// thread only overlaps the inflation with parsing, so they gain much less. A
+// corrupted or truncated file is a fatal error either way.
+class SequenceFileReader {
+ public:
+  SequenceFileReader() = default;
+
+  SequenceFileReader(const SequenceFileReader &) = delete;
+  SequenceFileReader &operator=(const SequenceFileReader &) = delete;
+
+  ~SequenceFileReader() { Close(); }
+
+  // Return false if the file cannot be opened.
+  bool Open(const std::string &file_path, int num_threads);
+
+  void Close();
+
+  // Copy the next at most 'size' bytes into 'buffer' and return the number of
+  // bytes copied. It only returns fewer bytes at the end of the file. Exit
+  // when the file is corrupted.
+  int Read(void *buffer, unsigned size);
+
+ private:
+  struct Chunk {
+    std::vector<char> data;
+    size_t size = 0;
+    bool is_last = false;
+    bool is_corrupted = false;
+  };
+
+  static bool IsBGZFHeader(const uint8_t *header);
+
+  bool IsGzipFileCorrupted() const;
+
+  // Exit with an error when the file is found corrupted or truncated.
+  void ExitIfCorrupted() const;
+
+  void GenerateGzipChunks();
+  void GenerateBGZFChunks();
+
+  // Return the size of the loaded compressed block, 0 at the end of the file
+  // and -1 if the block is corrupted.
+  int LoadBGZFBlock(std::vector<uint8_t> &block);
+
+  // Return false if the block is corrupted.
+  bool InflateBGZFBlock(const std::vector<uint8_t> &block, char *output,
+                        uint32_t output_size) const;
+
+  // Return NULL when the reader is closing.
+  Chunk *AcquireFreeChunk();
+  void PushFilledChunk(Chunk *chunk);
+  Chunk *PopFilledChunk();
+  void ReleaseChunk(Chunk *chunk);
+
+  static constexpr int kNumChunks = 4;
+  static constexpr size_t kGzipChunkSize = (size_t)1 << 22;
+  static constexpr int kNumBGZFBlocksPerChunk = 64;
+
+  std::string file_path_;
+  int num_threads_ = 0;
+  bool is_bgzf_ = false;
+  gzFile gz_file_ = NULL;
+  FILE *bgzf_file_ = NULL;
+
+  std::thread decompression_thread_;
+  std::vector<Chunk> chunks_;
+  std::deque<Chunk *> free_chunks_;
+  std::deque<Chunk *> filled_chunks_;
+  std::mutex chunk_mutex_;
+  std::condition_variable chunk_condition_;
+  bool is_closing_ = false;
+
+  // The chunk being consumed by Read().
+  Chunk *current_chunk_ = NULL;
+  size_t current_chunk_offset_ = 0;
+};
+
+inline int ReadSequenceFile(SequenceFileReader *reader, void *buffer,
+                            unsigned size) {
+  return reader->Read(buffer, size);
+}
+
+}  // namespace chromap
+
+#endif  // SEQUENCE_FILE_READER_H_
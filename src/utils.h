@@ -3,8 +3,12 @@
 
 #include <sys/resource.h>
 #include <sys/time.h>
+#include <tmmintrin.h>
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <string>
 #include <tuple>
 #include <vector>
 
@@ -34,14 +38,6 @@ struct BarcodeWithQual {
   }
 };
 
-struct _mm_history {
-  unsigned int timestamp = 0;
-  std::vector<Minimizer> minimizers;
-  std::vector<Candidate> positive_candidates;
-  std::vector<Candidate> negative_candidates;
-  uint32_t repetitive_seed_length;
-};
-
 KHASH_MAP_INIT_INT64(k128, uint128_t);
 KHASH_MAP_INIT_INT64(k64_seq, uint64_t);
 KHASH_SET_INIT_INT(k32_set);
@@ -107,6 +103,183 @@ inline static char Uint8ToChar(const uint8_t i) {
   return uint8_to_char_table_[i];
 }
 
+// Write the reverse complement of 'sequence' into 'reverse_complement', which
+// must hold at least 'sequence_length' chars. The output is the same as
+// complementing each base with CharToUint8/Uint8ToChar: bases are upper-cased
+// and anything other than ACGT becomes 'N'. Blocks of 16 bases are reversed
+// and complemented with pshufb on the low nibble of the lower-cased char.
+inline static void GenerateReverseComplement(const char *sequence,
+                                             uint32_t sequence_length,
+                                             char *reverse_complement) {
+  const __m128i reverse_mask =
+      _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  // Indexed by the low nibble: 'a' -> 1, 'c' -> 3, 't' -> 4, 'g' -> 7.
+  const __m128i complement_table = _mm_setr_epi8(
+      'N', 'T', 'N', 'G', 'A', 'N', 'N', 'C', 'N', 'N', 'N', 'N', 'N', 'N', 'N',
+      'N');
+  const __m128i expected_table = _mm_setr_epi8(0, 'a', 0, 'c', 't', 0, 0, 'g',
+                                               0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i lower_case_bit = _mm_set1_epi8(0x20);
+  const __m128i low_nibble_mask = _mm_set1_epi8(0x0f);
+  const __m128i ambiguous_base = _mm_set1_epi8('N');
+
+  uint32_t i = 0;
+  for (; i + 16 <= sequence_length; i += 16) {
+    __m128i bases = _mm_loadu_si128(
+        (const __m128i *)(sequence + sequence_length - i - 16));
+    bases = _mm_or_si128(_mm_shuffle_epi8(bases, reverse_mask),
+                         lower_case_bit);
+    const __m128i low_nibbles = _mm_and_si128(bases, low_nibble_mask);
+    const __m128i is_valid_base = _mm_cmpeq_epi8(
+        bases, _mm_shuffle_epi8(expected_table, low_nibbles));
+    const __m128i complement_bases =
+        _mm_or_si128(_mm_and_si128(is_valid_base,
+                                   _mm_shuffle_epi8(complement_table,
+                                                    low_nibbles)),
+                     _mm_andnot_si128(is_valid_base, ambiguous_base));
+    _mm_storeu_si128((__m128i *)(reverse_complement + i), complement_bases);
+  }
+
+  for (; i < sequence_length; ++i) {
+    reverse_complement[i] = Uint8ToChar(
+        ((uint8_t)3) ^ CharToUint8(sequence[sequence_length - i - 1]));
+  }
+}
+
+// Return count * log(count). The values for counts up to the usual read lengths
+// are computed once, so that scoring a read does not call log() per triplet.
+inline static double GetCountTimesLogCount(uint32_t count) {
+  static const std::vector<double> count_times_log_counts = [] {
+    std::vector<double> values(512, 0);
+    for (uint32_t i = 2; i < values.size(); ++i) {
+      values[i] = i * std::log((double)i);
+    }
+    return values;
+  }();
+  if (count < count_times_log_counts.size()) {
+    return count_times_log_counts[count];
+  }
+  return count * std::log((double)count);
+}
+
+// Return the Shannon entropy of the triplets (3-mers) of the sequence,
+// normalized by the highest entropy possible for its number of triplets, as in
+// the DUST filter. Poly-G, dinucleotide repeats like (CA)n and other
+// low-complexity sequences score near 0, random sequences near 1. Triplets
+// with an N are skipped.
+inline static double GetTripletEntropy(const char *sequence,
+                                       uint32_t sequence_length) {
+  uint32_t triplet_counts[64] = {0};
+  uint32_t num_triplets = 0;
+  uint32_t triplet = 0;
+  uint32_t num_valid_bases = 0;
+  for (uint32_t i = 0; i < sequence_length; ++i) {
+    const uint8_t base = CharToUint8(sequence[i]);
+    if (base > 3) {
+      num_valid_bases = 0;
+      continue;
+    }
+    triplet = ((triplet << 2) | base) & 63;
+    if (++num_valid_bases >= 3) {
+      ++triplet_counts[triplet];
+      ++num_triplets;
+    }
+  }
+  if (num_triplets < 2) {
+    return 1;
+  }
+
+  double sum_of_count_logs = 0;
+  for (uint32_t count : triplet_counts) {
+    sum_of_count_logs += GetCountTimesLogCount(count);
+  }
+  const uint32_t max_num_distinct_triplets = std::min(num_triplets, 64u);
+  const double entropy =
+      (GetCountTimesLogCount(num_triplets) - sum_of_count_logs) / num_triplets;
+  return entropy * max_num_distinct_triplets /
+         GetCountTimesLogCount(max_num_distinct_triplets);
+}
+
+// Return the length of the run of Gs at the end of the sequence, ignoring the
+// case. The sequence is scanned backwards 16 bases at a time.
+inline static uint32_t GetPolyGTailLength(const char *sequence,
+                                          uint32_t sequence_length) {
+  const __m128i lower_case_bit = _mm_set1_epi8(0x20);
+  const __m128i lower_case_g = _mm_set1_epi8('g');
+  uint32_t tail_length = 0;
+  for (; tail_length + 16 <= sequence_length; tail_length += 16) {
+    const __m128i bases = _mm_or_si128(
+        _mm_loadu_si128(
+            (const __m128i *)(sequence + sequence_length - tail_length - 16)),
+        lower_case_bit);
+    const uint32_t is_g_mask =
+        _mm_movemask_epi8(_mm_cmpeq_epi8(bases, lower_case_g));
+    if (is_g_mask != 0xffff) {
+      // Count the Gs after the last other base of the block.
+      return tail_length + __builtin_clz(~is_g_mask << 16);
+    }
+  }
+
+  while (tail_length < sequence_length &&
+         (sequence[sequence_length - tail_length - 1] | 0x20) == 'g') {
+    ++tail_length;
+  }
+  return tail_length;
+}
+
+// Return the number of positions where the two sequences differ, ignoring the
+// case and comparing 16 bases at a time. Stop counting once there are more
+// than 'max_num_mismatches' mismatches.
+inline static uint32_t GetNumMismatches(const char *sequence1,
+                                        const char *sequence2,
+                                        uint32_t length,
+                                        uint32_t max_num_mismatches) {
+  const __m128i lower_case_bit = _mm_set1_epi8(0x20);
+  uint32_t num_mismatches = 0;
+  uint32_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    const __m128i bases1 = _mm_or_si128(
+        _mm_loadu_si128((const __m128i *)(sequence1 + i)), lower_case_bit);
+    const __m128i bases2 = _mm_or_si128(
+        _mm_loadu_si128((const __m128i *)(sequence2 + i)), lower_case_bit);
+    num_mismatches += 16 - __builtin_popcount(_mm_movemask_epi8(
+                               _mm_cmpeq_epi8(bases1, bases2)));
+    if (num_mismatches > max_num_mismatches) {
+      return num_mismatches;
+    }
+  }
+
+  for (; i < length && num_mismatches <= max_num_mismatches; ++i) {
+    num_mismatches += (sequence1[i] | 0x20) != (sequence2[i] | 0x20);
+  }
+  return num_mismatches;
+}
+
+// Return the first position where the adapter, or a prefix of it running off
+// the 3' end, matches the sequence over at least 'min_overlap_length' bases,
+// or 'sequence_length' if there is none. One mismatch is allowed every 8 bases
+// of the match.
+inline static uint32_t GetAdapterPosition(const char *sequence,
+                                          uint32_t sequence_length,
+                                          const std::string &adapter,
+                                          uint32_t min_overlap_length) {
+  const uint32_t adapter_error_rate_inverse = 8;
+  min_overlap_length =
+      std::max(std::min(min_overlap_length, (uint32_t)adapter.length()), 1u);
+  for (uint32_t position = 0; position + min_overlap_length <= sequence_length;
+       ++position) {
+    const uint32_t overlap_length =
+        std::min((uint32_t)adapter.length(), sequence_length - position);
+    const uint32_t error_threshold =
+        overlap_length / adapter_error_rate_inverse;
+    if (GetNumMismatches(sequence + position, adapter.data(), overlap_length,
+                         error_threshold) <= error_threshold) {
+      return position;
+    }
+  }
+  return sequence_length;
+}
+
 // Make sure the length is not greater than 32 before calling this function.
 inline static uint64_t GenerateSeedFromSequence(const char *sequence,
                                                 uint32_t sequence_length,
@@ -128,6 +301,93 @@ inline static uint64_t GenerateSeedFromSequence(const char *sequence,
   return seed;
 }
 
+// Return whether 'read1' overlaps the reverse complement of the longer read2
+// by at least 'min_overlap_length' bases with at most one mismatch, and set
+// 'overlap_offset' to the offset of the overlap in 'negative_read2'.
+inline static bool FindMateOverlapOffset(const char *read1,
+                                         uint32_t read1_length,
+                                         const char *negative_read2,
+                                         uint32_t read2_length,
+                                         int min_overlap_length,
+                                         uint32_t &overlap_offset) {
+  const int seed_length = min_overlap_length / 2;
+  const uint32_t error_threshold_for_merging = 1;
+  if (min_overlap_length < 0 || (uint32_t)min_overlap_length > read2_length) {
+    return false;
+  }
+
+  // read1 overlaps the reverse complement of read2 from an offset when they
+  // differ at most at one base over the overlap, so either of the first two
+  // seeds of read1 matches exactly. A seed matching at the first offset wins,
+  // with the mismatch if any after the first seed, and otherwise the first
+  // offset with the mismatch in the first seed. Only the offsets where the
+  // 2-bit packed k-mers at the start of the seeds match are checked.
+  const int kmer_length = std::min(seed_length, 32);
+  const uint64_t kmer_mask =
+      kmer_length == 32 ? ~0ULL : (1ULL << (2 * kmer_length)) - 1;
+  const uint64_t seed1_kmer = GenerateSeedFromSequence(
+      read1, read1_length, /*start_position=*/0, kmer_length);
+  const uint64_t seed2_kmer =
+      GenerateSeedFromSequence(read1, read1_length, seed_length, kmer_length);
+  uint64_t kmer1 = 0;
+  uint64_t kmer2 = 0;
+  for (int i = 0; i < kmer_length - 1; ++i) {
+    kmer1 = (kmer1 << 2) | (CharToUint8(negative_read2[i]) & 3);
+    kmer2 = (kmer2 << 2) | (CharToUint8(negative_read2[seed_length + i]) & 3);
+  }
+
+  const uint32_t max_overlap_offset = read2_length - min_overlap_length;
+  bool is_merged = false;
+  for (uint32_t offset = 0; offset <= max_overlap_offset; ++offset) {
+    if (kmer_length > 0) {
+      kmer1 = ((kmer1 << 2) |
+               (CharToUint8(negative_read2[offset + kmer_length - 1]) & 3)) &
+              kmer_mask;
+      kmer2 = ((kmer2 << 2) |
+               (CharToUint8(negative_read2[offset + seed_length +
+                                           kmer_length - 1]) &
+                3)) &
+              kmer_mask;
+    }
+    // Bases other than ACGT are packed the same way as some of them, so a
+    // match of the k-mers may be a false positive but never a miss.
+    if (kmer1 != seed1_kmer && kmer2 != seed2_kmer) {
+      continue;
+    }
+
+    const uint32_t overlap_length =
+        std::min(read1_length, read2_length - offset);
+    const uint32_t seed1_length =
+        std::min((uint32_t)seed_length, overlap_length);
+    const uint32_t num_seed1_errors =
+        GetNumMismatches(negative_read2 + offset, read1, seed1_length,
+                         error_threshold_for_merging);
+    if (num_seed1_errors > error_threshold_for_merging) {
+      continue;
+    }
+    const uint32_t num_errors =
+        num_seed1_errors +
+        GetNumMismatches(negative_read2 + offset + seed1_length,
+                         read1 + seed1_length, overlap_length - seed1_length,
+                         error_threshold_for_merging - num_seed1_errors);
+    if (num_errors > error_threshold_for_merging) {
+      continue;
+    }
+
+    if (num_seed1_errors == 0) {
+      is_merged = true;
+      overlap_offset = offset;
+      break;
+    }
+    if (!is_merged) {
+      is_merged = true;
+      overlap_offset = offset;
+    }
+  }
+
+  return is_merged;
+}
+
 inline static uint64_t GenerateMinimizer(uint32_t sequence_index,
                                          uint32_t sequence_position,
                                          const Strand strand) {
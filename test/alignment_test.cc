@@ -0,0 +1,141 @@
+#include <stdint.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "alignment.h"
+#include "test_check.h"
+
+namespace chromap {
+namespace {
+
+const char kBases[] = "ACGT";
+
+// A reference window around a read with 'num_edits' random substitutions,
+// insertions and deletions.
+void GenerateCandidate(int error_threshold, int read_length, int num_edits,
+                       std::mt19937 &generator, std::string &read,
+                       std::string &reference_window) {
+  reference_window.clear();
+  for (int i = 0; i < read_length + 2 * error_threshold; ++i) {
+    reference_window.push_back(kBases[generator() % 4]);
+  }
+  read = reference_window.substr(error_threshold, read_length);
+  for (int ei = 0; ei < num_edits; ++ei) {
+    const size_t position = generator() % read.size();
+    switch (generator() % 3) {
+      case 0:
+        read[position] = kBases[generator() % 4];
+        break;
+      case 1:
+        read.insert(read.begin() + position, kBases[generator() % 4]);
+        break;
+      default:
+        read.erase(read.begin() + position);
+        break;
+    }
+  }
+  // Keep the read length and let the read run into the reference window.
+  while ((int)read.size() < read_length) {
+    read.push_back(kBases[generator() % 4]);
+  }
+  read.resize(read_length);
+}
+
+// The early exit on the band lower bound must give the same results as
+// running through the full band, which only stops once the band start has
+// more than 3 times the threshold errors.
+void CheckBandedAlignPatternToText() {
+  std::mt19937 generator(11);
+  int num_failed_candidates = 0;
+  for (int trial = 0; trial < 20000; ++trial) {
+    const int error_threshold = 1 + generator() % 15;
+    const int read_length = 2 * error_threshold + 20 + generator() % 130;
+    const int num_edits = generator() % (3 * error_threshold + 2);
+    std::string read;
+    std::string reference_window;
+    GenerateCandidate(error_threshold, read_length, num_edits, generator,
+                      read, reference_window);
+
+    int full_band_end_position = -1;
+    const int full_band_num_errors = BandedAlignPatternToText(
+        error_threshold, reference_window.data(), read.data(), read_length,
+        &full_band_end_position, /*find_end_past_error_threshold=*/true);
+    int end_position = -1;
+    const int num_errors =
+        BandedAlignPatternToText(error_threshold, reference_window.data(),
+                                 read.data(), read_length, &end_position);
+    if (full_band_num_errors > error_threshold) {
+      CHECK(num_errors > error_threshold);
+      ++num_failed_candidates;
+    } else {
+      CHECK(num_errors == full_band_num_errors);
+      CHECK(end_position == full_band_end_position);
+    }
+  }
+  // Both passing and failing candidates are covered.
+  CHECK(num_failed_candidates > 1000);
+  CHECK(num_failed_candidates < 19000);
+}
+
+// The SIMD verifiers must agree with the scalar one in every lane, including
+// when some lanes stop early and others do not.
+template <typename Integer, int kNumLanes>
+void CheckBandedAlignPatternsToText(
+    void (*align_patterns_to_text)(int, const char **, const char *, int,
+                                   Integer *, Integer *),
+    int max_error_threshold) {
+  std::mt19937 generator(11);
+  for (int trial = 0; trial < 5000; ++trial) {
+    const int error_threshold = 1 + generator() % max_error_threshold;
+    const int read_length = 2 * error_threshold + 20 + generator() % 130;
+    std::string read;
+    std::string reference_window;
+    GenerateCandidate(error_threshold, read_length, /*num_edits=*/0,
+                      generator, read, reference_window);
+
+    // Each lane has the window of the read with its own number of
+    // substitutions.
+    std::vector<std::string> reference_windows(kNumLanes, reference_window);
+    const char *patterns[kNumLanes];
+    Integer num_errors[kNumLanes];
+    Integer end_positions[kNumLanes];
+    for (int li = 0; li < kNumLanes; ++li) {
+      const int num_edits = generator() % (3 * error_threshold + 2);
+      for (int ei = 0; ei < num_edits; ++ei) {
+        reference_windows[li][generator() % reference_windows[li].size()] =
+            kBases[generator() % 4];
+      }
+      patterns[li] = reference_windows[li].data();
+      end_positions[li] = read_length - 1;
+    }
+    align_patterns_to_text(error_threshold, patterns, read.data(),
+                           read_length, num_errors, end_positions);
+
+    for (int li = 0; li < kNumLanes; ++li) {
+      int expected_end_position = -1;
+      const int expected_num_errors = BandedAlignPatternToText(
+          error_threshold, patterns[li], read.data(), read_length,
+          &expected_end_position, /*find_end_past_error_threshold=*/true);
+      if (expected_num_errors > error_threshold) {
+        CHECK(num_errors[li] > error_threshold);
+      } else {
+        CHECK(num_errors[li] == expected_num_errors);
+        CHECK(end_positions[li] == expected_end_position);
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace chromap
+
+int main() {
+  chromap::CheckBandedAlignPatternToText();
+  chromap::CheckBandedAlignPatternsToText<int32_t, 4>(
+      chromap::BandedAlign4PatternsToText, /*max_error_threshold=*/15);
+  chromap::CheckBandedAlignPatternsToText<int16_t, 8>(
+      chromap::BandedAlign8PatternsToText, /*max_error_threshold=*/7);
+  return FinishTest("alignment_test");
+}
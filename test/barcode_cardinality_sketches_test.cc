@@ -0,0 +1,80 @@
+#include <stdint.h>
+
+#include <cmath>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "barcode_cardinality_sketches.h"
+#include "test_check.h"
+
+namespace chromap {
+namespace {
+
+std::map<uint64_t, size_t> GetCardinalities(
+    BarcodeCardinalitySketches &sketches) {
+  std::map<uint64_t, size_t> cardinalities;
+  for (const std::pair<uint64_t, size_t> &cardinality :
+       sketches.GetCardinalities()) {
+    cardinalities[cardinality.first] = cardinality.second;
+  }
+  return cardinalities;
+}
+
+// Add 'num_values' consecutive values to the sketch of 'barcode', each value
+// 'num_copies' times.
+void AddValues(uint64_t barcode, uint32_t first_value, uint32_t num_values,
+               int num_copies, BarcodeCardinalitySketches &sketches) {
+  const uint32_t sketch_id = sketches.GetSketchId(barcode);
+  for (int copy = 0; copy < num_copies; ++copy) {
+    for (uint32_t value = first_value; value < first_value + num_values;
+         ++value) {
+      sketches.Add(sketch_id, value);
+    }
+  }
+}
+
+bool IsClose(size_t estimate, size_t cardinality, double relative_error) {
+  return std::fabs((double)estimate - cardinality) <=
+         relative_error * cardinality;
+}
+
+void CheckSmallCardinalities() {
+  // Below k the estimates are 0, as with the K-MinHash sketches.
+  BarcodeCardinalitySketches sketches(/*min_num_registers=*/250);
+  AddValues(/*barcode=*/1, 0, 10, 3, sketches);
+  AddValues(/*barcode=*/2, 0, 200, 2, sketches);
+  AddValues(/*barcode=*/3, 1000, 1000, 2, sketches);
+  std::map<uint64_t, size_t> cardinalities = GetCardinalities(sketches);
+  CHECK(cardinalities.size() == 3);
+  CHECK(cardinalities[1] == 0);
+  CHECK(cardinalities[2] == 0);
+  CHECK(IsClose(cardinalities[3], 1000, 0.2));
+
+  // Small sketches count their values exactly.
+  BarcodeCardinalitySketches exact_sketches(/*min_num_registers=*/1);
+  AddValues(/*barcode=*/7, 5, 3, 4, exact_sketches);
+  cardinalities = GetCardinalities(exact_sketches);
+  CHECK(cardinalities[7] == 3);
+}
+
+void CheckLargeCardinalities() {
+  BarcodeCardinalitySketches sketches(/*min_num_registers=*/1024);
+  // The sketches of the barcodes do not mix, and the same ids come back.
+  const uint32_t sketch_id = sketches.GetSketchId(/*barcode=*/5);
+  AddValues(/*barcode=*/9, 0, 2000, 1, sketches);
+  AddValues(/*barcode=*/5, 0, 100000, 2, sketches);
+  CHECK(sketches.GetSketchId(/*barcode=*/5) == sketch_id);
+  std::map<uint64_t, size_t> cardinalities = GetCardinalities(sketches);
+  CHECK(IsClose(cardinalities[5], 100000, 0.1));
+  CHECK(IsClose(cardinalities[9], 2000, 0.1));
+}
+
+}  // namespace
+}  // namespace chromap
+
+int main() {
+  chromap::CheckSmallCardinalities();
+  chromap::CheckLargeCardinalities();
+  return FinishTest("barcode_cardinality_sketches_test");
+}
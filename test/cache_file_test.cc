@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "cache_file.h"
+#include "mmcache.hpp"
+#include "test_check.h"
+
+namespace chromap {
+namespace {
+
+// Return the path of a new empty temporary file.
+std::string CreateTemporaryFile() {
+  char file_path[] = "/tmp/chromap_cache_file_test_XXXXXX";
+  const int file_descriptor = mkstemp(file_path);
+  CHECK(file_descriptor >= 0);
+  close(file_descriptor);
+  return file_path;
+}
+
+// An entry whose payload is filled from 'seed'.
+CacheFileEntry GenerateEntry(uint32_t score, uint32_t num_minimizers,
+                             uint32_t num_positive_candidates,
+                             uint32_t num_negative_candidates, uint64_t seed) {
+  CacheFileEntry entry;
+  entry.score = score;
+  entry.payload.resize(_mm_cache_entry_payload::GetSize(
+      num_minimizers, num_positive_candidates, num_negative_candidates));
+  _mm_cache_entry_payload *payload =
+      (_mm_cache_entry_payload *)entry.payload.data();
+  payload->num_minimizers = num_minimizers;
+  payload->num_positive_candidates = num_positive_candidates;
+  payload->num_negative_candidates = num_negative_candidates;
+  payload->repetitive_seed_length = seed % 50;
+  for (uint32_t mi = 0; mi < num_minimizers; ++mi) {
+    payload->GetMinimizers()[mi] = seed * 1000 + mi;
+    payload->GetStrands()[mi] = (seed + mi) & 1;
+    if (mi + 1 < num_minimizers) {
+      payload->GetOffsets()[mi] = mi + 1;
+    }
+  }
+  for (uint32_t ci = 0; ci < num_positive_candidates; ++ci) {
+    payload->GetPositiveCandidatePositions()[ci] = seed + ci;
+    payload->GetPositiveCandidateCounts()[ci] = ci + 1;
+  }
+  for (uint32_t ci = 0; ci < num_negative_candidates; ++ci) {
+    payload->GetNegativeCandidatePositions()[ci] = seed + 100 + ci;
+    payload->GetNegativeCandidateCounts()[ci] = ci + 2;
+  }
+  return entry;
+}
+
+CacheFileKey GenerateKey() {
+  CacheFileKey key;
+  key.index_fingerprint = 0x0123456789abcdefULL;
+  key.kmer_size = 17;
+  key.window_size = 7;
+  key.error_threshold = 8;
+  key.min_num_seeds_required_for_mapping = 2;
+  key.max_seed_frequencies[0] = 500;
+  key.max_seed_frequencies[1] = 1000;
+  return key;
+}
+
+// Return whether loading the file makes the process exit with an error.
+bool DoesLoadingExit(const std::string &file_path) {
+  const pid_t pid = fork();
+  if (pid == 0) {
+    // Keep the expected error message out of the test output.
+    freopen("/dev/null", "w", stderr);
+    CacheFileKey key;
+    std::vector<CacheFileEntry> entries;
+    LoadCacheFile(file_path, key, entries);
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) && WEXITSTATUS(status) != 0;
+}
+
+void CheckRoundTrip() {
+  const CacheFileKey key = GenerateKey();
+  std::vector<CacheFileEntry> entries;
+  entries.push_back(GenerateEntry(/*score=*/3, 2, 1, 0, /*seed=*/1));
+  entries.push_back(GenerateEntry(/*score=*/9, 5, 3, 2, /*seed=*/2));
+  entries.push_back(GenerateEntry(/*score=*/1, 1, 0, 4, /*seed=*/3));
+  entries.push_back(GenerateEntry(/*score=*/9, 3, 2, 2, /*seed=*/4));
+  const std::vector<CacheFileEntry> unsorted_entries = entries;
+  const std::string file_path = CreateTemporaryFile();
+  SaveCacheFile(file_path, key, entries);
+
+  // The entries are saved by descending scores, ties in their order.
+  CacheFileKey loaded_key;
+  std::vector<CacheFileEntry> loaded_entries;
+  CHECK(LoadCacheFile(file_path, loaded_key, loaded_entries));
+  CHECK(loaded_key == key);
+  CHECK(loaded_entries.size() == 4);
+  const size_t expected_order[4] = {1, 3, 0, 2};
+  for (size_t ei = 0; ei < loaded_entries.size() && ei < 4; ++ei) {
+    const CacheFileEntry &expected_entry = unsorted_entries[expected_order[ei]];
+    CHECK(loaded_entries[ei].score == expected_entry.score);
+    CHECK(loaded_entries[ei].payload == expected_entry.payload);
+  }
+
+  // An entry in both files is merged with the sum of its scores.
+  const std::string other_file_path = CreateTemporaryFile();
+  std::vector<CacheFileEntry> other_entries;
+  other_entries.push_back(GenerateEntry(/*score=*/4, 3, 2, 2, /*seed=*/4));
+  other_entries.push_back(GenerateEntry(/*score=*/2, 4, 1, 1, /*seed=*/5));
+  SaveCacheFile(other_file_path, key, other_entries);
+  const std::string merged_file_path = CreateTemporaryFile();
+  MergeCacheFiles({file_path, other_file_path}, merged_file_path);
+  CHECK(LoadCacheFile(merged_file_path, loaded_key, loaded_entries));
+  CHECK(loaded_key == key);
+  CHECK(loaded_entries.size() == 5);
+  if (loaded_entries.size() == 5) {
+    CHECK(loaded_entries[0].score == 13);
+    CHECK(loaded_entries[0].payload == unsorted_entries[3].payload);
+  }
+
+  unlink(file_path.c_str());
+  unlink(other_file_path.c_str());
+  unlink(merged_file_path.c_str());
+}
+
+void CheckVersionAndKey() {
+  CacheFileKey key;
+  std::vector<CacheFileEntry> entries;
+  CHECK(!LoadCacheFile("/tmp/chromap_cache_file_test_missing", key, entries));
+
+  entries.push_back(GenerateEntry(/*score=*/1, 2, 1, 1, /*seed=*/1));
+  const std::string file_path = CreateTemporaryFile();
+  SaveCacheFile(file_path, GenerateKey(), entries);
+  CHECK(!DoesLoadingExit(file_path));
+
+  // The version follows the 8 magic bytes.
+  FILE *cache_file = fopen(file_path.c_str(), "r+b");
+  const uint32_t other_version = 2;
+  fseek(cache_file, 8, SEEK_SET);
+  fwrite(&other_version, sizeof(other_version), 1, cache_file);
+  fclose(cache_file);
+  CHECK(DoesLoadingExit(file_path));
+
+  // A truncated file is rejected too.
+  SaveCacheFile(file_path, GenerateKey(), entries);
+  CHECK(truncate(file_path.c_str(), 30) == 0);
+  CHECK(DoesLoadingExit(file_path));
+  unlink(file_path.c_str());
+
+  // Any parameter the candidates depend on changes the key.
+  CacheFileKey other_key = GenerateKey();
+  CHECK(other_key == GenerateKey());
+  other_key.max_seed_frequencies[1] = 2000;
+  CHECK(other_key != GenerateKey());
+  other_key = GenerateKey();
+  other_key.index_fingerprint ^= 1;
+  CHECK(other_key != GenerateKey());
+}
+
+}  // namespace
+}  // namespace chromap
+
+int main() {
+  chromap::CheckRoundTrip();
+  chromap::CheckVersionAndKey();
+  return FinishTest("cache_file_test");
+}
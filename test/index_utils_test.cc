@@ -0,0 +1,122 @@
+#include <stdint.h>
+
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "index_utils.h"
+#include "test_check.h"
+
+namespace chromap {
+namespace {
+
+// The first occurrence found by a linear scan of the list.
+uint32_t GetFirstOccurrenceNotBeforeByScan(
+    const std::vector<uint64_t> &occurrence_table, uint32_t offset,
+    uint32_t num_occurrences, uint32_t first_occurrence,
+    uint64_t candidate_position) {
+  uint32_t oi = first_occurrence;
+  while (oi < num_occurrences &&
+         GenerateCandidatePositionFromOccurrenceTableEntry(
+             occurrence_table[offset + oi]) < candidate_position) {
+    ++oi;
+  }
+  return oi;
+}
+
+void CheckGetFirstOccurrenceNotBefore() {
+  std::mt19937 generator(11);
+  // Lists around the lengths searched with the samples, each sorted by the
+  // candidate positions with repeats and random strand bits.
+  std::vector<uint64_t> occurrence_table;
+  std::vector<std::pair<uint32_t, uint32_t>> occurrence_lists;
+  for (int li = 0; li < 300; ++li) {
+    const uint32_t num_occurrences = 1 + generator() % 300;
+    std::vector<uint64_t> candidate_positions(num_occurrences);
+    for (uint64_t &candidate_position : candidate_positions) {
+      candidate_position = generator() % (4 * num_occurrences);
+    }
+    std::sort(candidate_positions.begin(), candidate_positions.end());
+    occurrence_lists.emplace_back(occurrence_table.size(), num_occurrences);
+    for (uint64_t candidate_position : candidate_positions) {
+      occurrence_table.push_back((candidate_position << 1) | (generator() & 1));
+    }
+  }
+
+  // Sampled as in Index.
+  std::vector<uint64_t> occurrence_table_samples;
+  for (size_t i = 0; i < occurrence_table.size();
+       i += kOccurrenceSampleInterval) {
+    occurrence_table_samples.push_back(
+        GenerateCandidatePositionFromOccurrenceTableEntry(occurrence_table[i]));
+  }
+
+  for (const std::pair<uint32_t, uint32_t> &occurrence_list :
+       occurrence_lists) {
+    const uint32_t offset = occurrence_list.first;
+    const uint32_t num_occurrences = occurrence_list.second;
+    for (int query = 0; query < 50; ++query) {
+      const uint32_t first_occurrence = generator() % (num_occurrences + 1);
+      const uint64_t candidate_position =
+          generator() % (4 * num_occurrences + 2);
+      CHECK(GetFirstOccurrenceNotBefore(
+                occurrence_table.data(), occurrence_table_samples.data(),
+                offset, num_occurrences, first_occurrence,
+                candidate_position) ==
+            GetFirstOccurrenceNotBeforeByScan(occurrence_table, offset,
+                                              num_occurrences,
+                                              first_occurrence,
+                                              candidate_position));
+    }
+  }
+}
+
+void CheckMergeSortedCandidatePositionLists() {
+  std::mt19937 generator(11);
+  std::vector<std::pair<uint32_t, uint32_t>> list_ranges;
+  std::vector<uint32_t> losers;
+  for (int trial = 0; trial < 2000; ++trial) {
+    // Up to 40 lists, some of them empty, with repeated positions.
+    const uint32_t num_lists = generator() % 41;
+    const uint64_t max_position = 1 + generator() % 1000;
+    std::vector<uint64_t> candidate_position_lists;
+    std::vector<uint32_t> list_offsets(1, 0);
+    std::vector<uint64_t> expected_candidate_positions;
+    for (uint32_t li = 0; li < num_lists; ++li) {
+      std::vector<uint64_t> list(generator() % 30);
+      for (uint64_t &position : list) {
+        position = generator() % max_position;
+      }
+      std::sort(list.begin(), list.end());
+      candidate_position_lists.insert(candidate_position_lists.end(),
+                                      list.begin(), list.end());
+      list_offsets.push_back(candidate_position_lists.size());
+
+      std::vector<uint64_t> merged_positions;
+      std::merge(expected_candidate_positions.begin(),
+                 expected_candidate_positions.end(), list.begin(), list.end(),
+                 std::back_inserter(merged_positions));
+      expected_candidate_positions.swap(merged_positions);
+    }
+
+    // The merged positions are appended to the existing ones.
+    std::vector<uint64_t> candidate_positions(trial % 3, 7);
+    expected_candidate_positions.insert(expected_candidate_positions.begin(),
+                                        trial % 3, 7);
+    MergeSortedCandidatePositionLists(candidate_position_lists, list_offsets,
+                                      list_ranges, losers,
+                                      candidate_positions);
+    CHECK(candidate_positions == expected_candidate_positions);
+  }
+}
+
+}  // namespace
+}  // namespace chromap
+
+int main() {
+  chromap::CheckGetFirstOccurrenceNotBefore();
+  chromap::CheckMergeSortedCandidatePositionLists();
+  return FinishTest("index_utils_test");
+}
@@ -0,0 +1,143 @@
+#include <stdint.h>
+
+#include <vector>
+
+#include "cache_file.h"
+#include "mmcache.hpp"
+#include "test_check.h"
+
+namespace chromap {
+namespace {
+
+const int kNumEntries = 50;
+
+// The minimizers of the entry, 1 to 3 of them on the positive strand with
+// offsets 1, 2, ... The first and the last minimizers sum up to 7 * index + 1,
+// so the entries are in different sets of any cache with at least
+// 7 * kNumEntries sets.
+std::vector<Minimizer> GenerateMinimizers(int entry_index) {
+  std::vector<Minimizer> minimizers;
+  const int num_minimizers = 1 + entry_index % 3;
+  uint64_t position = 0;
+  for (int mi = 0; mi < num_minimizers; ++mi) {
+    uint64_t hash = 100000 + mi;
+    if (mi == 0) {
+      hash = 7 * entry_index + 1;
+    } else if (mi == num_minimizers - 1) {
+      hash = 0;
+    }
+    minimizers.emplace_back(hash, position << 1);
+    position += mi + 1;
+  }
+  return minimizers;
+}
+
+CacheFileEntry GenerateEntry(int entry_index) {
+  const std::vector<Minimizer> minimizers = GenerateMinimizers(entry_index);
+  const uint32_t num_positive_candidates = 1 + entry_index % 2;
+  const uint32_t num_negative_candidates = entry_index % 3;
+  CacheFileEntry entry;
+  entry.score = 1;
+  entry.payload.resize(_mm_cache_entry_payload::GetSize(
+      minimizers.size(), num_positive_candidates, num_negative_candidates));
+  _mm_cache_entry_payload *payload =
+      (_mm_cache_entry_payload *)entry.payload.data();
+  payload->num_minimizers = minimizers.size();
+  payload->num_positive_candidates = num_positive_candidates;
+  payload->num_negative_candidates = num_negative_candidates;
+  payload->repetitive_seed_length = entry_index;
+  for (uint32_t mi = 0; mi < minimizers.size(); ++mi) {
+    payload->GetMinimizers()[mi] = minimizers[mi].GetHash();
+    payload->GetStrands()[mi] = 0;
+    if (mi + 1 < minimizers.size()) {
+      payload->GetOffsets()[mi] = mi + 1;
+    }
+  }
+  const uint64_t rid = entry_index % 4;
+  for (uint32_t ci = 0; ci < num_positive_candidates; ++ci) {
+    payload->GetPositiveCandidatePositions()[ci] =
+        (rid << 32) | (1000 * entry_index + 10 * ci + 500);
+    payload->GetPositiveCandidateCounts()[ci] = ci + 1;
+  }
+  for (uint32_t ci = 0; ci < num_negative_candidates; ++ci) {
+    payload->GetNegativeCandidatePositions()[ci] =
+        (rid << 32) | (1000 * entry_index + 10 * ci + 700);
+    payload->GetNegativeCandidateCounts()[ci] = ci + 2;
+  }
+  return entry;
+}
+
+// Every entry is found with the candidates it was cached with.
+void CheckEntriesQueryable(mm_cache &cache,
+                           const std::vector<CacheFileEntry> &entries) {
+  int num_missing_entries = 0;
+  int num_wrong_entries = 0;
+  for (int ei = 0; ei < kNumEntries; ++ei) {
+    std::vector<Candidate> positive_candidates;
+    std::vector<Candidate> negative_candidates;
+    uint32_t repetitive_seed_length = 0;
+    if (cache.Query(GenerateMinimizers(ei), positive_candidates,
+                    negative_candidates, repetitive_seed_length,
+                    /*read_len=*/100) < 0) {
+      ++num_missing_entries;
+      continue;
+    }
+    const _mm_cache_entry_payload *payload =
+        (const _mm_cache_entry_payload *)entries[ei].payload.data();
+    bool is_entry_right =
+        repetitive_seed_length == payload->repetitive_seed_length &&
+        positive_candidates.size() == payload->num_positive_candidates &&
+        negative_candidates.size() == payload->num_negative_candidates;
+    for (uint32_t ci = 0; is_entry_right && ci < positive_candidates.size();
+         ++ci) {
+      is_entry_right =
+          positive_candidates[ci].position ==
+              payload->GetPositiveCandidatePositions()[ci] &&
+          positive_candidates[ci].count ==
+              payload->GetPositiveCandidateCounts()[ci];
+    }
+    for (uint32_t ci = 0; is_entry_right && ci < negative_candidates.size();
+         ++ci) {
+      is_entry_right =
+          negative_candidates[ci].position ==
+              payload->GetNegativeCandidatePositions()[ci] &&
+          negative_candidates[ci].count ==
+              payload->GetNegativeCandidateCounts()[ci];
+    }
+    num_wrong_entries += !is_entry_right;
+  }
+  CHECK(num_missing_entries == 0);
+  CHECK(num_wrong_entries == 0);
+}
+
+// A resize rehashes the entries into the new slots. None is dropped when the
+// sets have room for them.
+void CheckResize(int associativity) {
+  std::vector<CacheFileEntry> entries;
+  for (int ei = 0; ei < kNumEntries; ++ei) {
+    entries.push_back(GenerateEntry(ei));
+  }
+  mm_cache cache(/*size=*/1009 * associativity, associativity);
+  cache.SetKmerLength(17);
+  CHECK(cache.ImportEntries(entries) == (uint64_t)kNumEntries);
+  CheckEntriesQueryable(cache, entries);
+
+  cache.Resize(4000 * associativity);
+  CHECK(cache.GetNumSets() >= 4000);
+  CHECK(cache.GetNumOccupiedSlots() == (uint64_t)kNumEntries);
+  CheckEntriesQueryable(cache, entries);
+
+  cache.Resize(400 * associativity);
+  CHECK(cache.GetNumSets() >= 400 && cache.GetNumSets() < 1009);
+  CHECK(cache.GetNumOccupiedSlots() == (uint64_t)kNumEntries);
+  CheckEntriesQueryable(cache, entries);
+}
+
+}  // namespace
+}  // namespace chromap
+
+int main() {
+  chromap::CheckResize(/*associativity=*/1);
+  chromap::CheckResize(/*associativity=*/4);
+  return FinishTest("mmcache_test");
+}
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "chromap.h"
+#include "test_check.h"
+
+namespace chromap {
+namespace {
+
+const int kNumReferenceSequences = 4;
+const int kReferenceSequenceLength = 20000;
+const int kReadLength = 100;
+const int kFragmentLength = 300;
+
+// A pair of reads from the fragment starting at 'fragment_start' of the
+// reference sequence 'rid', with read2 on the negative strand.
+struct Fragment {
+  int rid;
+  int fragment_start;
+};
+
+std::string GetReverseComplement(const std::string &sequence) {
+  std::string reverse_complement(sequence.rbegin(), sequence.rend());
+  for (char &base : reverse_complement) {
+    switch (base) {
+      case 'A':
+        base = 'T';
+        break;
+      case 'C':
+        base = 'G';
+        break;
+      case 'G':
+        base = 'C';
+        break;
+      default:
+        base = 'A';
+        break;
+    }
+  }
+  return reverse_complement;
+}
+
+std::string GetReferenceSequenceName(int rid) {
+  return "chr" + std::to_string(rid + 1);
+}
+
+// Run 'function' in a child process with the logs of chromap kept out of the
+// test output. Return whether it finished without an error.
+template <typename Function>
+bool RunInChildProcess(Function function) {
+  const pid_t pid = fork();
+  if (pid == 0) {
+    freopen("/dev/null", "w", stderr);
+    function();
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+std::vector<std::string> LoadLines(const std::string &file_path) {
+  std::vector<std::string> lines;
+  std::ifstream file(file_path);
+  std::string line;
+  while (std::getline(file, line)) {
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+class PairedEndMappingTest {
+ public:
+  PairedEndMappingTest() {
+    char directory_path[] = "/tmp/chromap_paired_end_mapping_test_XXXXXX";
+    CHECK(mkdtemp(directory_path) != NULL);
+    directory_path_ = directory_path;
+    reference_file_path_ = directory_path_ + "/ref.fa";
+    index_file_path_ = directory_path_ + "/ref.index";
+    read1_file_path_ = directory_path_ + "/r1.fq";
+    read2_file_path_ = directory_path_ + "/r2.fq";
+    rid_order_file_path_ = directory_path_ + "/order.txt";
+
+    std::mt19937 generator(11);
+    std::ofstream reference_file(reference_file_path_);
+    for (int rid = 0; rid < kNumReferenceSequences; ++rid) {
+      std::string reference_sequence;
+      for (int i = 0; i < kReferenceSequenceLength; ++i) {
+        reference_sequence.push_back("ACGT"[generator() % 4]);
+      }
+      reference_file << ">" << GetReferenceSequenceName(rid) << "\n"
+                     << reference_sequence << "\n";
+      reference_sequences_.push_back(reference_sequence);
+    }
+    reference_file.close();
+
+    // The custom order reverses the reference sequences.
+    std::ofstream rid_order_file(rid_order_file_path_);
+    for (int rid = kNumReferenceSequences - 1; rid >= 0; --rid) {
+      rid_order_file << GetReferenceSequenceName(rid) << "\n";
+    }
+    rid_order_file.close();
+
+    IndexParameters index_parameters;
+    index_parameters.reference_file_path = reference_file_path_;
+    index_parameters.index_output_file_path = index_file_path_;
+    CHECK(RunInChildProcess([&index_parameters]() {
+      Chromap chromap_for_indexing(index_parameters);
+      chromap_for_indexing.ConstructIndex();
+    }));
+  }
+
+  ~PairedEndMappingTest() {
+    for (const std::string &file_path :
+         {reference_file_path_, index_file_path_, read1_file_path_,
+          read2_file_path_, rid_order_file_path_,
+          directory_path_ + "/mappings.bed"}) {
+      unlink(file_path.c_str());
+    }
+    rmdir(directory_path_.c_str());
+  }
+
+  void SaveReads(const std::vector<Fragment> &fragments) {
+    std::ofstream read1_file(read1_file_path_);
+    std::ofstream read2_file(read2_file_path_);
+    for (size_t fi = 0; fi < fragments.size(); ++fi) {
+      const std::string &reference_sequence =
+          reference_sequences_[fragments[fi].rid];
+      const std::string read1 =
+          reference_sequence.substr(fragments[fi].fragment_start, kReadLength);
+      const std::string read2 = GetReverseComplement(reference_sequence.substr(
+          fragments[fi].fragment_start + kFragmentLength - kReadLength,
+          kReadLength));
+      const std::string qualities(kReadLength, 'I');
+      read1_file << "@pair" << fi << "\n"
+                 << read1 << "\n+\n"
+                 << qualities << "\n";
+      read2_file << "@pair" << fi << "\n"
+                 << read2 << "\n+\n"
+                 << qualities << "\n";
+    }
+  }
+
+  // Map the saved reads into BED and return the mapping lines.
+  std::vector<std::string> MapReads(bool use_custom_rid_order) {
+    MappingParameters mapping_parameters;
+    mapping_parameters.reference_file_path = reference_file_path_;
+    mapping_parameters.index_file_path = index_file_path_;
+    mapping_parameters.read_file1_paths = {read1_file_path_};
+    mapping_parameters.read_file2_paths = {read2_file_path_};
+    mapping_parameters.mapping_output_file_path =
+        directory_path_ + "/mappings.bed";
+    if (use_custom_rid_order) {
+      mapping_parameters.custom_rid_order_file_path = rid_order_file_path_;
+    }
+    CHECK(RunInChildProcess([&mapping_parameters]() {
+      Chromap chromap_for_mapping(mapping_parameters);
+      chromap_for_mapping
+          .MapPairedEndReads<PairedEndMappingWithoutBarcode>();
+    }));
+    return LoadLines(mapping_parameters.mapping_output_file_path);
+  }
+
+  static std::string GetExpectedMappingPrefix(const Fragment &fragment) {
+    std::ostringstream prefix;
+    prefix << GetReferenceSequenceName(fragment.rid) << "\t"
+           << fragment.fragment_start << "\t"
+           << fragment.fragment_start + kFragmentLength << "\t";
+    return prefix.str();
+  }
+
+ private:
+  std::string directory_path_;
+  std::string reference_file_path_;
+  std::string index_file_path_;
+  std::string read1_file_path_;
+  std::string read2_file_path_;
+  std::string rid_order_file_path_;
+  std::vector<std::string> reference_sequences_;
+};
+
+// Concordant unique pairs take the fast path that skips the paired-end filter
+// and the verification. They must get the same mappings with a custom rid
+// order, only output in that order.
+void CheckConcordantUniquePairs() {
+  PairedEndMappingTest test;
+  const Fragment fragments[2] = {{/*rid=*/0, /*fragment_start=*/5000},
+                                 {/*rid=*/2, /*fragment_start=*/12000}};
+  test.SaveReads({fragments[0], fragments[1]});
+
+  const std::vector<std::string> mappings =
+      test.MapReads(/*use_custom_rid_order=*/false);
+  CHECK(mappings.size() == 2);
+  if (mappings.size() == 2) {
+    for (int fi = 0; fi < 2; ++fi) {
+      CHECK(mappings[fi].find(PairedEndMappingTest::GetExpectedMappingPrefix(
+                fragments[fi])) == 0);
+    }
+  }
+
+  const std::vector<std::string> reordered_mappings =
+      test.MapReads(/*use_custom_rid_order=*/true);
+  CHECK(reordered_mappings.size() == 2);
+  if (mappings.size() == 2 && reordered_mappings.size() == 2) {
+    CHECK(reordered_mappings[0] == mappings[1]);
+    CHECK(reordered_mappings[1] == mappings[0]);
+  }
+}
+
+}  // namespace
+}  // namespace chromap
+
+int main() {
+  chromap::CheckConcordantUniquePairs();
+  return FinishTest("paired_end_mapping_test");
+}
@@ -0,0 +1,105 @@
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "read_range_scheduler.h"
+#include "test_check.h"
+
+namespace chromap {
+namespace {
+
+// Map 'num_reads' reads with all the workers of the scheduler, each on its own
+// thread, and check every read is given out exactly once. The first worker is
+// slowed down so that the others steal its reads.
+void CheckAllReadsGivenOutOnce(ReadRangeScheduler &scheduler,
+                               uint32_t num_reads) {
+  scheduler.Reset(num_reads);
+  std::vector<std::atomic<uint32_t>> num_times_given_out(num_reads);
+  for (std::atomic<uint32_t> &num_times : num_times_given_out) {
+    num_times.store(0);
+  }
+
+  std::vector<std::thread> workers;
+  for (int worker_id = 0; worker_id < scheduler.GetNumWorkers();
+       ++worker_id) {
+    workers.emplace_back([&scheduler, &num_times_given_out, worker_id]() {
+      uint32_t range_begin = 0;
+      uint32_t range_end = 0;
+      while (scheduler.GetNextRange(worker_id, range_begin, range_end)) {
+        CHECK(range_begin < range_end);
+        CHECK(range_end <= num_times_given_out.size());
+        for (uint32_t read_index = range_begin;
+             read_index < range_end && read_index < num_times_given_out.size();
+             ++read_index) {
+          num_times_given_out[read_index].fetch_add(1);
+        }
+        if (worker_id == 0) {
+          std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+      }
+    });
+  }
+  // Every worker returns once all the reads are given out.
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+
+  uint32_t num_reads_not_given_out_once = 0;
+  for (const std::atomic<uint32_t> &num_times : num_times_given_out) {
+    num_reads_not_given_out_once += num_times.load() != 1;
+  }
+  CHECK(num_reads_not_given_out_once == 0);
+
+  // Nothing is left once a worker has got false.
+  uint32_t range_begin = 0;
+  uint32_t range_end = 0;
+  for (int worker_id = 0; worker_id < scheduler.GetNumWorkers(); ++worker_id) {
+    CHECK(!scheduler.GetNextRange(worker_id, range_begin, range_end));
+  }
+}
+
+void CheckSingleWorker() {
+  // A single worker gets the reads in order without stealing.
+  ReadRangeScheduler scheduler(/*num_workers=*/1);
+  for (uint32_t num_reads : {0u, 1u, 15u, 16u, 17u, 1000u, 100003u}) {
+    scheduler.Reset(num_reads);
+    uint32_t next_read_index = 0;
+    uint32_t range_begin = 0;
+    uint32_t range_end = 0;
+    while (scheduler.GetNextRange(/*worker_id=*/0, range_begin, range_end)) {
+      CHECK(range_begin == next_read_index);
+      CHECK(range_begin < range_end);
+      next_read_index = range_end;
+    }
+    CHECK(next_read_index == num_reads);
+    CHECK(scheduler.GetNumSteals() == 0);
+  }
+}
+
+void CheckMultipleWorkers() {
+  // The same scheduler is reused across batches, as in the mapping loops,
+  // including batches with fewer reads than workers.
+  ReadRangeScheduler scheduler(/*num_workers=*/8);
+  for (uint32_t num_reads : {0u, 1u, 7u, 8u, 9u, 100u, 5000u, 100003u}) {
+    CheckAllReadsGivenOutOnce(scheduler, num_reads);
+  }
+  // The slow first worker has its reads stolen in the last batch.
+  CHECK(scheduler.GetNumSteals() > 0);
+
+  ReadRangeScheduler two_worker_scheduler(/*num_workers=*/2);
+  for (int batch = 0; batch < 100; ++batch) {
+    CheckAllReadsGivenOutOnce(two_worker_scheduler, 1000 + batch);
+  }
+}
+
+}  // namespace
+}  // namespace chromap
+
+int main() {
+  chromap::CheckSingleWorker();
+  chromap::CheckMultipleWorkers();
+  return FinishTest("read_range_scheduler_test");
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "sequence_arena.h"
+#include "sequence_batch.h"
+#include "test_check.h"
+
+namespace chromap {
+namespace {
+
+struct FastqRecord {
+  std::string name;
+  std::string sequence;
+  std::string qual;
+};
+
+// Write the records into a new temporary file and return its path.
+std::string WriteTemporaryFastqFile(const std::vector<FastqRecord> &records) {
+  char file_path[] = "/tmp/chromap_sequence_batch_test_XXXXXX";
+  const int file_descriptor = mkstemp(file_path);
+  CHECK(file_descriptor >= 0);
+  FILE *fastq_file = fdopen(file_descriptor, "w");
+  for (const FastqRecord &record : records) {
+    fprintf(fastq_file, "@%s comment\n%s\n+\n%s\n", record.name.c_str(),
+            record.sequence.c_str(), record.qual.c_str());
+  }
+  fclose(fastq_file);
+  return file_path;
+}
+
+void CheckSequenceArena() {
+  SequenceArena arena;
+  std::mt19937 generator(11);
+  std::vector<std::string> strings;
+  std::vector<const char *> copies;
+  // About 3 blocks of short strings, and one longer than a block.
+  for (int i = 0; i < 200000; ++i) {
+    strings.push_back(std::string(generator() % 500, 'A' + i % 26));
+    if (i == 100000) {
+      strings.back().assign(((size_t)1 << 24) + 1, 'C');
+    }
+    copies.push_back(
+        arena.Append(strings.back().data(), strings.back().size()));
+  }
+  // The copies are terminated and stay valid as the arena grows.
+  for (size_t i = 0; i < strings.size(); ++i) {
+    CHECK(strlen(copies[i]) == strings[i].size());
+    CHECK(strings[i] == copies[i]);
+  }
+
+  // The blocks are reused after Clear().
+  const uint64_t memory_bytes = arena.GetMemoryBytes();
+  arena.Clear();
+  const char *first_copy = arena.Append("ACGT", 4);
+  CHECK(first_copy == copies[0]);
+  CHECK(strcmp(first_copy, "ACGT") == 0);
+  CHECK(arena.GetMemoryBytes() == memory_bytes);
+
+  SequenceArena other_arena;
+  other_arena.Swap(arena);
+  CHECK(arena.GetMemoryBytes() == 0);
+  CHECK(other_arena.GetMemoryBytes() == memory_bytes);
+}
+
+void CheckLoadedSequences() {
+  std::vector<FastqRecord> records;
+  std::mt19937 generator(11);
+  for (int i = 0; i < 1000; ++i) {
+    FastqRecord record;
+    record.name = "read" + std::to_string(i);
+    const uint32_t length = 1 + generator() % 300;
+    for (uint32_t j = 0; j < length; ++j) {
+      record.sequence.push_back("ACGTNacgt"[generator() % 9]);
+      record.qual.push_back('!' + generator() % 40);
+    }
+    records.push_back(record);
+  }
+  const std::string file_path = WriteTemporaryFastqFile(records);
+
+  // Load in batches of 300, so the arenas are cleared and reused.
+  SequenceBatch batch(300, SequenceEffectiveRange());
+  batch.InitializeLoading(file_path);
+  size_t num_loaded_records = 0;
+  bool is_end = false;
+  while (!is_end) {
+    uint32_t num_loaded_sequences = 0;
+    while (num_loaded_sequences < batch.GetMaxBatchSize()) {
+      if (batch.LoadOneSequenceAndSaveAt(num_loaded_sequences)) {
+        is_end = true;
+        break;
+      }
+      ++num_loaded_sequences;
+    }
+    CHECK(batch.GetNumSequences() == num_loaded_sequences);
+    for (uint32_t si = 0; si < num_loaded_sequences; ++si) {
+      const FastqRecord &record = records[num_loaded_records + si];
+      CHECK(batch.GetSequenceLengthAt(si) == record.sequence.size());
+      CHECK(record.sequence == batch.GetSequenceAt(si));
+      CHECK(record.qual == batch.GetSequenceQualAt(si));
+      CHECK(record.name == batch.GetSequenceNameAt(si));
+      CHECK(batch.GetSequenceNameLengthAt(si) == record.name.size());
+      CHECK(batch.GetSequenceIdAt(si) == num_loaded_records + si);
+
+      std::string negative_sequence;
+      batch.GetNegativeSequenceAt(si, negative_sequence);
+      CHECK(negative_sequence.size() == record.sequence.size());
+      CHECK(negative_sequence[0] ==
+            Uint8ToChar(3 ^ CharToUint8(record.sequence.back())));
+    }
+    num_loaded_records += num_loaded_sequences;
+  }
+  batch.FinalizeLoading();
+  CHECK(num_loaded_records == records.size());
+  unlink(file_path.c_str());
+}
+
+}  // namespace
+}  // namespace chromap
+
+int main() {
+  chromap::CheckSequenceArena();
+  chromap::CheckLoadedSequences();
+  return FinishTest("sequence_batch_test");
+}
@@ -0,0 +1,33 @@
+#ifndef TEST_CHECK_H_
+#define TEST_CHECK_H_
+
+#include <iostream>
+
+// A failed check is reported and counted, and the test goes on, so one run
+// shows all the failures. Each test returns GetNumFailedChecks() != 0 from
+// main().
+inline int &GetNumFailedChecks() {
+  static int num_failed_checks = 0;
+  return num_failed_checks;
+}
+
+#define CHECK(condition)                                              \
+  do {                                                                \
+    if (!(condition)) {                                               \
+      std::cerr << __FILE__ << ":" << __LINE__                        \
+                << ": check failed: " #condition "\n";                \
+      ++GetNumFailedChecks();                                         \
+    }                                                                 \
+  } while (0)
+
+inline int FinishTest(const char *test_name) {
+  if (GetNumFailedChecks() == 0) {
+    std::cerr << test_name << ": passed.\n";
+    return 0;
+  }
+  std::cerr << test_name << ": " << GetNumFailedChecks()
+            << " checks failed.\n";
+  return 1;
+}
+
+#endif  // TEST_CHECK_H_
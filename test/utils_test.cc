@@ -0,0 +1,215 @@
+#include <stdint.h>
+
+#include <random>
+#include <string>
+
+#include "test_check.h"
+#include "utils.h"
+
+namespace chromap {
+namespace {
+
+// The per-base reverse complement the SIMD kernel must agree with.
+std::string GenerateReverseComplementOneByOne(const std::string &sequence) {
+  std::string reverse_complement;
+  for (size_t i = sequence.size(); i > 0; --i) {
+    reverse_complement.push_back(
+        Uint8ToChar(((uint8_t)3) ^ CharToUint8(sequence[i - 1])));
+  }
+  return reverse_complement;
+}
+
+void CheckReverseComplement() {
+  std::string reverse_complement(8, 'X');
+  GenerateReverseComplement("ACGTNacgtn", 0, &reverse_complement[0]);
+  CHECK(reverse_complement == "XXXXXXXX");
+
+  reverse_complement.resize(10);
+  GenerateReverseComplement("ACGTNacgtn", 10, &reverse_complement[0]);
+  CHECK(reverse_complement == "NACGTNACGT");
+
+  // Lengths around the 16-base blocks, with lower case, N, IUPAC codes and
+  // bytes that share the low nibble of a base, e.g. 'q' with 'a'.
+  const std::string alphabet = "ACGTNacgtnRYKMSWqdsw@\x01\xe1\xff";
+  std::mt19937 generator(11);
+  for (uint32_t length = 1; length <= 100; ++length) {
+    for (int trial = 0; trial < 20; ++trial) {
+      std::string sequence;
+      for (uint32_t i = 0; i < length; ++i) {
+        sequence.push_back(alphabet[generator() % alphabet.size()]);
+      }
+      reverse_complement.assign(length, 'X');
+      GenerateReverseComplement(sequence.data(), length,
+                                &reverse_complement[0]);
+      CHECK(reverse_complement == GenerateReverseComplementOneByOne(sequence));
+    }
+  }
+}
+
+std::string GenerateRandomSequence(uint32_t length, std::mt19937 &generator) {
+  std::string sequence;
+  for (uint32_t i = 0; i < length; ++i) {
+    sequence.push_back("ACGT"[generator() % 4]);
+  }
+  return sequence;
+}
+
+std::string Repeat(const std::string &unit, uint32_t length) {
+  std::string sequence;
+  while (sequence.size() < length) {
+    sequence += unit;
+  }
+  sequence.resize(length);
+  return sequence;
+}
+
+double GetTripletEntropyOf(const std::string &sequence) {
+  return GetTripletEntropy(sequence.data(), sequence.size());
+}
+
+void CheckTripletEntropy() {
+  std::mt19937 generator(11);
+  const std::string random_sequence = GenerateRandomSequence(150, generator);
+  CHECK(GetTripletEntropyOf(random_sequence) > 0.85);
+  CHECK(GetTripletEntropyOf(std::string(150, 'G')) == 0);
+  // Short repeats have many base changes but few distinct triplets.
+  CHECK(GetTripletEntropyOf(Repeat("CA", 150)) < 0.2);
+  CHECK(GetTripletEntropyOf(Repeat("ACG", 150)) < 0.3);
+  CHECK(GetTripletEntropyOf(Repeat("AACGT", 150)) < 0.45);
+  // Half random, half poly-G is in between.
+  const double half_poly_g_entropy = GetTripletEntropyOf(
+      random_sequence.substr(0, 75) + std::string(75, 'G'));
+  CHECK(half_poly_g_entropy > 0.45 && half_poly_g_entropy < 0.85);
+
+  // The case is ignored, and triplets with an N are skipped.
+  std::string lower_case_sequence = random_sequence;
+  for (char &base : lower_case_sequence) {
+    base |= 0x20;
+  }
+  CHECK(GetTripletEntropyOf(lower_case_sequence) ==
+        GetTripletEntropyOf(random_sequence));
+  CHECK(GetTripletEntropyOf(Repeat("CA", 150) + std::string(10, 'N')) ==
+        GetTripletEntropyOf(Repeat("CA", 150)));
+  CHECK(GetTripletEntropyOf("AC") == 1);
+  CHECK(GetTripletEntropyOf("NNNNNNNN") == 1);
+}
+
+void CheckPolyGTailLength() {
+  CHECK(GetPolyGTailLength("", 0) == 0);
+  CHECK(GetPolyGTailLength("GGG", 3) == 3);
+  CHECK(GetPolyGTailLength("ACGT", 4) == 0);
+  CHECK(GetPolyGTailLength("ACgGg", 5) == 3);
+
+  // Tails around the 16-base blocks, in upper and lower case.
+  std::mt19937 generator(11);
+  for (uint32_t length = 1; length <= 100; ++length) {
+    for (uint32_t tail_length = 0; tail_length <= length; ++tail_length) {
+      std::string sequence = GenerateRandomSequence(length, generator);
+      for (uint32_t i = length - tail_length; i < length; ++i) {
+        sequence[i] = generator() % 2 == 0 ? 'G' : 'g';
+      }
+      if (tail_length < length) {
+        sequence[length - tail_length - 1] = "ACTact"[generator() % 6];
+      }
+      CHECK(GetPolyGTailLength(sequence.data(), length) == tail_length);
+    }
+  }
+}
+
+std::string ToLowerCase(std::string sequence) {
+  for (char &base : sequence) {
+    base |= 0x20;
+  }
+  return sequence;
+}
+
+std::string GetReverseComplement(const std::string &sequence) {
+  std::string reverse_complement(sequence.size(), 'X');
+  GenerateReverseComplement(sequence.data(), sequence.size(),
+                            &reverse_complement[0]);
+  return reverse_complement;
+}
+
+void CheckAdapterPosition() {
+  const std::string adapter = "CTGTCTCTTATACACATCT";
+  std::mt19937 generator(11);
+  for (int trial = 0; trial < 1000; ++trial) {
+    const std::string insert = GenerateRandomSequence(30, generator);
+    const std::string read = insert + adapter + "GATCGGAAGAGC";
+    // Mismatches do not stop a match, and the case is ignored.
+    std::string mismatched_read = read;
+    mismatched_read[30 + generator() % adapter.size()] = 'N';
+    for (const std::string &sequence :
+         {read, ToLowerCase(read), mismatched_read}) {
+      CHECK(GetAdapterPosition(sequence.data(), sequence.size(), adapter, 8) <=
+            30);
+    }
+  }
+
+  // A prefix of the adapter running off the 3' end needs the min overlap.
+  const std::string insert = "AAAAAAAAAAAAAAAAAAAA";
+  for (uint32_t prefix_length = 1; prefix_length <= adapter.size();
+       ++prefix_length) {
+    const std::string read = insert + adapter.substr(0, prefix_length);
+    const uint32_t expected_position =
+        prefix_length >= 8 ? insert.size() : read.size();
+    CHECK(GetAdapterPosition(read.data(), read.size(), adapter, 8) ==
+          expected_position);
+    const std::string lower_case_read = ToLowerCase(read);
+    CHECK(GetAdapterPosition(lower_case_read.data(), lower_case_read.size(),
+                             adapter, 8) == expected_position);
+  }
+  CHECK(GetAdapterPosition(insert.data(), insert.size(), adapter, 8) ==
+        insert.size());
+}
+
+void CheckMateOverlapOffset() {
+  std::mt19937 generator(11);
+  for (int trial = 0; trial < 1000; ++trial) {
+    // Both reads run from the two ends of a short insert into the adapters.
+    const uint32_t read_length = 50 + generator() % 100;
+    const uint32_t insert_length = 30 + generator() % (read_length - 30);
+    const std::string insert = GenerateRandomSequence(insert_length, generator);
+    std::string read1 =
+        insert + GenerateRandomSequence(read_length - insert_length, generator);
+    std::string read2 =
+        GetReverseComplement(insert) +
+        GenerateRandomSequence(read_length - insert_length, generator);
+    if (trial % 2 == 0) {
+      read1 = ToLowerCase(read1);
+    }
+    // One mismatch is allowed in the overlap.
+    if (trial % 3 == 0) {
+      read1[generator() % insert_length] = 'N';
+    }
+
+    const std::string negative_read2 = GetReverseComplement(read2);
+    uint32_t overlap_offset = 0;
+    CHECK(FindMateOverlapOffset(read1.data(), read1.size(),
+                                negative_read2.data(), negative_read2.size(),
+                                /*min_overlap_length=*/30, overlap_offset));
+    CHECK(negative_read2.size() - overlap_offset == insert_length);
+  }
+
+  // Two mismatches are not.
+  const std::string read1 = "ACGTTGCAACGTAGCTAGCTAGGATCCATGC";
+  std::string negative_read2 = read1;
+  negative_read2[3] = negative_read2[3] == 'A' ? 'C' : 'A';
+  negative_read2[20] = negative_read2[20] == 'A' ? 'C' : 'A';
+  uint32_t overlap_offset = 0;
+  CHECK(!FindMateOverlapOffset(read1.data(), read1.size(),
+                               negative_read2.data(), negative_read2.size(),
+                               /*min_overlap_length=*/30, overlap_offset));
+}
+
+}  // namespace
+}  // namespace chromap
+
+int main() {
+  chromap::CheckReverseComplement();
+  chromap::CheckTripletEntropy();
+  chromap::CheckPolyGTailLength();
+  chromap::CheckAdapterPosition();
+  chromap::CheckMateOverlapOffset();
+  return FinishTest("utils_test");
+}